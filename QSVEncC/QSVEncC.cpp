@@ -44,6 +44,7 @@
 #endif
 
 #include "qsv_pipeline.h"
+#include "qsv_pipeline_executor.h"
 #include "qsv_cmd.h"
 #include "qsv_prm.h"
 #include "qsv_query.h"
@@ -53,6 +54,8 @@
 #include "rgy_resource.h"
 #include "rgy_env.h"
 #include "rgy_opencl.h"
+#include "rgy_bench.h"
+#include "rgy_input_raw.h"
 
 #if ENABLE_AVSW_READER
 extern "C" {
@@ -510,6 +513,22 @@ int ParseDeviceOption(const TCHAR *option_name, const TCHAR *arg1, QSVDeviceNum&
     return 0;
 }
 
+//--check-*-benchの結果を、指定があればファイルへ、なければ標準出力へ出力する
+static int write_check_result(const TCHAR *arg1, const std::string& result) {
+    const tstring output = (arg1[0] != _T('\0') && arg1[0] != _T('-')) ? arg1 : _T("");
+    if (output.length() > 0) {
+        std::ofstream ofs(output);
+        if (!ofs.good()) {
+            _ftprintf(stderr, _T("Failed to open \"%s\".\n"), output.c_str());
+            return -1;
+        }
+        ofs << result;
+    } else {
+        fprintf(stdout, "%s", result.c_str());
+    }
+    return 1;
+}
+
 int parse_print_options(const TCHAR *option_name, const TCHAR *arg1, const QSVDeviceNum deviceNum, RGYParamLogLevel& loglevel) {
 
     // process multi-character options
@@ -627,6 +646,58 @@ int parse_print_options(const TCHAR *option_name, const TCHAR *arg1, const QSVDe
             return -1;
         }
     }
+    if (0 == _tcscmp(option_name, _T("check-csp-bench"))) {
+        return write_check_result(arg1, benchmark_convert_csp({ { 1280, 720 }, { 1920, 1080 } }, { 1, 2, 4 }));
+    }
+    if (0 == _tcscmp(option_name, _T("check-threadpool-bench"))) {
+        return write_check_result(arg1, benchmark_thread_pool({ 1, 2, 4, 8, 16 }));
+    }
+    if (0 == _tcscmp(option_name, _T("check-queue-bench"))) {
+        return write_check_result(arg1, benchmark_queue({ 1, 2, 4, 8, 16 }));
+    }
+    if (0 == _tcscmp(option_name, _T("check-nal-bench"))) {
+        //<path> または out=<path>,h264=<file>,hevc=<file>,av1=<file>
+        tstring output = (arg1[0] != _T('-')) ? arg1 : _T("");
+        std::vector<std::pair<RGY_CODEC, tstring>> streams;
+        if (output.find_first_of(_T("=")) != tstring::npos) {
+            const auto param_list = split(output, _T(","));
+            output.clear();
+            for (const auto& param : param_list) {
+                const auto pos = param.find_first_of(_T("="));
+                const auto param_arg = tolowercase(param.substr(0, pos));
+                const auto param_val = (pos != tstring::npos) ? param.substr(pos + 1) : _T("");
+                int codec = RGY_CODEC_UNKNOWN;
+                if (param_arg == _T("out")) {
+                    output = param_val;
+                } else if (get_list_value(list_rgy_codec, param_arg.c_str(), &codec)
+                    && (codec == RGY_CODEC_H264 || codec == RGY_CODEC_HEVC || codec == RGY_CODEC_AV1)
+                    && param_val.length() > 0) {
+                    streams.push_back(std::make_pair((RGY_CODEC)codec, param_val));
+                } else {
+                    _ftprintf(stderr, _T("Unknown param for --%s: \"%s\".\n"), option_name, param.c_str());
+                    return -1;
+                }
+            }
+        }
+        int errorCount = 0;
+        const auto result = benchmark_nal_reader(streams, errorCount);
+        const int ret = write_check_result(output.c_str(), result);
+        return (errorCount > 0) ? -1 : ret;
+    }
+    if (0 == _tcscmp(option_name, _T("check-pipeline-executor"))) {
+        int errorCount = 0;
+        const auto result = check_pipeline_executor(20, errorCount);
+        const int ret = write_check_result(arg1, result);
+        return (errorCount > 0) ? -1 : ret;
+    }
+#if ENABLE_RAW_READER
+    if (0 == _tcscmp(option_name, _T("check-raw-pipe-stop"))) {
+        int errorCount = 0;
+        const auto result = check_raw_pipe_stop(errorCount);
+        const int ret = write_check_result(arg1, result);
+        return (errorCount > 0) ? -1 : ret;
+    }
+#endif //#if ENABLE_RAW_READER
 #if ENABLE_AVSW_READER
     if (0 == _tcscmp(option_name, _T("check-avcodec-dll"))) {
         const auto ret = check_avcodec_dll();
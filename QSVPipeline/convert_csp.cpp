@@ -231,6 +231,30 @@ void convert_yuv444_16_to_y410_avx2(void** dst, const void** src, int width, int
 void convert_yuv444_16_to_y410_sse41(void** dst, const void** src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int* crop);
 void convert_yuv444_16_to_y410_sse2(void** dst, const void** src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int* crop);
 
+void convert_yuy2_to_nv12_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+
+void convert_yv12_to_nv12_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_uv_yv12_to_nv12_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+
+void convert_yv12_16_to_p010_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_yv12_14_to_p010_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_yv12_12_to_p010_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_yv12_10_to_p010_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_yv12_09_to_p010_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+
+void convert_nv12_to_yv12_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_p010_to_yv12_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+
+void convert_p010_to_yuv420_16_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_p010_to_yuv420_14_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_p010_to_yuv420_12_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_p010_to_yuv420_10_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+
+void convert_yuv444_16_to_y410_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_yuv444_14_to_y410_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_yuv444_12_to_y410_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+void convert_yuv444_10_to_y410_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
+
 void convert_yc48_to_yuv444_avx(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
 void convert_yc48_to_yuv444_sse41(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
 void convert_yc48_to_yuv444_sse2(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop);
@@ -2417,6 +2441,11 @@ void convert_rgb_to_gbr32_c(void **dst, const void **src, int width, int src_y_p
 
 #pragma warning (pop)
 
+#if defined(_M_X64) || defined(__x86_64)
+#define FUNC_AVX512(from, to, uv_only, funcp, funci, simd) { from, to, uv_only, { funcp, funci }, simd },
+#else
+#define FUNC_AVX512(from, to, uv_only, funcp, funci, simd)
+#endif
 #if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
 #define FUNC_AVX2(from, to, uv_only, funcp, funci, simd) { from, to, uv_only, { funcp, funci }, simd },
 #define FUNC_AVX(from, to, uv_only, funcp, funci, simd) { from, to, uv_only, { funcp, funci }, simd },
@@ -2429,6 +2458,7 @@ void convert_rgb_to_gbr32_c(void **dst, const void **src, int width, int src_y_p
 #define FUNC__C_(from, to, uv_only, funcp, funci, simd) { from, to, uv_only, { funcp, funci }, simd },
 
 // テーブル作成の簡略化のため
+#define AVX512BW (RGY_SIMD::AVX512F|RGY_SIMD::AVX512BW)
 #define AVX2  (RGY_SIMD::AVX2)
 #define AVX   (RGY_SIMD::AVX)
 #define SSE42 (RGY_SIMD::SSE42)
@@ -2451,6 +2481,7 @@ static const ConvertCSP funcList[] = {
     FUNC__C_(  RGY_CSP_P010,      RGY_CSP_NV12,      false,  copy_p010_to_nv12_c,                 copy_p010_to_nv12_c,                 NONE)
 #endif
 #if !CLFILTERS_AUF
+    FUNC_AVX512( RGY_CSP_YUY2,     RGY_CSP_NV12,     false, convert_yuy2_to_nv12_avx512bw,      convert_yuy2_to_nv12_i_avx2,        AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_YUY2,      RGY_CSP_NV12,      false,  convert_yuy2_to_nv12_avx2,           convert_yuy2_to_nv12_i_avx2,         AVX2|AVX)
     FUNC_AVX(  RGY_CSP_YUY2,      RGY_CSP_NV12,      false,  convert_yuy2_to_nv12_avx,            convert_yuy2_to_nv12_i_avx,          AVX )
     FUNC_SSE(  RGY_CSP_YUY2,      RGY_CSP_NV12,      false,  convert_yuy2_to_nv12_sse2,           convert_yuy2_to_nv12_i_ssse3,        SSSE3|SSE2 )
@@ -2484,11 +2515,13 @@ static const ConvertCSP funcList[] = {
     FUNC_SSE( RGY_CSP_YUV444_16,  RGY_CSP_YC48,      false,  convert_yuv444_16bit_to_yc48_sse2,   convert_yuv444_16bit_to_yc48_sse2,   SSE2 )
 #endif
 #if ENABLE_AVSW_READER || ENABLE_AVI_READER || ENABLE_AVISYNTH_READER || ENABLE_VAPOURSYNTH_READER || ENABLE_AVI_READER || ENABLE_RAW_READER
+    FUNC_AVX512( RGY_CSP_YV12,     RGY_CSP_NV12,     false, convert_yv12_to_nv12_avx512bw,      convert_yv12_to_nv12_avx512bw,      AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_YV12, RGY_CSP_NV12, false, convert_yv12_to_nv12_avx2,     convert_yv12_to_nv12_avx2,     AVX2|AVX)
     FUNC_AVX(  RGY_CSP_YV12, RGY_CSP_NV12, false, convert_yv12_to_nv12_avx,      convert_yv12_to_nv12_avx,      AVX )
     FUNC_SSE(  RGY_CSP_YV12, RGY_CSP_NV12, false, convert_yv12_to_nv12_sse2,     convert_yv12_to_nv12_sse2,     SSE2 )
     FUNC__C_(  RGY_CSP_YV12, RGY_CSP_NV12, false, convert_yv12_to_nv12_c,        convert_yv12_to_nv12_c,        NONE )
     FUNC__C_(  RGY_CSP_YV12, RGY_CSP_YUV444, false, convert_yv12_p_to_yuv444,    convert_yv12_i_to_yuv444,      NONE )
+    FUNC_AVX512( RGY_CSP_YV12,     RGY_CSP_NV12,     true,  convert_uv_yv12_to_nv12_avx512bw,   convert_uv_yv12_to_nv12_avx512bw,   AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_YV12, RGY_CSP_NV12, true,  convert_uv_yv12_to_nv12_avx2,  convert_uv_yv12_to_nv12_avx2,  AVX2|AVX )
     FUNC_AVX(  RGY_CSP_YV12, RGY_CSP_NV12, true,  convert_uv_yv12_to_nv12_avx,   convert_uv_yv12_to_nv12_avx,   AVX )
     FUNC_SSE(  RGY_CSP_YV12, RGY_CSP_NV12, true,  convert_uv_yv12_to_nv12_sse2,  convert_uv_yv12_to_nv12_sse2,  SSE2 )
@@ -2601,22 +2634,28 @@ static const ConvertCSP funcList[] = {
     FUNC_AVX2( RGY_CSP_YV12_09,   RGY_CSP_NV12,      false, convert_yv12_09_to_nv12_avx2,        convert_yv12_09_to_nv12_avx2, AVX2|AVX )
     FUNC_SSE(  RGY_CSP_YV12_09,   RGY_CSP_NV12,      false, convert_yv12_09_to_nv12_sse2,        convert_yv12_09_to_nv12_sse2, SSE2 )
     FUNC__C_(  RGY_CSP_YV12_10,   RGY_CSP_NV12,      false, convert_yv12_09_to_nv12_c,           convert_yv12_09_to_nv12_c,    NONE )
+    FUNC_AVX512( RGY_CSP_YV12_16,  RGY_CSP_P010,     false, convert_yv12_16_to_p010_avx512bw,   convert_yv12_16_to_p010_avx512bw,   AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_YV12_16,   RGY_CSP_P010,      false, convert_yv12_16_to_p010_avx2,        convert_yv12_16_to_p010_avx2, AVX2|AVX )
     FUNC_SSE(  RGY_CSP_YV12_16,   RGY_CSP_P010,      false, convert_yv12_16_to_p010_sse2,        convert_yv12_16_to_p010_sse2, SSE2 )
     FUNC__C_(  RGY_CSP_YV12_16,   RGY_CSP_P010,      false, convert_yv12_16_to_p010_c,           convert_yv12_16_to_p010_c,    NONE )
+    FUNC_AVX512( RGY_CSP_YV12_14,  RGY_CSP_P010,     false, convert_yv12_14_to_p010_avx512bw,   convert_yv12_14_to_p010_avx512bw,   AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_YV12_14,   RGY_CSP_P010,      false, convert_yv12_14_to_p010_avx2,        convert_yv12_14_to_p010_avx2, AVX2|AVX )
     FUNC_SSE(  RGY_CSP_YV12_14,   RGY_CSP_P010,      false, convert_yv12_14_to_p010_sse2,        convert_yv12_14_to_p010_sse2, SSE2 )
     FUNC__C_(  RGY_CSP_YV12_14,   RGY_CSP_P010,      false, convert_yv12_14_to_p010_c,           convert_yv12_14_to_p010_c,    NONE )
+    FUNC_AVX512( RGY_CSP_YV12_12,  RGY_CSP_P010,     false, convert_yv12_12_to_p010_avx512bw,   convert_yv12_12_to_p010_avx512bw,   AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_YV12_12,   RGY_CSP_P010,      false, convert_yv12_12_to_p010_avx2,        convert_yv12_12_to_p010_avx2, AVX2|AVX )
     FUNC_SSE(  RGY_CSP_YV12_12,   RGY_CSP_P010,      false, convert_yv12_12_to_p010_sse2,        convert_yv12_12_to_p010_sse2, SSE2 )
     FUNC__C_(  RGY_CSP_YV12_12,   RGY_CSP_P010,      false, convert_yv12_12_to_p010_c,           convert_yv12_12_to_p010_c,    NONE )
+    FUNC_AVX512( RGY_CSP_YV12_10,  RGY_CSP_P010,     false, convert_yv12_10_to_p010_avx512bw,   convert_yv12_10_to_p010_avx512bw,   AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_YV12_10,   RGY_CSP_P010,      false, convert_yv12_10_to_p010_avx2,        convert_yv12_10_to_p010_avx2, AVX2|AVX )
     FUNC_SSE(  RGY_CSP_YV12_10,   RGY_CSP_P010,      false, convert_yv12_10_to_p010_sse2,        convert_yv12_10_to_p010_sse2, SSE2 )
     FUNC__C_(  RGY_CSP_YV12_10,   RGY_CSP_P010,      false, convert_yv12_10_to_p010_c,           convert_yv12_10_to_p010_c,    NONE )
+    FUNC_AVX512( RGY_CSP_YV12_09,  RGY_CSP_P010,     false, convert_yv12_09_to_p010_avx512bw,   convert_yv12_09_to_p010_avx512bw,   AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_YV12_09,   RGY_CSP_P010,      false, convert_yv12_09_to_p010_avx2,        convert_yv12_09_to_p010_avx2, AVX2|AVX )
     FUNC_SSE(  RGY_CSP_YV12_09,   RGY_CSP_P010,      false, convert_yv12_09_to_p010_sse2,        convert_yv12_09_to_p010_sse2, SSE2 )
     FUNC__C_(  RGY_CSP_YV12_09,   RGY_CSP_P010,      false, convert_yv12_09_to_p010_c,           convert_yv12_09_to_p010_c,    NONE )
 
+    FUNC_AVX512( RGY_CSP_NV12,     RGY_CSP_YV12,     false, convert_nv12_to_yv12_avx512bw,      convert_nv12_to_yv12_avx512bw,      AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_NV12,      RGY_CSP_YV12,      false, convert_nv12_to_yv12_avx2,      convert_nv12_to_yv12_avx2,      AVX2|AVX )
     FUNC__C_(  RGY_CSP_NV12,      RGY_CSP_YV12,      false, convert_nv12_to_yv12_c,         convert_nv12_to_yv12_c,         NONE )
     FUNC_AVX2( RGY_CSP_NV12,      RGY_CSP_YV12_16,   false, convert_nv12_to_yuv420_16_avx2, convert_nv12_to_yuv420_16_avx2, AVX2|AVX )
@@ -2627,14 +2666,19 @@ static const ConvertCSP funcList[] = {
     FUNC__C_(  RGY_CSP_NV12,      RGY_CSP_YV12_12,   false, convert_nv12_to_yuv420_12_c,    convert_nv12_to_yuv420_12_c,    NONE )
     FUNC_AVX2( RGY_CSP_NV12,      RGY_CSP_YV12_10,   false, convert_nv12_to_yuv420_10_avx2, convert_nv12_to_yuv420_10_avx2, AVX2|AVX )
     FUNC__C_(  RGY_CSP_NV12,      RGY_CSP_YV12_10,   false, convert_nv12_to_yuv420_10_c,    convert_nv12_to_yuv420_10_c,    NONE )
+    FUNC_AVX512( RGY_CSP_P010,     RGY_CSP_YV12,     false, convert_p010_to_yv12_avx512bw,      convert_p010_to_yv12_avx512bw,      AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_P010,      RGY_CSP_YV12,      false, convert_p010_to_yv12_avx2,      convert_p010_to_yv12_avx2,      AVX2|AVX ) 
     FUNC__C_(  RGY_CSP_P010,      RGY_CSP_YV12,      false, convert_p010_to_yv12_c,         convert_p010_to_yv12_c,         NONE )
+    FUNC_AVX512( RGY_CSP_P010,     RGY_CSP_YV12_16,  false, convert_p010_to_yuv420_16_avx512bw, convert_p010_to_yuv420_16_avx512bw, AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_P010,      RGY_CSP_YV12_16,   false, convert_p010_to_yuv420_16_avx2, convert_p010_to_yuv420_16_avx2, AVX2|AVX )
     FUNC__C_(  RGY_CSP_P010,      RGY_CSP_YV12_16,   false, convert_p010_to_yuv420_16_c,    convert_p010_to_yuv420_16_c,    NONE )
+    FUNC_AVX512( RGY_CSP_P010,     RGY_CSP_YV12_14,  false, convert_p010_to_yuv420_14_avx512bw, convert_p010_to_yuv420_14_avx512bw, AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_P010,      RGY_CSP_YV12_14,   false, convert_p010_to_yuv420_14_avx2, convert_p010_to_yuv420_14_avx2, AVX2|AVX )
     FUNC__C_(  RGY_CSP_P010,      RGY_CSP_YV12_14,   false, convert_p010_to_yuv420_14_c,    convert_p010_to_yuv420_14_c,    NONE )
+    FUNC_AVX512( RGY_CSP_P010,     RGY_CSP_YV12_12,  false, convert_p010_to_yuv420_12_avx512bw, convert_p010_to_yuv420_12_avx512bw, AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_P010,      RGY_CSP_YV12_12,   false, convert_p010_to_yuv420_12_avx2, convert_p010_to_yuv420_12_avx2, AVX2|AVX )
     FUNC__C_(  RGY_CSP_P010,      RGY_CSP_YV12_12,   false, convert_p010_to_yuv420_12_c,    convert_p010_to_yuv420_12_c,    NONE )
+    FUNC_AVX512( RGY_CSP_P010,     RGY_CSP_YV12_10,  false, convert_p010_to_yuv420_10_avx512bw, convert_p010_to_yuv420_10_avx512bw, AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_P010,      RGY_CSP_YV12_10,   false, convert_p010_to_yuv420_10_avx2, convert_p010_to_yuv420_10_avx2, AVX2|AVX )
     FUNC__C_(  RGY_CSP_P010,      RGY_CSP_YV12_10,   false, convert_p010_to_yuv420_10_c,    convert_p010_to_yuv420_10_c,    NONE )
 
@@ -2723,18 +2767,22 @@ static const ConvertCSP funcList[] = {
     FUNC_SSE(  RGY_CSP_YUV444_09, RGY_CSP_VUYA,      false, copy_yuv444_09_to_ayuv444_sse2,      copy_yuv444_09_to_ayuv444_sse2,  SSE2 )
     FUNC_AVX2( RGY_CSP_YUV444,    RGY_CSP_VUYA,      false, copy_yuv444_to_ayuv444_avx2,         copy_yuv444_to_ayuv444_avx2,     AVX2|AVX )
     FUNC_SSE(  RGY_CSP_YUV444,    RGY_CSP_VUYA,      false, copy_yuv444_to_ayuv444_sse2,         copy_yuv444_to_ayuv444_sse2,     SSE2 )
+    FUNC_AVX512( RGY_CSP_YUV444_16, RGY_CSP_Y410,     false, convert_yuv444_16_to_y410_avx512bw, convert_yuv444_16_to_y410_avx512bw, AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_YUV444_16, RGY_CSP_Y410,      false, convert_yuv444_16_to_y410_avx2,      convert_yuv444_16_to_y410_avx2,  AVX2|AVX)
     FUNC_SSE(  RGY_CSP_YUV444_16, RGY_CSP_Y410,      false, convert_yuv444_16_to_y410_sse41,     convert_yuv444_16_to_y410_sse41, SSE41)
     FUNC_SSE(  RGY_CSP_YUV444_16, RGY_CSP_Y410,      false, convert_yuv444_16_to_y410_sse2,      convert_yuv444_16_to_y410_sse2,  SSE2)
     FUNC__C_(  RGY_CSP_YUV444_16, RGY_CSP_Y410,      false, convert_yuv444_16_to_y410,           convert_yuv444_16_to_y410,       NONE)
+    FUNC_AVX512( RGY_CSP_YUV444_14, RGY_CSP_Y410,     false, convert_yuv444_14_to_y410_avx512bw, convert_yuv444_14_to_y410_avx512bw, AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_YUV444_14, RGY_CSP_Y410,      false, convert_yuv444_14_to_y410_avx2,      convert_yuv444_14_to_y410_avx2,  AVX2|AVX)
     FUNC_SSE(  RGY_CSP_YUV444_14, RGY_CSP_Y410,      false, convert_yuv444_14_to_y410_sse41,     convert_yuv444_14_to_y410_sse41, SSE41)
     FUNC_SSE(  RGY_CSP_YUV444_14, RGY_CSP_Y410,      false, convert_yuv444_14_to_y410_sse2,      convert_yuv444_14_to_y410_sse2,  SSE2)
     FUNC__C_(  RGY_CSP_YUV444_14, RGY_CSP_Y410,      false, convert_yuv444_14_to_y410,           convert_yuv444_14_to_y410,       NONE)
+    FUNC_AVX512( RGY_CSP_YUV444_12, RGY_CSP_Y410,     false, convert_yuv444_12_to_y410_avx512bw, convert_yuv444_12_to_y410_avx512bw, AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_YUV444_12, RGY_CSP_Y410,      false, convert_yuv444_12_to_y410_avx2,      convert_yuv444_12_to_y410_avx2,  AVX2|AVX)
     FUNC_SSE(  RGY_CSP_YUV444_12, RGY_CSP_Y410,      false, convert_yuv444_12_to_y410_sse41,     convert_yuv444_12_to_y410_sse41, SSE41)
     FUNC_SSE(  RGY_CSP_YUV444_12, RGY_CSP_Y410,      false, convert_yuv444_12_to_y410_sse2,      convert_yuv444_12_to_y410_sse2,  SSE2)
     FUNC__C_(  RGY_CSP_YUV444_12, RGY_CSP_Y410,      false, convert_yuv444_12_to_y410,           convert_yuv444_12_to_y410,       NONE)
+    FUNC_AVX512( RGY_CSP_YUV444_10, RGY_CSP_Y410,     false, convert_yuv444_10_to_y410_avx512bw, convert_yuv444_10_to_y410_avx512bw, AVX512BW|AVX2|AVX )
     FUNC_AVX2( RGY_CSP_YUV444_10, RGY_CSP_Y410,      false, convert_yuv444_10_to_y410_avx2,      convert_yuv444_10_to_y410_avx2,  AVX2|AVX)
     FUNC_SSE(  RGY_CSP_YUV444_10, RGY_CSP_Y410,      false, convert_yuv444_10_to_y410_sse41,     convert_yuv444_10_to_y410_sse41, SSE41)
     FUNC_SSE(  RGY_CSP_YUV444_10, RGY_CSP_Y410,      false, convert_yuv444_10_to_y410_sse2,      convert_yuv444_10_to_y410_sse2,  SSE2)
@@ -2885,32 +2933,88 @@ const TCHAR *get_memtype_str(RGY_MEM_TYPE type) {
     }
 }
 
-const ConvertCSP *get_convert_csp_func(RGY_CSP csp_from, RGY_CSP csp_to, bool uv_only, RGY_SIMD simd) {
-    if (rgy_csp_has_alpha(csp_from) && rgy_csp_has_alpha(csp_to)) {
-        return get_convert_csp_func(rgy_csp_alpha_base(csp_from), rgy_csp_alpha_base(csp_to), uv_only, simd);
+// (csp_from, csp_to, uv_only)ごとに、funcListの候補を優先順に並べたテーブル
+// 起動後最初の呼び出し時に一度だけ作成し、このCPUで使用可能な最適な関数もあらかじめ決めておく
+class ConvertCSPTable {
+    struct Entry {
+        const ConvertCSP *best;   // このCPUで使用可能な最適な関数
+        uint16_t start;           // m_candidates内の開始位置
+        uint16_t count;           // 候補の数
+    };
+    static int index(RGY_CSP csp_from, RGY_CSP csp_to, bool uv_only) {
+        return ((int)csp_from * RGY_CSP_COUNT + (int)csp_to) * 2 + (uv_only ? 1 : 0);
     }
-    if (rgy_csp_has_alpha(csp_from)) {
-        return get_convert_csp_func(rgy_csp_alpha_base(csp_from), csp_to, uv_only, simd);
+    std::vector<Entry> m_table;
+    std::vector<const ConvertCSP *> m_candidates;
+    RGY_SIMD m_availableSIMD;
+public:
+    ConvertCSPTable() : m_table(RGY_CSP_COUNT * RGY_CSP_COUNT * 2, Entry{ nullptr, 0, 0 }), m_candidates(), m_availableSIMD(get_availableSIMD()) {
+        static_assert(_countof(funcList) < UINT16_MAX, "funcList too large for ConvertCSPTable.");
+        for (const auto& func : funcList) {
+            m_table[index(func.csp_from, func.csp_to, func.uv_only)].count++;
+        }
+        uint16_t start = 0;
+        for (auto& entry : m_table) {
+            entry.start = start;
+            start += entry.count;
+            entry.count = 0;
+        }
+        m_candidates.resize(start, nullptr);
+        for (const auto& func : funcList) {
+            auto& entry = m_table[index(func.csp_from, func.csp_to, func.uv_only)];
+            m_candidates[entry.start + entry.count] = &func;
+            entry.count++;
+            if (entry.best == nullptr && func.simd == (m_availableSIMD & func.simd)) {
+                entry.best = &func;
+            }
+        }
     }
-    RGY_SIMD availableSIMD = get_availableSIMD() & simd;
-    const ConvertCSP *convert = nullptr;
-    for (int i = 0; i < _countof(funcList); i++) {
-        if (csp_from != funcList[i].csp_from)
-            continue;
-
-        if (csp_to != funcList[i].csp_to)
-            continue;
+    const ConvertCSP *get(RGY_CSP csp_from, RGY_CSP csp_to, bool uv_only, RGY_SIMD simd) const {
+        if (csp_from < 0 || csp_from >= RGY_CSP_COUNT || csp_to < 0 || csp_to >= RGY_CSP_COUNT) {
+            return nullptr;
+        }
+        const auto& entry = m_table[index(csp_from, csp_to, uv_only)];
+        const RGY_SIMD availableSIMD = m_availableSIMD & simd;
+        if (availableSIMD == m_availableSIMD) {
+            return entry.best;
+        }
+        // SIMDが制限されている場合は候補の中から探す
+        for (int i = 0; i < entry.count; i++) {
+            const auto func = m_candidates[entry.start + i];
+            if (func->simd == (availableSIMD & func->simd)) {
+                return func;
+            }
+        }
+        return nullptr;
+    }
+    RGY_SIMD availableSIMD() const { return m_availableSIMD; }
+};
 
-        if (uv_only != funcList[i].uv_only)
-            continue;
+static const ConvertCSPTable& get_convert_csp_table() {
+    static const ConvertCSPTable table;
+    return table;
+}
 
-        if (funcList[i].simd != (availableSIMD & funcList[i].simd))
-            continue;
+const ConvertCSP *get_convert_csp_func(RGY_CSP csp_from, RGY_CSP csp_to, bool uv_only, RGY_SIMD simd) {
+    // alpha付きの場合は、alphaを除いた色空間の変換関数を使用する (alphaはget_copy_alpha_funcで別途処理)
+    if (rgy_csp_has_alpha(csp_from)) {
+        csp_from = rgy_csp_alpha_base(csp_from);
+        if (rgy_csp_has_alpha(csp_to)) {
+            csp_to = rgy_csp_alpha_base(csp_to);
+        }
+    }
+    return get_convert_csp_table().get(csp_from, csp_to, uv_only, simd);
+}
 
-        convert = &funcList[i];
-        break;
+std::vector<const ConvertCSP *> get_convert_csp_func_list() {
+    const auto availableSIMD = get_convert_csp_table().availableSIMD();
+    std::vector<const ConvertCSP *> list;
+    for (const auto& func : funcList) {
+        if (func.simd == (availableSIMD & func.simd)) {
+            list.push_back(&func);
+        }
     }
-    return convert;
+    return list;
 }
 
 funcConvertCSP get_copy_alpha_func(RGY_CSP csp_from, RGY_CSP csp_to) {
@@ -2965,6 +3069,7 @@ funcConvertCSP get_copy_alpha_func(RGY_CSP csp_from, RGY_CSP csp_to) {
 
 const TCHAR *get_simd_str(RGY_SIMD simd) {
     static std::vector<std::pair<RGY_SIMD, const TCHAR*>> simd_str_list = {
+        { AVX512BW, _T("AVX512BW") },
         { AVX2,  _T("AVX2")   },
         { AVX,   _T("AVX")    },
         { SSE42, _T("SSE4.2") },
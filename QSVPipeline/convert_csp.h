@@ -849,6 +849,8 @@ typedef struct ConvertCSP {
 } ConvertCSP;
 
 const ConvertCSP *get_convert_csp_func(RGY_CSP csp_from, RGY_CSP csp_to, bool uv_only, RGY_SIMD simd);
+//このCPUで実行可能なすべての変換関数を、SIMDの異なるものも含めて列挙する
+std::vector<const ConvertCSP *> get_convert_csp_func_list();
 funcConvertCSP get_copy_alpha_func(RGY_CSP csp_from, RGY_CSP csp_to);
 const TCHAR *get_simd_str(RGY_SIMD simd);
 
@@ -0,0 +1,478 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2011-2016 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+#if defined(_M_X64) || defined(__x86_64)
+
+#include <immintrin.h>
+#include "rgy_simd.h"
+#include <stdint.h>
+#include <string.h>
+#include "convert_csp.h"
+
+#if _MSC_VER >= 1800 && !defined(__AVX512BW__) && !defined(_DEBUG)
+static_assert(false, "do not forget to set /arch:AVX512 for this file.");
+#endif
+
+#if defined(_MSC_VER) || defined(__AVX512BW__)
+
+#pragma warning (push)
+#pragma warning (disable: 4100)
+#pragma warning (disable: 4127)
+
+template<bool use_stream>
+static void RGY_FORCEINLINE avx512_memcpy(uint8_t *dst, const uint8_t *src, int size) {
+    if (size < 256) {
+        memcpy(dst, src, size);
+        return;
+    }
+    uint8_t *dst_fin = dst + size;
+    uint8_t *dst_aligned_fin = (uint8_t *)(((size_t)(dst_fin + 63) & ~63) - 256);
+    __m512i z0, z1, z2, z3;
+    const int start_align_diff = (int)((size_t)dst & 63);
+    if (start_align_diff) {
+        z0 = _mm512_loadu_si512((const __m512i*)src);
+        _mm512_storeu_si512((__m512i*)dst, z0);
+        dst += 64 - start_align_diff;
+        src += 64 - start_align_diff;
+    }
+#define _mm512_stream_switch_si512(x, zmm) ((use_stream) ? _mm512_stream_si512((x), (zmm)) : _mm512_store_si512((x), (zmm)))
+    for ( ; dst < dst_aligned_fin; dst += 256, src += 256) {
+        z0 = _mm512_loadu_si512((const __m512i*)(src +   0));
+        z1 = _mm512_loadu_si512((const __m512i*)(src +  64));
+        z2 = _mm512_loadu_si512((const __m512i*)(src + 128));
+        z3 = _mm512_loadu_si512((const __m512i*)(src + 192));
+        _mm512_stream_switch_si512((__m512i*)(dst +   0), z0);
+        _mm512_stream_switch_si512((__m512i*)(dst +  64), z1);
+        _mm512_stream_switch_si512((__m512i*)(dst + 128), z2);
+        _mm512_stream_switch_si512((__m512i*)(dst + 192), z3);
+    }
+#undef _mm512_stream_switch_si512
+    uint8_t *dst_tmp = dst_fin - 256;
+    src -= (dst - dst_tmp);
+    z0 = _mm512_loadu_si512((const __m512i*)(src +   0));
+    z1 = _mm512_loadu_si512((const __m512i*)(src +  64));
+    z2 = _mm512_loadu_si512((const __m512i*)(src + 128));
+    z3 = _mm512_loadu_si512((const __m512i*)(src + 192));
+    _mm512_storeu_si512((__m512i*)(dst_tmp +   0), z0);
+    _mm512_storeu_si512((__m512i*)(dst_tmp +  64), z1);
+    _mm512_storeu_si512((__m512i*)(dst_tmp + 128), z2);
+    _mm512_storeu_si512((__m512i*)(dst_tmp + 192), z3);
+}
+
+//packus_epi16/packus_epi32は128bitレーンごとに動作するので、
+//2つの入力を連結した順に並べなおす
+static RGY_FORCEINLINE __m512i permute_after_packus(__m512i z) {
+    return _mm512_permutexvar_epi64(_mm512_set_epi64(7, 5, 3, 1, 6, 4, 2, 0), z);
+}
+
+//unpacklo/unpackhiで前半/後半がそれぞれ連続して出力されるよう並べておく
+static RGY_FORCEINLINE __m512i permute_before_unpack(__m512i z) {
+    return _mm512_permutexvar_epi64(_mm512_set_epi64(7, 3, 6, 2, 5, 1, 4, 0), z);
+}
+
+//conv_bit_depth_と同様、四捨五入ののち上限でクリップする
+//adds_epu16で飽和させれば、シフト後の値は(1<<out_bit_depth)-1で頭打ちになる
+template<int in_bit_depth, int out_bit_depth>
+static RGY_FORCEINLINE __m512i round_rsft_epu16(__m512i z) {
+    const int rsft = (in_bit_depth > out_bit_depth) ? in_bit_depth - out_bit_depth : 0;
+    if (rsft == 0) {
+        return z;
+    }
+    const __m512i zrsftAdd = _mm512_set1_epi16((short)((1 << rsft) >> 1));
+    return _mm512_srli_epi16(_mm512_adds_epu16(z, zrsftAdd), rsft);
+}
+
+template<typename Tin, int in_bit_depth, typename Tout, int out_bit_depth>
+static void RGY_FORCEINLINE copy_y_plane_avx512(void *dst, int dst_y_pitch_byte, const void *src, int src_y_pitch_byte, const int width, const int *crop, const THREAD_Y_RANGE& y_range) {
+    const int crop_left   = crop[0];
+    const int crop_right  = crop[2];
+    const int src_y_pitch = src_y_pitch_byte / sizeof(Tin);
+    const int dst_y_pitch = dst_y_pitch_byte / sizeof(Tout);
+
+    const Tin *srcYLine = (const Tin *)src + src_y_pitch * y_range.start_src + crop_left;
+    Tout *dstLine = (Tout *)dst + dst_y_pitch * y_range.start_dst;
+    const int y_width = width - crop_right - crop_left;
+    for (int y = 0; y < y_range.len; y++, srcYLine += src_y_pitch, dstLine += dst_y_pitch) {
+        if (in_bit_depth == out_bit_depth && sizeof(Tin) == sizeof(Tout)) {
+            avx512_memcpy<false>((uint8_t *)dstLine, (const uint8_t *)srcYLine, y_width * (int)sizeof(Tin));
+        } else if (sizeof(Tin) == 2 && sizeof(Tout) == 1) {
+            const Tin *src_ptr = srcYLine;
+            Tout *dst_ptr = dstLine;
+            for (int x = 0; x < y_width; x += 64, src_ptr += 64, dst_ptr += 64) {
+                __m512i z0 = _mm512_loadu_si512((const __m512i *)(src_ptr +  0));
+                __m512i z1 = _mm512_loadu_si512((const __m512i *)(src_ptr + 32));
+                z0 = round_rsft_epu16<in_bit_depth, 8>(z0);
+                z1 = round_rsft_epu16<in_bit_depth, 8>(z1);
+                _mm512_storeu_si512((__m512i *)dst_ptr, permute_after_packus(_mm512_packus_epi16(z0, z1)));
+            }
+        } else if (sizeof(Tin) == 2 && sizeof(Tout) == 2) {
+            const Tin *src_ptr = srcYLine;
+            Tout *dst_ptr = dstLine;
+            for (int x = 0; x < y_width; x += 32, src_ptr += 32, dst_ptr += 32) {
+                __m512i z0 = _mm512_loadu_si512((const __m512i *)src_ptr);
+                if (in_bit_depth > out_bit_depth) {
+                    z0 = round_rsft_epu16<in_bit_depth, out_bit_depth>(z0);
+                } else {
+                    z0 = _mm512_slli_epi16(z0, out_bit_depth - in_bit_depth);
+                }
+                _mm512_storeu_si512((__m512i *)dst_ptr, z0);
+            }
+        }
+    }
+}
+
+void convert_yuy2_to_nv12_avx512bw(void **dst_array, const void **src_array, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    const int crop_left   = crop[0];
+    const int crop_up     = crop[1];
+    const int crop_right  = crop[2];
+    const int crop_bottom = crop[3];
+    const void *src = src_array[0];
+    const auto y_range = thread_y_range(crop_up, height - crop_bottom, thread_id, thread_n);
+    uint8_t *srcLine = (uint8_t *)src + src_y_pitch_byte * y_range.start_src + crop_left;
+    uint8_t *dstYLine = (uint8_t *)dst_array[0] + dst_y_pitch_byte * y_range.start_dst;
+    uint8_t *dstCLine = (uint8_t *)dst_array[1] + dst_y_pitch_byte * (y_range.start_dst >> 1);
+    const __m512i zMask00ff = _mm512_set1_epi16(0x00ff);
+    for (int y = 0; y < y_range.len; y += 2) {
+        uint8_t *p = srcLine;
+        uint8_t *pw = p + src_y_pitch_byte;
+        const int x_fin = width - crop_right - crop_left;
+        for (int x = 0; x < x_fin; x += 64, p += 128, pw += 128) {
+            //-----------1行目---------------
+            __m512i z0 = _mm512_loadu_si512((const __m512i *)(p +  0));
+            __m512i z1 = _mm512_loadu_si512((const __m512i *)(p + 64));
+            __m512i zY0 = permute_after_packus(_mm512_packus_epi16(_mm512_and_si512(z0, zMask00ff), _mm512_and_si512(z1, zMask00ff)));
+            __m512i zC0 = permute_after_packus(_mm512_packus_epi16(_mm512_srli_epi16(z0, 8), _mm512_srli_epi16(z1, 8)));
+            _mm512_storeu_si512((__m512i *)(dstYLine + x), zY0);
+            //-----------1行目終了---------------
+
+            //-----------2行目---------------
+            z0 = _mm512_loadu_si512((const __m512i *)(pw +  0));
+            z1 = _mm512_loadu_si512((const __m512i *)(pw + 64));
+            __m512i zY1 = permute_after_packus(_mm512_packus_epi16(_mm512_and_si512(z0, zMask00ff), _mm512_and_si512(z1, zMask00ff)));
+            __m512i zC1 = permute_after_packus(_mm512_packus_epi16(_mm512_srli_epi16(z0, 8), _mm512_srli_epi16(z1, 8)));
+            _mm512_storeu_si512((__m512i *)(dstYLine + dst_y_pitch_byte + x), zY1);
+            //-----------2行目終了---------------
+
+            _mm512_storeu_si512((__m512i *)(dstCLine + x), _mm512_avg_epu8(zC0, zC1)); //UVUVUVUV
+        }
+        srcLine  += src_y_pitch_byte << 1;
+        dstYLine += dst_y_pitch_byte << 1;
+        dstCLine += dst_y_pitch_byte;
+    }
+}
+
+template<bool uv_only>
+static void RGY_FORCEINLINE convert_yv12_to_nv12_avx512bw_base(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    const int crop_left   = crop[0];
+    const int crop_up     = crop[1];
+    const int crop_right  = crop[2];
+    const int crop_bottom = crop[3];
+    //Y成分のコピー
+    if (!uv_only) {
+        const auto y_range = thread_y_range(crop_up, height - crop_bottom, thread_id, thread_n);
+        copy_y_plane_avx512<uint8_t, 8, uint8_t, 8>(dst[0], dst_y_pitch_byte, src[0], src_y_pitch_byte, width, crop, y_range);
+    }
+    //UV成分のコピー
+    const auto uv_range = thread_y_range(crop_up >> 1, (height - crop_bottom) >> 1, thread_id, thread_n);
+    uint8_t *srcULine = (uint8_t *)src[1] + ((src_uv_pitch_byte * uv_range.start_src) + (crop_left >> 1));
+    uint8_t *srcVLine = (uint8_t *)src[2] + ((src_uv_pitch_byte * uv_range.start_src) + (crop_left >> 1));
+    uint8_t *dstLine = (uint8_t *)dst[1] + dst_y_pitch_byte * uv_range.start_dst;
+    for (int y = 0; y < uv_range.len; y++, srcULine += src_uv_pitch_byte, srcVLine += src_uv_pitch_byte, dstLine += dst_y_pitch_byte) {
+        const int x_fin = width - crop_right;
+        uint8_t *src_u_ptr = srcULine;
+        uint8_t *src_v_ptr = srcVLine;
+        uint8_t *dst_ptr = dstLine;
+        for (int x = crop_left; x < x_fin; x += 128, src_u_ptr += 64, src_v_ptr += 64, dst_ptr += 128) {
+            __m512i z0 = permute_before_unpack(_mm512_loadu_si512((const __m512i *)src_u_ptr));
+            __m512i z1 = permute_before_unpack(_mm512_loadu_si512((const __m512i *)src_v_ptr));
+            _mm512_storeu_si512((__m512i *)(dst_ptr +  0), _mm512_unpacklo_epi8(z0, z1));
+            _mm512_storeu_si512((__m512i *)(dst_ptr + 64), _mm512_unpackhi_epi8(z0, z1));
+        }
+    }
+}
+
+void convert_yv12_to_nv12_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yv12_to_nv12_avx512bw_base<false>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_uv_yv12_to_nv12_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yv12_to_nv12_avx512bw_base<true>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+template<int in_bit_depth, bool uv_only>
+static void RGY_FORCEINLINE convert_yv12_high_to_p010_avx512bw_base(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    static_assert(8 < in_bit_depth && in_bit_depth <= 16, "in_bit_depth must be 9-16.");
+    const int crop_left   = crop[0];
+    const int crop_up     = crop[1];
+    const int crop_right  = crop[2];
+    const int crop_bottom = crop[3];
+    const int dst_y_pitch = dst_y_pitch_byte >> 1;
+    //Y成分のコピー
+    if (!uv_only) {
+        const auto y_range = thread_y_range(crop_up, height - crop_bottom, thread_id, thread_n);
+        copy_y_plane_avx512<uint16_t, in_bit_depth, uint16_t, 16>(dst[0], dst_y_pitch_byte, src[0], src_y_pitch_byte, width, crop, y_range);
+    }
+    //UV成分のコピー
+    const auto uv_range = thread_y_range(crop_up >> 1, (height - crop_bottom) >> 1, thread_id, thread_n);
+    const int src_uv_pitch = src_uv_pitch_byte >> 1;
+    uint16_t *srcULine = (uint16_t *)src[1] + ((src_uv_pitch * uv_range.start_src) + (crop_left >> 1));
+    uint16_t *srcVLine = (uint16_t *)src[2] + ((src_uv_pitch * uv_range.start_src) + (crop_left >> 1));
+    uint16_t *dstLine = (uint16_t *)dst[1] + dst_y_pitch * uv_range.start_dst;
+    for (int y = 0; y < uv_range.len; y++, srcULine += src_uv_pitch, srcVLine += src_uv_pitch, dstLine += dst_y_pitch) {
+        const int x_fin = width - crop_right;
+        uint16_t *src_u_ptr = srcULine;
+        uint16_t *src_v_ptr = srcVLine;
+        uint16_t *dst_ptr = dstLine;
+        for (int x = crop_left; x < x_fin; x += 64, src_u_ptr += 32, src_v_ptr += 32, dst_ptr += 64) {
+            __m512i z0 = _mm512_loadu_si512((const __m512i *)src_u_ptr);
+            __m512i z1 = _mm512_loadu_si512((const __m512i *)src_v_ptr);
+            if (in_bit_depth < 16) {
+                z0 = _mm512_slli_epi16(z0, 16 - in_bit_depth);
+                z1 = _mm512_slli_epi16(z1, 16 - in_bit_depth);
+            }
+            z0 = permute_before_unpack(z0);
+            z1 = permute_before_unpack(z1);
+            _mm512_storeu_si512((__m512i *)(dst_ptr +  0), _mm512_unpacklo_epi16(z0, z1));
+            _mm512_storeu_si512((__m512i *)(dst_ptr + 32), _mm512_unpackhi_epi16(z0, z1));
+        }
+    }
+}
+
+void convert_yv12_16_to_p010_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yv12_high_to_p010_avx512bw_base<16, false>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_yv12_14_to_p010_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yv12_high_to_p010_avx512bw_base<14, false>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_yv12_12_to_p010_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yv12_high_to_p010_avx512bw_base<12, false>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_yv12_10_to_p010_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yv12_high_to_p010_avx512bw_base<10, false>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_yv12_09_to_p010_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yv12_high_to_p010_avx512bw_base<9, false>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_nv12_to_yv12_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    const int crop_left   = crop[0];
+    const int crop_up     = crop[1];
+    const int crop_right  = crop[2];
+    const int crop_bottom = crop[3];
+    const int y_width = width - crop_right - crop_left;
+    const int uv_width = y_width >> 1;
+    const auto y_range = thread_y_range(crop_up, height - crop_bottom, thread_id, thread_n);
+
+    //Y成分のコピー
+    copy_y_plane_avx512<uint8_t, 8, uint8_t, 8>(dst[0], dst_y_pitch_byte, src[0], src_y_pitch_byte, width, crop, y_range);
+
+    // UV planes
+    const __m512i zMask00ff = _mm512_set1_epi16(0x00ff);
+    const auto uv_range = thread_y_range(crop_up >> 1, (height - crop_bottom) >> 1, thread_id, thread_n);
+    const uint8_t *srcUVline = (const uint8_t *)src[1] + src_uv_pitch_byte * uv_range.start_src + crop_left;
+    uint8_t *dstUline = (uint8_t *)dst[1] + dst_uv_pitch_byte * uv_range.start_dst;
+    uint8_t *dstVline = (uint8_t *)dst[2] + dst_uv_pitch_byte * uv_range.start_dst;
+    for (int y = 0; y < uv_range.len; y++, srcUVline += src_uv_pitch_byte, dstUline += dst_uv_pitch_byte, dstVline += dst_uv_pitch_byte) {
+        const uint8_t *srcUV = srcUVline;
+        uint8_t *dstU = dstUline;
+        uint8_t *dstV = dstVline;
+        for (int x = 0; x < uv_width; x += 64, dstU += 64, dstV += 64, srcUV += 128) {
+            __m512i uv0 = _mm512_loadu_si512((const __m512i *)(srcUV +  0));
+            __m512i uv1 = _mm512_loadu_si512((const __m512i *)(srcUV + 64));
+            __m512i u0 = _mm512_packus_epi16(_mm512_and_si512(uv0, zMask00ff), _mm512_and_si512(uv1, zMask00ff));
+            __m512i v0 = _mm512_packus_epi16(_mm512_srli_epi16(uv0, 8), _mm512_srli_epi16(uv1, 8));
+            _mm512_storeu_si512((__m512i *)dstU, permute_after_packus(u0));
+            _mm512_storeu_si512((__m512i *)dstV, permute_after_packus(v0));
+        }
+    }
+}
+
+void convert_p010_to_yv12_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    const int crop_left   = crop[0];
+    const int crop_up     = crop[1];
+    const int crop_right  = crop[2];
+    const int crop_bottom = crop[3];
+    const int y_width = width - crop_right - crop_left;
+    const int uv_width = y_width >> 1;
+    const auto y_range = thread_y_range(crop_up, height - crop_bottom, thread_id, thread_n);
+
+    //Y成分のコピー
+    copy_y_plane_avx512<uint16_t, 16, uint8_t, 8>(dst[0], dst_y_pitch_byte, src[0], src_y_pitch_byte, width, crop, y_range);
+
+    // UV planes
+    //packus_epi32 -> packus_epi16 で各128bitレーンに4画素ずつ4組並ぶので、32bit単位で並べなおす
+    const __m512i zMask0000ffff = _mm512_set1_epi32(0x0000ffff);
+    const __m512i zPermUV = _mm512_set_epi32(15, 11, 7, 3, 14, 10, 6, 2, 13, 9, 5, 1, 12, 8, 4, 0);
+    const auto uv_range = thread_y_range(crop_up >> 1, (height - crop_bottom) >> 1, thread_id, thread_n);
+    const uint16_t *srcUVline = (const uint16_t *)src[1] + (src_uv_pitch_byte / 2) * uv_range.start_src + crop_left;
+    uint8_t *dstUline = (uint8_t *)dst[1] + dst_uv_pitch_byte * uv_range.start_dst;
+    uint8_t *dstVline = (uint8_t *)dst[2] + dst_uv_pitch_byte * uv_range.start_dst;
+    for (int y = 0; y < uv_range.len; y++, srcUVline += (src_uv_pitch_byte / 2), dstUline += dst_uv_pitch_byte, dstVline += dst_uv_pitch_byte) {
+        const uint16_t *srcUV = srcUVline;
+        uint8_t *dstU = dstUline;
+        uint8_t *dstV = dstVline;
+        for (int x = 0; x < uv_width; x += 64, dstU += 64, dstV += 64, srcUV += 128) {
+            __m512i uv0 = round_rsft_epu16<16, 8>(_mm512_loadu_si512((const __m512i *)(srcUV +  0)));
+            __m512i uv1 = round_rsft_epu16<16, 8>(_mm512_loadu_si512((const __m512i *)(srcUV + 32)));
+            __m512i uv2 = round_rsft_epu16<16, 8>(_mm512_loadu_si512((const __m512i *)(srcUV + 64)));
+            __m512i uv3 = round_rsft_epu16<16, 8>(_mm512_loadu_si512((const __m512i *)(srcUV + 96)));
+            __m512i u0 = _mm512_packus_epi16(
+                _mm512_packus_epi32(_mm512_and_si512(uv0, zMask0000ffff), _mm512_and_si512(uv1, zMask0000ffff)),
+                _mm512_packus_epi32(_mm512_and_si512(uv2, zMask0000ffff), _mm512_and_si512(uv3, zMask0000ffff)));
+            __m512i v0 = _mm512_packus_epi16(
+                _mm512_packus_epi32(_mm512_srli_epi32(uv0, 16), _mm512_srli_epi32(uv1, 16)),
+                _mm512_packus_epi32(_mm512_srli_epi32(uv2, 16), _mm512_srli_epi32(uv3, 16)));
+            _mm512_storeu_si512((__m512i *)dstU, _mm512_permutexvar_epi32(zPermUV, u0));
+            _mm512_storeu_si512((__m512i *)dstV, _mm512_permutexvar_epi32(zPermUV, v0));
+        }
+    }
+}
+
+template<int out_bit_depth>
+static void RGY_FORCEINLINE convert_p010_to_yuv420_high_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    const int crop_left   = crop[0];
+    const int crop_up     = crop[1];
+    const int crop_right  = crop[2];
+    const int crop_bottom = crop[3];
+    const int y_width = width - crop_right - crop_left;
+    const int uv_width = y_width >> 1;
+    const auto y_range = thread_y_range(crop_up, height - crop_bottom, thread_id, thread_n);
+
+    //Y成分のコピー
+    copy_y_plane_avx512<uint16_t, 16, uint16_t, out_bit_depth>(dst[0], dst_y_pitch_byte, src[0], src_y_pitch_byte, width, crop, y_range);
+
+    // UV planes
+    const __m512i zMask0000ffff = _mm512_set1_epi32(0x0000ffff);
+    const auto uv_range = thread_y_range(crop_up >> 1, (height - crop_bottom) >> 1, thread_id, thread_n);
+    const uint16_t *srcUVline = (const uint16_t *)src[1] + (src_uv_pitch_byte / 2) * uv_range.start_src + crop_left;
+    uint16_t *dstUline = (uint16_t *)dst[1] + (dst_uv_pitch_byte / 2) * uv_range.start_dst;
+    uint16_t *dstVline = (uint16_t *)dst[2] + (dst_uv_pitch_byte / 2) * uv_range.start_dst;
+    for (int y = 0; y < uv_range.len; y++, srcUVline += (src_uv_pitch_byte / 2), dstUline += (dst_uv_pitch_byte / 2), dstVline += (dst_uv_pitch_byte / 2)) {
+        const uint16_t *srcUV = srcUVline;
+        uint16_t *dstU = dstUline;
+        uint16_t *dstV = dstVline;
+        for (int x = 0; x < uv_width; x += 32, dstU += 32, dstV += 32, srcUV += 64) {
+            __m512i uv0 = _mm512_loadu_si512((const __m512i *)(srcUV +  0));
+            __m512i uv1 = _mm512_loadu_si512((const __m512i *)(srcUV + 32));
+            if (out_bit_depth < 16) {
+                uv0 = round_rsft_epu16<16, out_bit_depth>(uv0);
+                uv1 = round_rsft_epu16<16, out_bit_depth>(uv1);
+            }
+            __m512i u0 = _mm512_packus_epi32(_mm512_and_si512(uv0, zMask0000ffff), _mm512_and_si512(uv1, zMask0000ffff));
+            __m512i v0 = _mm512_packus_epi32(_mm512_srli_epi32(uv0, 16), _mm512_srli_epi32(uv1, 16));
+            _mm512_storeu_si512((__m512i *)dstU, permute_after_packus(u0));
+            _mm512_storeu_si512((__m512i *)dstV, permute_after_packus(v0));
+        }
+    }
+}
+
+void convert_p010_to_yuv420_16_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_p010_to_yuv420_high_avx512bw<16>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+void convert_p010_to_yuv420_14_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_p010_to_yuv420_high_avx512bw<14>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+void convert_p010_to_yuv420_12_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_p010_to_yuv420_high_avx512bw<12>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+void convert_p010_to_yuv420_10_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_p010_to_yuv420_high_avx512bw<10>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+template<int in_bit_depth>
+static void RGY_FORCEINLINE convert_yuv444_high_to_y410_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    static_assert(10 <= in_bit_depth && in_bit_depth <= 16, "in_bit_depth must be 10-16.");
+    const int out_bit_depth = 10;
+    const int crop_left   = crop[0];
+    const int crop_up     = crop[1];
+    const int crop_right  = crop[2];
+    const int crop_bottom = crop[3];
+    const int src_y_pitch = src_y_pitch_byte / sizeof(uint16_t);
+    const int dst_y_pitch = dst_y_pitch_byte / sizeof(uint32_t);
+    const auto y_range = thread_y_range(crop_up, height - crop_bottom, thread_id, thread_n);
+    const __m512i zMax = _mm512_set1_epi16((1 << out_bit_depth) - 1);
+    const uint16_t *srcYLine = (const uint16_t *)src[0] + src_y_pitch * y_range.start_src + crop_left;
+    const uint16_t *srcULine = (const uint16_t *)src[1] + src_y_pitch * y_range.start_src + crop_left;
+    const uint16_t *srcVLine = (const uint16_t *)src[2] + src_y_pitch * y_range.start_src + crop_left;
+    uint32_t *dstLine = (uint32_t *)dst[0] + dst_y_pitch * y_range.start_dst;
+    const int y_width = width - crop_right - crop_left;
+    for (int y = 0; y < y_range.len; y++, srcYLine += src_y_pitch, srcULine += src_y_pitch, srcVLine += src_y_pitch, dstLine += dst_y_pitch) {
+        const uint16_t *src_y_ptr = srcYLine;
+        const uint16_t *src_u_ptr = srcULine;
+        const uint16_t *src_v_ptr = srcVLine;
+        uint32_t *dst_ptr = dstLine;
+        for (int x = 0; x < y_width; x += 32, src_y_ptr += 32, src_u_ptr += 32, src_v_ptr += 32, dst_ptr += 32) {
+            __m512i pixY = _mm512_loadu_si512((const __m512i *)src_y_ptr);
+            __m512i pixU = _mm512_loadu_si512((const __m512i *)src_u_ptr);
+            __m512i pixV = _mm512_loadu_si512((const __m512i *)src_v_ptr);
+            if (in_bit_depth > out_bit_depth) {
+                pixY = round_rsft_epu16<in_bit_depth, out_bit_depth>(pixY);
+                pixU = round_rsft_epu16<in_bit_depth, out_bit_depth>(pixU);
+                pixV = round_rsft_epu16<in_bit_depth, out_bit_depth>(pixV);
+            }
+            pixY = _mm512_min_epu16(pixY, zMax);
+            pixU = _mm512_min_epu16(pixU, zMax);
+            pixV = _mm512_min_epu16(pixV, zMax);
+
+            // 15 - 0
+            __m512i pixY410_0 = _mm512_ternarylogic_epi32(
+                _mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(pixV)), 20),
+                _mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(pixY)), 10),
+                _mm512_cvtepu16_epi32(_mm512_castsi512_si256(pixU)), 0xfe);
+            // 31 - 16
+            __m512i pixY410_1 = _mm512_ternarylogic_epi32(
+                _mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(pixV, 1)), 20),
+                _mm512_slli_epi32(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(pixY, 1)), 10),
+                _mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(pixU, 1)), 0xfe);
+            _mm512_storeu_si512((__m512i *)(dst_ptr +  0), pixY410_0);
+            _mm512_storeu_si512((__m512i *)(dst_ptr + 16), pixY410_1);
+        }
+    }
+}
+
+void convert_yuv444_16_to_y410_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yuv444_high_to_y410_avx512bw<16>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_yuv444_14_to_y410_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yuv444_high_to_y410_avx512bw<14>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_yuv444_12_to_y410_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yuv444_high_to_y410_avx512bw<12>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+void convert_yuv444_10_to_y410_avx512bw(void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int thread_id, int thread_n, int *crop) {
+    convert_yuv444_high_to_y410_avx512bw<10>(dst, src, width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte, height, dst_height, thread_id, thread_n, crop);
+}
+
+#pragma warning (pop)
+#endif //#if defined(_MSC_VER) || defined(__AVX512BW__)
+#endif //#if defined(_M_X64) || defined(__x86_64)
@@ -220,6 +220,23 @@ tstring encoder_help() {
         _T("   --check-environment          check environment info\n")
         _T("   --check-device               check device available\n")
         _T("   --check-clinfo               check OpenCL info\n")
+        _T("   --check-csp-bench [<string>] benchmark colorspace conversions in json format\n")
+        _T("                                 with no option value, result will on stdout,\n")
+        _T("                                 otherwise, it is written to file path set.\n")
+        _T("   --check-threadpool-bench [<string>]\n")
+        _T("                                benchmark thread pool in json format\n")
+        _T("   --check-queue-bench [<string>]\n")
+        _T("                                benchmark packet queues in json format\n")
+        _T("   --check-nal-bench [<string>]\n")
+        _T("                                benchmark NAL unit/OBU parsing in json format\n")
+        _T("                                  <path> or out=<path>,h264=<file>,hevc=<file>,av1=<file>\n")
+        _T("   --check-pipeline-executor [<string>]\n")
+        _T("                                self test of --pipeline-thread in json format\n")
+#if ENABLE_RAW_READER
+        _T("   --check-raw-pipe-stop [<string>]\n")
+        _T("                                check stopping raw/y4m pipe input does not hang\n")
+        _T("                                 while the pipe is stalled, in json format\n")
+#endif
 #if ENABLE_AVSW_READER
         _T("   --check-avversion            show dll version\n")
         _T("   --check-codecs               show codecs available\n")
@@ -452,6 +469,8 @@ tstring encoder_help() {
         _T("                                 note that mfx thread cannot be less than 2.\n")
 #endif
         _T("   --gpu-copy                   Enables gpu accelerated copying between device and host.\n")
+        _T("   --(no-)pipeline-thread       run input, filters, encode and output of the pipeline\n")
+        _T("                                 in separate threads. default: off\n")
         _T("   --min-memory                 minimize memory usage of QSVEncC.\n")
         _T("                                 same as --output-thread 0 --audio-thread 0\n")
         _T("                                   --mfx-thread 2 -a 1 --input-buf 1 --output-buf 0\n")
@@ -1904,6 +1923,14 @@ int ParseOneOption(const TCHAR *option_name, const TCHAR* strInput[], int& i, in
         pParams->gpuCopy = true;
         return 0;
     }
+    if (0 == _tcscmp(option_name, _T("pipeline-thread"))) {
+        pParams->pipelineThread = true;
+        return 0;
+    }
+    if (0 == _tcscmp(option_name, _T("no-pipeline-thread"))) {
+        pParams->pipelineThread = false;
+        return 0;
+    }
     if (0 == _tcscmp(option_name, _T("min-memory"))) {
         pParams->ctrl.threadOutput = 0;
         pParams->ctrl.threadAudio = 0;
@@ -2619,6 +2646,7 @@ tstring gen_cmd(const sInputParams *pParams, bool save_disabled_prm) {
     OPT_NUM(_T("--mfx-thread"), nSessionThreads);
 #endif //#if defined(_WIN32) || defined(_WIN64)
     OPT_BOOL(_T("--gpu-copy"), _T(""), gpuCopy);
+    OPT_BOOL(_T("--pipeline-thread"), _T("--no-pipeline-thread"), pipelineThread);
     OPT_NUM(_T("--input-buf"), nInputBufSize);
 
     cmd << gen_cmd(&pParams->ctrl, &encPrmDefault.ctrl, save_disabled_prm);
@@ -59,6 +59,8 @@ RGY_DISABLE_WARNING_POP
 #include "rgy_filesystem.h"
 #include "rgy_input.h"
 #include "rgy_output.h"
+#include "rgy_trace.h"
+#include "qsv_pipeline_executor.h"
 #include "rgy_input_raw.h"
 #include "rgy_input_vpy.h"
 #include "rgy_input_avs.h"
@@ -1544,7 +1546,17 @@ RGY_ERR CQSVPipeline::AllocFrames() {
 
     PrintMes(RGY_LOG_DEBUG, _T("allocFrames: m_nAsyncDepth - %d frames\n"), m_nAsyncDepth);
 
+    // --pipeline-threadの場合、ステージ間のキューに滞留するフレームの分を追加で確保する
+    const auto stageStart = (m_pipelineThread) ? PipelineTaskExecutor::splitStages(m_pipelineTasks) : std::vector<size_t>();
+    auto requestNumFramesQueue = [&](const size_t it0, const size_t it1) {
+        if (!m_pipelineThread) return 0;
+        const bool crossStage = it1 + 1 == m_pipelineTasks.size() // 最後のtaskの出力は出力スレッドに渡される
+            || std::any_of(stageStart.begin(), stageStart.end(), [it0, it1](const size_t start) { return it0 < start && start <= it1; });
+        return (crossStage) ? PIPELINE_EXECUTOR_QUEUE_SIZE + 1 : 0;
+    };
+
     PipelineTask *t0 = m_pipelineTasks[0].get();
+    size_t it0 = 0;
     for (size_t ip = 1; ip < m_pipelineTasks.size(); ip++) {
         if (t0->isPassThrough()) {
             PrintMes(RGY_LOG_ERROR, _T("allocFrames: t0 cannot be path through task!\n"));
@@ -1601,7 +1613,7 @@ RGY_ERR CQSVPipeline::AllocFrames() {
             PrintMes(RGY_LOG_ERROR, _T("AllocFrames: invalid pipeline: cannot get request from either t0 or t1!\n"));
             return RGY_ERR_UNSUPPORTED;
         }
-        const int requestNumFrames = std::max(1, t0RequestNumFrame + t1RequestNumFrame + m_nAsyncDepth + 1);
+        const int requestNumFrames = std::max(1, t0RequestNumFrame + t1RequestNumFrame + m_nAsyncDepth + 1) + requestNumFramesQueue(it0, ip);
         if (allocateOpenCLFrame) { // OpenCLフレームを介してやり取りする場合
             const RGYFrameInfo frame(allocRequest.Info.CropW, allocRequest.Info.CropH,
                 csp_enc_to_rgy(allocRequest.Info.FourCC),
@@ -1648,6 +1660,7 @@ RGY_ERR CQSVPipeline::AllocFrames() {
             }
         }
         t0 = t1;
+        it0 = ip;
     }
     return RGY_ERR_NONE;
 }
@@ -1700,6 +1713,8 @@ CQSVPipeline::CQSVPipeline() :
     m_sessionParams(),
     m_nProcSpeedLimit(0),
     m_taskPerfMonitor(false),
+    m_pipelineThread(false),
+    m_traceOutput(false),
     m_dummyLoad(),
     m_pAbortByUser(nullptr),
     m_heAbort(),
@@ -3752,6 +3767,7 @@ RGY_ERR CQSVPipeline::InitParallelEncode(sInputParams *inputParam, const int max
             return RGY_ERR_UNKNOWN;
         }
         PrintMes(RGY_LOG_WARN, _T("%s"), errmes);
+        m_pFileReader->parallelEncFanOutClose(); // 子への分配のため保持していた入力を解放する
         inputParam->ctrl.parallelEnc.parallelCount = 0;
         inputParam->ctrl.parallelEnc.parallelId = -1;
         return (isChild) ? sts : RGY_ERR_NONE; // 子スレッド側でエラーが起こった場合はエラー、親の場合は正常終了(並列動作を無効化して継続)を返す
@@ -3771,6 +3787,7 @@ RGY_ERR CQSVPipeline::InitParallelEncode(sInputParams *inputParam, const int max
             PrintMes(RGY_LOG_WARN, _T("Parallel count limited to %d\n"), inputParam->ctrl.parallelEnc.parallelCount);
         }
         if (inputParam->ctrl.parallelEnc.parallelCount <= 1) { // 並列数が1以下ならparallelを無効化
+            m_pFileReader->parallelEncFanOutClose();
             inputParam->ctrl.parallelEnc.parallelCount = 0;
             inputParam->ctrl.parallelEnc.parallelId = -1;
             PrintMes(RGY_LOG_DEBUG, _T("Parallel encoding disabled, as parallel count id set to %d.\n"), inputParam->ctrl.parallelEnc.parallelCount);
@@ -3784,9 +3801,14 @@ RGY_ERR CQSVPipeline::InitParallelEncode(sInputParams *inputParam, const int max
         if (inputParam->ctrl.parallelEnc.isChild()) {
             return sts; // 子スレッド側でエラーが起こった場合はエラー
         }
+        if (m_parallelEnc->inputFannedOut()) {
+            PrintMes(RGY_LOG_ERROR, _T("Failed to initialize parallel encoding, input was already read for parallel encoding.\n"));
+            return sts; // 親が入力を読み込んで分配済みの場合は、並列処理を無効化して続行できない
+        }
         // うまくいかなかった場合、並列処理を無効化して続行する
         PrintMes(RGY_LOG_WARN, _T("Failed to initialize parallel encoding, disabled.\n"));
         m_parallelEnc.reset();
+        m_pFileReader->parallelEncFanOutClose();
         // m_deviceUsageはいったん解放したので、登録を再追加
         if (m_deviceUsage) {
             m_deviceUsage = std::make_unique<RGYDeviceUsage>();
@@ -3838,6 +3860,16 @@ RGY_ERR CQSVPipeline::Init(sInputParams *pParams) {
 
     RGY_ERR sts = RGY_ERR_NONE;
 
+    // 並列エンコードの子は親と同じトレースに記録するので、開始と出力は親でのみ行う
+    if (pParams->ctrl.traceFile.length() > 0 && !pParams->ctrl.parallelEnc.isChild()) {
+        if ((sts = RGYTrace::start(pParams->ctrl.traceFile)) != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("Failed to open trace file \"%s\".\n"), pParams->ctrl.traceFile.c_str());
+            return sts;
+        }
+        m_traceOutput = true;
+        PrintMes(RGY_LOG_DEBUG, _T("Started trace: %s.\n"), pParams->ctrl.traceFile.c_str());
+    }
+
 #if ENABLE_VULKAN
     if (pParams->ctrl.enableVulkan == RGYParamInitVulkan::TargetVendor) {
         setenv("VK_LOADER_DRIVERS_SELECT", "*intel*", 1);
@@ -3978,6 +4010,9 @@ RGY_ERR CQSVPipeline::Init(sInputParams *pParams) {
 
     sts = InitOpenCL(pParams->ctrl.enableOpenCL, pParams->ctrl.parallelEnc.isParent() ? 1 : pParams->ctrl.openclBuildThreads, pParams->vpp.checkPerformance);
     if (sts < RGY_ERR_NONE) return sts;
+    if (m_cl && pParams->ctrl.openclCache) {
+        m_cl->setProgramCacheDir((pParams->ctrl.openclCacheDir.length() > 0) ? pParams->ctrl.openclCacheDir : RGYOpenCLContext::defaultProgramCacheDir());
+    }
     PrintMes(RGY_LOG_DEBUG, _T("InitOpenCL: Success.\n"));
 
     sts = input_ret.get();
@@ -4032,6 +4067,13 @@ RGY_ERR CQSVPipeline::Init(sInputParams *pParams) {
 
     m_nProcSpeedLimit = pParams->ctrl.procSpeedLimit;
     m_taskPerfMonitor = pParams->ctrl.taskPerfMonitor;
+    m_pipelineThread = pParams->pipelineThread;
+    if (m_pipelineThread && pParams->ctrl.threadOutput == 0
+        && std::find(m_pFileWriterListAudio.begin(), m_pFileWriterListAudio.end(), m_pFileWriter) != m_pFileWriterListAudio.end()) {
+        //出力スレッドがないと、音声の書き出し(音声taskのステージ)と映像の書き出し(出力スレッド)が同じファイルに並行して行われてしまう
+        PrintMes(RGY_LOG_WARN, _T("--pipeline-thread requires output thread when muxing audio, disabled (--output-thread 0 / --min-memory).\n"));
+        m_pipelineThread = false;
+    }
     m_nAsyncDepth = clamp_param_int((pParams->ctrl.lowLatency) ? 1 : pParams->nAsyncDepth, 0, QSV_ASYNC_DEPTH_MAX, _T("async-depth"));
     if (m_nAsyncDepth == 0) {
         m_nAsyncDepth = QSV_DEFAULT_ASYNC_DEPTH;
@@ -4155,6 +4197,7 @@ void CQSVPipeline::Close() {
     }
     m_poolFrame.reset();
     m_poolPkt.reset();
+    PrintMes(RGY_LOG_DEBUG, _T("%s\n"), RGYBitstreamBufferPool::get().statsStr().c_str());
 #if defined(_WIN32) || defined(_WIN64)
     if (m_bTimerPeriodTuning) {
         timeEndPeriod(1);
@@ -4180,12 +4223,19 @@ void CQSVPipeline::Close() {
     m_nAVSyncMode = RGY_AVSYNC_AUTO;
     m_nProcSpeedLimit = 0;
     m_taskPerfMonitor = false;
+    m_pipelineThread = false;
+    if (m_traceOutput) { // RunEncode2まで到達しなかった場合
+        RGYTrace::stop();
+        m_traceOutput = false;
+    }
 #if ENABLE_AVSW_READER
     av_qsv_log_free();
 #endif //#if ENABLE_AVSW_READER
     PrintMes(RGY_LOG_DEBUG, _T("Closed pipeline.\n"));
     if (m_pQSVLog.get() != nullptr) {
         m_pQSVLog->writeFileFooter();
+        //ファイルをほかのRGYLogと共有している場合は解放しても書き込まれないので、ここで書き込んでおく
+        m_pQSVLog->flush();
         m_pQSVLog.reset();
     }
 }
@@ -4504,6 +4554,39 @@ RGY_ERR CQSVPipeline::RunEncode2() {
         }
         return true;
     };
+    // --trace用に、各タスクのsendFrame/getOutputの区間とキューの深さを記録する
+    struct PipelineTaskTraceName {
+        const char *send;
+        const char *get;
+        const char *queue;
+    };
+    std::vector<PipelineTaskTraceName> traceNames;
+    std::vector<int> traceQueueSize;
+    if (RGYTrace::enabled()) {
+        RGYTrace::setThreadName("pipeline");
+        for (size_t itask = 0; itask < m_pipelineTasks.size(); itask++) {
+            const auto name = strsprintf(_T("%d:%s"), (int)itask, m_pipelineTasks[itask]->print().c_str());
+            traceNames.push_back({ RGYTrace::intern(name + _T(" send")), RGYTrace::intern(name + _T(" get")), RGYTrace::intern(name + _T(" queue")) });
+        }
+        traceQueueSize.resize(m_pipelineTasks.size(), -1);
+    }
+    auto taskSendFrame = [&](const size_t itask, std::unique_ptr<PipelineTaskOutput>& data) {
+        RGYTraceScope trace((traceNames.size() > 0) ? traceNames[itask].send : nullptr, m_pipelineTasks[itask]->inputFrames());
+        return m_pipelineTasks[itask]->sendFrame(data);
+    };
+    auto taskGetOutput = [&](const size_t itask) {
+        RGYTraceScope trace((traceNames.size() > 0) ? traceNames[itask].get : nullptr, m_pipelineTasks[itask]->outputFrames());
+        auto output = m_pipelineTasks[itask]->getOutput(requireSync(itask));
+        if (traceNames.size() > 0) {
+            const int queueSize = m_pipelineTasks[itask]->outputQueueSize();
+            trace.setQueue(queueSize);
+            if (traceQueueSize[itask] != queueSize) { // 変化があったときのみカウンタを記録する
+                RGYTrace::counter(traceNames[itask].queue, queueSize);
+                traceQueueSize[itask] = queueSize;
+            }
+        }
+        return output;
+    };
     auto time_prev = std::chrono::high_resolution_clock::now();
 
     RGY_ERR err = RGY_ERR_NONE;
@@ -4519,7 +4602,25 @@ RGY_ERR CQSVPipeline::RunEncode2() {
         PipelineTaskData(size_t t, std::unique_ptr<PipelineTaskOutput>& d) : task(t), data(std::move(d)) {};
     };
     std::deque<PipelineTaskData> dataqueue;
-    {
+    if (m_pipelineThread) {
+        // ステージごとのスレッドで処理する (flushまで行われる)
+        PipelineTaskExecutorFuncs funcs;
+        funcs.sendFrame = taskSendFrame;
+        funcs.getOutput = taskGetOutput;
+        int outputFrames = 0; // 出力スレッドからのみ参照する
+        funcs.write = [&](std::unique_ptr<PipelineTaskOutput>& data) {
+            RGYTraceScope trace("output", outputFrames++);
+            if (stopwatchOutput) stopwatchOutput->set(0);
+            auto sts = data->write(m_pFileWriter.get(), m_device->allocator(), (m_cl) ? &m_cl->queue() : nullptr, m_videoQualityMetric.get());
+            if (stopwatchOutput) stopwatchOutput->add(0, 0);
+            return sts;
+        };
+        funcs.checkAbort = checkAbort;
+        funcs.checkAbortInput = []() { return stdInAbort(); };
+        funcs.waitInput = [&]() { speedCtrl.wait(m_pipelineTasks.front()->outputFrames()); };
+        PipelineTaskExecutor executor(m_pipelineTasks, m_pQSVLog);
+        err = executor.run(funcs);
+    } else {
         auto checkContinue = [&checkAbort](RGY_ERR& err) {
             if (checkAbort() || stdInAbort()) { err = RGY_ERR_ABORTED; return false; }
             return err >= RGY_ERR_NONE || err == RGY_ERR_MORE_DATA || err == RGY_ERR_MORE_SURFACE;
@@ -4535,13 +4636,13 @@ RGY_ERR CQSVPipeline::RunEncode2() {
                 if (d.task < m_pipelineTasks.size()) {
                     err = RGY_ERR_NONE;
                     auto& task = m_pipelineTasks[d.task];
-                    err = task->sendFrame(d.data);
+                    err = taskSendFrame(d.task, d.data);
                     if (!checkContinue(err)) {
                         PrintMes(setloglevel(err), _T("Break in task %s: %s.\n"), task->print().c_str(), get_err_mes(err));
                         break;
                     }
                     if (err == RGY_ERR_NONE) {
-                        auto output = task->getOutput(requireSync(d.task));
+                        auto output = taskGetOutput(d.task);
                         if (output.size() == 0) break;
                         //出てきたものは先頭に追加していく
                         std::for_each(output.rbegin(), output.rend(), [itask = d.task, &dataqueue](auto&& o) {
@@ -4549,6 +4650,7 @@ RGY_ERR CQSVPipeline::RunEncode2() {
                             });
                     }
                 } else { // pipelineの最終的なデータを出力
+                    RGYTraceScope trace("output", m_pipelineTasks.back()->outputFrames());
                     if (stopwatchOutput) stopwatchOutput->set(0);
                     if ((err = d.data->write(m_pFileWriter.get(), m_device->allocator(), (m_cl) ? &m_cl->queue() : nullptr, m_videoQualityMetric.get())) != RGY_ERR_NONE) {
                         PrintMes(RGY_LOG_ERROR, _T("failed to write output: %s.\n"), get_err_mes(err));
@@ -4560,8 +4662,7 @@ RGY_ERR CQSVPipeline::RunEncode2() {
             if (dataqueue.empty()) {
                 // taskを前方からひとつづつ出力が残っていないかチェック(主にcheckptsの処理のため)
                 for (size_t itask = 0; itask < m_pipelineTasks.size(); itask++) {
-                    auto& task = m_pipelineTasks[itask];
-                    auto output = task->getOutput(requireSync(itask));
+                    auto output = taskGetOutput(itask);
                     if (output.size() > 0) {
                         //出てきたものは先頭に追加していく
                         std::for_each(output.rbegin(), output.rend(), [itask, &dataqueue](auto&& o) {
@@ -4594,13 +4695,12 @@ RGY_ERR CQSVPipeline::RunEncode2() {
                 dataqueue.pop_front();
                 if (d.task < m_pipelineTasks.size()) {
                     err = RGY_ERR_NONE;
-                    auto& task = m_pipelineTasks[d.task];
-                    err = task->sendFrame(d.data);
+                    err = taskSendFrame(d.task, d.data);
                     if (!checkContinue(err)) {
                         if (d.task == flushedTaskSend) flushedTaskSend++;
                         break;
                     }
-                    auto output = task->getOutput(requireSync(d.task));
+                    auto output = taskGetOutput(d.task);
                     if (output.size() == 0) break;
                     //出てきたものは先頭に追加していく
                     std::for_each(output.rbegin(), output.rend(), [itask = d.task, &dataqueue](auto&& o) {
@@ -4608,6 +4708,7 @@ RGY_ERR CQSVPipeline::RunEncode2() {
                         });
                     RGY_IGNORE_STS(err, RGY_ERR_MORE_DATA); //VPPなどでsendFrameがRGY_ERR_MORE_DATAだったが、フレームが出てくる場合がある
                 } else { // pipelineの最終的なデータを出力
+                    RGYTraceScope trace("output", m_pipelineTasks.back()->outputFrames());
                     if (stopwatchOutput) stopwatchOutput->set(0);
                     if ((err = d.data->write(m_pFileWriter.get(), m_device->allocator(), (m_cl) ? &m_cl->queue() : nullptr, m_videoQualityMetric.get())) != RGY_ERR_NONE) {
                         PrintMes(RGY_LOG_ERROR, _T("failed to write output: %s.\n"), get_err_mes(err));
@@ -4619,8 +4720,7 @@ RGY_ERR CQSVPipeline::RunEncode2() {
             if (dataqueue.empty()) {
                 // taskを前方からひとつづつ出力が残っていないかチェック(主にcheckptsの処理のため)
                 for (size_t itask = flushedTaskGet; itask < m_pipelineTasks.size(); itask++) {
-                    auto& task = m_pipelineTasks[itask];
-                    auto output = task->getOutput(requireSync(itask));
+                    auto output = taskGetOutput(itask);
                     if (output.size() > 0) {
                         //出てきたものは先頭に追加していく
                         std::for_each(output.rbegin(), output.rend(), [itask, &dataqueue](auto&& o) {
@@ -4705,6 +4805,12 @@ RGY_ERR CQSVPipeline::RunEncode2() {
         m_deviceUsage->close();
     }
     m_pStatus->WriteResults();
+    if (m_traceOutput) {
+        if (auto sts = RGYTrace::stop(); sts != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_WARN, _T("Failed to write trace: %s.\n"), get_err_mes(sts));
+        }
+        m_traceOutput = false;
+    }
     if (filter_result.size()) {
         PrintMes(RGY_LOG_INFO, _T("\nVpp Filter Performance\n"));
         const auto max_len = std::accumulate(filter_result.begin(), filter_result.end(), 0u, [](uint32_t max_length, std::pair<tstring, double> info) {
@@ -4723,6 +4829,10 @@ RGY_ERR CQSVPipeline::RunEncode2() {
     if (m_parallelEnc) {
         m_parallelEnc->close(err == RGY_ERR_NONE);
     }
+    if (err != RGY_ERR_NONE && m_pQSVLog) {
+        //エラーや中断で終了する場合は、そのままプロセスが終了してもよいよう、ここでログをファイルに書き込んでおく
+        m_pQSVLog->flush();
+    }
     return err;
 }
 
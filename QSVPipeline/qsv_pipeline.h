@@ -168,6 +168,8 @@ protected:
     MFXVideoSession2Params m_sessionParams;
     uint32_t m_nProcSpeedLimit;
     bool m_taskPerfMonitor;
+    bool m_pipelineThread; // pipelineをステージごとのスレッドで処理する
+    bool m_traceOutput; // --traceの出力を行う (並列エンコードの子ではfalse)
     std::unique_ptr<RGYDummyLoadCL> m_dummyLoad;
 
     bool *m_pAbortByUser;
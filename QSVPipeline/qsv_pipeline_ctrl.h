@@ -192,43 +192,44 @@ class PipelineTaskSurfaces {
 private:
     class PipelineTaskSurfacesPair {
     private:
+        RGYFrameMFXSurf *mfx_; // MFXのフレームの場合のみ (isFree()のたびにdynamic_castしなくてよいよう、構築時に保持する)
         std::unique_ptr<RGYFrame> surf_;
+        PipelineTaskSurfaceType type_;
         std::atomic<int> ref;
     public:
-        PipelineTaskSurfacesPair(std::unique_ptr<RGYFrame> s) : surf_(std::move(s)), ref(0) {};
+        PipelineTaskSurfacesPair(std::unique_ptr<RGYFrameMFXSurf> s) : mfx_(s.get()), surf_(std::move(s)), type_(PipelineTaskSurfaceType::MFX), ref(0) {};
+        PipelineTaskSurfacesPair(std::unique_ptr<RGYCLFrame> s) : mfx_(nullptr), surf_(std::move(s)), type_(PipelineTaskSurfaceType::CL), ref(0) {};
 
         // 使用されていないフレームかを返す
         // mfxの参照カウンタと独自参照カウンタの両方をチェック
         bool isFree() const {
             if (ref != 0) return false;
-            if (auto mfxsurf = dynamic_cast<const RGYFrameMFXSurf*>(surf_.get()); mfxsurf != nullptr) {
-                return mfxsurf->locked() == 0;
-            }
-            return true;
+            return (mfx_) ? mfx_->locked() == 0 : true;
         }
         PipelineTaskSurface getRef() { return PipelineTaskSurface(surf_.get(), &ref); };
         const RGYFrame *surf() const { return surf_.get(); }
         RGYFrame *surf() { return surf_.get(); }
-        PipelineTaskSurfaceType type() const {
-            if (!surf_) return PipelineTaskSurfaceType::UNKNOWN;
-            if (dynamic_cast<const RGYCLFrame*>(surf_.get())) return PipelineTaskSurfaceType::CL;
-            if (dynamic_cast<const RGYFrameMFXSurf*>(surf_.get())) return PipelineTaskSurfaceType::MFX;
-            return PipelineTaskSurfaceType::UNKNOWN;
-        }
+        RGYFrameMFXSurf *mfx() { return mfx_; }
+        PipelineTaskSurfaceType type() const { return (surf_) ? type_ : PipelineTaskSurfaceType::UNKNOWN; }
     };
     std::vector<std::unique_ptr<PipelineTaskSurfacesPair>> m_surfaces; // フレームと参照カウンタ
+    std::unordered_map<const mfxFrameSurface1 *, PipelineTaskSurfacesPair *> m_mfxSurfMap; // mfxFrameSurface1からの逆引き用
+    size_t m_next; // 次に空きを探し始める位置
 public:
-    PipelineTaskSurfaces() : m_surfaces() {};
+    PipelineTaskSurfaces() : m_surfaces(), m_mfxSurfMap(), m_next(0) {};
     ~PipelineTaskSurfaces() { }
 
     void clear() {
         m_surfaces.clear();
+        m_mfxSurfMap.clear();
+        m_next = 0;
     }
     void setSurfaces(std::vector<mfxFrameSurface1>& surfs) {
         clear();
         m_surfaces.resize(surfs.size());
         for (size_t i = 0; i < m_surfaces.size(); i++) {
-            m_surfaces[i] = std::make_unique<PipelineTaskSurfacesPair>(std::move(std::make_unique<RGYFrameMFXSurf>(surfs[i])));
+            m_surfaces[i] = std::make_unique<PipelineTaskSurfacesPair>(std::make_unique<RGYFrameMFXSurf>(surfs[i]));
+            m_mfxSurfMap[m_surfaces[i]->mfx()->surf()] = m_surfaces[i].get();
         }
     }
     void setSurfaces(std::vector<std::unique_ptr<RGYCLFrame>>& surfs) {
@@ -239,24 +240,36 @@ public:
         }
     }
 
+    // 前回返したフレームの次から空きを探す
+    // フレームはおおむね使用した順に解放されるので、通常は最初に調べたフレームが空いている
     PipelineTaskSurface getFreeSurf() {
-        for (auto& s : m_surfaces) {
-            if (s->isFree()) {
-                return s->getRef();
+        const size_t count = m_surfaces.size();
+        for (size_t i = 0; i < count; i++) {
+            size_t idx = m_next + i;
+            if (idx >= count) idx -= count;
+            if (m_surfaces[idx]->isFree()) {
+                m_next = (idx + 1 < count) ? idx + 1 : 0;
+                return m_surfaces[idx]->getRef();
             }
         }
         return PipelineTaskSurface();
     }
-    PipelineTaskSurface get(mfxFrameSurface1 *surf) {
-        for (auto& s : m_surfaces) {
-            if (auto mfx = dynamic_cast<RGYFrameMFXSurf*>(s->surf()); mfx != nullptr) {
-                if (mfx->surf() == surf) {
-                    return s->getRef();
-                }
+    // 空きフレームが得られるまで待機する (waitCount回試して得られなければ空のPipelineTaskSurfaceを返す)
+    // mfxの参照カウンタの解放は通知されないので、sleep_hybridで待機しながら確認する
+    PipelineTaskSurface waitFreeSurf(const uint32_t waitCount) {
+        for (uint32_t i = 0; i < waitCount; i++) {
+            PipelineTaskSurface s = getFreeSurf();
+            if (s != nullptr) {
+                return s;
             }
+            sleep_hybrid(i);
         }
         return PipelineTaskSurface();
     }
+    PipelineTaskSurface get(mfxFrameSurface1 *surf) {
+        auto it = m_mfxSurfMap.find(surf);
+        return (it != m_mfxSurfMap.end()) ? it->second->getRef() : PipelineTaskSurface();
+    }
     size_t bufCount() const { return m_surfaces.size(); }
 
     bool isAllFree() const {
@@ -529,6 +542,9 @@ public:
         return (m_stopwatch) ? m_stopwatch->maxWorkStrLen() : 0u;
     }
     virtual bool isPassThrough() const { return false; }
+    // getOutputで取り出したフレームを、すぐに後続のtaskで処理する必要があるか
+    // (trueの場合、PipelineTaskExecutorはこのtaskの直後でスレッドを分割しない)
+    virtual bool requireImmediateConsume() const { return false; }
     virtual tstring print() const { return getPipelineTaskTypeName(m_type); }
     virtual std::optional<mfxFrameAllocRequest> requiredSurfIn() = 0;
     virtual std::optional<mfxFrameAllocRequest> requiredSurfOut() = 0;
@@ -675,15 +691,11 @@ public:
             PrintMes(RGY_LOG_ERROR, _T("getWorkSurf:   No buffer allocated!\n"));
             return PipelineTaskSurface();
         }
-        for (uint32_t i = 0; i < MSDK_WAIT_INTERVAL; i++) {
-            PipelineTaskSurface s = m_workSurfs.getFreeSurf();
-            if (s != nullptr) {
-                return s;
-            }
-            sleep_hybrid(i);
+        PipelineTaskSurface s = m_workSurfs.waitFreeSurf(MSDK_WAIT_INTERVAL);
+        if (s == nullptr) {
+            PrintMes(RGY_LOG_ERROR, _T("getWorkSurf:   Failed to get work surface, all %d frames used.\n"), m_workSurfs.bufCount());
         }
-        PrintMes(RGY_LOG_ERROR, _T("getWorkSurf:   Failed to get work surface, all %d frames used.\n"), m_workSurfs.bufCount());
-        return PipelineTaskSurface();
+        return s;
     }
 
     void setOutputMaxQueueSize(int size) { m_outMaxQueueSize = size; }
@@ -692,6 +704,7 @@ public:
     int inputFrames() const { return m_inFrames; }
     int outputFrames() const { return m_outFrames; }
     int outputMaxQueueSize() const { return m_outMaxQueueSize; }
+    int outputQueueSize() const { return (int)m_outQeueue.size(); }
 };
 
 class PipelineTaskInput : public PipelineTask {
@@ -1150,6 +1163,10 @@ public:
         // そのまま渡すのでPassThrough
         return true;
     }
+    virtual bool requireImmediateConsume() const override {
+        // getOutputで上書きしたタイムスタンプは、次のフレームを取り出す前に後続で使用される必要がある
+        return true;
+    }
     static const int MAX_FORCECFR_INSERT_FRAMES = 1024; //事実上の無制限
 public:
     virtual std::optional<mfxFrameAllocRequest> requiredSurfIn() override {
@@ -1530,8 +1547,8 @@ protected:
     }
 
     RGY_ERR openNextFile() {
-        if (m_currentChunk >= 0 && m_parallelEnc->cacheMode(m_currentChunk) == RGYParamParallelEncCache::Mem) {
-            // メモリモードの場合は、まだそのエンコーダの戻り値をチェックしていないので、ここでチェック
+        if (m_currentChunk >= 0 && m_parallelEnc->cacheMode(m_currentChunk) != RGYParamParallelEncCache::File) {
+            // メモリ/リングバッファモードの場合は、まだそのエンコーダの戻り値をチェックしていないので、ここでチェック
             auto procsts = checkEncodeResult();
             if (procsts != RGY_ERR_NONE) {
                 PrintMes(RGY_LOG_ERROR, _T("Error in parallel enc %d: %s\n"), m_currentChunk, get_err_mes(procsts));
@@ -1541,7 +1558,13 @@ protected:
         }
 
         m_currentChunk++;
-        if (m_currentChunk >= (int)m_parallelEnc->parallelCount()) {
+        // 次のチャンクは順に起動されるので、起動を待つ (起動されるチャンクがもうなければ終了)
+        if (!m_parallelEnc->waitChunkStarted(m_currentChunk)) {
+            // チャンクの起動に失敗して打ち切られた場合は、エラーとする
+            if (auto err = m_parallelEnc->checkAllProcessErrors(); err != RGY_ERR_NONE) {
+                PrintMes(RGY_LOG_ERROR, _T("Error in parallel enc: %s\n"), get_err_mes(err));
+                return err;
+            }
             return RGY_ERR_MORE_BITSTREAM;
         }
         
@@ -1685,7 +1708,7 @@ protected:
             if (auto err = openNextFile(); err != RGY_ERR_NONE) {
                 return err;
             }
-        } else if (m_currentChunk >= (int)m_parallelEnc->parallelCount()) {
+        } else if (!m_parallelEnc->waitChunkStarted(m_currentChunk)) {
             return RGY_ERR_MORE_BITSTREAM;
         }
         auto err = getBitstreamOneFrame(bsOut, header);
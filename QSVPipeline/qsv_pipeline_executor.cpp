@@ -0,0 +1,585 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2025 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#include <cstdarg>
+#include "qsv_pipeline_executor.h"
+#include "qsv_allocator_sys.h"
+#include "rgy_trace.h"
+
+PipelineTaskExecutor::PipelineTaskExecutor(std::vector<std::unique_ptr<PipelineTask>>& tasks, std::shared_ptr<RGYLog> log) :
+    m_tasks(tasks),
+    m_stageStart(),
+    m_queues(),
+    m_funcs(nullptr),
+    m_abort(false),
+    m_stopInput(false),
+    m_err(RGY_ERR_NONE),
+    m_log(log) {
+}
+
+PipelineTaskExecutor::~PipelineTaskExecutor() {
+    m_queues.clear();
+}
+
+std::vector<size_t> PipelineTaskExecutor::splitStages(const std::vector<std::unique_ptr<PipelineTask>>& tasks) {
+    std::vector<size_t> stageStart;
+    if (tasks.size() == 0) {
+        return stageStart;
+    }
+    stageStart.push_back(0);
+    size_t srctask = 0;
+    for (size_t itask = 1; itask < tasks.size(); itask++) {
+        if (tasks[itask]->isPassThrough()) {
+            continue;
+        }
+        // mfx同士の受け渡しはsyncpointを介して非同期に行われるので、同じスレッドで処理する
+        // 同期が必要な箇所のみで分割し、同期(waitsync)は上流側のスレッドで行う
+        if (tasks[srctask]->requireSync(tasks[itask]->taskType())) {
+            // 間にあるpassthroughなtaskは上流側のステージで処理するが、
+            // 出力をすぐに後続で処理する必要のあるtask(checkpts)からは下流側のステージで処理する
+            size_t boundary = srctask + 1;
+            while (boundary < itask && !tasks[boundary]->requireImmediateConsume()) {
+                boundary++;
+            }
+            stageStart.push_back(boundary);
+        }
+        srctask = itask;
+    }
+    return stageStart;
+}
+
+void PipelineTaskExecutor::setError(RGY_ERR err) {
+    int expected = RGY_ERR_NONE;
+    m_err.compare_exchange_strong(expected, (int)err);
+    m_abort = true;
+}
+
+bool PipelineTaskExecutor::pushData(PipelineTaskQueue *queue, std::unique_ptr<PipelineTaskOutput>& data) {
+    //キューが一杯の場合は待機するが、中断された場合には抜ける
+    while (!queue->push(std::move(data), 100)) {
+        if (m_abort) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool PipelineTaskExecutor::popData(PipelineTaskQueue *queue, std::unique_ptr<PipelineTaskOutput>& data) {
+    while (!queue->pop(&data, 100)) {
+        if (m_abort) {
+            return false;
+        }
+    }
+    return true;
+}
+
+RGY_ERR PipelineTaskExecutor::runStage(const size_t istage) {
+    const size_t taskBegin = m_stageStart[istage];
+    const size_t taskEnd = m_stageStart[istage + 1];
+    const bool firstStage = istage == 0;
+    PipelineTaskQueue *queueIn = (firstStage) ? nullptr : m_queues[istage - 1].get();
+    PipelineTaskQueue *queueOut = m_queues[istage].get();
+    PrintMes(RGY_LOG_DEBUG, _T("stage %d: task %d - %d.\n"), (int)istage, (int)taskBegin, (int)taskEnd - 1);
+
+    auto setloglevel = [](RGY_ERR err) {
+        if (err == RGY_ERR_NONE || err == RGY_ERR_MORE_DATA || err == RGY_ERR_MORE_SURFACE || err == RGY_ERR_MORE_BITSTREAM) return RGY_LOG_DEBUG;
+        if (err > RGY_ERR_NONE) return RGY_LOG_WARN;
+        return RGY_LOG_ERROR;
+        };
+    // 各taskの処理は、CQSVPipeline::RunEncode2のシングルスレッドでの処理をステージ内のtaskに限定したもの
+    // taskEndに達したデータは次のステージに渡す
+    RGY_ERR err = RGY_ERR_NONE;
+    bool inputEOF = firstStage; // 上流のステージからの終端を受け取ったか
+    std::deque<PipelineTaskData> dataqueue;
+    {
+        auto checkContinue = [&](RGY_ERR& err) {
+            if (m_abort || m_funcs->checkAbort() || (firstStage && m_funcs->checkAbortInput())) { err = RGY_ERR_ABORTED; return false; }
+            return err >= RGY_ERR_NONE || err == RGY_ERR_MORE_DATA || err == RGY_ERR_MORE_SURFACE;
+            };
+        while (checkContinue(err)) {
+            if (dataqueue.empty()) {
+                if (firstStage) {
+                    if (m_stopInput) { // 後段から入力の終了が要求された
+                        err = RGY_ERR_MORE_BITSTREAM;
+                        break;
+                    }
+                    m_funcs->waitInput();
+                    dataqueue.push_back(PipelineTaskData(taskBegin)); // デコード実行用
+                } else {
+                    std::unique_ptr<PipelineTaskOutput> input;
+                    if (!popData(queueIn, input)) {
+                        err = RGY_ERR_ABORTED;
+                        break;
+                    }
+                    if (!input) { // 上流のステージの終了
+                        inputEOF = true;
+                        err = RGY_ERR_MORE_BITSTREAM;
+                        break;
+                    }
+                    dataqueue.push_back(PipelineTaskData(taskBegin, input));
+                }
+            }
+            while (!dataqueue.empty()) {
+                auto d = std::move(dataqueue.front());
+                dataqueue.pop_front();
+                if (d.task < taskEnd) {
+                    err = m_funcs->sendFrame(d.task, d.data);
+                    if (!checkContinue(err)) {
+                        PrintMes(setloglevel(err), _T("Break in task %s: %s.\n"), m_tasks[d.task]->print().c_str(), get_err_mes(err));
+                        break;
+                    }
+                    if (err == RGY_ERR_NONE) {
+                        auto output = m_funcs->getOutput(d.task);
+                        if (output.size() == 0) break;
+                        //出てきたものは先頭に追加していく
+                        std::for_each(output.rbegin(), output.rend(), [itask = d.task, &dataqueue](auto&& o) {
+                            dataqueue.push_front(PipelineTaskData(itask + 1, o));
+                            });
+                    }
+                } else if (!pushData(queueOut, d.data)) { // 次のステージへ
+                    err = RGY_ERR_ABORTED;
+                    break;
+                }
+            }
+            if (dataqueue.empty()) {
+                // taskを前方からひとつづつ出力が残っていないかチェック(主にcheckptsの処理のため)
+                for (size_t itask = taskBegin; itask < taskEnd; itask++) {
+                    auto output = m_funcs->getOutput(itask);
+                    if (output.size() > 0) {
+                        //出てきたものは先頭に追加していく
+                        std::for_each(output.rbegin(), output.rend(), [itask, &dataqueue](auto&& o) {
+                            dataqueue.push_front(PipelineTaskData(itask + 1, o));
+                            });
+                        //checkptsの処理上、でてきたフレームはすぐに後続処理に渡したいのでbreak
+                        break;
+                    }
+                }
+            }
+        }
+    }
+    // flush
+    if (err == RGY_ERR_MORE_BITSTREAM) { // 読み込みの完了を示すフラグ
+        if (!inputEOF) {
+            // 上流のステージがまだ終了していないのに終了する場合は、先頭のステージに入力の終了を要求する
+            m_stopInput = true;
+        }
+        err = RGY_ERR_NONE;
+        for (size_t itask = taskBegin; itask < taskEnd; itask++) {
+            m_tasks[itask]->setOutputMaxQueueSize(0); //flushのため
+        }
+        auto checkContinue = [&](RGY_ERR& err) {
+            if (m_abort || m_funcs->checkAbort()) { err = RGY_ERR_ABORTED; return false; }
+            return err >= RGY_ERR_NONE || err == RGY_ERR_MORE_SURFACE;
+            };
+        for (size_t flushedTaskSend = taskBegin, flushedTaskGet = taskBegin; flushedTaskGet < taskEnd && err != RGY_ERR_ABORTED; ) { // taskを前方からひとつづつflushしていく
+            err = RGY_ERR_NONE;
+            if (flushedTaskSend == flushedTaskGet) {
+                dataqueue.push_back(PipelineTaskData(flushedTaskSend)); //flush用
+            }
+            while (!dataqueue.empty() && checkContinue(err)) {
+                auto d = std::move(dataqueue.front());
+                dataqueue.pop_front();
+                if (d.task < taskEnd) {
+                    err = m_funcs->sendFrame(d.task, d.data);
+                    if (!checkContinue(err)) {
+                        if (d.task == flushedTaskSend) flushedTaskSend++;
+                        break;
+                    }
+                    auto output = m_funcs->getOutput(d.task);
+                    if (output.size() == 0) break;
+                    //出てきたものは先頭に追加していく
+                    std::for_each(output.rbegin(), output.rend(), [itask = d.task, &dataqueue](auto&& o) {
+                        dataqueue.push_front(PipelineTaskData(itask + 1, o));
+                        });
+                    RGY_IGNORE_STS(err, RGY_ERR_MORE_DATA); //VPPなどでsendFrameがRGY_ERR_MORE_DATAだったが、フレームが出てくる場合がある
+                } else if (!pushData(queueOut, d.data)) { // 次のステージへ
+                    err = RGY_ERR_ABORTED;
+                    break;
+                }
+            }
+            if (dataqueue.empty() && err != RGY_ERR_ABORTED) {
+                // taskを前方からひとつづつ出力が残っていないかチェック(主にcheckptsの処理のため)
+                for (size_t itask = flushedTaskGet; itask < taskEnd; itask++) {
+                    auto output = m_funcs->getOutput(itask);
+                    if (output.size() > 0) {
+                        //出てきたものは先頭に追加していく
+                        std::for_each(output.rbegin(), output.rend(), [itask, &dataqueue](auto&& o) {
+                            dataqueue.push_front(PipelineTaskData(itask + 1, o));
+                            });
+                        //checkptsの処理上、でてきたフレームはすぐに後続処理に渡したいのでbreak
+                        break;
+                    } else if (itask == flushedTaskGet && flushedTaskGet < flushedTaskSend) {
+                        flushedTaskGet++;
+                    }
+                }
+            }
+        }
+    }
+    dataqueue.clear();
+    if (err == RGY_ERR_NONE || err == RGY_ERR_MORE_DATA || err == RGY_ERR_MORE_SURFACE || err == RGY_ERR_MORE_BITSTREAM || err > RGY_ERR_NONE) {
+        // 下流に終端を通知する
+        std::unique_ptr<PipelineTaskOutput> eof;
+        pushData(queueOut, eof);
+        // 途中で終了した場合は、上流の終了まで残りを破棄する
+        while (!inputEOF) {
+            std::unique_ptr<PipelineTaskOutput> input;
+            if (!popData(queueIn, input)) break;
+            inputEOF = !input;
+        }
+    } else {
+        setError(err);
+    }
+    PrintMes(RGY_LOG_DEBUG, _T("stage %d: finished: %s.\n"), (int)istage, get_err_mes(err));
+    return err;
+}
+
+RGY_ERR PipelineTaskExecutor::runOutput() {
+    PipelineTaskQueue *queueIn = m_queues.back().get();
+    RGY_ERR err = RGY_ERR_NONE;
+    for (;;) {
+        if (m_funcs->checkAbort()) {
+            err = RGY_ERR_ABORTED;
+            break;
+        }
+        std::unique_ptr<PipelineTaskOutput> data;
+        if (!popData(queueIn, data)) {
+            err = RGY_ERR_ABORTED;
+            break;
+        }
+        if (!data) { // 全ステージの終了
+            break;
+        }
+        if ((err = m_funcs->write(data)) != RGY_ERR_NONE) {
+            PrintMes(RGY_LOG_ERROR, _T("failed to write output: %s.\n"), get_err_mes(err));
+            break;
+        }
+    }
+    if (err != RGY_ERR_NONE) {
+        setError(err);
+    }
+    PrintMes(RGY_LOG_DEBUG, _T("output: finished: %s.\n"), get_err_mes(err));
+    return err;
+}
+
+RGY_ERR PipelineTaskExecutor::run(PipelineTaskExecutorFuncs& funcs) {
+    if (m_tasks.size() == 0) {
+        return RGY_ERR_INVALID_OPERATION;
+    }
+    m_funcs = &funcs;
+    m_abort = false;
+    m_stopInput = false;
+    m_err = RGY_ERR_NONE;
+    m_stageStart = splitStages(m_tasks);
+    const size_t stageCount = m_stageStart.size();
+    m_stageStart.push_back(m_tasks.size());
+    m_queues.clear();
+    for (size_t i = 0; i < stageCount; i++) {
+        m_queues.push_back(std::make_unique<PipelineTaskQueue>());
+        m_queues.back()->init(PIPELINE_EXECUTOR_QUEUE_SIZE);
+    }
+    PrintMes(RGY_LOG_DEBUG, _T("run pipeline in %d stages + output.\n"), (int)stageCount);
+
+    // 先頭のステージは呼び出し元のスレッドで処理する
+    std::vector<std::thread> threads;
+    for (size_t istage = 1; istage < stageCount; istage++) {
+        threads.push_back(std::thread([this, istage]() {
+            if (RGYTrace::enabled()) {
+                RGYTrace::setThreadName(RGYTrace::intern(strsprintf(_T("pipeline stage %d"), (int)istage)));
+            }
+            runStage(istage);
+        }));
+    }
+    threads.push_back(std::thread([this]() {
+        RGYTrace::setThreadName("pipeline output");
+        runOutput();
+    }));
+    runStage(0);
+    for (auto& th : threads) {
+        th.join();
+    }
+    // m_tasksを解放する前に、キューに残ったフレームを解放する
+    for (auto& queue : m_queues) {
+        queue->close([](std::unique_ptr<PipelineTaskOutput> *data) { data->reset(); });
+    }
+    m_funcs = nullptr;
+    return (RGY_ERR)m_err.load();
+}
+
+void PipelineTaskExecutor::PrintMes(RGYLogLevel log_level, const TCHAR *format, ...) {
+    if (m_log.get() == nullptr) {
+        if (log_level <= RGY_LOG_INFO) {
+            return;
+        }
+    } else if (log_level < m_log->getLogLevel(RGY_LOGT_CORE)) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+
+    int len = _vsctprintf(format, args) + 1; // _vscprintf doesn't count terminating '\0'
+    vector<TCHAR> buffer(len, 0);
+    _vstprintf_s(buffer.data(), len, format, args);
+    va_end(args);
+
+    tstring mes = tstring(_T("executor: ")) + buffer.data();
+
+    if (m_log.get() != nullptr) {
+        m_log->write(log_level, RGY_LOGT_CORE, mes.c_str());
+    } else {
+        _ftprintf(stderr, _T("%s"), mes.c_str());
+    }
+}
+
+// --check-pipeline-executor用の入力
+// フレームの先頭にフレーム番号を書き込み、指定されたタイムスタンプを設定する
+class RGYInputExecutorCheck : public RGYInput {
+public:
+    RGYInputExecutorCheck(const std::vector<int64_t>& pts) : RGYInput(), m_pts(pts), m_next(0) {
+        m_readerName = _T("check");
+    }
+    virtual ~RGYInputExecutorCheck() {};
+protected:
+    virtual RGY_ERR Init([[maybe_unused]] const TCHAR *strFileName, [[maybe_unused]] VideoInfo *pInputInfo, [[maybe_unused]] const RGYInputPrm *prm) override {
+        return RGY_ERR_NONE;
+    }
+    virtual RGY_ERR LoadNextFrameInternal(RGYFrame *surface) override {
+        if (m_next >= m_pts.size()) {
+            return RGY_ERR_MORE_DATA;
+        }
+        const uint32_t marker = (uint32_t)m_next;
+        memcpy(surface->ptrY(), &marker, sizeof(marker));
+        surface->setTimestamp(m_pts[m_next]);
+        surface->setDuration(0);
+        m_next++;
+        return RGY_ERR_NONE;
+    }
+    std::vector<int64_t> m_pts;
+    size_t m_next;
+};
+
+struct ExecutorCheckFrame {
+    int id;      // inputFrameId
+    int marker;  // フレームに書き込まれていたフレーム番号
+    int64_t pts;
+};
+
+// --check-pipeline-executor用の出力
+// 受け取ったフレームの情報を記録する (errorAt番目のフレームではエラーを返す)
+class RGYOutputExecutorCheck : public RGYOutput {
+public:
+    RGYOutputExecutorCheck(const int errorAt) : RGYOutput(), m_frames(), m_errorAt(errorAt) {
+        m_OutType = OUT_TYPE_SURFACE;
+        m_strWriterName = _T("check");
+    }
+    virtual ~RGYOutputExecutorCheck() {};
+    virtual RGY_ERR WriteNextFrame([[maybe_unused]] RGYBitstream *pBitstream) override {
+        return RGY_ERR_UNSUPPORTED;
+    }
+    virtual RGY_ERR WriteNextFrame(RGYFrame *pSurface) override {
+        if (pSurface == nullptr) { // 終了
+            return RGY_ERR_NONE;
+        }
+        if ((int)m_frames.size() == m_errorAt) {
+            return RGY_ERR_UNKNOWN;
+        }
+        uint32_t marker = 0;
+        memcpy(&marker, pSurface->ptrY(), sizeof(marker));
+        m_frames.push_back({ pSurface->inputFrameId(), (int)marker, (int64_t)pSurface->timestamp() });
+        return RGY_ERR_NONE;
+    }
+    const std::vector<ExecutorCheckFrame>& frames() const { return m_frames; }
+protected:
+    virtual RGY_ERR Init([[maybe_unused]] const TCHAR *strFileName, [[maybe_unused]] const VideoInfo *pOutputInfo, [[maybe_unused]] const void *prm) override {
+        return RGY_ERR_NONE;
+    }
+    std::vector<ExecutorCheckFrame> m_frames;
+    int m_errorAt;
+};
+
+struct ExecutorCheckCase {
+    const char *name;
+    int frames;
+    std::vector<sTrim> trim;
+    bool forcecfr;   // 入力のタイムスタンプに欠落・重複を入れ、--avsync forcecfrで水増し・間引きを行う
+    int errorAt;     // 出力でエラーを返すフレーム (-1の場合はエラーなし)
+};
+
+// シングルスレッドで処理した場合に出力されるはずのフレームを求める
+static std::vector<ExecutorCheckFrame> executor_check_expected(const ExecutorCheckCase& c, const std::vector<int64_t>& pts) {
+    std::vector<ExecutorCheckFrame> expected;
+    int64_t ptsFirst = -1;
+    int64_t ptsEstimated = 0;
+    for (int i = 0; i < c.frames; i++) {
+        if (!frame_inside_range(i, c.trim).first) {
+            continue;
+        }
+        if (c.forcecfr) {
+            if (ptsFirst < 0) {
+                ptsFirst = pts[i];
+            }
+            const int64_t ptsOut = pts[i] - ptsFirst;
+            if (ptsOut < ptsEstimated) { // 間引き
+                continue;
+            }
+            for (; ptsEstimated < ptsOut; ptsEstimated++) { // 水増し
+                expected.push_back({ i, i, ptsEstimated });
+            }
+        }
+        expected.push_back({ i, i, ptsEstimated++ });
+    }
+    return expected;
+}
+
+// 1回分のpipelineを構築して実行し、出力されたフレームを検証する
+static tstring executor_check_run(const ExecutorCheckCase& c, const std::vector<int64_t>& pts, const std::vector<ExecutorCheckFrame>& expected, int& outputFrames) {
+    outputFrames = 0;
+    const mfxVersion mfxVer = { 0 };
+    const auto timebase = rgy_rational<int>(1, 30);
+    sTrimParam trimParam;
+    trimParam.list = c.trim;
+    trimParam.offset = 0;
+
+    // taskより先に破棄されないよう、allocator/入力/出力はtaskより先に宣言する
+    auto allocator = std::make_unique<QSVAllocatorSys>();
+    if (allocator->Init(nullptr, nullptr) != MFX_ERR_NONE) {
+        return _T("failed to init allocator");
+    }
+    RGYInputExecutorCheck input(pts);
+    RGYOutputExecutorCheck output(c.errorAt);
+    std::vector<std::unique_ptr<PipelineTask>> tasks;
+    tasks.push_back(std::make_unique<PipelineTaskInput>(nullptr, allocator.get(), -1, 0, &input, mfxVer, nullptr, nullptr));
+    if (trimParam.list.size() > 0) {
+        tasks.push_back(std::make_unique<PipelineTaskTrim>(trimParam, &input, nullptr, timebase, 0, mfxVer, nullptr));
+    }
+    tasks.push_back(std::make_unique<PipelineTaskCheckPTS>(nullptr, timebase, timebase, 1, (c.forcecfr) ? RGY_AVSYNC_FORCE_CFR : RGY_AVSYNC_AUTO, false, false, mfxVer, nullptr));
+    tasks.push_back(std::make_unique<PipelineTaskOutputRaw>(nullptr, &output, 0, mfxVer, nullptr));
+
+    // 出力スレッドへのキューに滞留する分を含めて確保する (CQSVPipeline::AllocFramesと同様)
+    mfxFrameAllocRequest allocRequest = { 0 };
+    allocRequest.Type = MFX_MEMTYPE_SYSTEM_MEMORY | MFX_MEMTYPE_FROM_VPPIN | MFX_MEMTYPE_EXTERNAL_FRAME;
+    allocRequest.Info.FourCC = MFX_FOURCC_NV12;
+    allocRequest.Info.ChromaFormat = MFX_CHROMAFORMAT_YUV420;
+    allocRequest.Info.Width = 64;
+    allocRequest.Info.Height = 64;
+    allocRequest.Info.CropW = 64;
+    allocRequest.Info.CropH = 64;
+    allocRequest.Info.FrameRateExtN = timebase.d();
+    allocRequest.Info.FrameRateExtD = timebase.n();
+    allocRequest.Info.PicStruct = MFX_PICSTRUCT_PROGRESSIVE;
+    allocRequest.NumFrameMin = allocRequest.NumFrameSuggested = (mfxU16)(2 + PIPELINE_EXECUTOR_QUEUE_SIZE + 1);
+    auto err = tasks.front()->workSurfacesAlloc(allocRequest, false, allocator.get());
+    if (err != RGY_ERR_NONE) {
+        return tstring(_T("failed to alloc frames: ")) + get_err_mes(err);
+    }
+
+    PipelineTaskExecutorFuncs funcs;
+    funcs.sendFrame = [&](const size_t itask, std::unique_ptr<PipelineTaskOutput>& data) { return tasks[itask]->sendFrame(data); };
+    funcs.getOutput = [&](const size_t itask) { return tasks[itask]->getOutput(false); };
+    funcs.write = [&](std::unique_ptr<PipelineTaskOutput>& data) { return data->write(&output, allocator.get(), nullptr, nullptr); };
+    funcs.checkAbort = []() { return false; };
+    funcs.checkAbortInput = []() { return false; };
+    funcs.waitInput = []() {};
+    {
+        PipelineTaskExecutor executor(tasks, nullptr);
+        err = executor.run(funcs);
+    }
+    tasks.clear();
+    // 出力スレッドはrun()の終了までにjoinされているので、ここからはoutputを参照してよい
+    const auto& frames = output.frames();
+    outputFrames = (int)frames.size();
+    // 出力でエラーを返した場合は、そこまでのフレームが出力されていればよい
+    const bool errorOutput = c.errorAt >= 0 && c.errorAt < (int)expected.size();
+    const auto errExpected = (errorOutput) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
+    const size_t expectedFrames = (errorOutput) ? (size_t)c.errorAt : expected.size();
+    if (err != errExpected) {
+        return strsprintf(_T("returned %s (expected %s)"), get_err_mes(err), get_err_mes(errExpected));
+    }
+    if (frames.size() != expectedFrames) {
+        return strsprintf(_T("output %d frames (expected %d)"), (int)frames.size(), (int)expectedFrames);
+    }
+    for (size_t i = 0; i < frames.size(); i++) {
+        if (frames[i].id != expected[i].id || frames[i].marker != expected[i].marker) {
+            return strsprintf(_T("frame %d: id %d, data %d (expected %d)"), (int)i, frames[i].id, frames[i].marker, expected[i].id);
+        }
+        // forcecfrで水増ししたフレームは同じsurfaceを参照しており、出力時にはタイムスタンプが上書きされている場合があるので比較しない
+        // (rawの出力ではタイムスタンプを使用しない)
+        if (!c.forcecfr && frames[i].pts != expected[i].pts) {
+            return strsprintf(_T("frame %d: pts %lld (expected %lld)"), (int)i, (long long)frames[i].pts, (long long)expected[i].pts);
+        }
+    }
+    return _T("");
+}
+
+std::string check_pipeline_executor(const int loops, int& errorCount) {
+    const ExecutorCheckCase cases[] = {
+        { "empty",    0,   {},                            false, -1 },
+        { "single",   1,   {},                            false, -1 },
+        { "cfr",      300, {},                            false, -1 },
+        { "trim",     300, { { 10, 99 }, { 150, 199 } },  false, -1 },
+        { "trim_end", 300, { { 0, 29 } },                 false, -1 },
+        { "forcecfr", 300, {},                            true,  -1 },
+        { "error",    300, {},                            false, 50 },
+    };
+    errorCount = 0;
+    std::string json = "{\n";
+    json += strsprintf("  \"loops\": %d,\n", loops);
+    json += strsprintf("  \"queue_size\": %d,\n", PIPELINE_EXECUTOR_QUEUE_SIZE);
+    json += "  \"results\": [\n";
+    bool first = true;
+    for (const auto& c : cases) {
+        // forcecfrの場合、50フレーム目の前に3フレーム分の欠落、121フレーム目で重複を入れる
+        std::vector<int64_t> pts(c.frames);
+        for (int i = 0; i < c.frames; i++) {
+            pts[i] = (c.forcecfr) ? i + ((i >= 50) ? 3 : 0) - ((i >= 121) ? 1 : 0) : i;
+        }
+        const auto expected = executor_check_expected(c, pts);
+        tstring mes;
+        int outputFrames = 0;
+        for (int i = 0; i < loops && mes.length() == 0; i++) {
+            mes = executor_check_run(c, pts, expected, outputFrames);
+        }
+        if (mes.length() > 0) {
+            errorCount++;
+        }
+        if (!first) {
+            json += ",\n";
+        }
+        first = false;
+        const int expectedFrames = (c.errorAt >= 0) ? std::min(c.errorAt, (int)expected.size()) : (int)expected.size();
+        json += strsprintf("    { \"scenario\": \"%s\", \"frames\": %d, \"output_frames\": %d, \"expected_frames\": %d, \"valid\": %s",
+            c.name, c.frames, outputFrames, expectedFrames, (mes.length() == 0) ? "true" : "false");
+        if (mes.length() > 0) {
+            json += strsprintf(", \"message\": \"%s\"", tchar_to_string(mes).c_str());
+        }
+        json += " }";
+    }
+    json += "\n  ],\n";
+    json += strsprintf("  \"error\": %d\n", errorCount);
+    json += "}\n";
+    return json;
+}
@@ -0,0 +1,101 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2025 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// ------------------------------------------------------------------------------------------
+
+#ifndef __QSV_PIPELINE_EXECUTOR_H__
+#define __QSV_PIPELINE_EXECUTOR_H__
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include "rgy_queue.h"
+#include "qsv_pipeline_ctrl.h"
+
+// ステージ間のキューの長さ
+static const int PIPELINE_EXECUTOR_QUEUE_SIZE = 4;
+
+// PipelineTaskExecutorから呼び出す処理
+// 各taskのsendFrame/getOutputはtaskを担当するステージのスレッドからのみ呼ばれる
+struct PipelineTaskExecutorFuncs {
+    std::function<RGY_ERR(const size_t itask, std::unique_ptr<PipelineTaskOutput>& data)> sendFrame;
+    std::function<std::vector<std::unique_ptr<PipelineTaskOutput>>(const size_t itask)> getOutput;
+    std::function<RGY_ERR(std::unique_ptr<PipelineTaskOutput>& data)> write; // pipelineの最終的なデータを出力 (出力スレッドから呼ばれる)
+    std::function<bool()> checkAbort;      // 中断の確認 (各ステージのスレッドから呼ばれる)
+    std::function<bool()> checkAbortInput; // 入力中の中断の確認 (先頭のステージのスレッドから呼ばれる)
+    std::function<void()> waitInput;       // 入力前の待機 (速度制限用、先頭のステージのスレッドから呼ばれる)
+};
+
+// pipelineのtaskを複数のステージに分割し、ステージごとのスレッドで並列に処理する
+// ステージの分割はtask間の受け渡しで同期が必要な箇所(requireSync)のみで行い、
+// ステージ内ではこれまでと同様に前方のtaskから1フレームずつ処理する
+// ステージ間は固定長のキューで受け渡し、キューが一杯の場合は上流のステージが待機する
+// 最後のステージの出力は、出力スレッドでwriteを行う
+class PipelineTaskExecutor {
+public:
+    PipelineTaskExecutor(std::vector<std::unique_ptr<PipelineTask>>& tasks, std::shared_ptr<RGYLog> log);
+    ~PipelineTaskExecutor();
+
+    // 各ステージの先頭のtaskのindexを返す
+    static std::vector<size_t> splitStages(const std::vector<std::unique_ptr<PipelineTask>>& tasks);
+
+    // 全ステージの処理を行い、終了を待つ
+    RGY_ERR run(PipelineTaskExecutorFuncs& funcs);
+protected:
+    struct PipelineTaskData {
+        size_t task;
+        std::unique_ptr<PipelineTaskOutput> data;
+        PipelineTaskData(size_t t) : task(t), data() {};
+        PipelineTaskData(size_t t, std::unique_ptr<PipelineTaskOutput>& d) : task(t), data(std::move(d)) {};
+    };
+    // nullptrで終端を示す
+    typedef RGYQueueBounded<std::unique_ptr<PipelineTaskOutput>, RGYQueueBoundedMode::SPSC> PipelineTaskQueue;
+
+    RGY_ERR runStage(const size_t istage);
+    RGY_ERR runOutput();
+    bool pushData(PipelineTaskQueue *queue, std::unique_ptr<PipelineTaskOutput>& data);
+    bool popData(PipelineTaskQueue *queue, std::unique_ptr<PipelineTaskOutput>& data);
+    void setError(RGY_ERR err);
+
+    void PrintMes(RGYLogLevel log_level, const TCHAR *format, ...);
+
+    std::vector<std::unique_ptr<PipelineTask>>& m_tasks;
+    std::vector<size_t> m_stageStart;                       // 各ステージの先頭のtask (最後にm_tasks.size())
+    std::vector<std::unique_ptr<PipelineTaskQueue>> m_queues; // m_queues[i]: ステージiの出力 (最後のステージの出力は出力スレッドへ)
+    PipelineTaskExecutorFuncs *m_funcs;
+    std::atomic<bool> m_abort;      // エラー/中断により全スレッドを停止する
+    std::atomic<bool> m_stopInput;  // 後段のtaskから入力の終了が要求された
+    std::atomic<int> m_err;         // 最初に発生したエラー
+    std::shared_ptr<RGYLog> m_log;
+};
+
+// --check-pipeline-executor用
+// CPUのみで処理できるtask(Input/Trim/CheckPTS/OutputRaw)でpipelineを構成してPipelineTaskExecutorで処理し、
+// 出力されたフレームの順序・内容・タイムスタンプを検証する (json形式で返す)
+std::string check_pipeline_executor(const int loops, int& errorCount);
+
+#endif // __QSV_PIPELINE_EXECUTOR_H__
@@ -304,6 +304,7 @@ sInputParams::sInputParams() :
     bGlobalMotionAdjust(false),
     functionMode(QSVFunctionMode::Auto),
     gpuCopy(false),
+    pipelineThread(false),
     nSessionThreads(0),
     nSessionThreadPriority(get_value_from_chr(list_priority, _T("normal"))),
     nVP8Sharpness(0),
@@ -376,6 +376,7 @@ struct sInputParams {
     bool       bGlobalMotionAdjust;
     QSVFunctionMode functionMode;
     bool       gpuCopy;
+    bool       pipelineThread; //pipelineをステージごとのスレッドで処理する
 
     int        nSessionThreads;
     int        nSessionThreadPriority;
@@ -47,6 +47,7 @@
 #include "rgy_err.h"
 #include "rgy_frame_info.h"
 #include "rgy_opencl.h"
+#include "rgy_bitstream_pool.h"
 
 using std::vector;
 using std::unique_ptr;
@@ -303,7 +304,7 @@ public:
 
     void free_mem() {
         if (m_bitstream.Data) {
-            _aligned_free(m_bitstream.Data);
+            RGYBitstreamBufferPool::get().release(m_bitstream.Data);
             m_bitstream.Data = nullptr;
         }
     }
@@ -317,11 +318,12 @@ public:
         free_mem();
 
         if (nSize > 0) {
-            if (nullptr == (m_bitstream.Data = (uint8_t *)_aligned_malloc(nSize, 32))) {
+            size_t capacity = 0;
+            if (nullptr == (m_bitstream.Data = RGYBitstreamBufferPool::get().alloc(nSize, &capacity))) {
                 return RGY_ERR_NULL_PTR;
             }
 
-            m_bitstream.MaxLength = (uint32_t)nSize;
+            m_bitstream.MaxLength = (uint32_t)capacity;
         }
         return RGY_ERR_NONE;
     }
@@ -382,7 +384,8 @@ public:
 
     RGY_ERR resize(size_t nNewSize) {
         if (m_bitstream.MaxLength < nNewSize) {
-            uint8_t *pData = (uint8_t *)_aligned_malloc(nNewSize, 32);
+            size_t capacity = 0;
+            uint8_t *pData = RGYBitstreamBufferPool::get().alloc(nNewSize, &capacity);
             if (pData == nullptr) {
                 return RGY_ERR_NULL_PTR;
             }
@@ -394,7 +397,7 @@ public:
             m_bitstream.Data = pData;
             m_bitstream.DataOffset = 0;
             m_bitstream.DataLength = (uint32_t)nNewSize;
-            m_bitstream.MaxLength = (uint32_t)nNewSize;
+            m_bitstream.MaxLength = (uint32_t)capacity;
             return RGY_ERR_NONE;
         }
         if (m_bitstream.DataLength > 0 && m_bitstream.MaxLength < nNewSize + m_bitstream.DataOffset) {
@@ -412,7 +415,8 @@ public:
     }
 
     RGY_ERR changeSize(size_t nNewSize) {
-        uint8_t *pData = (uint8_t *)_aligned_malloc(nNewSize, 32);
+        size_t capacity = 0;
+        uint8_t *pData = RGYBitstreamBufferPool::get().alloc(nNewSize, &capacity);
         if (pData == nullptr) {
             return RGY_ERR_NULL_PTR;
         }
@@ -426,7 +430,7 @@ public:
         m_bitstream.Data       = pData;
         m_bitstream.DataOffset = 0;
         m_bitstream.DataLength = (uint32_t)nDataLen;
-        m_bitstream.MaxLength  = (uint32_t)nNewSize;
+        m_bitstream.MaxLength  = (uint32_t)capacity;
 
         return RGY_ERR_NONE;
     }
@@ -0,0 +1,359 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2025 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include "rgy_osdep.h"
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <fcntl.h>
+#include <unistd.h>
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+#include "rgy_async_writer.h"
+#include "rgy_trace.h"
+#include "rgy_util.h"
+
+RGYAsyncFileWriter::RGYAsyncFileWriter() :
+    m_fp(nullptr),
+    m_fdDirect(-1),
+    m_buf(),
+    m_bufCapacity(0),
+    m_bufIdx(0),
+    m_bufSize(0),
+    m_bufOffset(0),
+    m_fileSize(0),
+    m_filePos(0),
+    m_preallocated(false),
+    m_thread(),
+    m_mtx(),
+    m_cvSubmit(),
+    m_cvDone(),
+    m_pending({ -1, 0, 0 }),
+    m_stop(false),
+    m_err(RGY_ERR_NONE),
+    m_errno(0),
+    m_statBytes(0),
+    m_statBlocks(0),
+    m_statDirectBytes(0),
+    m_statWriteTime(0),
+    m_statStallTime(0),
+    m_statStallCount(0) {
+    m_buf[0] = nullptr;
+    m_buf[1] = nullptr;
+}
+
+RGYAsyncFileWriter::~RGYAsyncFileWriter() {
+    close();
+}
+
+RGY_ERR RGYAsyncFileWriter::open(const TCHAR *filename, size_t bufSize, bool directIO, int64_t preallocSize) {
+    m_bufCapacity = (std::max(bufSize, (size_t)ALIGN_SIZE) + ALIGN_SIZE - 1) & ~(ALIGN_SIZE - 1);
+    for (auto& buf : m_buf) {
+        if ((buf = (uint8_t *)_aligned_malloc(m_bufCapacity, ALIGN_SIZE)) == nullptr) {
+            return RGY_ERR_MEMORY_ALLOC;
+        }
+    }
+    //"movflags:faststart"にするには、共有モードで開けるようにする必要がある
+    m_fp = _tfsopen(filename, _T("wb"), _SH_DENYWR);
+    if (m_fp == nullptr) {
+        m_errno = errno;
+        return RGY_ERR_FILE_OPEN;
+    }
+    //バッファリングはこちらで行う
+    setvbuf(m_fp, nullptr, _IONBF, 0);
+#if !(defined(_WIN32) || defined(_WIN64))
+    if (preallocSize > 0) {
+        //ファイルサイズは変えずに領域のみ確保する (失敗しても続行する)
+        m_preallocated = fallocate(fileno(m_fp), FALLOC_FL_KEEP_SIZE, 0, preallocSize) == 0;
+    }
+    if (directIO) {
+        //対応していないファイルシステムではopenに失敗するので、その場合は通常の書き込みとする
+        m_fdDirect = ::open(filename, O_WRONLY | O_DIRECT);
+    }
+#else
+    UNREFERENCED_PARAMETER(directIO);
+    UNREFERENCED_PARAMETER(preallocSize);
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+    m_thread = std::thread(&RGYAsyncFileWriter::flushThreadFunc, this);
+    return RGY_ERR_NONE;
+}
+
+void RGYAsyncFileWriter::setError(RGY_ERR err, int errNo) {
+    int expected = RGY_ERR_NONE;
+    if (m_err.compare_exchange_strong(expected, err)) {
+        m_errno = errNo;
+    }
+}
+
+RGY_ERR RGYAsyncFileWriter::writeAt(const uint8_t *ptr, size_t size, int64_t offset) {
+#if defined(_WIN32) || defined(_WIN64)
+    if (m_filePos != offset) {
+        if (_fseeki64(m_fp, offset, SEEK_SET) != 0) {
+            m_filePos = -1;
+            setError(RGY_ERR_UNDEFINED_BEHAVIOR, errno);
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
+        }
+    }
+    const size_t written = _fwrite_nolock(ptr, 1, size, m_fp);
+    m_filePos = offset + written;
+    if (written < size) {
+        setError(RGY_ERR_NOT_ENOUGH_BUFFER, errno);
+        return RGY_ERR_NOT_ENOUGH_BUFFER;
+    }
+#else
+    const int fd = fileno(m_fp);
+    while (size > 0) {
+        const auto ret = pwrite(fd, ptr, size, offset);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            setError(RGY_ERR_NOT_ENOUGH_BUFFER, errno);
+            return RGY_ERR_NOT_ENOUGH_BUFFER;
+        }
+        ptr += ret;
+        size -= ret;
+        offset += ret;
+    }
+#endif
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYAsyncFileWriter::writeBlock(const uint8_t *ptr, size_t size, int64_t offset) {
+#if !(defined(_WIN32) || defined(_WIN64))
+    const int fdDirect = m_fdDirect;
+    //O_DIRECTではファイル位置・サイズ・アドレスともアライメントが必要
+    //バッファの先頭はアライメントされているので、位置が揃っていればアライメントされた部分まではO_DIRECTで書き出す
+    if (fdDirect >= 0 && (offset & (ALIGN_SIZE - 1)) == 0) {
+        const size_t directSize = size & ~(ALIGN_SIZE - 1);
+        size_t done = 0;
+        while (done < directSize) {
+            const auto ret = pwrite(fdDirect, ptr + done, directSize - done, offset + done);
+            if (ret < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ret < 0 && errno == EINVAL) {
+                //アライメント要件が異なるなどで書き込めない場合は、以降は通常の書き込みとする
+                m_fdDirect = -1;
+                ::close(fdDirect);
+                break;
+            }
+            if (ret <= 0 || (ret & (ALIGN_SIZE - 1)) != 0) {
+                setError(RGY_ERR_NOT_ENOUGH_BUFFER, errno);
+                return RGY_ERR_NOT_ENOUGH_BUFFER;
+            }
+            done += ret;
+        }
+        m_statDirectBytes += done;
+        ptr += done;
+        size -= done;
+        offset += done;
+    }
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+    return (size > 0) ? writeAt(ptr, size, offset) : RGY_ERR_NONE;
+}
+
+void RGYAsyncFileWriter::flushThreadFunc() {
+    RGYTrace::setThreadName("output flush");
+    std::unique_lock<std::mutex> lock(m_mtx);
+    for (;;) {
+        m_cvSubmit.wait(lock, [this]() { return m_pending.idx >= 0 || m_stop; });
+        if (m_pending.idx < 0) {
+            break; // m_stop
+        }
+        const auto block = m_pending;
+        lock.unlock();
+        if (m_err == RGY_ERR_NONE) {
+            RGYTraceScope trace("output flush");
+            const auto start = RGYTrace::now();
+            if (writeBlock(m_buf[block.idx], block.size, block.offset) == RGY_ERR_NONE) {
+                m_statBytes += block.size;
+                m_statBlocks++;
+            }
+            m_statWriteTime += RGYTrace::now() - start;
+        }
+        lock.lock();
+        m_pending.idx = -1;
+        m_cvDone.notify_all();
+    }
+}
+
+void RGYAsyncFileWriter::waitIdle() {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    if (m_pending.idx >= 0) {
+        const auto start = RGYTrace::now();
+        m_cvDone.wait(lock, [this]() { return m_pending.idx < 0; });
+        m_statStallTime += RGYTrace::now() - start;
+        m_statStallCount++;
+    }
+}
+
+void RGYAsyncFileWriter::submit() {
+    if (m_bufSize == 0) {
+        return;
+    }
+    //書き込みスレッドが前のブロックを書き出し終わるまで待つ
+    waitIdle();
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_pending.idx = m_bufIdx;
+        m_pending.size = m_bufSize;
+        m_pending.offset = m_bufOffset;
+    }
+    m_cvSubmit.notify_one();
+    m_bufOffset += m_bufSize;
+    m_fileSize = std::max(m_fileSize, m_bufOffset);
+    m_bufSize = 0;
+    m_bufIdx ^= 1;
+}
+
+int RGYAsyncFileWriter::write(const uint8_t *buf, int size) {
+    if (m_fp == nullptr || m_err != RGY_ERR_NONE) {
+        return -1;
+    }
+    for (int remain = size; remain > 0; ) {
+        //seekでアライメントがずれた場合は、次のバッファの先頭がアライメントされるよう区切る
+        const size_t limit = m_bufCapacity - (size_t)(m_bufOffset & (ALIGN_SIZE - 1));
+        const size_t copySize = std::min<size_t>(remain, limit - m_bufSize);
+        memcpy(m_buf[m_bufIdx] + m_bufSize, buf, copySize);
+        m_bufSize += copySize;
+        buf += copySize;
+        remain -= (int)copySize;
+        if (m_bufSize >= limit) {
+            submit();
+        }
+    }
+    return (m_err != RGY_ERR_NONE) ? -1 : size;
+}
+
+int64_t RGYAsyncFileWriter::seek(int64_t offset, int whence) {
+    if (m_fp == nullptr) {
+        return -1;
+    }
+    const int64_t pos = m_bufOffset + (int64_t)m_bufSize;
+    int64_t newPos = -1;
+    switch (whence) {
+    case SEEK_SET: newPos = offset; break;
+    case SEEK_CUR: newPos = pos + offset; break;
+    case SEEK_END: newPos = std::max(m_fileSize, pos) + offset; break;
+    default: return -1;
+    }
+    if (newPos < 0) {
+        return -1;
+    }
+    if (newPos != pos) {
+        //書き込みスレッドは投入順に書き出すので、ここで書き出しを待つ必要はない
+        submit();
+        m_bufOffset = newPos;
+    }
+    return newPos;
+}
+
+int RGYAsyncFileWriter::read(uint8_t *buf, int size) {
+    if (m_fp == nullptr) {
+        return -1;
+    }
+    submit();
+    waitIdle();
+#if defined(_WIN32) || defined(_WIN64)
+    if (_fseeki64(m_fp, m_bufOffset, SEEK_SET) != 0) {
+        m_filePos = -1;
+        return -1;
+    }
+    const int ret = (int)_fread_nolock(buf, 1, size, m_fp);
+    m_filePos = -1;
+#else
+    const int ret = (int)pread(fileno(m_fp), buf, size, m_bufOffset);
+#endif
+    if (ret > 0) {
+        m_bufOffset += ret;
+    }
+    return ret;
+}
+
+RGY_ERR RGYAsyncFileWriter::close() {
+    if (m_thread.joinable()) {
+        submit();
+        waitIdle();
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            m_stop = true;
+        }
+        m_cvSubmit.notify_one();
+        m_thread.join();
+    }
+    const int fdDirect = m_fdDirect.exchange(-1);
+    if (fdDirect >= 0) {
+#if !(defined(_WIN32) || defined(_WIN64))
+        ::close(fdDirect);
+#endif
+    }
+    if (m_fp) {
+#if !(defined(_WIN32) || defined(_WIN64))
+        if (m_preallocated) {
+            //FALLOC_FL_KEEP_SIZEで確保した領域はファイルサイズを超えても残るので、実際に書き込んだ大きさで切り詰めて解放する
+            if (ftruncate(fileno(m_fp), m_fileSize) != 0) {
+                setError(RGY_ERR_UNDEFINED_BEHAVIOR, errno);
+            }
+            m_preallocated = false;
+        }
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+        if (fclose(m_fp) != 0) {
+            setError(RGY_ERR_UNDEFINED_BEHAVIOR, errno);
+        }
+        m_fp = nullptr;
+    }
+    for (auto& buf : m_buf) {
+        if (buf) {
+            _aligned_free(buf);
+            buf = nullptr;
+        }
+    }
+    return error();
+}
+
+RGYAsyncFileWriter::Stats RGYAsyncFileWriter::stats() const {
+    Stats stats;
+    stats.bytes = m_statBytes;
+    stats.blocks = m_statBlocks;
+    stats.directBytes = m_statDirectBytes;
+    stats.writeTime = m_statWriteTime;
+    stats.stallTime = m_statStallTime;
+    stats.stallCount = m_statStallCount;
+    return stats;
+}
+
+tstring RGYAsyncFileWriter::statsStr() const {
+    const auto s = stats();
+    tstring str = strsprintf(_T("async write: %.1f MB in %lld blocks, write %.2fs, stall %.2fs (%lld times)"),
+        s.bytes / (double)(1024 * 1024), (long long)s.blocks,
+        s.writeTime * 1e-9, s.stallTime * 1e-9, (long long)s.stallCount);
+    if (s.directBytes > 0) {
+        str += strsprintf(_T(", direct %.1f%%"), s.directBytes * 100.0 / (double)s.bytes);
+    }
+    return str;
+}
@@ -0,0 +1,123 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2025 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_ASYNC_WRITER_H__
+#define __RGY_ASYNC_WRITER_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "rgy_err.h"
+#include "rgy_tchar.h"
+
+// 出力ファイルへの書き込みを専用のスレッドで行う
+// 2つのバッファを交互に使用し、一方を書き込みスレッドが書き出している間に、もう一方へ書き込みデータをためる
+// 書き込みスレッドの処理が追いつかず、呼び出し元が待機した時間をストール時間として記録する
+// write/seek/read/closeは同一のスレッドから呼ぶこと
+class RGYAsyncFileWriter {
+public:
+    static const size_t ALIGN_SIZE = 4096; // バッファのアライメント (O_DIRECT用)
+
+    struct Stats {
+        uint64_t bytes;      // 書き出したバイト数
+        uint64_t blocks;     // 書き出したブロック数
+        uint64_t directBytes; // O_DIRECTで書き出したバイト数
+        int64_t writeTime;   // 書き込みスレッドの書き出しにかかった時間 (ns)
+        int64_t stallTime;   // 呼び出し元が書き込みスレッドを待った時間 (ns)
+        int64_t stallCount;  // 呼び出し元が書き込みスレッドを待った回数
+    };
+
+    RGYAsyncFileWriter();
+    ~RGYAsyncFileWriter();
+
+    // ファイルを開き、書き込みスレッドを開始する
+    // bufSize     : バッファ1つあたりのサイズ (ALIGN_SIZEの倍数に切り上げる)
+    // directIO    : O_DIRECTでの書き出しを試みる (Linuxのみ)
+    // preallocSize: ファイルの領域をあらかじめ確保する (Linuxのみ、0なら行わない)
+    RGY_ERR open(const TCHAR *filename, size_t bufSize, bool directIO, int64_t preallocSize);
+    // バッファに書き込み、書き込んだバイト数を返す (エラー時は-1)
+    int write(const uint8_t *buf, int size);
+    // 書き込み位置を変更する (AVSEEK_SIZEは非対応)
+    int64_t seek(int64_t offset, int whence);
+    // 書き込み済みのデータをすべて書き出したうえで、現在位置から読み込む
+    int read(uint8_t *buf, int size);
+    // 書き込み済みのデータをすべて書き出し、ファイルを閉じる
+    RGY_ERR close();
+
+    bool isOpen() const { return m_fp != nullptr; }
+    bool directIOEnabled() const { return m_fdDirect >= 0; }
+    size_t bufSize() const { return m_bufCapacity; }
+    RGY_ERR error() const { return (RGY_ERR)m_err.load(); }
+    int errorNo() const { return m_errno; }
+    Stats stats() const;
+    tstring statsStr() const;
+protected:
+    struct Block {
+        int idx;         // バッファのindex (-1なら無し)
+        size_t size;     // データサイズ
+        int64_t offset;  // 書き出し先のファイル位置
+    };
+    void submit();
+    void waitIdle();
+    void flushThreadFunc();
+    RGY_ERR writeBlock(const uint8_t *ptr, size_t size, int64_t offset);
+    RGY_ERR writeAt(const uint8_t *ptr, size_t size, int64_t offset);
+    void setError(RGY_ERR err, int errNo);
+
+    FILE *m_fp;
+    std::atomic<int> m_fdDirect;  // O_DIRECTで開いたファイルディスクリプタ (-1なら無効)
+    uint8_t *m_buf[2];
+    size_t m_bufCapacity;
+    int m_bufIdx;                 // 呼び出し元が書き込み中のバッファ
+    size_t m_bufSize;             // 呼び出し元が書き込み中のバッファのデータサイズ
+    int64_t m_bufOffset;          // 呼び出し元が書き込み中のバッファの先頭のファイル位置
+    int64_t m_fileSize;           // 書き込み済みのファイルの大きさ
+    int64_t m_filePos;            // 書き込みスレッド側のファイルポインタの位置 (-1なら不明)
+    bool m_preallocated;          // fallocateで領域を確保したか (closeで確保しすぎた分を切り詰める)
+
+    std::thread m_thread;
+    std::mutex m_mtx;
+    std::condition_variable m_cvSubmit;  // ブロックの投入を書き込みスレッドへ通知
+    std::condition_variable m_cvDone;    // ブロックの書き出し完了を呼び出し元へ通知
+    Block m_pending;                     // 書き込みスレッドへ渡したブロック
+    bool m_stop;
+    std::atomic<int> m_err;
+    std::atomic<int> m_errno;
+
+    std::atomic<uint64_t> m_statBytes;
+    std::atomic<uint64_t> m_statBlocks;
+    std::atomic<uint64_t> m_statDirectBytes;
+    std::atomic<int64_t> m_statWriteTime;
+    int64_t m_statStallTime;
+    int64_t m_statStallCount;
+};
+
+#endif //__RGY_ASYNC_WRITER_H__
@@ -0,0 +1,732 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2025 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+
+#include <queue>
+#include <thread>
+#include <future>
+#include <chrono>
+#include <limits>
+#include <random>
+#include <fstream>
+#include "rgy_bench.h"
+#include "rgy_thread_pool.h"
+#include "rgy_queue.h"
+#include "rgy_bitstream.h"
+#include "rgy_util.h"
+#include "cpu_info.h"
+
+//1回の計測は、最低でもこの回数・時間だけ繰り返し、最小の処理時間をとる
+static const int BENCH_MIN_LOOP = 3;
+static const double BENCH_MIN_SEC = 0.1;
+
+template<typename Func>
+static double bench_min_sec(Func func) {
+    double minSec = std::numeric_limits<double>::max();
+    const auto benchStart = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < BENCH_MIN_LOOP
+        || std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - benchStart).count() < BENCH_MIN_SEC; i++) {
+        const auto start = std::chrono::high_resolution_clock::now();
+        func();
+        const auto fin = std::chrono::high_resolution_clock::now();
+        minSec = std::min(minSec, std::chrono::duration<double>(fin - start).count());
+    }
+    return minSec;
+}
+
+static std::string bench_cpu_name() {
+    char cpuName[256] = { 0 };
+    getCPUName(cpuName, _countof(cpuName));
+    return cpuName;
+}
+
+// 比較用: 変更前のRGYThreadPool (単一のstd::queueを1つのmutexで保護し、タスクごとにmake_shared<packaged_task>とstd::bindを行う)
+class RGYThreadPoolLegacy {
+public:
+    // 変更前の実装にはsubmitがないので、同じ単一キューにfutureを作らず投入し、完了数で待つものを比較用に用意する
+    class TaskGroup {
+    public:
+        TaskGroup() : remain(0), mtx(), cv() {};
+        void add(int n) { remain.fetch_add(n); }
+        void done() {
+            std::lock_guard<std::mutex> lock(mtx);
+            if (remain.fetch_sub(1) == 1) {
+                cv.notify_all();
+            }
+        }
+        void wait() {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this]() { return remain.load() == 0; });
+        }
+    private:
+        std::atomic<int> remain;
+        std::mutex mtx;
+        std::condition_variable cv;
+    };
+    RGYThreadPoolLegacy(int num_threads) {
+        num_threads = std::max(num_threads, 1);
+        for (int i = 0; i < num_threads; i++) {
+            workers.emplace_back([this] {
+                while (true) {
+                    std::function<void()> task;
+                    {
+                        std::unique_lock<std::mutex> lock(queue_mutex);
+                        condition.wait(lock, [this] {
+                            return stop || !tasks.empty();
+                        });
+                        if (stop && tasks.empty()) {
+                            return;
+                        }
+                        task = std::move(tasks.front());
+                        tasks.pop();
+                    }
+                    task();
+                }
+            });
+        }
+    }
+    template<class F, class... Args>
+    auto enqueue(F&& f, Args&&... args)
+        -> std::future<typename std::invoke_result<F, Args...>::type> {
+        using return_type = typename std::invoke_result<F, Args...>::type;
+        auto task = std::make_shared<std::packaged_task<return_type()>>(
+            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
+        );
+        std::future<return_type> res = task->get_future();
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            tasks.emplace([task]() { (*task)(); });
+        }
+        condition.notify_one();
+        return res;
+    }
+    template<class F>
+    void submit(F&& f, TaskGroup *group) {
+        group->add(1);
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            tasks.emplace([func = typename std::decay<F>::type(std::forward<F>(f)), group]() { func(); group->done(); });
+        }
+        condition.notify_one();
+    }
+    void wait(TaskGroup& group) {
+        group.wait();
+    }
+    ~RGYThreadPoolLegacy() {
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            stop = true;
+        }
+        condition.notify_all();
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+    }
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queue_mutex;
+    std::condition_variable condition;
+    bool stop = false;
+};
+
+static const int THREAD_POOL_BENCH_TASKS = 100000; // 1回の計測で投入するタスク数
+static const int THREAD_POOL_BENCH_WORK = 64;      // 1タスクあたりの処理量 (スケジューラのオーバーヘッドが見えるよう小さくする)
+
+static uint32_t thread_pool_bench_work(uint32_t x) {
+    for (int i = 0; i < THREAD_POOL_BENCH_WORK; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+    }
+    return x;
+}
+
+static uint32_t thread_pool_bench_expected() {
+    uint32_t sum = 0;
+    for (int i = 0; i < THREAD_POOL_BENCH_TASKS; i++) {
+        sum ^= thread_pool_bench_work((uint32_t)i + 1);
+    }
+    return sum;
+}
+
+// 1つのスレッドからenqueueし、futureで結果を受け取る
+template<typename Pool>
+static uint32_t thread_pool_bench_enqueue(Pool& pool, int taskStart, int taskEnd) {
+    std::vector<std::future<uint32_t>> futures;
+    futures.reserve(taskEnd - taskStart);
+    for (int i = taskStart; i < taskEnd; i++) {
+        futures.push_back(pool.enqueue(thread_pool_bench_work, (uint32_t)i + 1));
+    }
+    uint32_t sum = 0;
+    for (auto& f : futures) {
+        sum ^= f.get();
+    }
+    return sum;
+}
+
+// producers個のスレッドから同時にenqueueする
+template<typename Pool>
+static uint32_t thread_pool_bench_multi_producer(Pool& pool, int producers) {
+    std::vector<std::future<uint32_t>> results;
+    std::vector<std::thread> threads;
+    for (int ip = 0; ip < producers; ip++) {
+        std::packaged_task<uint32_t()> task([&pool, ip, producers]() {
+            return thread_pool_bench_enqueue(pool, THREAD_POOL_BENCH_TASKS * ip / producers, THREAD_POOL_BENCH_TASKS * (ip + 1) / producers);
+        });
+        results.push_back(task.get_future());
+        threads.emplace_back(std::move(task));
+    }
+    uint32_t sum = 0;
+    for (int ip = 0; ip < producers; ip++) {
+        threads[ip].join();
+        sum ^= results[ip].get();
+    }
+    return sum;
+}
+
+// futureを使わず、1タスクずつsubmitしてgroupで待つ
+template<typename Pool, typename Group>
+static uint32_t thread_pool_bench_submit(Pool& pool) {
+    std::atomic<uint32_t> sum(0);
+    Group group;
+    for (int i = 0; i < THREAD_POOL_BENCH_TASKS; i++) {
+        pool.submit([&sum, i]() { sum.fetch_xor(thread_pool_bench_work((uint32_t)i + 1), std::memory_order_relaxed); }, &group);
+    }
+    pool.wait(group);
+    return sum.load();
+}
+
+// futureを使わず、submit_batchでまとめて投入してgroupで待つ
+static uint32_t thread_pool_bench_batch(RGYThreadPool& pool) {
+    std::atomic<uint32_t> sum(0);
+    std::vector<std::function<void()>> funcs;
+    funcs.reserve(THREAD_POOL_BENCH_TASKS);
+    for (int i = 0; i < THREAD_POOL_BENCH_TASKS; i++) {
+        funcs.push_back([&sum, i]() { sum.fetch_xor(thread_pool_bench_work((uint32_t)i + 1), std::memory_order_relaxed); });
+    }
+    RGYThreadPoolTaskGroup group;
+    pool.submit_batch(funcs, &group);
+    pool.wait(group);
+    return sum.load();
+}
+
+// 行の範囲をparallel_forで分割する (変更前の実装では、範囲ごとにenqueueしてfutureで待つ)
+static uint32_t thread_pool_bench_parallel_for(RGYThreadPool& pool) {
+    std::atomic<uint32_t> sum(0);
+    pool.parallel_for(0, THREAD_POOL_BENCH_TASKS, 1, [&sum](int start, int end) {
+        uint32_t local = 0;
+        for (int i = start; i < end; i++) {
+            local ^= thread_pool_bench_work((uint32_t)i + 1);
+        }
+        sum.fetch_xor(local, std::memory_order_relaxed);
+    });
+    return sum.load();
+}
+
+std::string benchmark_thread_pool(const std::vector<int>& threads) {
+    const uint32_t expected = thread_pool_bench_expected();
+    std::string json = "{\n";
+    json += strsprintf("  \"cpu\": \"%s\",\n", bench_cpu_name().c_str());
+    json += strsprintf("  \"tasks\": %d,\n", THREAD_POOL_BENCH_TASKS);
+    std::vector<std::string> results;      // 同じAPIで変更前後を比較した結果
+    std::vector<std::string> batchResults; // 変更前にはないまとめて投入するAPIの結果 (変更後のsubmitと比較)
+    int errorCount = 0;
+    for (const auto th : threads) {
+        if (th <= 0) {
+            continue;
+        }
+        RGYThreadPoolLegacy legacy(th);
+        RGYThreadPool pool(th);
+        struct BenchScenario {
+            const char *name;
+            std::function<uint32_t()> legacy;
+            std::function<uint32_t()> current;
+        };
+        //スケジューラ自体の比較となるよう、変更前後で同じAPIを使う
+        const BenchScenario scenarios[] = {
+            { "enqueue",        [&]() { return thread_pool_bench_enqueue(legacy, 0, THREAD_POOL_BENCH_TASKS); },
+                                [&]() { return thread_pool_bench_enqueue(pool,   0, THREAD_POOL_BENCH_TASKS); } },
+            { "multi_producer", [&]() { return thread_pool_bench_multi_producer(legacy, th); },
+                                [&]() { return thread_pool_bench_multi_producer(pool,   th); } },
+            { "submit",         [&]() { return thread_pool_bench_submit<RGYThreadPoolLegacy, RGYThreadPoolLegacy::TaskGroup>(legacy); },
+                                [&]() { return thread_pool_bench_submit<RGYThreadPool, RGYThreadPoolTaskGroup>(pool); } },
+        };
+        for (const auto& scenario : scenarios) {
+            bool valid = true;
+            const double legacySec = bench_min_sec([&]() { valid &= scenario.legacy() == expected; });
+            const double currentSec = bench_min_sec([&]() { valid &= scenario.current() == expected; });
+            if (!valid) {
+                errorCount++;
+            }
+            results.push_back(strsprintf("    { \"scenario\": \"%s\", \"threads\": %d, \"legacy_tasks_per_sec\": %.0f, \"tasks_per_sec\": %.0f, \"speedup\": %.3f, \"valid\": %s }",
+                scenario.name, th,
+                THREAD_POOL_BENCH_TASKS / legacySec, THREAD_POOL_BENCH_TASKS / currentSec, legacySec / currentSec,
+                valid ? "true" : "false"));
+        }
+        //まとめて投入するAPIは変更前にはないので、変更後の1タスクずつのsubmitに対する比で別に示す
+        bool submitValid = true;
+        const double submitSec = bench_min_sec([&]() { submitValid &= thread_pool_bench_submit<RGYThreadPool, RGYThreadPoolTaskGroup>(pool) == expected; });
+        const BenchScenario batchScenarios[] = {
+            { "submit_batch", nullptr, [&]() { return thread_pool_bench_batch(pool); } },
+            { "parallel_for", nullptr, [&]() { return thread_pool_bench_parallel_for(pool); } },
+        };
+        for (const auto& scenario : batchScenarios) {
+            bool valid = submitValid;
+            const double currentSec = bench_min_sec([&]() { valid &= scenario.current() == expected; });
+            if (!valid) {
+                errorCount++;
+            }
+            batchResults.push_back(strsprintf("    { \"scenario\": \"%s\", \"threads\": %d, \"submit_tasks_per_sec\": %.0f, \"tasks_per_sec\": %.0f, \"speedup_vs_submit\": %.3f, \"valid\": %s }",
+                scenario.name, th,
+                THREAD_POOL_BENCH_TASKS / submitSec, THREAD_POOL_BENCH_TASKS / currentSec, submitSec / currentSec,
+                valid ? "true" : "false"));
+        }
+    }
+    json += "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        json += results[i] + ((i + 1 < results.size()) ? ",\n" : "\n");
+    }
+    json += "  ],\n";
+    json += "  \"batch_results\": [\n";
+    for (size_t i = 0; i < batchResults.size(); i++) {
+        json += batchResults[i] + ((i + 1 < batchResults.size()) ? ",\n" : "\n");
+    }
+    json += "  ],\n";
+    json += strsprintf("  \"error\": %d\n", errorCount);
+    json += "}\n";
+    return json;
+}
+
+static const int QUEUE_BENCH_ITEMS = 200000;  // 1回の計測で受け渡すデータ数
+static const int QUEUE_BENCH_CAPACITY = 1024; // キューの最大サイズ
+
+struct QueueBenchItem {
+    int64_t pushTime; //push時刻 (ns)、0なら終了の通知
+};
+
+static int64_t queue_bench_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct QueueBenchResult {
+    double itemsPerSec;
+    double latencyAvgUs;
+    double latencyP99Us;
+    bool valid;
+};
+
+// 比較用: これまでの使い方と同様に、取り出せなければwait_for_pushで待機する
+class QueueBenchMPMP {
+public:
+    QueueBenchMPMP() : m_queue() { m_queue.init(QUEUE_BENCH_CAPACITY, QUEUE_BENCH_CAPACITY); }
+    void push(const QueueBenchItem& item) { m_queue.push(item); }
+    void pop(QueueBenchItem *item) {
+        while (!m_queue.front_copy_and_pop_no_lock(item)) {
+            m_queue.wait_for_push();
+        }
+    }
+private:
+    RGYQueueMPMP<QueueBenchItem, 64> m_queue;
+};
+
+template<RGYQueueBoundedMode mode>
+class QueueBenchBounded {
+public:
+    QueueBenchBounded() : m_queue() { m_queue.init(QUEUE_BENCH_CAPACITY); }
+    void push(const QueueBenchItem& item) { m_queue.push(item); }
+    void pop(QueueBenchItem *item) { m_queue.pop(item); }
+private:
+    RGYQueueBounded<QueueBenchItem, mode> m_queue;
+};
+
+// producers個のスレッドからpushし、consumers個のスレッドでpopする
+template<typename Queue>
+static QueueBenchResult queue_bench_run(int producers, int consumers) {
+    Queue queue;
+    std::vector<std::vector<int64_t>> latency(consumers);
+    std::vector<std::thread> threads;
+    const auto start = std::chrono::steady_clock::now();
+    for (int ic = 0; ic < consumers; ic++) {
+        latency[ic].reserve(QUEUE_BENCH_ITEMS / consumers * 2);
+        threads.emplace_back([&queue, &lat = latency[ic]]() {
+            for (;;) {
+                QueueBenchItem item;
+                queue.pop(&item);
+                if (item.pushTime == 0) {
+                    break;
+                }
+                lat.push_back(queue_bench_now() - item.pushTime);
+            }
+        });
+    }
+    std::vector<std::thread> producerThreads;
+    for (int ip = 0; ip < producers; ip++) {
+        const int count = QUEUE_BENCH_ITEMS * (ip + 1) / producers - QUEUE_BENCH_ITEMS * ip / producers;
+        producerThreads.emplace_back([&queue, count]() {
+            for (int i = 0; i < count; i++) {
+                queue.push(QueueBenchItem{ queue_bench_now() });
+            }
+        });
+    }
+    for (auto& th : producerThreads) {
+        th.join();
+    }
+    for (int ic = 0; ic < consumers; ic++) {
+        queue.push(QueueBenchItem{ 0 });
+    }
+    for (auto& th : threads) {
+        th.join();
+    }
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<int64_t> all;
+    for (const auto& lat : latency) {
+        all.insert(all.end(), lat.begin(), lat.end());
+    }
+    QueueBenchResult result = { 0.0, 0.0, 0.0, all.size() == (size_t)QUEUE_BENCH_ITEMS };
+    if (all.size() > 0) {
+        std::sort(all.begin(), all.end());
+        double sum = 0.0;
+        for (const auto v : all) sum += (double)v;
+        result.latencyAvgUs = sum / all.size() * 1e-3;
+        result.latencyP99Us = all[std::min(all.size() - 1, all.size() * 99 / 100)] * 1e-3;
+    }
+    result.itemsPerSec = QUEUE_BENCH_ITEMS / sec;
+    return result;
+}
+
+// 最もスループットの高かった回の結果をとる
+template<typename Queue>
+static QueueBenchResult queue_bench_best(int producers, int consumers) {
+    QueueBenchResult best = { 0.0, 0.0, 0.0, true };
+    const auto benchStart = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < BENCH_MIN_LOOP
+        || std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - benchStart).count() < BENCH_MIN_SEC; i++) {
+        const auto result = queue_bench_run<Queue>(producers, consumers);
+        const bool valid = best.valid && result.valid;
+        if (result.itemsPerSec > best.itemsPerSec) {
+            best = result;
+        }
+        best.valid = valid;
+    }
+    return best;
+}
+
+static std::string queue_bench_json(const char *scenario, const char *queue, int producers, int consumers, const QueueBenchResult& result) {
+    return strsprintf("    { \"scenario\": \"%s\", \"queue\": \"%s\", \"producers\": %d, \"consumers\": %d, \"items_per_sec\": %.0f, \"latency_avg_us\": %.3f, \"latency_p99_us\": %.3f, \"valid\": %s }",
+        scenario, queue, producers, consumers, result.itemsPerSec, result.latencyAvgUs, result.latencyP99Us, result.valid ? "true" : "false");
+}
+
+std::string benchmark_queue(const std::vector<int>& threads) {
+    std::string json = "{\n";
+    json += strsprintf("  \"cpu\": \"%s\",\n", bench_cpu_name().c_str());
+    json += strsprintf("  \"items\": %d,\n", QUEUE_BENCH_ITEMS);
+    json += strsprintf("  \"capacity\": %d,\n", QUEUE_BENCH_CAPACITY);
+    json += "  \"results\": [\n";
+    std::vector<std::string> results;
+    int errorCount = 0;
+    auto add = [&](const char *scenario, const char *queue, int producers, int consumers, const QueueBenchResult& result) {
+        results.push_back(queue_bench_json(scenario, queue, producers, consumers, result));
+        if (!result.valid) errorCount++;
+    };
+    //1対1 (デマルチプレクサ→エンコーダなどの受け渡し)
+    add("spsc", "RGYQueueMPMP",          1, 1, queue_bench_best<QueueBenchMPMP>(1, 1));
+    add("spsc", "RGYQueueBounded<SPSC>", 1, 1, queue_bench_best<QueueBenchBounded<RGYQueueBoundedMode::SPSC>>(1, 1));
+    add("spsc", "RGYQueueBounded<MPMC>", 1, 1, queue_bench_best<QueueBenchBounded<RGYQueueBoundedMode::MPMC>>(1, 1));
+    for (const auto th : threads) {
+        if (th <= 0) {
+            continue;
+        }
+        //複数スレッドから1スレッドへ (音声処理タスク→muxスレッドなど)
+        add("mpsc", "RGYQueueMPMP",          th, 1, queue_bench_best<QueueBenchMPMP>(th, 1));
+        add("mpsc", "RGYQueueBounded<MPMC>", th, 1, queue_bench_best<QueueBenchBounded<RGYQueueBoundedMode::MPMC>>(th, 1));
+        //複数スレッドから複数スレッドへ
+        add("mpmc", "RGYQueueMPMP",          th, th, queue_bench_best<QueueBenchMPMP>(th, th));
+        add("mpmc", "RGYQueueBounded<MPMC>", th, th, queue_bench_best<QueueBenchBounded<RGYQueueBoundedMode::MPMC>>(th, th));
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+        json += results[i] + ((i + 1 < results.size()) ? ",\n" : "\n");
+    }
+    json += "  ],\n";
+    json += strsprintf("  \"error\": %d\n", errorCount);
+    json += "}\n";
+    return json;
+}
+
+static const size_t NAL_BENCH_STREAM_SIZE = 16 * 1024 * 1024; // 生成するストリームの大きさ
+static const int NAL_BENCH_GOP_LEN = 30;                       // 生成するストリームのキーフレームの間隔
+
+static const char *nal_bench_codec_name(const RGY_CODEC codec) {
+    switch (codec) {
+    case RGY_CODEC_H264: return "h264";
+    case RGY_CODEC_HEVC: return "hevc";
+    case RGY_CODEC_AV1:  return "av1";
+    default:             return "unknown";
+    }
+}
+
+// 乱数のペイロードを追加する (0が続くところにはemulation prevention byteを入れ、start codeが現れないようにする)
+static void nal_bench_add_payload(std::vector<uint8_t>& data, std::mt19937& rnd, const size_t size) {
+    int zeros = 0;
+    for (size_t i = 0; i + 1 < size; i++) {
+        // 0を多めに含め、start codeの候補となる箇所が適度に現れるようにする
+        uint8_t byte = (rnd() % 16 == 0) ? 0 : (uint8_t)rnd();
+        if (zeros >= 2 && byte <= 3) {
+            data.push_back(0x03);
+            zeros = 0;
+        }
+        data.push_back(byte);
+        zeros = (byte == 0) ? zeros + 1 : 0;
+    }
+    data.push_back(0x80); // rbsp_stop_one_bit
+}
+
+// AnnexB形式のH.264/HEVCのストリームを生成する
+static std::vector<uint8_t> nal_bench_gen_annexb(const RGY_CODEC codec) {
+    std::mt19937 rnd(1234);
+    std::vector<uint8_t> data;
+    data.reserve(NAL_BENCH_STREAM_SIZE + 256 * 1024);
+    struct NalGen {
+        uint8_t type;
+        size_t size;
+    };
+    for (int frame = 0; data.size() < NAL_BENCH_STREAM_SIZE; frame++) {
+        const bool key = (frame % NAL_BENCH_GOP_LEN) == 0;
+        const size_t sliceSize = (key) ? 60000 + rnd() % 40000 : 2000 + rnd() % 28000;
+        std::vector<NalGen> nals;
+        if (codec == RGY_CODEC_H264) {
+            nals.push_back({ NALU_H264_AUD, 2 });
+            if (key) {
+                nals.push_back({ NALU_H264_SPS, 20 });
+                nals.push_back({ NALU_H264_PPS, 6 });
+                nals.push_back({ NALU_H264_SEI, 30 });
+            }
+            nals.push_back({ (uint8_t)((key) ? NALU_H264_IDR : NALU_H264_NONIDR), sliceSize });
+        } else {
+            nals.push_back({ NALU_HEVC_AUD, 3 });
+            if (key) {
+                nals.push_back({ NALU_HEVC_VPS, 24 });
+                nals.push_back({ NALU_HEVC_SPS, 40 });
+                nals.push_back({ NALU_HEVC_PPS, 8 });
+                nals.push_back({ NALU_HEVC_PREFIX_SEI, 30 });
+            }
+            nals.push_back({ (uint8_t)((key) ? NALU_HEVC_SLICE_IDR_W_RADL : 1 /*TRAIL_R*/), sliceSize });
+        }
+        for (size_t i = 0; i < nals.size(); i++) {
+            // アクセスユニットの先頭とパラメータセットは4byte、それ以外は3byteのstart code
+            if (i == 0 || nals[i].size < 64) {
+                data.push_back(0);
+            }
+            data.push_back(0);
+            data.push_back(0);
+            data.push_back(1);
+            if (codec == RGY_CODEC_H264) {
+                data.push_back((uint8_t)((3 << 5) | nals[i].type));
+            } else {
+                data.push_back((uint8_t)(nals[i].type << 1));
+                data.push_back((uint8_t)((key) ? 1 : 1 + frame % 3)); // nuh_temporal_id_plus1
+            }
+            nal_bench_add_payload(data, rnd, nals[i].size);
+        }
+    }
+    return data;
+}
+
+static void nal_bench_add_leb128(std::vector<uint8_t>& data, size_t value) {
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        if (value) {
+            byte |= 0x80;
+        }
+        data.push_back(byte);
+    } while (value);
+}
+
+// AV1のOBUのストリーム (low overhead bitstream format) を生成する
+static std::vector<uint8_t> nal_bench_gen_av1() {
+    std::mt19937 rnd(1234);
+    std::vector<uint8_t> data;
+    data.reserve(NAL_BENCH_STREAM_SIZE + 256 * 1024);
+    auto addObu = [&](const uint8_t type, const int temporalId, const size_t size) {
+        const bool extension = temporalId >= 0;
+        data.push_back((uint8_t)((type << 3) | ((extension) ? 0x04 : 0) | 0x02));
+        if (extension) {
+            data.push_back((uint8_t)(temporalId << 5));
+        }
+        nal_bench_add_leb128(data, size);
+        for (size_t i = 0; i < size; i++) {
+            data.push_back((uint8_t)rnd());
+        }
+    };
+    for (int frame = 0; data.size() < NAL_BENCH_STREAM_SIZE; frame++) {
+        const bool key = (frame % NAL_BENCH_GOP_LEN) == 0;
+        addObu(OBU_TEMPORAL_DELIMITER, -1, 0);
+        if (key) {
+            addObu(OBU_SEQUENCE_HEADER, -1, 12);
+        }
+        // キーフレーム以外はtemporal layerを付与する (OBUヘッダの拡張の解析も確認する)
+        addObu(OBU_FRAME, (key) ? -1 : frame % 3, (key) ? 60000 + rnd() % 40000 : 2000 + rnd() % 28000);
+    }
+    return data;
+}
+
+static bool nal_bench_read_file(const tstring& filename, std::vector<uint8_t>& data) {
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs.good()) {
+        return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    return data.size() > 0;
+}
+
+// RGYNalUnitReaderの結果がparse_nal_unit_xxxと一致するか
+static bool nal_bench_check_nal(const std::vector<nal_info>& list, const RGY_CODEC codec, const uint8_t *data, const size_t size) {
+    RGYNalUnitReader reader(codec, data, size);
+    nal_info nal = { 0 };
+    size_t count = 0;
+    while (reader.next(nal)) {
+        if (count >= list.size()) {
+            return false;
+        }
+        const auto& ref = list[count++];
+        if (nal.ptr != ref.ptr || nal.size != ref.size || nal.type != ref.type
+            || nal.nuh_layer_id != ref.nuh_layer_id || nal.temporal_id != ref.temporal_id) {
+            return false;
+        }
+    }
+    return count == list.size();
+}
+
+// RGYOBUReaderの結果がparse_unit_av1と一致するか
+static bool nal_bench_check_obu(const std::deque<std::unique_ptr<unit_info>>& list, const uint8_t *data, const size_t size) {
+    RGYOBUReader reader(data, size);
+    obu_info obu = { 0 };
+    size_t count = 0;
+    while (reader.next(obu)) {
+        if (count >= list.size()) {
+            return false;
+        }
+        const auto& ref = list[count++];
+        if (obu.type != ref->type || obu.extension_flag != ref->extension_flag || obu.has_size_flag != ref->has_size_flag
+            || obu.temporal_id != ref->temporal_id || obu.spatial_id != ref->spatial_id || obu.obu_offset != ref->obu_offset) {
+            return false;
+        }
+        // サイズのないOBU(末尾まで)は、parse_unit_av1ではOBUヘッダの分だけ短く切り出されるので、その範囲で比較する
+        if ((obu.has_size_flag) ? obu.size != ref->unit_data.size() : obu.size < ref->unit_data.size()) {
+            return false;
+        }
+        if (ref->unit_data.size() > 0 && memcmp(obu.ptr, ref->unit_data.data(), ref->unit_data.size()) != 0) {
+            return false;
+        }
+    }
+    return count == list.size();
+}
+
+std::string benchmark_nal_reader(const std::vector<std::pair<RGY_CODEC, tstring>>& streams, int& errorCount) {
+    struct NalBenchStream {
+        RGY_CODEC codec;
+        std::string name;
+        std::vector<uint8_t> data;
+        bool loaded;
+    };
+    std::vector<NalBenchStream> benchStreams = {
+        { RGY_CODEC_H264, "generated", nal_bench_gen_annexb(RGY_CODEC_H264), true },
+        { RGY_CODEC_HEVC, "generated", nal_bench_gen_annexb(RGY_CODEC_HEVC), true },
+        { RGY_CODEC_AV1,  "generated", nal_bench_gen_av1(), true },
+    };
+    for (const auto& stream : streams) {
+        NalBenchStream benchStream = { stream.first, str_replace(tchar_to_string(stream.second), "\\", "/"), {}, false };
+        benchStream.loaded = nal_bench_read_file(stream.second, benchStream.data);
+        benchStreams.push_back(std::move(benchStream));
+    }
+
+    errorCount = 0;
+    std::string json = "{\n";
+    json += strsprintf("  \"cpu\": \"%s\",\n", bench_cpu_name().c_str());
+    json += "  \"results\": [\n";
+    std::vector<std::string> results;
+    for (const auto& stream : benchStreams) {
+        if (!stream.loaded) {
+            errorCount++;
+            results.push_back(strsprintf("    { \"stream\": \"%s\", \"codec\": \"%s\", \"valid\": false, \"message\": \"failed to read file\" }",
+                stream.name.c_str(), nal_bench_codec_name(stream.codec)));
+            continue;
+        }
+        const uint8_t *data = stream.data.data();
+        const size_t size = stream.data.size();
+        size_t units = 0;
+        size_t readerUnits = 0;
+        bool valid = true;
+        double listSec = 0.0;
+        double readerSec = 0.0;
+        if (stream.codec == RGY_CODEC_AV1) {
+            valid = nal_bench_check_obu(parse_unit_av1(data, size), data, size);
+            listSec = bench_min_sec([&]() {
+                units = parse_unit_av1(data, size).size();
+            });
+            readerSec = bench_min_sec([&]() {
+                RGYOBUReader reader(data, size);
+                obu_info obu = { 0 };
+                readerUnits = 0;
+                while (reader.next(obu)) {
+                    readerUnits++;
+                }
+            });
+        } else {
+            const auto parse_nal_unit = (stream.codec == RGY_CODEC_H264) ? get_parse_nal_unit_h264_func() : get_parse_nal_unit_hevc_func();
+            valid = nal_bench_check_nal(parse_nal_unit(data, size), stream.codec, data, size);
+            listSec = bench_min_sec([&]() {
+                units = parse_nal_unit(data, size).size();
+            });
+            readerSec = bench_min_sec([&]() {
+                RGYNalUnitReader reader(stream.codec, data, size);
+                nal_info nal = { 0 };
+                readerUnits = 0;
+                while (reader.next(nal)) {
+                    readerUnits++;
+                }
+            });
+        }
+        valid &= units == readerUnits;
+        if (!valid) {
+            errorCount++;
+        }
+        results.push_back(strsprintf("    { \"stream\": \"%s\", \"codec\": \"%s\", \"bytes\": %llu, \"units\": %llu, \"list_mb_per_sec\": %.1f, \"reader_mb_per_sec\": %.1f, \"speedup\": %.3f, \"valid\": %s }",
+            stream.name.c_str(), nal_bench_codec_name(stream.codec), (unsigned long long)size, (unsigned long long)units,
+            size / (listSec * 1024.0 * 1024.0), size / (readerSec * 1024.0 * 1024.0), listSec / readerSec,
+            valid ? "true" : "false"));
+    }
+    for (size_t i = 0; i < results.size(); i++) {
+        json += results[i] + ((i + 1 < results.size()) ? ",\n" : "\n");
+    }
+    json += "  ],\n";
+    json += strsprintf("  \"error\": %d\n", errorCount);
+    json += "}\n";
+    return json;
+}
@@ -0,0 +1,47 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2025 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __RGY_BENCH_H__
+#define __RGY_BENCH_H__
+
+#include <vector>
+#include <string>
+#include "rgy_def.h"
+
+// スレッドプールのタスク投入・実行のスループットを、変更前の単一キューの実装と比較する (json形式で返す)
+std::string benchmark_thread_pool(const std::vector<int>& threads);
+
+// RGYQueueBoundedのスループットと遅延を、RGYQueueMPMPと比較する (json形式で返す)
+std::string benchmark_queue(const std::vector<int>& threads);
+
+// RGYNalUnitReader/RGYOBUReaderの走査速度を、parse_nal_unit_h264/hevc, parse_unit_av1と比較し、結果が一致するかを確認する (json形式で返す)
+// 生成したストリームに加え、streamsで指定したエレメンタリストリームのファイルも計測する
+std::string benchmark_nal_reader(const std::vector<std::pair<RGY_CODEC, tstring>>& streams, int& errorCount);
+
+#endif //__RGY_BENCH_H__
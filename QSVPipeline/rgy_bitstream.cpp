@@ -880,15 +880,23 @@ static std::unique_ptr<unit_info> get_unit(const uint8_t *data, const size_t siz
         size_t ret = size - 1 - extension_flag;
         unit->unit_data.resize(ret);
     } else {
-        size_t obu_size = 0;
+        const uint8_t *const fin_pos = start_pos + size;
+        uint64_t obu_size = 0;
         for (int i = 0; i < 8; i++) {
+            if (data >= fin_pos) {
+                return nullptr;
+            }
             uint8_t byte = *data++;
             obu_size |= (uint64_t)(byte & 0x7f) << (i * 7);
             if (!(byte & 0x80))
                 break;
         }
+        //途中で途切れている場合は終了
+        if (obu_size > (uint64_t)(fin_pos - data)) {
+            return nullptr;
+        }
 
-        const size_t ret = obu_size + (data - start_pos);
+        const size_t ret = (size_t)obu_size + (data - start_pos);
         unit->unit_data.resize(ret);
     }
     unit->obu_offset = (int)(data - start_pos);
@@ -903,6 +911,9 @@ std::deque<std::unique_ptr<unit_info>> parse_unit_av1(const uint8_t *data, const
     int64_t size_remain = (int64_t)size;
     while (size_remain > 0) {
         auto unit = get_unit(data, size_remain);
+        if (!unit) {
+            break;
+        }
         const auto unit_size = unit->unit_data.size();
         if (unit_size == 0) {
             break;
@@ -914,6 +925,257 @@ std::deque<std::unique_ptr<unit_info>> parse_unit_av1(const uint8_t *data, const
     return list;
 }
 
+RGYNalUnitReader::RGYNalUnitReader(const RGY_CODEC codec, const uint8_t *data, const size_t size) :
+    m_memmem(nullptr),
+    m_codec(codec),
+    m_data(data),
+    m_size(size),
+    m_next(RGY_MEMMEM_NOT_FOUND) {
+    static const auto memmem_func = get_memmem_func();
+    m_memmem = memmem_func;
+    m_next = findStartCode(0);
+}
+
+size_t RGYNalUnitReader::findStartCode(const size_t offset) const {
+    static const uint8_t header[3] = { 0, 0, 1 };
+    if (m_data == nullptr || offset + sizeof(header) > m_size) {
+        return RGY_MEMMEM_NOT_FOUND;
+    }
+    const auto next = m_memmem((const void *)(m_data + offset), m_size - offset, (const void *)header, sizeof(header));
+    return (next == RGY_MEMMEM_NOT_FOUND) ? RGY_MEMMEM_NOT_FOUND : offset + next;
+}
+
+bool RGYNalUnitReader::next(nal_info& nal) {
+    if (m_next == RGY_MEMMEM_NOT_FOUND) {
+        return false;
+    }
+    const size_t i = m_next;
+    nal.ptr = m_data + i - (i > 0 && m_data[i-1] == 0);
+    nal.type = 0;
+    nal.nuh_layer_id = 0;
+    nal.temporal_id = 0;
+    switch (m_codec) {
+    case RGY_CODEC_H264:
+        if (i + 3 < m_size) {
+            nal.type = m_data[i + 3] & 0x1f;
+        }
+        break;
+    case RGY_CODEC_HEVC:
+        if (i + 4 < m_size) {
+            nal.type = (m_data[i + 3] & 0x7f) >> 1;
+            nal.nuh_layer_id = ((m_data[i + 3] & 1) << 5) | ((m_data[i + 4] & 0xf8) >> 3);
+            nal.temporal_id = (m_data[i + 4] & 0x07) - 1;
+        }
+        break;
+    case RGY_CODEC_VVC:
+        if (i + 4 < m_size) {
+            nal.nuh_layer_id = m_data[i + 3] & 0x3f;
+            nal.type = (m_data[i + 4] & 0xf8) >> 3;
+            nal.temporal_id = (m_data[i + 4] & 0x07) - 1;
+        }
+        break;
+    default:
+        break;
+    }
+    //次のnal unitの先頭までをこのnal unitとする
+    m_next = findStartCode(i + 3);
+    const uint8_t *fin = (m_next != RGY_MEMMEM_NOT_FOUND) ? m_data + m_next - (m_data[m_next-1] == 0) : m_data + m_size;
+    nal.size = fin - nal.ptr;
+    return true;
+}
+
+RGYOBUReader::RGYOBUReader(const uint8_t *data, const size_t size) :
+    m_data(data),
+    m_size((data) ? size : 0),
+    m_pos(0) {
+}
+
+bool RGYOBUReader::next(obu_info& obu) {
+    const size_t size_remain = m_size - m_pos;
+    if (size_remain <= 1) {
+        return false;
+    }
+    const uint8_t *const start_pos = m_data + m_pos;
+    const uint8_t *const fin_pos = m_data + m_size;
+    const uint8_t *data = start_pos;
+    const uint8_t firstbyte = *data++;
+    obu.ptr = start_pos;
+    obu.type = (firstbyte & (0x78)) >> 3;
+    obu.extension_flag = (firstbyte & 0x04) >> 2;
+    obu.has_size_flag = (firstbyte & 0x02) >> 1;
+    obu.temporal_id = 0;
+    obu.spatial_id = 0;
+    if (obu.extension_flag) {
+        const uint8_t byte2 = *data++;
+        obu.temporal_id = (byte2 & (0xE0)) >> 5;
+        obu.spatial_id = (byte2 & (0x18)) >> 3;
+    }
+    if (!obu.has_size_flag) {
+        //サイズがなければ、残りすべてがこのOBU
+        obu.size = size_remain;
+    } else {
+        uint64_t obu_size = 0;
+        for (int i = 0; i < 8; i++) {
+            if (data >= fin_pos) {
+                return false;
+            }
+            const uint8_t byte = *data++;
+            obu_size |= (uint64_t)(byte & 0x7f) << (i * 7);
+            if (!(byte & 0x80))
+                break;
+        }
+        //途中で途切れている場合は終了
+        if (obu_size > (uint64_t)(fin_pos - data)) {
+            return false;
+        }
+        obu.size = (size_t)obu_size + (data - start_pos);
+    }
+    obu.obu_offset = (int)(data - start_pos);
+    m_pos += obu.size;
+    return true;
+}
+
+RGYMp4ToAnnexb::RGYMp4ToAnnexb() :
+    m_codec(RGY_CODEC_UNKNOWN),
+    m_extradata(),
+    m_header(),
+    m_naluLengthSize(4),
+    m_nals(),
+    m_insertIdx(-1),
+    m_outSize(0),
+    m_leftover(0) {
+}
+
+RGY_ERR RGYMp4ToAnnexb::setExtradata(const RGY_CODEC codec, const uint8_t *extradata, const size_t size) {
+    if (codec == m_codec && size == m_extradata.size() && (size == 0 || memcmp(extradata, m_extradata.data(), size) == 0)) {
+        return RGY_ERR_NONE;
+    }
+    static const uint8_t SC[] = { 0, 0, 0, 1 };
+    m_codec = codec;
+    m_extradata.assign(extradata, extradata + size);
+    m_header.clear();
+    const uint8_t *ptr = extradata;
+    const uint8_t *ptr_fin = extradata + size;
+    auto copy_nals = [&](const int count) {
+        for (int i = 0; i < count; i++) {
+            if (ptr + 2 > ptr_fin) return false;
+            const uint32_t nal_size = readUB16(ptr); ptr += 2;
+            if (nal_size > (size_t)(ptr_fin - ptr)) return false;
+            m_header.insert(m_header.end(), SC, SC + 4);
+            m_header.insert(m_header.end(), ptr, ptr + nal_size); ptr += nal_size;
+        }
+        return true;
+    };
+    if (codec == RGY_CODEC_H264) {
+        // avcC: version(8) profile(8) compat(8) level(8) 111111xx(lengthSizeMinusOne) 111xxxxx(numSPS) {SPS} numPPS {PPS}
+        if (size < 7) {
+            return RGY_ERR_INVALID_DATA_TYPE;
+        }
+        m_naluLengthSize = (ptr[4] & 3) + 1;
+        const int numSPS = ptr[5] & 0x1f;
+        ptr += 6;
+        if (!copy_nals(numSPS) || ptr >= ptr_fin) {
+            return RGY_ERR_INVALID_DATA_TYPE;
+        }
+        const int numPPS = *ptr; ptr++;
+        if (!copy_nals(numPPS)) {
+            return RGY_ERR_INVALID_DATA_TYPE;
+        }
+    } else if (codec == RGY_CODEC_HEVC) {
+        // hvcC: 21byteの固定部分の後、lengthSizeMinusOne, numOfArrays, {type, numNalus, {nal}}
+        if (size < 23) {
+            return RGY_ERR_INVALID_DATA_TYPE;
+        }
+        ptr += 21;
+        m_naluLengthSize = ((*ptr) & 3) + 1; ptr++;
+        const int numOfArrays = *ptr; ptr++;
+        for (int ia = 0; ia < numOfArrays; ia++) {
+            if (ptr + 3 > ptr_fin) {
+                return RGY_ERR_INVALID_DATA_TYPE;
+            }
+            ptr++;
+            const int count = readUB16(ptr); ptr += 2;
+            if (!copy_nals(count)) {
+                return RGY_ERR_INVALID_DATA_TYPE;
+            }
+        }
+    } else {
+        return RGY_ERR_UNSUPPORTED;
+    }
+    return RGY_ERR_NONE;
+}
+
+size_t RGYMp4ToAnnexb::prepare(const uint8_t *data, const size_t size) {
+    m_nals.clear();
+    m_insertIdx = -1;
+    m_outSize = 0;
+    bool vps_exist = false;
+    bool sps_exist = false;
+    bool pps_exist = false;
+    bool got_irap = m_header.empty(); //ヘッダがなければ挿入の判定は不要
+    size_t pos = 0;
+    while (pos + m_naluLengthSize < size) {
+        uint32_t nal_size = 0;
+        for (int i = 0; i < m_naluLengthSize; i++) {
+            nal_size = (nal_size << 8) | data[pos + i];
+        }
+        const size_t nal_pos = pos + m_naluLengthSize;
+        if (nal_size > size - nal_pos) {
+            break;
+        }
+        if (!got_irap) {
+            bool header_exist = false;
+            bool is_irap = false;
+            if (m_codec == RGY_CODEC_HEVC) {
+                const int nalu_type = (data[nal_pos] >> 1) & 0x3f;
+                vps_exist |= nalu_type == NALU_HEVC_VPS;
+                sps_exist |= nalu_type == NALU_HEVC_SPS;
+                pps_exist |= nalu_type == NALU_HEVC_PPS;
+                header_exist = vps_exist && sps_exist && pps_exist;
+                is_irap = nalu_type >= 16 && nalu_type <= 23;
+            } else {
+                const int nalu_type = data[nal_pos] & 0x1f;
+                sps_exist |= nalu_type == NALU_H264_SPS;
+                pps_exist |= nalu_type == NALU_H264_PPS;
+                header_exist = sps_exist && pps_exist;
+                is_irap = nalu_type == NALU_H264_IDR;
+            }
+            // ヘッダーがすでにある場合は、extra dataをつけないようにする (header_existでチェック)
+            // 1度つけていたら、もうつけない (got_irapでチェック)
+            if (is_irap && !header_exist) {
+                m_insertIdx = (int)m_nals.size();
+                m_outSize += m_header.size();
+            }
+            got_irap |= is_irap;
+        }
+        m_nals.push_back({ nal_pos, nal_size });
+        m_outSize += 4 + nal_size;
+        pos = nal_pos + nal_size;
+    }
+    m_leftover = size - pos;
+    return m_outSize;
+}
+
+void RGYMp4ToAnnexb::convert(uint8_t *buf) const {
+    static const uint8_t SC[] = { 0, 0, 0, 1 };
+    //長さフィールドは4byte以下なので、変換後の位置は変換前の位置より後ろになる
+    //後ろから変換すれば、未処理のデータを上書きすることなくその場で変換できる
+    size_t dst = m_outSize;
+    for (int i = (int)m_nals.size() - 1; i >= 0; i--) {
+        const auto& nal = m_nals[i];
+        dst -= nal.size;
+        if (dst != nal.offset) {
+            memmove(buf + dst, buf + nal.offset, nal.size);
+        }
+        dst -= sizeof(SC);
+        memcpy(buf + dst, SC, sizeof(SC));
+        if (i == m_insertIdx) {
+            dst -= m_header.size();
+            memcpy(buf + dst, m_header.data(), m_header.size());
+        }
+    }
+}
+
 #if 0
 
 
@@ -35,6 +35,7 @@
 #include <cstdint>
 #include <string>
 #include "rgy_def.h"
+#include "rgy_err.h"
 #include "rgy_util.h"
 
 struct nal_info {
@@ -55,6 +56,18 @@ struct unit_info {
     std::vector<uint8_t> unit_data;
 };
 
+// unit_infoと異なり、データはコピーせず入力バッファを指す
+struct obu_info {
+    const uint8_t *ptr; // OBUの先頭 (OBUヘッダを含む)
+    size_t size;        // OBUヘッダを含むサイズ
+    uint8_t type;
+    uint8_t extension_flag;
+    uint8_t has_size_flag;
+    int temporal_id;
+    int spatial_id;
+    int obu_offset;     // ptrからOBUのデータ部までのオフセット
+};
+
 enum : uint8_t {
     NALU_H264_UNDEF    = 0,
     NALU_H264_NONIDR   = 1,
@@ -237,6 +250,75 @@ decltype(find_header_c)* get_find_header_func();
 
 std::deque<std::unique_ptr<unit_info>> parse_unit_av1(const uint8_t *data, const size_t size);
 
+// 入力バッファのnal unitを先頭から1つずつ返す
+// parse_nal_unit_xxxと同じ結果を返すが、nal_infoは入力バッファを指すだけで、リストの作成やデータのコピーは行わない
+// start codeの探索にはCPUに応じたSIMD版(get_memmem_func)を使用する
+// !! 入力バッファは走査中有効である必要がある !!
+class RGYNalUnitReader {
+public:
+    RGYNalUnitReader(const RGY_CODEC codec, const uint8_t *data, const size_t size);
+    //次のnal unitを取得する、もうなければfalseを返す
+    bool next(nal_info& nal);
+protected:
+    size_t findStartCode(const size_t offset) const;
+
+    size_t (*m_memmem)(const void *data, const size_t data_size, const void *target, const size_t target_size);
+    RGY_CODEC m_codec;
+    const uint8_t *m_data;
+    size_t m_size;
+    size_t m_next; //次のstart code (00 00 01)の位置
+};
+
+// 入力バッファのOBUを先頭から1つずつ返す
+// parse_unit_av1と異なり、OBUごとのメモリ確保やデータのコピーは行わない
+// !! 入力バッファは走査中有効である必要がある !!
+class RGYOBUReader {
+public:
+    RGYOBUReader(const uint8_t *data, const size_t size);
+    //次のOBUを取得する、もうなければ(あるいは途中で途切れていれば)falseを返す
+    bool next(obu_info& obu);
+protected:
+    const uint8_t *m_data;
+    size_t m_size;
+    size_t m_pos; //次のOBUの位置
+};
+
+// mp4/mkv形式(nal unitの長さ+nal unit)のH.264/HEVCのパケットをAnnexB形式に変換する
+// 長さフィールドをstart codeに置き換えるので、長さフィールドが4byteでヘッダの挿入も不要な場合はデータの移動なしにその場で変換する
+// それ以外の場合も、変換後のサイズをあらかじめ求めて、出力先を1度だけ確保すればよいようにする
+// IRAP(IDR)の前にヘッダ(VPS/SPS/PPS)がない場合は、extradataから作成したヘッダを挿入する
+class RGYMp4ToAnnexb {
+public:
+    RGYMp4ToAnnexb();
+    //extradata(avcC/hvcC)を設定し、AnnexB形式のヘッダを作成する
+    //前回と同じextradataの場合は何もしない
+    RGY_ERR setExtradata(const RGY_CODEC codec, const uint8_t *extradata, const size_t size);
+    //AnnexB形式のヘッダ
+    const std::vector<uint8_t>& header() const { return m_header; }
+    //nal unitの長さフィールドのbyte数
+    int naluLengthSize() const { return m_naluLengthSize; }
+    //パケットを走査し、変換後のサイズを返す
+    size_t prepare(const uint8_t *data, const size_t size);
+    //prepare()したパケットをAnnexB形式に変換する
+    //bufの先頭にはprepare()したデータが置かれていて、prepare()の戻り値以上の大きさがあること
+    void convert(uint8_t *buf) const;
+    //prepare()したパケットのうち、途中で途切れていて変換できなかったbyte数
+    size_t leftover() const { return m_leftover; }
+protected:
+    struct NalPos {
+        size_t offset; //入力パケットでのnal unitの位置 (長さフィールドを除く)
+        size_t size;
+    };
+    RGY_CODEC m_codec;
+    std::vector<uint8_t> m_extradata; //変換元のextradata (変更の検出用)
+    std::vector<uint8_t> m_header;
+    int m_naluLengthSize;
+    std::vector<NalPos> m_nals;       //prepare()したパケットのnal unit
+    int m_insertIdx;                  //ヘッダを挿入するnal unitのindex (-1なら挿入しない)
+    size_t m_outSize;
+    size_t m_leftover;
+};
+
 uint8_t gen_obu_header(const uint8_t obu_type);
 size_t get_av1_uleb_size_bytes(uint64_t value);
 std::vector<uint8_t> get_av1_uleb_size_data(uint64_t value);
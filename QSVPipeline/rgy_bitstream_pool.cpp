@@ -0,0 +1,225 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2025 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <array>
+#include <cassert>
+#include "rgy_bitstream_pool.h"
+#include "rgy_osdep.h"
+#include "rgy_util.h"
+
+// 領域の直前に置くヘッダ
+struct RGYBitstreamBufferHeader {
+    uint32_t magic;
+    int32_t idx;      // サイズクラス (-1ならプールの対象外)
+    size_t capacity;  // 使用可能なサイズ
+};
+static_assert(sizeof(RGYBitstreamBufferHeader) <= RGYBitstreamBufferPool::ALIGN, "RGYBitstreamBufferHeader too large.");
+static const uint32_t RGY_BITSTREAM_BUFFER_MAGIC = 0x4C4F4F50; // "POOL"
+
+static RGYBitstreamBufferHeader *getHeader(uint8_t *ptr) {
+    return (RGYBitstreamBufferHeader *)(ptr - RGYBitstreamBufferPool::ALIGN);
+}
+
+// スレッドごとのキャッシュ
+// ロックは取らず、スレッドの終了時には全体の空きリストに返却する
+struct RGYBitstreamBufferThreadCache {
+    std::array<std::array<uint8_t *, RGYBitstreamBufferPool::THREAD_CACHE_COUNT>, RGYBitstreamBufferPool::NUM_CLASSES> buf;
+    std::array<size_t, RGYBitstreamBufferPool::NUM_CLASSES> count;
+    size_t bytes;
+    bool active; // スレッドの終了処理後はキャッシュを使用しない
+
+    RGYBitstreamBufferThreadCache() : buf(), count(), bytes(0), active(true) {};
+    ~RGYBitstreamBufferThreadCache() {
+        active = false;
+        auto& pool = RGYBitstreamBufferPool::get();
+        for (int idx = 0; idx < RGYBitstreamBufferPool::NUM_CLASSES; idx++) {
+            for (size_t i = 0; i < count[idx]; i++) {
+                pool.globalPush(idx, buf[idx][i]);
+            }
+            count[idx] = 0;
+        }
+        bytes = 0;
+    }
+    uint8_t *pop(int idx) {
+        if (!active || count[idx] == 0) {
+            return nullptr;
+        }
+        bytes -= RGYBitstreamBufferPool::classSize(idx);
+        return buf[idx][--count[idx]];
+    }
+    bool push(int idx, uint8_t *ptr) {
+        const auto size = RGYBitstreamBufferPool::classSize(idx);
+        if (!active || count[idx] >= RGYBitstreamBufferPool::THREAD_CACHE_COUNT || bytes + size > RGYBitstreamBufferPool::THREAD_CACHE_BYTES) {
+            return false;
+        }
+        buf[idx][count[idx]++] = ptr;
+        bytes += size;
+        return true;
+    }
+};
+
+static thread_local RGYBitstreamBufferThreadCache g_bitstreamBufferThreadCache;
+
+RGYBitstreamBufferPool& RGYBitstreamBufferPool::get() {
+    // スレッドの終了時(プロセスの終了時を含む)にもキャッシュの返却先として使用するので、破棄しない
+    static RGYBitstreamBufferPool *pool = new RGYBitstreamBufferPool();
+    return *pool;
+}
+
+RGYBitstreamBufferPool::RGYBitstreamBufferPool() :
+    m_mtx(),
+    m_free(),
+    m_cachedBytes(0),
+    m_alloc(0),
+    m_reuseThread(0),
+    m_reuseGlobal(0),
+    m_heapAlloc(0),
+    m_heapFree(0) {
+}
+
+RGYBitstreamBufferPool::~RGYBitstreamBufferPool() {
+    for (auto& list : m_free) {
+        for (auto ptr : list) {
+            heapFree(ptr);
+        }
+        list.clear();
+    }
+}
+
+int RGYBitstreamBufferPool::sizeClass(size_t size) {
+    if (size > classSize(NUM_CLASSES - 1)) {
+        return -1;
+    }
+    if (size <= classSize(0)) {
+        return 0;
+    }
+    // size <= 2^(k+1) となる最小のkを求め、2^k*1.5 か 2^(k+1) のどちらに収まるかを判定する
+    int k = 0;
+    while (((size_t)1 << (k + 1)) < size) {
+        k++;
+    }
+    const int idx = ((k - 12) << 1) + 1; // 3 * 2^(k-1)
+    return (size <= classSize(idx)) ? idx : idx + 1;
+}
+
+uint8_t *RGYBitstreamBufferPool::heapAlloc(int idx, size_t capacity) {
+    uint8_t *base = (uint8_t *)_aligned_malloc(capacity + ALIGN, ALIGN);
+    if (base == nullptr) {
+        return nullptr;
+    }
+    m_heapAlloc++;
+    uint8_t *ptr = base + ALIGN;
+    auto header = getHeader(ptr);
+    header->magic = RGY_BITSTREAM_BUFFER_MAGIC;
+    header->idx = idx;
+    header->capacity = capacity;
+    return ptr;
+}
+
+void RGYBitstreamBufferPool::heapFree(uint8_t *ptr) {
+    m_heapFree++;
+    _aligned_free(ptr - ALIGN);
+}
+
+void RGYBitstreamBufferPool::globalPush(int idx, uint8_t *ptr) {
+    const auto size = (int64_t)classSize(idx);
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (m_cachedBytes + size <= (int64_t)GLOBAL_CACHE_BYTES) {
+            m_free[idx].push_back(ptr);
+            m_cachedBytes += size;
+            return;
+        }
+    }
+    heapFree(ptr);
+}
+
+uint8_t *RGYBitstreamBufferPool::alloc(size_t size, size_t *capacity) {
+    m_alloc++;
+    const int idx = sizeClass(size);
+    if (idx < 0) {
+        // 大きすぎる場合はプールせず、そのまま確保する
+        auto ptr = heapAlloc(-1, size);
+        if (ptr && capacity) *capacity = size;
+        return ptr;
+    }
+    uint8_t *ptr = g_bitstreamBufferThreadCache.pop(idx);
+    if (ptr) {
+        m_reuseThread++;
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            if (m_free[idx].size() > 0) {
+                ptr = m_free[idx].back();
+                m_free[idx].pop_back();
+                m_cachedBytes -= (int64_t)classSize(idx);
+            }
+        }
+        if (ptr) {
+            m_reuseGlobal++;
+        } else if ((ptr = heapAlloc(idx, classSize(idx))) == nullptr) {
+            return nullptr;
+        }
+    }
+    if (capacity) *capacity = classSize(idx);
+    return ptr;
+}
+
+void RGYBitstreamBufferPool::release(uint8_t *ptr) {
+    if (ptr == nullptr) {
+        return;
+    }
+    auto header = getHeader(ptr);
+    assert(header->magic == RGY_BITSTREAM_BUFFER_MAGIC);
+    const int idx = header->idx;
+    if (idx < 0) {
+        heapFree(ptr);
+        return;
+    }
+    if (!g_bitstreamBufferThreadCache.push(idx, ptr)) {
+        globalPush(idx, ptr);
+    }
+}
+
+RGYBitstreamBufferPool::Stats RGYBitstreamBufferPool::stats() const {
+    Stats stats;
+    stats.alloc = m_alloc;
+    stats.reuseThread = m_reuseThread;
+    stats.reuseGlobal = m_reuseGlobal;
+    stats.heapAlloc = m_heapAlloc;
+    stats.heapFree = m_heapFree;
+    stats.cachedBytes = m_cachedBytes;
+    return stats;
+}
+
+tstring RGYBitstreamBufferPool::statsStr() const {
+    const auto s = stats();
+    const double reuse = (s.alloc > 0) ? (s.reuseThread + s.reuseGlobal) * 100.0 / s.alloc : 0.0;
+    return strsprintf(_T("bitstream buffer pool: alloc %lld, reuse %.1f%% (thread %lld, global %lld), heap alloc %lld, heap free %lld, cached %.1f MB"),
+        (long long)s.alloc, reuse, (long long)s.reuseThread, (long long)s.reuseGlobal,
+        (long long)s.heapAlloc, (long long)s.heapFree, s.cachedBytes / (1024.0 * 1024.0));
+}
@@ -0,0 +1,100 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2025 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_BITSTREAM_POOL_H__
+#define __RGY_BITSTREAM_POOL_H__
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "rgy_tchar.h"
+
+// RGYBitstream(mfxBitstream)のデータ領域用のメモリプール
+// 確保サイズをサイズクラスに切り上げ、解放された領域はサイズクラスごとに保持して再利用する
+// 解放/確保はまずスレッドごとのキャッシュで行い、あふれた分はプロセス全体の空きリストで共有する
+// (エンコーダ出力・demux・muxなどで毎フレーム確保/解放されるため、ヒープへのアクセスと断片化を避ける)
+// 確保した領域の直前にヘッダを置いてサイズクラスを記録するので、解放時にはポインタのみ渡せばよい
+// !! 確保した領域は必ずRGYBitstreamBufferPool::release()で解放すること !!
+class RGYBitstreamBufferPool {
+public:
+    static const size_t ALIGN = 64;          // データ領域のアライメント (ヘッダのサイズも兼ねる)
+    static const int NUM_CLASSES = 32;       // サイズクラス数 (4KB, 6KB, 8KB, 12KB, ..., 192MB)
+    static const size_t THREAD_CACHE_COUNT = 8;               // スレッドごとのキャッシュに保持する、サイズクラスあたりの最大数
+    static const size_t THREAD_CACHE_BYTES = 32 * 1024 * 1024; // スレッドごとのキャッシュに保持する最大サイズ
+    static const size_t GLOBAL_CACHE_BYTES = 256 * 1024 * 1024; // 全体の空きリストに保持する最大サイズ
+
+    struct Stats {
+        int64_t alloc;       // 確保の要求回数
+        int64_t reuseThread; // スレッドごとのキャッシュから再利用した回数
+        int64_t reuseGlobal; // 全体の空きリストから再利用した回数
+        int64_t heapAlloc;   // ヒープから確保した回数
+        int64_t heapFree;    // ヒープに返却した回数
+        int64_t cachedBytes; // 全体の空きリストに保持しているサイズ
+    };
+
+    // プロセス全体で共有するプールを返す
+    static RGYBitstreamBufferPool& get();
+
+    // size以上の領域を確保し、実際に使用可能なサイズをcapacityに返す (失敗時はnullptr)
+    uint8_t *alloc(size_t size, size_t *capacity);
+    // alloc()で確保した領域を返却する (nullptrなら何もしない)
+    void release(uint8_t *ptr);
+
+    Stats stats() const;
+    tstring statsStr() const;
+
+    // サイズクラスのindexを返す、プールの対象外のサイズなら-1
+    static int sizeClass(size_t size);
+    static size_t classSize(int idx) {
+        return (size_t)(2 + (idx & 1)) << (11 + (idx >> 1));
+    }
+protected:
+    friend struct RGYBitstreamBufferThreadCache;
+    RGYBitstreamBufferPool();
+    ~RGYBitstreamBufferPool();
+    RGYBitstreamBufferPool(const RGYBitstreamBufferPool&) = delete;
+    RGYBitstreamBufferPool& operator=(const RGYBitstreamBufferPool&) = delete;
+
+    uint8_t *heapAlloc(int idx, size_t capacity);
+    void heapFree(uint8_t *ptr);
+    // 全体の空きリストに返却する、保持しきれなければヒープに返す
+    void globalPush(int idx, uint8_t *ptr);
+
+    std::mutex m_mtx;
+    std::vector<uint8_t *> m_free[NUM_CLASSES]; // 全体の空きリスト (サイズクラスごと)
+    std::atomic<int64_t> m_cachedBytes;
+
+    std::atomic<int64_t> m_alloc;
+    std::atomic<int64_t> m_reuseThread;
+    std::atomic<int64_t> m_reuseGlobal;
+    std::atomic<int64_t> m_heapAlloc;
+    std::atomic<int64_t> m_heapFree;
+};
+
+#endif //__RGY_BITSTREAM_POOL_H__
@@ -4921,6 +4921,15 @@ int parse_one_common_option(const TCHAR *option_name, const TCHAR *strInput[], i
         }
         return 0;
     }
+    if (IS_OPTION("input-index")) {
+        common->inputIndex.enable = true;
+        if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
+            return 0;
+        }
+        i++;
+        common->inputIndex.filename = strInput[i];
+        return 0;
+    }
     if (IS_OPTION("input-pixel-format")) {
         i++;
         common->inputPixFmtStr = strInput[i];
@@ -6688,6 +6697,11 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
         ctrl->taskPerfMonitor = true;
         return 0;
     }
+    if (IS_OPTION("trace")) {
+        i++;
+        ctrl->traceFile = strInput[i];
+        return 0;
+    }
     if (IS_OPTION("lowlatency")) {
         ctrl->lowLatency = true;
         return 0;
@@ -6738,6 +6752,20 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
         ctrl->threadAudio = value;
         return 0;
     }
+    if (IS_OPTION("audio-thread-max") || IS_OPTION("thread-audio-max")) {
+        i++;
+        int value = 0;
+        if (1 != _stscanf_s(strInput[i], _T("%d"), &value)) {
+            print_cmd_error_invalid_value(option_name, strInput[i]);
+            return 1;
+        }
+        if (value < 0) {
+            print_cmd_error_invalid_value(option_name, strInput[i], _T("should be 0 or positive value"));
+            return 1;
+        }
+        ctrl->threadAudioMax = value;
+        return 0;
+    }
     if (IS_OPTION("thread-affinity")) {
         if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
             return 0;
@@ -6955,6 +6983,51 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
         ctrl->outputBufSizeMB = (std::min)(value, RGY_OUTPUT_BUF_MB_MAX);
         return 0;
     }
+    if (IS_OPTION("output-async")) {
+        ctrl->outputAsync.enable = true;
+        if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
+            return 0;
+        }
+        i++;
+        const auto paramList = std::vector<std::string>{ "direct", "prealloc" };
+        for (const auto &param : split(strInput[i], _T(","))) {
+            auto pos = param.find_first_of(_T("="));
+            if (pos != std::string::npos) {
+                auto param_arg = param.substr(0, pos);
+                auto param_val = param.substr(pos + 1);
+                param_arg = tolowercase(param_arg);
+                if (param_arg == _T("direct")) {
+                    bool b = false;
+                    if (!cmd_string_to_bool(&b, param_val)) {
+                        ctrl->outputAsync.directIO = b;
+                    } else {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("prealloc")) {
+                    try {
+                        ctrl->outputAsync.preallocMB = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (ctrl->outputAsync.preallocMB < 0) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("prealloc should be set in positive value."));
+                        return 1;
+                    }
+                    continue;
+                }
+                print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
+                return 1;
+            } else {
+                print_cmd_error_unknown_opt_param(option_name, param, paramList);
+                return 1;
+            }
+        }
+        return 0;
+    }
     if (IS_OPTION("thread-csp")) {
         i++;
         int value = 0;
@@ -7146,6 +7219,18 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
         ctrl->openclBuildThreads = value;
         return 0;
     }
+    if (IS_OPTION("opencl-cache")) {
+        ctrl->openclCache = true;
+        if (i + 1 < nArgNum && strInput[i + 1][0] != _T('-')) {
+            i++;
+            ctrl->openclCacheDir = strInput[i];
+        }
+        return 0;
+    }
+    if (IS_OPTION("no-opencl-cache")) {
+        ctrl->openclCache = false;
+        return 0;
+    }
     if (IS_OPTION("parallel") && ENABLE_PARALLEL_ENC) {
         if (i + 1 >= nArgNum || strInput[i + 1][0] == _T('-')) {
             return 0;
@@ -7216,6 +7301,32 @@ int parse_one_ctrl_option(const TCHAR *option_name, const TCHAR *strInput[], int
                     }
                     continue;
                 }
+                if (param_arg == _T("chunk-sec")) {
+                    try {
+                        ctrl->parallelEnc.chunkSec = std::stof(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (ctrl->parallelEnc.chunkSec < 1.0f) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("chunk-sec should be 1 or larger."));
+                        return 1;
+                    }
+                    continue;
+                }
+                if (param_arg == _T("fanout-mem")) {
+                    try {
+                        ctrl->parallelEnc.fanOutBufMB = std::stoi(param_val);
+                    } catch (...) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val);
+                        return 1;
+                    }
+                    if (ctrl->parallelEnc.fanOutBufMB < 1) {
+                        print_cmd_error_invalid_value(tstring(option_name) + _T(" ") + param_arg + _T("="), param_val, _T("fanout-mem should be 1 or larger."));
+                        return 1;
+                    }
+                    continue;
+                }
                 print_cmd_error_unknown_opt_param(option_name, param_arg, paramList);
                 return 1;
             } else {
@@ -8117,6 +8228,14 @@ tstring gen_cmd(const RGYParamCommon *param, const RGYParamCommon *defaultPrm, b
 
     OPT_FLOAT(_T("--input-analyze"), demuxAnalyzeSec, 6);
     OPT_NUM(_T("--input-probesize"), demuxProbesize);
+    if (param->inputIndex != defaultPrm->inputIndex) {
+        if (param->inputIndex.enable) {
+            cmd << _T(" --input-index");
+            if (param->inputIndex.filename.length() > 0) {
+                cmd << _T(" \"") << param->inputIndex.filename << _T("\"");
+            }
+        }
+    }
     OPT_TSTR(_T("--input-pixel-format"), inputPixFmtStr);
     OPT_NUM(_T("--input-retry"), inputRetry);
     if (param->nTrimCount > 0) {
@@ -8541,9 +8660,20 @@ tstring gen_cmd(const RGYParamCommon *param, const RGYParamCommon *defaultPrm, b
 tstring gen_cmd(const RGYParamControl *param, const RGYParamControl *defaultPrm, bool save_disabled_prm) {
     std::basic_stringstream<TCHAR> cmd;
     OPT_NUM(_T("--output-buf"), outputBufSizeMB);
+    if (param->outputAsync != defaultPrm->outputAsync && param->outputAsync.enable) {
+        std::basic_stringstream<TCHAR> tmp;
+        tmp.str(tstring());
+        ADD_BOOL(_T("direct"), outputAsync.directIO);
+        ADD_NUM(_T("prealloc"), outputAsync.preallocMB);
+        cmd << _T(" --output-async");
+        if (!tmp.str().empty()) {
+            cmd << _T(" ") << tmp.str().substr(1);
+        }
+    }
     OPT_NUM(_T("--thread-output"), threadOutput);
     OPT_NUM(_T("--thread-input"), threadInput);
     OPT_NUM(_T("--thread-audio"), threadAudio);
+    OPT_NUM(_T("--thread-audio-max"), threadAudioMax);
     OPT_NUM(_T("--thread-csp"), threadCsp);
     if (param->threadParams != defaultPrm->threadParams) {
         cmd << _T(" --thread-affinity ")    << param->threadParams.to_string(RGYParamThreadType::affinity);
@@ -8560,6 +8690,7 @@ tstring gen_cmd(const RGYParamControl *param, const RGYParamControl *defaultPrm,
         }
     }
     OPT_BOOL(_T("--task-perf-monitor"), _T(""), taskPerfMonitor);
+    OPT_STR_PATH(_T("--trace"), traceFile);
     OPT_BOOL(_T("--lowlatency"), _T(""), lowLatency);
     OPT_STR_PATH(_T("--log"), logfile);
     if (param->loglevel != defaultPrm->loglevel) {
@@ -8643,6 +8774,12 @@ tstring gen_cmd(const RGYParamControl *param, const RGYParamControl *defaultPrm,
         }
     }
     OPT_NUM(_T("--opencl-build-threads"), openclBuildThreads);
+    if (param->openclCache != defaultPrm->openclCache || param->openclCacheDir != defaultPrm->openclCacheDir) {
+        cmd << ((param->openclCache) ? _T(" --opencl-cache") : _T(" --no-opencl-cache"));
+        if (param->openclCache && param->openclCacheDir.length() > 0) {
+            cmd << _T(" \"") << param->openclCacheDir << _T("\"");
+        }
+    }
     OPT_BOOL(_T("--process-monitor-dev-usage"), _T(""), processMonitorDevUsage);
     OPT_BOOL(_T("--process-monitor-dev-usage-reset"), _T(""), processMonitorDevUsageReset);
 
@@ -8662,6 +8799,8 @@ tstring gen_cmd(const RGYParamControl *param, const RGYParamControl *defaultPrm,
             }
         }
         ADD_LST(_T("cache"), parallelEnc.cacheMode, list_parallel_enc_cache);
+        ADD_FLOAT(_T("chunk-sec"), parallelEnc.chunkSec, 3);
+        ADD_NUM(_T("fanout-mem"), parallelEnc.fanOutBufMB);
         if (!tmp.str().empty()) {
             cmd << _T(" --parallel ") << tmp.str().substr(1);
         }
@@ -8798,6 +8937,9 @@ tstring gen_cmd_help_common() {
         _T("                                 could be only used with avhw/avsw reader.\n")
         _T("                                 use if reader fails to detect audio stream.\n")
         _T("   --input-probesize <int>      set size in bytes which reader analyze input file.\n")
+        _T("   --input-index [<string>]     save/load keyframe index of input file to speed up\n")
+        _T("                                 seek and startup. could be only used with avhw/avsw reader.\n")
+        _T("                                 default filename: <input>.rgyidx\n")
         //_T("   --input-retry <int>          set retry count for openning input file.\n")
         //_T("                                 could useful for streaming input.\n")
         //_T("                                  default: disabled.\n")
@@ -9710,6 +9852,15 @@ tstring gen_cmd_help_ctrl() {
     tstring str = strsprintf(_T("\n")
 #if ENABLE_PARALLEL_ENC
         _T("   --parallel <int> or auto     Enable parallel encoding by file splitting.\n")
+        _T("   --parallel [<param1>=<value>][,<param2>=<value>]...\n")
+        _T("    params\n")
+        _T("      mp=<int> or auto          number of parallel encoders.\n")
+        _T("      chunks=<int>              number of chunks (default: 4 per encoder).\n")
+        _T("      cache=<string>            mem(default), file, ring\n")
+        _T("      chunk-sec=<float>         target chunk length in seconds when input\n")
+        _T("                                 is read by the main thread (pipe). default: 30\n")
+        _T("      fanout-mem=<int>          buffer limit in MB for input read by\n")
+        _T("                                 the main thread (pipe). default: 1024\n")
 #endif
         _T("   --log <string>               set log file name\n")
         _T("   --log-level <string>         set log level\n")
@@ -9737,18 +9888,30 @@ tstring gen_cmd_help_ctrl() {
         DEFAULT_DUMMY_LOAD_PERCENT);
     str += strsprintf(_T("")
         _T("   --task-perf-monitor          enable task performance monitoring.\n")
+        _T("   --trace <string>             output per stage timings and queue depths\n")
+        _T("                                 of the pipeline in Chrome trace format (json).\n")
         _T("   --lowlatency                 minimize latency (might have lower throughput).\n"));
     str += strsprintf(_T("")
         _T("   --output-buf <int>           buffer size for output in MByte\n")
         _T("                                 default %d MB (0-%d)\n"),
         RGY_OUTPUT_BUF_MB_DEFAULT, RGY_OUTPUT_BUF_MB_MAX
     );
+    str += strsprintf(_T("")
+        _T("   --output-async [<param1>=<value1>][,...]\n")
+        _T("     write output file from a dedicated thread with two buffers\n")
+        _T("     of --output-buf size. (only when muxing to a file by avcodec)\n")
+        _T("    params\n")
+        _T("      direct=<bool>             write with O_DIRECT (Linux only).\n")
+        _T("      prealloc=<int>            preallocate file space in MB (Linux only).\n"));
 #if ENABLE_AVCODEC_OUT_THREAD
     str += strsprintf(_T("")
         _T("   --output-thread <int>        set output thread num\n")
         _T("                                 -1: auto (= default)\n")
         _T("                                  0: disable (slow, but less memory usage)\n")
         _T("                                  1: use one thread\n")
+        _T("   --thread-audio-max <int>     max number of threads shared by audio\n")
+        _T("                                 decode/filter/encode of all tracks.\n")
+        _T("                                  0: auto (= default)\n")
 #if 0
         _T("   --audio-thread <int>         set audio thread num, available only with output thread\n")
         _T("                                 -1: auto (= default)\n")
@@ -9830,7 +9993,9 @@ tstring gen_cmd_help_ctrl() {
 #endif //#if defined(_WIN32) || defined(_WIN64)
 #if ENCODER_QSV || ENCODER_VCEENC || ENCODER_MPP
     str += strsprintf(_T("\n")
-        _T("   --disable-opencl             disable opencl features.\n"));
+        _T("   --disable-opencl             disable opencl features.\n")
+        _T("   --opencl-cache [<string>]    cache built OpenCL program binaries in the\n")
+        _T("                                 directory specified to speed up startup.\n"));
 #endif
     str += strsprintf(_T("\n")
         _T("   --disable-vulkan             disable vulkan features.\n"));
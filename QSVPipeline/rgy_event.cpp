@@ -27,6 +27,11 @@
 
 #include "rgy_event.h"
 #if !(defined(_WIN32) || defined(_WIN64))
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <ctime>
+#include <cerrno>
 
 #include <thread>
 #include <mutex>
@@ -130,7 +135,30 @@ unique_event CreateEventUnique(void* pDummy, int bManualReset, int bInitialState
     return unique_event(CreateEvent(pDummy, bManualReset, bInitialState, nullptr), CloseEvent);
 }
 
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "std::atomic<uint32_t> must be usable as futex word.");
+
+uint32_t rgy_atomic_wait(std::atomic<uint32_t> *addr, uint32_t expected, uint32_t millisec) {
+    struct timespec timeout;
+    struct timespec *ptimeout = nullptr;
+    if (millisec != INFINITE) {
+        timeout.tv_sec = millisec / 1000;
+        timeout.tv_nsec = (long)(millisec % 1000) * 1000 * 1000;
+        ptimeout = &timeout;
+    }
+    const auto ret = syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT_PRIVATE, expected, ptimeout, nullptr, 0);
+    return (ret != 0 && errno == ETIMEDOUT) ? WAIT_TIMEOUT : WAIT_OBJECT_0;
+}
+
+void rgy_atomic_notify_one(std::atomic<uint32_t> *addr) {
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+void rgy_atomic_notify_all(std::atomic<uint32_t> *addr) {
+    syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+}
+
 #else
+#pragma comment(lib, "Synchronization.lib")
 
 unique_event CreateEventUnique(void* pDummy, int bManualReset, int bInitialState, const wchar_t* name) {
     return unique_event(CreateEventW((LPSECURITY_ATTRIBUTES)pDummy, bManualReset, bInitialState, name), CloseEvent);
@@ -142,5 +170,18 @@ unique_event CreateEventUnique(void* pDummy, int bManualReset, int bInitialState
     return unique_event(CreateEventA((LPSECURITY_ATTRIBUTES)pDummy, bManualReset, bInitialState, nullptr), CloseEvent);
 }
 
+uint32_t rgy_atomic_wait(std::atomic<uint32_t> *addr, uint32_t expected, uint32_t millisec) {
+    return WaitOnAddress((volatile VOID *)addr, &expected, sizeof(expected), millisec) ? WAIT_OBJECT_0
+        : ((GetLastError() == ERROR_TIMEOUT) ? WAIT_TIMEOUT : WAIT_OBJECT_0);
+}
+
+void rgy_atomic_notify_one(std::atomic<uint32_t> *addr) {
+    WakeByAddressSingle((PVOID)addr);
+}
+
+void rgy_atomic_notify_all(std::atomic<uint32_t> *addr) {
+    WakeByAddressAll((PVOID)addr);
+}
+
 #endif //#if !(defined(_WIN32) || defined(_WIN64))
 
@@ -32,6 +32,7 @@
 #include <cstdint>
 #include <climits>
 #include <memory>
+#include <atomic>
 #include "rgy_osdep.h"
 
 #if defined(_WIN32) || defined(_WIN64)
@@ -68,4 +69,12 @@ unique_event CreateEventUnique(void *pDummy, int bManualReset, int bInitialState
 unique_event CreateEventUnique(void *pDummy, int bManualReset, int bInitialState, const wchar_t* name);
 unique_event CreateEventUnique(void *pDummy, int bManualReset, int bInitialState);
 
+//addrの値がexpectedと異なるものになるか、通知されるか、millisecが経過するまで待機する
+//Linuxではfutex、WindowsではWaitOnAddressを使用し、カーネル側で待機する
+//戻り値は、タイムアウトした場合はWAIT_TIMEOUT、それ以外はWAIT_OBJECT_0 (spurious wakeupもありうる)
+uint32_t rgy_atomic_wait(std::atomic<uint32_t> *addr, uint32_t expected, uint32_t millisec);
+//rgy_atomic_waitで待機しているスレッドを起こす
+void rgy_atomic_notify_one(std::atomic<uint32_t> *addr);
+void rgy_atomic_notify_all(std::atomic<uint32_t> *addr);
+
 #endif //__RGY_EVENT_H__
@@ -29,6 +29,11 @@
 #include <iostream>
 #include <fstream>
 #include <set>
+#include <map>
+#include <tuple>
+#include <random>
+#include <chrono>
+#include <limits>
 #include "rgy_input.h"
 #include "rgy_filesystem.h"
 #include "cpu_info.h"
@@ -79,20 +84,39 @@ const char *csp_rgy_to_y4mheader(const RGY_CSP csp) {
     return nullptr;
 }
 
-RGYConvertCSPPrm::RGYConvertCSPPrm() :
-    abort(false),
-    dst(nullptr),
-    src(nullptr),
-    interlaced(false),
-    width(0),
-    src_y_pitch_byte(0),
-    src_uv_pitch_byte(0),
-    dst_y_pitch_byte(0),
-    dst_uv_pitch_byte(0),
-    height(0),
-    dst_height(0),
-    crop(nullptr) {
+//1スレッドあたりの分割数
+//細かく分割しておき、空いたスレッドから順に処理させることで、スレッド間の処理時間の偏りを吸収する
+static const int RGY_CONVERT_CSP_BANDS_PER_THREAD = 4;
 
+//分割数によって出力が変わってしまう変換関数かどうか
+//これらは分割の境界で参照する行が変わるため、従来どおりスレッド数と同じ分割数で処理し、出力を変えないようにする
+static bool convert_csp_split_dependent(const ConvertCSP *csp) {
+    if (csp->simd == RGY_SIMD::NONE) {
+        return true;
+    }
+    return csp->csp_from == RGY_CSP_BGR24R && csp->csp_to == RGY_CSP_BGR32;
+}
+
+//現在のスレッドが動作しているNUMAノードのマスクを返す (NUMAでない場合は0)
+static uint64_t get_current_numa_node_mask() {
+    const auto cpu_info = get_cpu_info();
+    if (cpu_info.node_count <= 1) {
+        return 0;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    const int cpu = (int)GetCurrentProcessorNumber();
+#else
+    const int cpu = sched_getcpu();
+#endif
+    if (cpu < 0 || cpu >= 64) {
+        return 0;
+    }
+    for (int i = 0; i < cpu_info.node_count; i++) {
+        if (cpu_info.nodes[i].mask & (1llu << cpu)) {
+            return cpu_info.nodes[i].mask;
+        }
+    }
+    return 0;
 }
 
 
@@ -106,23 +130,25 @@ RGYConvertCSP::RGYConvertCSP(int threads, RGYParamThread threadParam) :
     m_uv_only(false),
     m_alpha(nullptr),
     m_threads(threads),
-    m_th(), m_heStart(), m_heFin(), m_heFinCopy(),
-    m_threadParam(threadParam), m_prm() {
+    m_pool(),
+    m_threadParam(threadParam) {
 };
 
 RGYConvertCSP::~RGYConvertCSP() {
-    m_prm.abort = true;
-    for (size_t i = 0; i < m_heStart.size(); i++) {
-        SetEvent(m_heStart[i].get());
-    }
-    for (size_t i = 0; i < m_th.size(); i++) {
-        m_th[i].join();
-    }
-    m_heFinCopy.clear();
-    m_heStart.clear();
-    m_heFin.clear();
-    m_th.clear();
+    m_pool.reset();
 };
+
+RGYParamThread RGYConvertCSP::poolThreadParam() const {
+    auto threadParam = m_threadParam;
+    if (threadParam.affinity.mode == RGYThreadAffinityMode::ALL) {
+        //affinityの指定がない場合、NUMA環境では変換元のバッファを読み書きする呼び出し元と同じノードで処理する
+        const auto nodeMask = get_current_numa_node_mask();
+        if (nodeMask) {
+            threadParam.affinity = RGYThreadAffinity(RGYThreadAffinityMode::CUSTOM, nodeMask);
+        }
+    }
+    return threadParam;
+}
 const ConvertCSP *RGYConvertCSP::getFunc(RGY_CSP csp_from, RGY_CSP csp_to, bool uv_only, RGY_SIMD simd) {
     if (m_csp == nullptr
         || (m_csp_from != csp_from || m_csp_to != csp_to || m_uv_only != uv_only)) {
@@ -139,58 +165,21 @@ const ConvertCSP *RGYConvertCSP::getFunc(RGY_CSP csp_from, RGY_CSP csp_to, RGY_S
     return getFunc(csp_from, csp_to, m_uv_only, simd);
 }
 
+const ConvertCSP *RGYConvertCSP::setFunc(const ConvertCSP *csp) {
+    m_csp_from = csp->csp_from;
+    m_csp_to = csp->csp_to;
+    m_uv_only = csp->uv_only;
+    m_alpha = get_copy_alpha_func(csp->csp_from, csp->csp_to);
+    m_csp = csp;
+    return m_csp;
+}
+
 int RGYConvertCSP::run(int interlaced, void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int *crop) {
     if (m_threads == 0) {
         const int div = (m_csp->simd == RGY_SIMD::NONE) ? 2 : 4;
         const int max = (m_csp->simd == RGY_SIMD::NONE) ? 8 : 4;
         m_threads = (dst_y_pitch_byte % 128 != 0) ? 1 : std::min(max, ((int)get_cpu_info().physical_cores + div) / div);
     }
-    if (m_threads > 1 && m_th.size() == 0) {
-        m_heFinCopy.clear();
-        m_heStart.clear();
-        m_heFin.clear();
-        for (int ith = 0; ith < m_threads; ith++) {
-            auto heStart = std::unique_ptr<void, handle_deleter>(CreateEvent(nullptr, false, false, nullptr), handle_deleter());
-            auto heFin = std::unique_ptr<void, handle_deleter>(CreateEvent(nullptr, false, false, nullptr), handle_deleter());
-            m_th.push_back(std::thread([heStart = heStart.get(), heFin = heFin.get(), ithId = ith, threadN = m_threads, threadParam = m_threadParam,
-                prm = &m_prm, cspfunc = &m_csp, alphafunc = m_alpha, csp_from = m_csp_from, csp_to = m_csp_to]() {
-                threadParam.apply(GetCurrentThread());
-                WaitForSingleObject((HANDLE)heStart, INFINITE);
-                while (!prm->abort) {
-                    (*cspfunc)->func[prm->interlaced](prm->dst, prm->src,
-                        prm->width, prm->src_y_pitch_byte, prm->src_uv_pitch_byte, prm->dst_y_pitch_byte, prm->dst_uv_pitch_byte,
-                        prm->height, prm->dst_height, ithId, threadN, prm->crop);
-                    if (alphafunc) {
-                        const int dstPlaneOffset = RGY_CSP_PLANES[csp_from] - 1;
-                        const int srcPlaneOffset = RGY_CSP_PLANES[csp_to] - 1;
-                        alphafunc(prm->dst + dstPlaneOffset, prm->src + srcPlaneOffset,
-                            prm->width, prm->src_y_pitch_byte, 0, prm->dst_y_pitch_byte, prm->dst_uv_pitch_byte,
-                            prm->height, prm->dst_height, ithId, threadN, prm->crop);
-                    }
-                    SetEvent((HANDLE)heFin);
-                    WaitForSingleObject((HANDLE)heStart, INFINITE);
-                }
-            }));
-            m_heFinCopy.push_back(heFin.get());
-            m_heStart.push_back(std::move(heStart));
-            m_heFin.push_back(std::move(heFin));
-        }
-    }
-    m_prm.abort = false;
-    m_prm.interlaced = interlaced;
-    m_prm.dst = dst;
-    m_prm.src = src;
-    m_prm.width = width;
-    m_prm.src_y_pitch_byte = src_y_pitch_byte;
-    m_prm.src_uv_pitch_byte = src_uv_pitch_byte;
-    m_prm.dst_y_pitch_byte = dst_y_pitch_byte;
-    m_prm.dst_uv_pitch_byte = dst_uv_pitch_byte;
-    m_prm.height = height;
-    m_prm.dst_height = dst_height;
-    m_prm.crop = crop;
-    for (size_t i = 0; i < m_heStart.size(); i++) {
-        SetEvent(m_heStart[i].get());
-    }
     if (m_threads == 1) {
         m_csp->func[interlaced](dst, src,
             width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte,
@@ -202,13 +191,205 @@ int RGYConvertCSP::run(int interlaced, void **dst, const void **src, int width,
                 width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte,
                 height, dst_height, 0, 1, crop);
         }
+        return 0;
     }
-    if (m_th.size() > 0) {
-        WaitForMultipleObjects((uint32_t)m_heFinCopy.size(), m_heFinCopy.data(), TRUE, INFINITE);
+    if (!m_pool) {
+        //呼び出し元のスレッドも処理に参加するので、ワーカーはm_threads-1
+        //同じ設定の変換を行うインスタンス間ではプールを共有し、スレッドを増やしすぎないようにする
+        m_pool = RGYThreadPool::shared(m_threads - 1, poolThreadParam());
     }
+    const int bands = convert_csp_split_dependent(m_csp) ? m_threads : m_threads * RGY_CONVERT_CSP_BANDS_PER_THREAD;
+    m_pool->parallel_for(0, bands, 1, [&](int band_start, int band_end) {
+        for (int iband = band_start; iband < band_end; iband++) {
+            m_csp->func[interlaced](dst, src,
+                width, src_y_pitch_byte, src_uv_pitch_byte, dst_y_pitch_byte, dst_uv_pitch_byte,
+                height, dst_height, iband, bands, crop);
+            if (m_alpha) {
+                const int dstPlaneOffset = RGY_CSP_PLANES[m_csp_from] - 1;
+                const int srcPlaneOffset = RGY_CSP_PLANES[m_csp_to] - 1;
+                m_alpha(dst + dstPlaneOffset, src + srcPlaneOffset,
+                    width, src_y_pitch_byte, 0, dst_y_pitch_byte, dst_uv_pitch_byte,
+                    height, dst_height, iband, bands, crop);
+            }
+        }
+    });
     return 0;
 }
 
+//ベンチマーク用のフレームバッファ
+//変換関数はプレーンごとにポインタを受け取るので、各プレーンは十分な大きさのpitchで確保しておく
+struct ConvertCSPBenchBuffer {
+    std::unique_ptr<uint8_t, decltype(&_aligned_free)> buf;
+    size_t size;
+    int pitch;
+    void *planes[4];
+
+    ConvertCSPBenchBuffer(RGY_CSP csp, int width, int height) : buf(nullptr, _aligned_free), size(0), pitch(0), planes() {
+        const int pixsize = std::max(1, ((int)RGY_CSP_BIT_DEPTH[csp] + 7) / 8);
+        //パック形式は1画素のバイト数、プレーナ形式はnv24のような色差のインタレースを考慮して2画素分をとる
+        const int bytesPerPixel = (RGY_CSP_PLANES[csp] <= 1) ? std::max(pixsize, (RGY_CSP_BIT_PER_PIXEL[csp] + 7) / 8) : pixsize * 2;
+        pitch = ALIGN(width * bytesPerPixel, 256);
+        const size_t planeSize = (size_t)pitch * height;
+        const int planeCount = std::max(1, (int)RGY_CSP_PLANES[csp]);
+        size = planeSize * (planeCount + 1) + 256; //行末やプレーン末尾を超えて読み書きする関数があっても落ちないよう、1プレーン分余分に確保する
+        buf.reset((uint8_t *)_aligned_malloc(size, 256));
+        memset(buf.get(), 0, size);
+        for (int i = 0; i < (int)_countof(planes); i++) {
+            planes[i] = buf.get() + planeSize * std::min(i, planeCount - 1);
+        }
+    }
+    //入力用に、データ型・ビット深度の範囲内の乱数で埋める
+    void fillRandom(RGY_CSP csp, std::mt19937& mt) {
+        switch (RGY_CSP_DATA_TYPE[csp]) {
+        case RGY_DATA_TYPE_U16: {
+            const uint16_t mask = (uint16_t)((1u << std::min<int>(RGY_CSP_BIT_DEPTH[csp], 16)) - 1);
+            auto ptr = (uint16_t *)buf.get();
+            for (size_t i = 0; i < size / sizeof(ptr[0]); i++) {
+                ptr[i] = (uint16_t)mt() & mask;
+            }
+        } break;
+        case RGY_DATA_TYPE_FP16: {
+            //0.0 - 1.0 (0x0000 - 0x3c00) の範囲とし、NaNやInfを避ける
+            std::uniform_int_distribution<int> dist(0x0000, 0x3c00);
+            auto ptr = (uint16_t *)buf.get();
+            for (size_t i = 0; i < size / sizeof(ptr[0]); i++) {
+                ptr[i] = (uint16_t)dist(mt);
+            }
+        } break;
+        case RGY_DATA_TYPE_FP32: {
+            std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+            auto ptr = (float *)buf.get();
+            for (size_t i = 0; i < size / sizeof(ptr[0]); i++) {
+                ptr[i] = dist(mt);
+            }
+        } break;
+        default: {
+            auto ptr = (uint32_t *)buf.get();
+            for (size_t i = 0; i < size / sizeof(ptr[0]); i++) {
+                ptr[i] = (uint32_t)mt();
+            }
+        } break;
+        }
+    }
+    void clear(uint8_t value = 0) {
+        memset(buf.get(), value, size);
+    }
+};
+
+//変換で読み書きする1フレームあたりのバイト数 (uv_onlyの場合は輝度を除く)
+static double convert_csp_bench_frame_bytes(RGY_CSP csp, bool uv_only, int width, int height) {
+    const double pixels = (double)width * height;
+    double bytes = pixels * RGY_CSP_BIT_PER_PIXEL[csp] / 8.0;
+    if (uv_only) {
+        bytes -= pixels * ((RGY_CSP_BIT_DEPTH[csp] + 7) / 8);
+    }
+    return std::max(bytes, 0.0);
+}
+
+std::string benchmark_convert_csp(const std::vector<std::pair<int, int>>& resolutions, const std::vector<int>& threads) {
+    //1回の計測は、最低でもこの回数・時間だけ繰り返し、最小の処理時間をとる
+    static const int BENCH_MIN_LOOP = 3;
+    static const double BENCH_MIN_SEC = 0.02;
+
+    const auto funcList = get_convert_csp_func_list();
+    //比較の基準とするのは、同じ変換のうち最も低いSIMDのもの (通常はC版)
+    std::map<std::tuple<RGY_CSP, RGY_CSP, bool>, const ConvertCSP *> refList;
+    for (const auto func : funcList) {
+        const auto key = std::make_tuple(func->csp_from, func->csp_to, func->uv_only);
+        auto it = refList.find(key);
+        if (it == refList.end() || popcnt64((uint64_t)func->simd) < popcnt64((uint64_t)it->second->simd)) {
+            refList[key] = func;
+        }
+    }
+    std::map<int, std::unique_ptr<RGYConvertCSP>> converters;
+    for (const auto th : threads) {
+        if (th > 0 && converters.count(th) == 0) {
+            converters[th] = std::make_unique<RGYConvertCSP>(th, RGYParamThread());
+        }
+    }
+    char cpuName[256] = { 0 };
+    getCPUName(cpuName, _countof(cpuName));
+    const double cpuClockGHz = getCPUMaxTurboClock();
+
+    std::string json = "{\n";
+    json += strsprintf("  \"cpu\": \"%s\",\n", cpuName);
+    json += strsprintf("  \"cpu_clock_ghz\": %.3f,\n", cpuClockGHz);
+    json += "  \"results\": [\n";
+    int mismatchCount = 0;
+    bool first = true;
+    std::mt19937 mt(1234);
+    int crop[4] = { 0 };
+    for (const auto& res : resolutions) {
+        const int width = res.first;
+        const int height = res.second;
+        for (const auto& ref : refList) {
+            const auto refFunc = ref.second;
+            ConvertCSPBenchBuffer src(refFunc->csp_from, width, height);
+            ConvertCSPBenchBuffer dstRef0(refFunc->csp_to, width, height);
+            ConvertCSPBenchBuffer dstRef(refFunc->csp_to, width, height);
+            ConvertCSPBenchBuffer dst(refFunc->csp_to, width, height);
+            src.fillRandom(refFunc->csp_from, mt);
+            //SIMD版はpitchの範囲内で画像の右端を超えて書き込むことがあるので、
+            //出力先を0x00と0xffで埋めて基準の関数を2回実行し、結果の一致する(=実際に書き込まれた)バイトのみを比較対象とする
+            refFunc->func[0](dstRef0.planes, (const void **)src.planes, width, src.pitch, src.pitch, dstRef0.pitch, dstRef0.pitch, height, height, 0, 1, crop);
+            dstRef.clear(0xff);
+            refFunc->func[0](dstRef.planes, (const void **)src.planes, width, src.pitch, src.pitch, dstRef.pitch, dstRef.pitch, height, height, 0, 1, crop);
+
+            const double frameBytes = convert_csp_bench_frame_bytes(refFunc->csp_from, refFunc->uv_only, width, height)
+                                    + convert_csp_bench_frame_bytes(refFunc->csp_to,   refFunc->uv_only, width, height);
+            for (const auto func : funcList) {
+                if (std::make_tuple(func->csp_from, func->csp_to, func->uv_only) != ref.first) {
+                    continue;
+                }
+                for (auto& conv : converters) {
+                    conv.second->setFunc(func);
+                    //1回目は出力の確認用 (ウォームアップも兼ねる)
+                    dst.clear();
+                    conv.second->run(0, dst.planes, (const void **)src.planes, width, src.pitch, src.pitch, dst.pitch, dst.pitch, height, height, crop);
+                    bool bitExact = true;
+                    for (size_t i = 0; i < dst.size && bitExact; i++) {
+                        bitExact = dstRef0.buf.get()[i] != dstRef.buf.get()[i] || dst.buf.get()[i] == dstRef.buf.get()[i];
+                    }
+                    if (!bitExact) {
+                        mismatchCount++;
+                    }
+                    double minSec = std::numeric_limits<double>::max();
+                    const auto benchStart = std::chrono::high_resolution_clock::now();
+                    for (int i = 0; i < BENCH_MIN_LOOP
+                        || std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - benchStart).count() < BENCH_MIN_SEC; i++) {
+                        const auto start = std::chrono::high_resolution_clock::now();
+                        conv.second->run(0, dst.planes, (const void **)src.planes, width, src.pitch, src.pitch, dst.pitch, dst.pitch, height, height, crop);
+                        const auto fin = std::chrono::high_resolution_clock::now();
+                        minSec = std::min(minSec, std::chrono::duration<double>(fin - start).count());
+                    }
+                    if (!first) {
+                        json += ",\n";
+                    }
+                    first = false;
+                    json += strsprintf("    { \"from\": \"%s\", \"to\": \"%s\", \"uv_only\": %s, \"simd\": \"%s\", \"width\": %d, \"height\": %d, \"threads\": %d, ",
+                        tchar_to_string(RGY_CSP_NAMES[func->csp_from]).c_str(), tchar_to_string(RGY_CSP_NAMES[func->csp_to]).c_str(),
+                        func->uv_only ? "true" : "false",
+                        (func->simd == RGY_SIMD::NONE) ? "C" : tchar_to_string(get_simd_str(func->simd)).c_str(),
+                        width, height, conv.first);
+                    json += strsprintf("\"time_ms\": %.4f, \"gbps\": %.3f, ", minSec * 1e3, frameBytes / minSec * 1e-9);
+                    if (cpuClockGHz > 0.0) {
+                        json += strsprintf("\"cycles_per_pixel\": %.3f, ", minSec * cpuClockGHz * 1e9 / ((double)width * height));
+                    } else {
+                        json += "\"cycles_per_pixel\": null, ";
+                    }
+                    json += strsprintf("\"reference_simd\": \"%s\", \"bitexact\": %s }",
+                        (refFunc->simd == RGY_SIMD::NONE) ? "C" : tchar_to_string(get_simd_str(refFunc->simd)).c_str(),
+                        bitExact ? "true" : "false");
+                }
+            }
+        }
+    }
+    json += "\n  ],\n";
+    json += strsprintf("  \"mismatch\": %d\n", mismatchCount);
+    json += "}\n";
+    return json;
+}
+
 #if !FOR_AUO
 
 std::vector<int> read_keyfile(tstring keyfile) {
@@ -571,10 +752,15 @@ RGY_ERR initReaders(
 
     RGYInputPrmRaw inputPrmRaw(inputPrm);
     inputPrmRaw.inputCsp = inputCspOfRawReader;
+    inputPrmRaw.threadParamInput = ctrl->threadParams.get(RGYThreadType::INPUT);
     if (ctrl->parallelEnc.isChild() && ctrl->parallelEnc.chunkPipeHandles.size() > 0) { // 親の場合は設定してはいけない
         // 親が子の実行すべきchunkを選択して先頭に設定してあるので、それを設定
         inputPrmRaw.chunkPipeHandle = ctrl->parallelEnc.chunkPipeHandles.front();
     }
+    if (ctrl->parallelEnc.isChild() && ctrl->parallelEnc.inputChunk) {
+        // 親が読み込んだチャンク分の入力データを使用する
+        inputPrmRaw.inputChunk = ctrl->parallelEnc.inputChunk;
+    }
 #if ENABLE_AVISYNTH_READER
     RGYInputAvsPrm inputPrmAvs(inputPrm);
 #endif
@@ -658,6 +844,7 @@ RGY_ERR initReaders(
         inputInfoAVCuvid.seekToSec = common->seekToSec;
         inputInfoAVCuvid.logFramePosList = ctrl->logFramePosList.getFilename(common->inputFilename, _T(".framelist.csv"));
         inputInfoAVCuvid.logPackets = ctrl->logPacketsList.getFilename(common->inputFilename, _T(".packets.csv"));
+        inputInfoAVCuvid.seekIndexFile = common->inputIndex.getFilename(common->inputFilename, _T(".rgyidx"));
         inputInfoAVCuvid.threadInput = ctrl->threadInput;
         inputInfoAVCuvid.threadParamInput = ctrl->threadParams.get(RGYThreadType::INPUT);
         inputInfoAVCuvid.queueInfo = (perfMonitor) ? perfMonitor->GetQueueInfoPtr() : nullptr;
@@ -673,6 +860,13 @@ RGY_ERR initReaders(
         inputInfoAVCuvid.timestampPassThrough = common->timestampPassThrough;
         inputInfoAVCuvid.hevcbsf = common->hevcbsf;
         inputInfoAVCuvid.avswDecoder = inprm->avswDecoder;
+        inputInfoAVCuvid.parallelEncParent = ctrl->parallelEnc.isParent();
+        if (ctrl->parallelEnc.isChild() && ctrl->parallelEnc.inputChunk) {
+            // 親が読み込んだチャンク分の映像パケットを使用する (映像ストリームのみとなる)
+            inputInfoAVCuvid.inputChunk = ctrl->parallelEnc.inputChunk;
+            inputInfoAVCuvid.videoTrack = 0;
+            inputInfoAVCuvid.videoStreamId = 0;
+        }
         pInputPrm = &inputInfoAVCuvid;
         log->write(RGY_LOG_DEBUG, RGY_LOGT_IN, _T("avhw/sw reader selected.\n"));
         pFileReader.reset(new RGYInputAvcodec());
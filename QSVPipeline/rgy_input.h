@@ -35,6 +35,7 @@
 #include "rgy_tchar.h"
 #include "rgy_log.h"
 #include "rgy_event.h"
+#include "rgy_thread_pool.h"
 #include "rgy_status.h"
 #include "rgy_timecode.h"
 #include "convert_csp.h"
@@ -120,23 +121,6 @@ static const char *trackMediaTypeStr(int trackID) {
 }
 #endif //#if ENABLE_AVSW_READER
 
-struct RGYConvertCSPPrm {
-    bool abort;
-    void **dst;
-    const void **src;
-    int interlaced;
-    int width;
-    int src_y_pitch_byte;
-    int src_uv_pitch_byte;
-    int dst_y_pitch_byte;
-    int dst_uv_pitch_byte;
-    int height;
-    int dst_height;
-    int *crop;
-
-    RGYConvertCSPPrm();
-};
-
 class RGYConvertCSP {
 private:
     const ConvertCSP *m_csp;
@@ -145,12 +129,10 @@ private:
     bool m_uv_only;
     funcConvertCSP m_alpha;
     int m_threads;
-    std::vector<std::thread> m_th;
-    std::vector<std::unique_ptr<void, handle_deleter>> m_heStart;
-    std::vector<std::unique_ptr<void, handle_deleter>> m_heFin;
-    std::vector<HANDLE> m_heFinCopy;
+    std::shared_ptr<RGYThreadPool> m_pool; // プロセス内で共有するプール (呼び出し元スレッドも処理に参加するので、m_threads-1スレッド)
     RGYParamThread m_threadParam;
-    RGYConvertCSPPrm m_prm;
+
+    RGYParamThread poolThreadParam() const;
 public:
     RGYConvertCSP();
     RGYConvertCSP(int threads, RGYParamThread threadParam);
@@ -158,10 +140,16 @@ public:
     const ConvertCSP *getFunc(RGY_CSP csp_from, RGY_CSP csp_to, RGY_SIMD simd);
     const ConvertCSP *getFunc(RGY_CSP csp_from, RGY_CSP csp_to, bool uv_only, RGY_SIMD simd);
     const ConvertCSP *getFunc() const { return m_csp; };
+    //SIMDの選択を行わず、変換関数を直接指定する (ベンチマーク用)
+    const ConvertCSP *setFunc(const ConvertCSP *csp);
 
     int run(int interlaced, void **dst, const void **src, int width, int src_y_pitch_byte, int src_uv_pitch_byte, int dst_y_pitch_byte, int dst_uv_pitch_byte, int height, int dst_height, int *crop);
 };
 
+//このCPUで実行可能なすべての変換関数について、解像度・スレッド数ごとに速度を計測し、結果をjson形式で返す
+//SIMD版の出力は、C版(ない場合は最も低いSIMD版)の1スレッドでの出力と一致するかも確認する
+std::string benchmark_convert_csp(const std::vector<std::pair<int, int>>& resolutions, const std::vector<int>& threads);
+
 class RGYInputPrm {
 public:
     int threadCsp;
@@ -177,6 +165,116 @@ public:
     virtual ~RGYInputPrm() {};
 };
 
+//並列エンコードで、親が入力を読み込んで子に分配する場合のチャンクの長さの制限
+//maxSizeは保持するデータ量の上限で、これを超えてチャンクに格納することはない
+//minSecの長さのチャンクがmaxSizeに収まらない場合は分配できないので、RGY_ERR_NOT_ENOUGH_BUFFERとする (短いチャンクが大量にできるのを防ぐ)
+struct RGYInputChunkLimit {
+    size_t maxSize;   //チャンクのデータ量の上限
+    double minSec;    //チャンクの長さの下限 (秒)
+    double targetSec; //チャンクの長さの目標 (秒)
+
+    RGYInputChunkLimit(size_t maxSize_, double minSec_, double targetSec_) : maxSize(maxSize_), minSec(minSec_), targetSec(targetSec_) {};
+    //チャンクをここで区切るか (nextSizeは次に区切れる位置までに追加されると見込まれるデータ量)
+    bool fin(size_t size, size_t nextSize, double sec) const { return sec >= minSec && (!fits(size, nextSize) || sec >= targetSec); }
+    //チャンクにaddSizeのデータを追加しても上限に収まるか
+    bool fits(size_t size, size_t addSize) const { return size + addSize <= maxSize; }
+};
+
+//並列エンコードで、パイプ入力などで子が個別に入力を開けない場合に、親が読み込んでチャンクごとに子へ渡す入力データ
+//raw/y4mの場合はフレームを、avcodecの場合は映像ストリームの情報とパケットを格納する
+//親はRGYInput::parallelEncFanOut()でチャンク分のデータをすべて読み込んでから子を起動するので、
+//子は先頭から順に取り出すだけでよい (ロックは不要)
+class RGYInputChunk {
+public:
+    RGYInputChunk(int startFrameId) : m_startFrameId(startFrameId), m_header(), m_frames(), m_next(0), m_size(0)
+#if ENABLE_AVSW_READER
+        , m_codecpar(), m_timebase(), m_avgFramerate(), m_rFramerate(), m_pkts(), m_overlapPkts(0)
+#endif //#if ENABLE_AVSW_READER
+    {};
+    ~RGYInputChunk() {
+#if ENABLE_AVSW_READER
+        for (auto& pkt : m_pkts) {
+            av_packet_free(&pkt);
+        }
+#endif //#if ENABLE_AVSW_READER
+    };
+
+    int startFrameId() const { return m_startFrameId; }
+    //チャンクに含まれるフレーム数 (次のチャンクと重複して持つパケットは含まない)
+    int frames() const {
+#if ENABLE_AVSW_READER
+        return (int)(m_frames.size() + m_pkts.size()) - m_overlapPkts;
+#else
+        return (int)m_frames.size();
+#endif //#if ENABLE_AVSW_READER
+    }
+    size_t size() const { return m_size; }
+    const std::string& header() const { return m_header; }
+    void setHeader(const std::string& header) { m_header = header; }
+    //(親) 読み込んだフレームを追加する
+    void addFrame(std::unique_ptr<uint8_t, aligned_malloc_deleter> frame, size_t frameSize) {
+        m_frames.push_back(std::move(frame));
+        m_size += frameSize;
+    }
+    //(子) 次のフレームを取得する (終端ならnullptr)
+    //前回取得したフレームは使用済みとして開放する
+    const uint8_t *nextFrame() {
+        if (m_next > 0) {
+            m_frames[m_next - 1].reset();
+        }
+        return (m_next < m_frames.size()) ? m_frames[m_next++].get() : nullptr;
+    }
+#if ENABLE_AVSW_READER
+    //(親) 映像ストリームの情報を設定する
+    RGY_ERR setVideoStream(const AVStream *stream) {
+        m_codecpar = std::unique_ptr<AVCodecParameters, RGYAVDeleter<AVCodecParameters>>(avcodec_parameters_alloc(), RGYAVDeleter<AVCodecParameters>(avcodec_parameters_free));
+        if (!m_codecpar || avcodec_parameters_copy(m_codecpar.get(), stream->codecpar) < 0) {
+            return RGY_ERR_NULL_PTR;
+        }
+        m_timebase = stream->time_base;
+        m_avgFramerate = stream->avg_frame_rate;
+        m_rFramerate = stream->r_frame_rate;
+        return RGY_ERR_NONE;
+    }
+    const AVCodecParameters *codecpar() const { return m_codecpar.get(); }
+    AVRational timebase() const { return m_timebase; }
+    AVRational avgFramerate() const { return m_avgFramerate; }
+    AVRational rFramerate() const { return m_rFramerate; }
+    int packets() const { return (int)m_pkts.size(); }
+    //(親) 読み込んだパケットを追加する (所有権はchunkに移る)
+    //overlap: 次のチャンクの先頭と重複して持つパケット (分割位置のキーフレームとそのleading picture)
+    void addPacket(AVPacket *pkt, bool overlap) {
+        m_pkts.push_back(pkt);
+        m_size += pkt->size;
+        m_overlapPkts += (overlap) ? 1 : 0;
+    }
+    //(子) 次のパケットをpktに移す (終端ならfalse)
+    bool nextPacket(AVPacket *pkt) {
+        if (m_next >= m_pkts.size()) {
+            return false;
+        }
+        av_packet_move_ref(pkt, m_pkts[m_next]);
+        av_packet_free(&m_pkts[m_next]);
+        m_next++;
+        return true;
+    }
+#endif //#if ENABLE_AVSW_READER
+protected:
+    int m_startFrameId;   //チャンクの先頭のフレームID
+    std::string m_header; //入力のヘッダ (y4mの場合)
+    std::vector<std::unique_ptr<uint8_t, aligned_malloc_deleter>> m_frames;
+    size_t m_next;
+    size_t m_size;        //読み込んだデータの合計
+#if ENABLE_AVSW_READER
+    std::unique_ptr<AVCodecParameters, RGYAVDeleter<AVCodecParameters>> m_codecpar; //映像ストリームの情報 (avcodecの場合)
+    AVRational m_timebase;
+    AVRational m_avgFramerate;
+    AVRational m_rFramerate;
+    std::vector<AVPacket*> m_pkts; //映像パケット (avcodecの場合)
+    int m_overlapPkts;             //m_pktsのうち、次のチャンクと重複して持つパケットの数
+#endif //#if ENABLE_AVSW_READER
+};
+
 class RGYInput {
 public:
     RGYInput();
@@ -252,6 +350,24 @@ public:
     virtual bool isPipe() const {
         return false;
     }
+    //並列エンコード時に、親が入力を読み込んでチャンクごとに子へ分配できるか
+    virtual bool parallelEncFanOutSupported() const {
+        return false;
+    }
+    //並列エンコード時に、親でseek用のindexファイルを別スレッドで作成する (作成が必要な場合のみ)
+    virtual void startSeekIndexBuild() {
+    }
+#pragma warning(push)
+#pragma warning(disable: 4100)
+    //並列エンコード時に、親が入力からlimitで区切られるところまで読み込み、chunkに格納する
+    //入力の終端に達した場合はRGY_ERR_MORE_DATAを返す
+    virtual RGY_ERR parallelEncFanOut(RGYInputChunk *chunk, const RGYInputChunkLimit& limit) {
+        return RGY_ERR_UNSUPPORTED;
+    }
+#pragma warning(pop)
+    //並列エンコードの親で、子への分配を終了する (並列エンコードを無効化した場合など)
+    virtual void parallelEncFanOutClose() {
+    }
 
 #if ENABLE_AVSW_READER
 #pragma warning(push)
@@ -43,6 +43,7 @@
 #include "rgy_filesystem.h"
 #include "rgy_language.h"
 #include "rgy_bitstream_aac.h"
+#include "rgy_trace.h"
 
 
 #if ENABLE_AVSW_READER
@@ -144,7 +145,6 @@ AVDemuxVideo::AVDemuxVideo() :
     HWDecodeDeviceId(),
     hevcbsf(RGYHEVCBsf::INTERNAL),
     bUseHEVCmp42AnnexB(false),
-    hevcNaluLengthSize(0),
     hdr10plusMetadataCopy(false),
     doviRpuMetadataCopy(false),
     simdCsp(RGY_SIMD::SIMD_ALL),
@@ -223,6 +223,22 @@ void AVDemuxThread::close(RGYLog *log) {
     bAbortInput = false;
 }
 
+void AVDemuxFanOut::close() {
+    std::lock_guard<std::mutex> lock(mtx);
+    enable = false;
+    abort = true;
+    for (auto& pkt : pkts) {
+        av_packet_free(&pkt);
+    }
+    pkts.clear();
+    for (auto& pkt : carry) {
+        av_packet_free(&pkt);
+    }
+    carry.clear();
+    queuedSize = 0;
+    cv.notify_all();
+}
+
 RGYInputAvcodecPrm::RGYInputAvcodecPrm(RGYInputPrm base) :
     RGYInputPrm(base),
     inputRetry(0),
@@ -262,6 +278,7 @@ RGYInputAvcodecPrm::RGYInputAvcodecPrm(RGYInputPrm base) :
     logFramePosList(),
     logCopyFrameData(),
     logPackets(),
+    seekIndexFile(),
     threadInput(0),
     threadParamInput(),
     queueInfo(nullptr),
@@ -276,7 +293,9 @@ RGYInputAvcodecPrm::RGYInputAvcodecPrm(RGYInputPrm base) :
     qpTableListRef(nullptr),
     inputOpt(),
     hevcbsf(RGYHEVCBsf::INTERNAL),
-    avswDecoder() {
+    avswDecoder(),
+    parallelEncParent(false),
+    inputChunk(nullptr) {
 
 }
 
@@ -284,7 +303,12 @@ RGYInputAvcodec::RGYInputAvcodec() :
     m_Demux(),
     m_logFramePosList(),
     m_fpPacketList(),
-    m_hevcMp42AnnexbBuffer() {
+    m_mp42Annexb(),
+    m_seekIndex(),
+    m_seekIndexSrcFile(),
+    m_seekIndexThread(),
+    m_seekIndexAbort(false),
+    m_inputChunk(nullptr) {
     m_readerName = _T("av" DECODER_NAME "/avsw");
 }
 
@@ -339,13 +363,20 @@ void RGYInputAvcodec::CloseStream(AVDemuxStream *stream) {
 void RGYInputAvcodec::Close() {
     AddMessage(RGY_LOG_DEBUG, _T("Closing...\n"));
     //リソースの解放
+    parallelEncFanOutClose();
     CloseThread();
+    if (m_seekIndexThread.joinable()) {
+        m_seekIndexAbort = true;
+        m_seekIndexThread.join();
+        AddMessage(RGY_LOG_DEBUG, _T("Closed index thread.\n"));
+    }
     m_Demux.qVideoPkt.close([](AVPacket **pkt) { av_packet_free(pkt); });
     for (uint32_t i = 0; i < m_Demux.qStreamPktL1.size(); i++) {
         av_packet_free(&m_Demux.qStreamPktL1[i]);
     }
     m_Demux.qStreamPktL1.clear();
     m_Demux.qStreamPktL2.close([](AVPacket **pkt) { av_packet_free(pkt); });
+    m_Demux.qStreamPktL2PushedMaxPts = AV_NOPTS_VALUE;
     AddMessage(RGY_LOG_DEBUG, _T("Closed Stream Packet Buffer.\n"));
 
     CloseFormat(&m_Demux.format); AddMessage(RGY_LOG_DEBUG, _T("Closed format.\n"));
@@ -361,8 +392,7 @@ void RGYInputAvcodec::Close() {
 
     m_trimParam.list.clear();
     m_trimParam.offset = 0;
-
-    m_hevcMp42AnnexbBuffer.clear();
+    m_seekIndex.close();
 
     //free input buffer (使用していない)
     //if (buffer) {
@@ -399,10 +429,11 @@ RGY_ERR RGYInputAvcodec::initVideoBsfs() {
     // NVEnc issue#70でm_Demux.video.bUseHEVCmp42AnnexBを使用することが効果的だあったため、採用したが、
     // NVEnc issue#389ではm_Demux.video.bUseHEVCmp42AnnexBを使用するとエラーとなることがわかった
     // さらに、#389の問題はirapがありヘッダーがない場合の処理の問題と分かった。これを修正し、再度有効に
-    if (m_Demux.video.stream->codecpar->codec_id == AV_CODEC_ID_HEVC
+    // H.264もIDRの前にSPS/PPSを挿入する同様の処理で対応できるので、内部実装を使用する
+    if ((m_Demux.video.stream->codecpar->codec_id == AV_CODEC_ID_HEVC || m_Demux.video.stream->codecpar->codec_id == AV_CODEC_ID_H264)
         && m_Demux.video.hevcbsf == RGYHEVCBsf::INTERNAL) {
         m_Demux.video.bUseHEVCmp42AnnexB = true;
-        AddMessage(RGY_LOG_DEBUG, _T("selected internal hevc bsf filter.\n"));
+        AddMessage(RGY_LOG_DEBUG, _T("selected internal %s bsf filter.\n"), char_to_tstring(avcodec_get_name(m_Demux.video.stream->codecpar->codec_id)).c_str());
     } else if (m_Demux.video.stream->codecpar->codec_id == AV_CODEC_ID_H264 ||
         m_Demux.video.stream->codecpar->codec_id == AV_CODEC_ID_HEVC) {
         const char *filtername = nullptr;
@@ -672,83 +703,53 @@ bool RGYInputAvcodec::isSelectedCodecTrack(const std::string &selectCodec, const
     return desc->id == stream->codecpar->codec_id;
 }
 
-void RGYInputAvcodec::hevcMp42Annexb(AVPacket *pkt) {
-    static const uint8_t SC[] = { 0, 0, 0, 1 };
+void RGYInputAvcodec::mp42Annexb(AVPacket *pkt) {
+    const auto codec = (m_Demux.video.stream->codecpar->codec_id == AV_CODEC_ID_H264) ? RGY_CODEC_H264 : RGY_CODEC_HEVC;
     if (pkt == NULL) {
-        m_hevcMp42AnnexbBuffer.reserve(m_Demux.video.extradataSize + 128);
-        const uint8_t *ptr = m_Demux.video.extradata;
-        const uint8_t *ptr_fin = ptr + m_Demux.video.extradataSize;
-        ptr += 21;
-        m_Demux.video.hevcNaluLengthSize = ((*ptr) & 3) + 1; ptr++;
-        const int numOfArrays = *ptr; ptr++;
-        for (int ia = 0; ia < numOfArrays; ia++) {
-            ptr++;
-            const int count = readUB16(ptr); ptr += 2;
-            for (int i = (std::max)(1, count); i; i--) {
-                uint32_t size = readUB16(ptr); ptr += 2;
-                m_hevcMp42AnnexbBuffer.insert(m_hevcMp42AnnexbBuffer.end(), SC, SC + 4);
-                m_hevcMp42AnnexbBuffer.insert(m_hevcMp42AnnexbBuffer.end(), ptr, ptr + size); ptr += size;
-            }
+        auto err = m_mp42Annexb.setExtradata(codec, m_Demux.video.extradata, m_Demux.video.extradataSize);
+        if (err != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_WARN, _T("mp42Annexb: failed to parse extradata: %s.\n"), get_err_mes(err));
         }
+        const auto& header = m_mp42Annexb.header();
         if (m_Demux.video.extradata) {
             av_free(m_Demux.video.extradata);
         }
-        m_Demux.video.extradata = (uint8_t *)av_malloc(m_hevcMp42AnnexbBuffer.size() + AV_INPUT_BUFFER_PADDING_SIZE);
-        m_Demux.video.extradataSize = (int)m_hevcMp42AnnexbBuffer.size();
-        memcpy(m_Demux.video.extradata, m_hevcMp42AnnexbBuffer.data(), m_hevcMp42AnnexbBuffer.size());
+        m_Demux.video.extradata = (uint8_t *)av_malloc(header.size() + AV_INPUT_BUFFER_PADDING_SIZE);
+        m_Demux.video.extradataSize = (int)header.size();
+        memcpy(m_Demux.video.extradata, header.data(), header.size());
         memset(m_Demux.video.extradata + m_Demux.video.extradataSize, 0, AV_INPUT_BUFFER_PADDING_SIZE);
-        if (ptr != ptr_fin) {
-            AddMessage(RGY_LOG_WARN, _T("hevcMp42Annexb extradata: data left behind %d bytes"), (int)(ptr_fin - ptr));
-        }
     } else {
-        bool vps_exist = false;
-        bool sps_exist = false;
-        bool pps_exist = false;
-        bool got_irap = false;
-        const int hevcNaluLengthSize = m_Demux.video.hevcNaluLengthSize;
-        m_hevcMp42AnnexbBuffer.reserve(pkt->size + 128);
-        const uint8_t *ptr = pkt->data;
-        const uint8_t *ptr_fin = ptr + pkt->size;
-        while (ptr + hevcNaluLengthSize < ptr_fin) {
-            uint32_t size = 0;
-            for (int i = 0; i < hevcNaluLengthSize; i++) {
-                size = (size << 8) | (*ptr); ptr++;
-            }
-            const int nalu_type = ((*ptr) >> 1) & 0x3f;
-            vps_exist |= nalu_type == NALU_HEVC_VPS;
-            sps_exist |= nalu_type == NALU_HEVC_SPS;
-            pps_exist |= nalu_type == NALU_HEVC_PPS;
-            const bool header_exist = vps_exist && sps_exist && pps_exist;
-            const bool is_irap = nalu_type >= 16 && nalu_type <= 23;
-            // ヘッダーがすでにある場合は、extra dataをつけないようにする (header_existでチェック)
-            // 1度つけていたら、もうつけない (got_irapでチェック)
-            const bool add_extradata = is_irap && !got_irap && !header_exist;
-            got_irap |= is_irap;
-
-            if (add_extradata) {
-                m_hevcMp42AnnexbBuffer.insert(m_hevcMp42AnnexbBuffer.end(), m_Demux.video.extradata, m_Demux.video.extradata + m_Demux.video.extradataSize);
-            }
-            m_hevcMp42AnnexbBuffer.insert(m_hevcMp42AnnexbBuffer.end(), SC, SC + 4);
-            m_hevcMp42AnnexbBuffer.insert(m_hevcMp42AnnexbBuffer.end(), ptr, ptr + size); ptr += size;
-        }
-        if (pkt->buf->size < m_hevcMp42AnnexbBuffer.size() + AV_INPUT_BUFFER_PADDING_SIZE) {
-            av_grow_packet(pkt, (int)m_hevcMp42AnnexbBuffer.size() + AV_INPUT_BUFFER_PADDING_SIZE);
-        }
-        memcpy(pkt->data, m_hevcMp42AnnexbBuffer.data(), m_hevcMp42AnnexbBuffer.size());
-        memset(pkt->data + m_hevcMp42AnnexbBuffer.size(), 0, AV_INPUT_BUFFER_PADDING_SIZE);
-        pkt->size = (int)m_hevcMp42AnnexbBuffer.size();
-        if (ptr != ptr_fin) {
-            AddMessage(RGY_LOG_WARN, _T("hevcMp42Annexb: data left behind %d bytes"), (int)(ptr_fin - ptr));
-        }
-    }
-    m_hevcMp42AnnexbBuffer.clear();
+        //extradataが変更された場合のみ、ヘッダを作り直す
+        std::remove_pointer<RGYArgN<2U, decltype(av_packet_get_side_data)>::type>::type side_data_size = 0;
+        auto side_data = av_packet_get_side_data(pkt, AV_PKT_DATA_NEW_EXTRADATA, &side_data_size);
+        if (side_data && side_data_size > 0 && side_data[0] == 1) {
+            auto err = m_mp42Annexb.setExtradata(codec, side_data, side_data_size);
+            if (err != RGY_ERR_NONE) {
+                AddMessage(RGY_LOG_WARN, _T("mp42Annexb: failed to parse new extradata: %s.\n"), get_err_mes(err));
+            }
+        }
+        const int outSize = (int)m_mp42Annexb.prepare(pkt->data, pkt->size);
+        //長さフィールドが4byteでヘッダの挿入もなければ、サイズは変わらずその場で変換される
+        const int ret = (outSize > pkt->size) ? av_grow_packet(pkt, outSize - pkt->size) : av_packet_make_writable(pkt);
+        if (ret < 0) {
+            AddMessage(RGY_LOG_ERROR, _T("mp42Annexb: failed to allocate packet: %s.\n"), qsv_av_err2str(ret).c_str());
+            return;
+        }
+        m_mp42Annexb.convert(pkt->data);
+        if (outSize < pkt->size) {
+            av_shrink_packet(pkt, outSize);
+        }
+        if (m_mp42Annexb.leftover() > 0) {
+            AddMessage(RGY_LOG_WARN, _T("mp42Annexb: data left behind %d bytes"), (int)m_mp42Annexb.leftover());
+        }
+    }
 }
 
 const AVPacket *RGYInputAvcodec::findFirstAudioStreamPackets(const AVDemuxStream& streamInfo) {
     //まず、L2キューを探す
     for (int j = 0; j < (int)m_Demux.qStreamPktL2.size(); j++) {
-        if (m_Demux.qStreamPktL2.get(j)->data->stream_index == streamInfo.index) {
-            return m_Demux.qStreamPktL2.get(j)->data;
+        if ((*m_Demux.qStreamPktL2.get(j))->stream_index == streamInfo.index) {
+            return *m_Demux.qStreamPktL2.get(j);
         }
     }
     //それで見つからなかったら、L1キューを探す
@@ -763,6 +764,19 @@ const AVPacket *RGYInputAvcodec::findFirstAudioStreamPackets(const AVDemuxStream
 RGY_ERR RGYInputAvcodec::getFirstFramePosAndFrameRate(const sTrim *pTrimList, int nTrimCount, bool bDetectpulldown, bool lowLatency, rgy_rational<int> fpsOverride) {
     AVRational fpsDecoder = m_Demux.video.stream->avg_frame_rate;
     const bool fpsDecoderInvalid = (fpsDecoder.den == 0 || fpsDecoder.num == 0);
+    const bool fpsUserSpecified = fpsOverride.is_valid();
+    //indexファイルに同じ条件での解析結果があれば、そのfpsを使用して解析を省略する
+    //ただし、ptsに問題がある場合やtrimのoffsetを取得する必要がある場合は、これまで通り解析する
+    if (!fpsUserSpecified && m_seekIndex.loaded() && nTrimCount == 0) {
+        const auto& analysis = m_seekIndex.analysis();
+        if (analysis.fpsNum > 0 && analysis.fpsDen > 0
+            && analysis.ptsStatus == RGY_PTS_NORMAL
+            && analysis.detectPulldown == (bDetectpulldown ? 1 : 0)
+            && analysis.analyzeSec == m_Demux.format.analyzeSec) {
+            fpsOverride = rgy_rational<int>(analysis.fpsNum, analysis.fpsDen);
+            AddMessage(RGY_LOG_DEBUG, _T("use fps %d/%d from index file.\n"), analysis.fpsNum, analysis.fpsDen);
+        }
+    }
     //timebaseが60で割り切れない場合には、ptsが完全には割り切れない値である場合があり、より多くのフレーム数を解析する必要がある
 
     int maxCheckFrames = 0;
@@ -823,7 +837,7 @@ RGY_ERR RGYInputAvcodec::getFirstFramePosAndFrameRate(const sTrim *pTrimList, in
             AVPacket *pkt = nullptr;
             if (iVideoPktCheck < qVideoPktCheckCount) {
                 // m_Demux.qVideoPktに入っているパケットがあれば、まずはそれを解析する
-                pkt = m_Demux.qVideoPkt.get(iVideoPktCheck++)->data;
+                pkt = *m_Demux.qVideoPkt.get(iVideoPktCheck++);
             } else {
                 auto [ret_sample, spkt] = getSample();
                 if (ret_sample) {
@@ -1094,6 +1108,18 @@ RGY_ERR RGYInputAvcodec::getFirstFramePosAndFrameRate(const sTrim *pTrimList, in
 
     AddMessage(RGY_LOG_DEBUG, _T("final AvgFps (round): %d/%d\n\n"), m_Demux.video.nAvgFramerate.num, m_Demux.video.nAvgFramerate.den);
 
+    if (m_seekIndex.recording()) {
+        RGYSeekIndex::Analysis analysis = { 0 };
+        if (!fpsUserSpecified) { // 指定されたfpsは記録しない
+            analysis.fpsNum = m_Demux.video.nAvgFramerate.num;
+            analysis.fpsDen = m_Demux.video.nAvgFramerate.den;
+        }
+        analysis.ptsStatus = m_Demux.frames.getStreamPtsStatus() | (RGYPtsStatus)m_Demux.video.streamPtsInvalid;
+        analysis.detectPulldown = (bDetectpulldown) ? 1 : 0;
+        analysis.analyzeSec = m_Demux.format.analyzeSec;
+        m_seekIndex.setAnalysis(analysis);
+    }
+
     auto trimList = make_vector(pTrimList, nTrimCount);
     //出力時の音声・字幕解析用に1パケットコピーしておく
     if (m_Demux.qStreamPktL1.size() > 0 || m_Demux.qStreamPktL2.size() > 0) {
@@ -1108,8 +1134,8 @@ RGY_ERR RGYInputAvcodec::getFirstFramePosAndFrameRate(const sTrim *pTrimList, in
                 std::vector<const AVPacket *> pktList;
                 //まず、L2キューを探す
                 for (int j = 0; j < (int)m_Demux.qStreamPktL2.size(); j++) {
-                    if (m_Demux.qStreamPktL2.get(j)->data->stream_index == streamInfo->index) {
-                        auto pktAud = m_Demux.qStreamPktL2.get(j)->data;
+                    if ((*m_Demux.qStreamPktL2.get(j))->stream_index == streamInfo->index) {
+                        auto pktAud = *m_Demux.qStreamPktL2.get(j);
                         if ((pktAud->flags & (AV_PKT_FLAG_CORRUPT | AV_PKT_FLAG_DISCARD)) == 0) {
                             pktList.push_back(pktAud);
                         }
@@ -1226,7 +1252,7 @@ RGY_ERR RGYInputAvcodec::parseHDRData() {
     auto frameDec = m_poolFrame->getFree();
     bool got_frame = false;
     for (uint32_t i = 0; i < m_Demux.qVideoPkt.size() && !got_frame; i++) {
-        AVPacket *pkt = m_Demux.qVideoPkt.get(i)->data;
+        AVPacket *pkt = *m_Demux.qVideoPkt.get(i);
         ret = avcodec_send_packet(codecCtxDec.get(), pkt);
 
         if (ret == AVERROR_EOF) { //これ以上パケットを送れない
@@ -1324,8 +1350,10 @@ RGY_ERR RGYInputAvcodec::parseHDR10plusDOVIRpuHEVC(AVPacket *pkt, const bool hdr
     if (m_Demux.video.stream->codecpar->codec_id != AV_CODEC_ID_HEVC) {
         return RGY_ERR_UNSUPPORTED;
     }
-    const auto nal_list = m_Demux.video.parse_nal_hevc(pkt->data, pkt->size);
-    for (const auto& nal_unit : nal_list) {
+    //全パケットに対して行うので、nal unitのリストは作らずに走査する
+    RGYNalUnitReader reader(RGY_CODEC_HEVC, pkt->data, pkt->size);
+    nal_info nal_unit;
+    while (reader.next(nal_unit)) {
         if (!(nal_unit.type == NALU_HEVC_PREFIX_SEI && hdr10plus)
             && !(nal_unit.type == NALU_HEVC_UNSPECIFIED && doviRpu)) {
             continue;
@@ -1384,17 +1412,19 @@ RGY_ERR RGYInputAvcodec::parseHDR10plusDOVIRpuAV1(AVPacket *pkt, const bool hdr1
     if (m_Demux.video.stream->codecpar->codec_id != AV_CODEC_ID_AV1) {
         return RGY_ERR_UNSUPPORTED;
     }
-    const auto av1_unit_list = parse_unit_av1(pkt->data, pkt->size);
-    for (const auto& av1_unit : av1_unit_list) {
-        if (av1_unit->type != OBU_METADATA) {
+    //全パケットに対して行うので、OBUのコピーは行わずに走査する
+    RGYOBUReader reader(pkt->data, pkt->size);
+    obu_info av1_unit;
+    while (reader.next(av1_unit)) {
+        if (av1_unit.type != OBU_METADATA || av1_unit.size <= (size_t)av1_unit.obu_offset) {
             continue;
         }
-        const uint8_t *const start_pos = av1_unit->unit_data.data();
-        const uint8_t *const fin_pos = start_pos + av1_unit->unit_data.size();
-        const uint8_t *const start_obu = start_pos + av1_unit->obu_offset;
+        const uint8_t *const start_pos = av1_unit.ptr;
+        const uint8_t *const fin_pos = start_pos + av1_unit.size;
+        const uint8_t *const start_obu = start_pos + av1_unit.obu_offset;
         if (start_obu[0] == AV1_METADATA_TYPE_ITUT_T35) { // metadata type
             const uint8_t *const start_metadata = start_obu + 1 /*metadata type*/;
-            int metadata_size = (int)av1_unit->unit_data.size() - av1_unit->obu_offset - 1/*metadata type*/;
+            int metadata_size = (int)av1_unit.size - av1_unit.obu_offset - 1/*metadata type*/;
             if (hdr10plus
                 && metadata_size > (int)sizeof(av1_itut_t35_header_hdr10plus)
                 && memcmp(start_metadata, av1_itut_t35_header_hdr10plus, sizeof(av1_itut_t35_header_hdr10plus)) == 0) {
@@ -1626,6 +1656,38 @@ RGY_ERR RGYInputAvcodec::initFormatCtx(const TCHAR *strFileName, const RGYInputA
     return RGY_ERR_NONE;
 }
 
+RGY_ERR RGYInputAvcodec::initFormatCtxFromChunk(const RGYInputChunk *chunk) {
+    CloseFormat(&m_Demux.format);
+    if (!chunk->codecpar()) {
+        AddMessage(RGY_LOG_ERROR, _T("No video stream information in input chunk.\n"));
+        return RGY_ERR_UNDEFINED_BEHAVIOR;
+    }
+    //親が読み込んだパケットを使用するので、入力は開かず、映像ストリームの情報のみ設定する
+    m_Demux.format.isPipe = false;
+    m_Demux.format.formatCtx = avformat_alloc_context();
+    if (!m_Demux.format.formatCtx) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to allocate format context.\n"));
+        return RGY_ERR_NULL_PTR;
+    }
+    auto stream = avformat_new_stream(m_Demux.format.formatCtx, nullptr);
+    if (!stream) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to allocate video stream.\n"));
+        return RGY_ERR_NULL_PTR;
+    }
+    int ret = avcodec_parameters_copy(stream->codecpar, chunk->codecpar());
+    if (ret < 0) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to copy codec parameters: %s.\n"), qsv_av_err2str(ret).c_str());
+        return RGY_ERR_UNKNOWN;
+    }
+    stream->time_base = chunk->timebase();
+    stream->avg_frame_rate = chunk->avgFramerate();
+    stream->r_frame_rate = chunk->rFramerate();
+    stream->sample_aspect_ratio = chunk->codecpar()->sample_aspect_ratio;
+    AddMessage(RGY_LOG_DEBUG, _T("opened input chunk from parent: %s, %d packets.\n"),
+        char_to_tstring(avcodec_get_name(stream->codecpar->codec_id)).c_str(), chunk->packets());
+    return RGY_ERR_NONE;
+}
+
 #pragma warning(push)
 #pragma warning(disable:4100)
 #pragma warning(disable:4127) //warning C4127: 条件式が定数です。
@@ -1643,6 +1705,7 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
     m_Demux.video.readVideo = input_prm->readVideo;
     m_Demux.video.hevcbsf = input_prm->hevcbsf;
     m_Demux.thread.queueInfo = input_prm->queueInfo;
+    m_inputChunk = input_prm->inputChunk;
     if (input_prm->readVideo) {
         m_inputVideoInfo = *inputInfo;
     } else {
@@ -1687,7 +1750,7 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
         if (iretry > 0) {
             AddMessage(RGY_LOG_WARN, _T("Failed to get video stream information, retry opening input (%d/%d)!\n"), iretry, input_prm->inputRetry);
         }
-        auto err = initFormatCtx(strFileName, input_prm, iretry);
+        auto err = (m_inputChunk) ? initFormatCtxFromChunk(m_inputChunk) : initFormatCtx(strFileName, input_prm, iretry);
         if (err != RGY_ERR_NONE) {
             return err;
         }
@@ -1701,9 +1764,11 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
 
     //キュー関連初期化
     //getFirstFramePosAndFrameRateで大量にパケットを突っ込む可能性があるので、この段階ではcapacityは無限大にしておく
-    m_Demux.qVideoPkt.init(4096, SIZE_MAX, 4);
+    m_Demux.qVideoPkt.init(4096, SIZE_MAX);
     m_Demux.qVideoPkt.set_keep_length(1); // 読み込み終了の判定に使うので、0にしてはならない
-    m_Demux.qStreamPktL2.init(4096);
+    m_Demux.qStreamPktL2.init(4096, SIZE_MAX);
+    //並列エンコードの親で、パイプ等で子が個別に入力を開けない場合は、読み込んだ映像パケットを子に分配するため保持する
+    m_Demux.fanOut.enable = input_prm->parallelEncParent && input_prm->readVideo && (isPipe() || !seekable());
 
     //動画ストリームを探す
     //動画ストリームは動画を処理しなかったとしても同期のため必要
@@ -1758,6 +1823,18 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
         }
 #endif
         m_Demux.video.stream = stream;
+
+        if (input_prm->seekIndexFile.length() > 0 && !m_inputChunk) {
+            m_seekIndexSrcFile = strFileName;
+            const auto err = m_seekIndex.open(input_prm->seekIndexFile, strFileName, m_Demux.video.index, stream->time_base.num, stream->time_base.den);
+            if (err == RGY_ERR_NONE) {
+                AddMessage(RGY_LOG_DEBUG, _T("Loaded index file \"%s\": %d keyframes.\n"), input_prm->seekIndexFile.c_str(), (int)m_seekIndex.keyframeCount());
+            } else if (err == RGY_ERR_NOT_FOUND) {
+                AddMessage(RGY_LOG_DEBUG, _T("Index file \"%s\" not found or outdated, will be created after reading whole file.\n"), input_prm->seekIndexFile.c_str());
+            } else {
+                AddMessage(RGY_LOG_WARN, _T("--input-index is only supported for normal files.\n"));
+            }
+        }
     }
 
     //音声ストリームを探す
@@ -2109,7 +2186,21 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
                 seek_sec = seek_start_sec + (duration_fin_sec - seek_start_sec) * input_prm->seekRatio;
             }
             const auto seek_time = av_rescale_q(1, av_d2q(seek_sec, 1<<24), m_Demux.video.stream->time_base);
-            int seek_ret = av_seek_frame(m_Demux.format.formatCtx, m_Demux.video.index, firstpkt->pts + seek_time, 0);
+            int seek_ret = -1;
+            //indexファイルがあれば、対象のキーフレームの位置に直接seekする
+            //timestampによるseekが二分探索となる形式(tsなど)で、seekを高速かつ正確にする
+            if (m_seekIndex.loaded()
+                && !(m_Demux.format.formatCtx->iformat->flags & AVFMT_NO_BYTE_SEEK)
+                && firstpkt->pts != AV_NOPTS_VALUE) {
+                const auto keyframe = m_seekIndex.findKeyframe(firstpkt->pts + seek_time);
+                if (keyframe && keyframe->pos >= 0) {
+                    seek_ret = av_seek_frame(m_Demux.format.formatCtx, m_Demux.video.index, keyframe->pos, AVSEEK_FLAG_BYTE);
+                    AddMessage(RGY_LOG_DEBUG, _T("seek by index: pts %lld, pos %lld: %s.\n"), (long long int)keyframe->pts, (long long int)keyframe->pos, (seek_ret >= 0) ? _T("success") : _T("failed"));
+                }
+            }
+            if (0 > seek_ret) {
+                seek_ret = av_seek_frame(m_Demux.format.formatCtx, m_Demux.video.index, firstpkt->pts + seek_time, 0);
+            }
             if (0 > seek_ret) {
                 seek_ret = av_seek_frame(m_Demux.format.formatCtx, m_Demux.video.index, firstpkt->pts + seek_time, AVSEEK_FLAG_ANY);
             }
@@ -2119,13 +2210,17 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
             }
             AddMessage(RGY_LOG_DEBUG, _T("set seek %s.\n"), print_time(seek_sec).c_str());
             // ヘッダがextradataから取得できないとき実パケットから取得する場合があり、このときはqueueにデータがあるので、これを破棄する
-            m_Demux.qVideoPkt.clear();
+            m_Demux.qVideoPkt.clear([](AVPacket **pkt) { av_packet_free(pkt); });
             //seekのために行ったgetSampleの結果は破棄する
             m_Demux.frames.clear();
             m_seek.first = (float)seek_sec;
             m_Demux.video.gotFirstKeyframe = false;
             m_Demux.video.beforeSeekStreamFirstKeyPts = m_Demux.video.streamFirstKeyPts;
             m_Demux.video.streamFirstKeyPts = 0;
+            //先頭から読み込まないので、indexファイルは作成しない
+            if (m_seekIndex.recording()) {
+                m_seekIndex.close();
+            }
         }
 
         //parserはseek後に初期化すること
@@ -2261,11 +2356,19 @@ RGY_ERR RGYInputAvcodec::Init(const TCHAR *strFileName, VideoInfo *inputInfo, co
         m_Demux.thread.bAbortInput = false;
         auto nPrmInputThread = input_prm->threadInput;
         m_Demux.thread.threadInput = (nPrmInputThread == RGY_INPUT_THREAD_AUTO) ? (input_prm->lowLatency ? 0 : 1) : nPrmInputThread;
+        if (m_Demux.fanOut.enable) {
+            //子に分配するパケットのキューが上限に達すると読み込みを待機するので、パイプラインを止めないよう必ずスレッド化する
+            m_Demux.thread.threadInput = 1;
+        }
         if (m_Demux.thread.threadInput) {
             m_Demux.thread.thInput = std::thread(&RGYInputAvcodec::ThreadFuncRead, this, input_prm->threadParamInput);
             //はじめcapacityを無限大にセットしたので、この段階で制限をかける
             //入力をスレッド化しない場合には、自動的に同期が保たれるので、ここでの制限は必要ない
-            m_Demux.qVideoPkt.set_capacity(256);
+            //子に分配する場合は、親のパイプラインは子の出力に合わせてしか映像パケットを取り出さないので、
+            //ここで制限すると後続のチャンクの読み込みが進まなくなる (読み込む量は分配用のキューの上限で制限される)
+            if (!m_Demux.fanOut.enable) {
+                m_Demux.qVideoPkt.set_capacity(256);
+            }
         }
     } else {
         //音声との同期とかに使うので、動画の情報を格納する
@@ -2601,35 +2704,25 @@ bool RGYInputAvcodec::checkOtherTimeSeekTo(int64_t pts, const AVDemuxStream *str
 int RGYInputAvcodec::getVideoFrameIdx(int64_t pts, AVRational timebase, int iStart) {
     const int framePosCount = m_Demux.frames.frameNum();
     const AVRational vid_pkt_timebase = (m_Demux.video.stream) ? m_Demux.video.stream->time_base : av_inv_q(m_Demux.video.nAvgFramerate);
-    if (av_cmp_q(timebase, vid_pkt_timebase) == 0) {
-        for (int i = (std::max)(0, iStart); i < framePosCount; i++) {
-            if (pts == m_Demux.frames.list(i).pts) {
-                return i;
-            }
-            //pts < demux.videoFramePts[i]であるなら、その前のフレームを返す
-            if (pts < m_Demux.frames.list(i).pts) {
-                //0フレーム目なら、仮想的に -1 フレーム目を考えて、それよりも前かどうかを判定する
-                //-2を返すことで、そのパケットは削除される
-                if (i == 0 && pts < m_Demux.frames.list(i).pts - m_Demux.frames.list(i).duration) {
-                    i--;
-                }
-                return i-1;
-            }
-        }
-    } else {
-        for (int i = (std::max)(0, iStart); i < framePosCount; i++) {
-            //pts < demux.videoFramePts[i]であるなら、その前のフレームを返す
-            if (av_compare_ts(pts, timebase, m_Demux.frames.list(i).pts, vid_pkt_timebase) < 0) {
-                //0フレーム目なら、仮想的に -1 フレーム目を考えて、それよりも前かどうかを判定する
-                //-2を返すことで、そのパケットは削除される
-                if (i == 0 && av_compare_ts(pts, timebase, m_Demux.frames.list(i).pts - m_Demux.frames.list(i).duration, vid_pkt_timebase) < 0) {
-                    i--;
-                }
-                return i-1;
-            }
-        }
+    const bool sameTimebase = av_cmp_q(timebase, vid_pkt_timebase) == 0;
+    //ptsは最初に動画のtimebaseに変換しておき、フレームごとの変換は行わない
+    //切り捨てで変換すれば、(変換前のpts) < list(i).pts と (変換後のpts) < list(i).pts は一致する
+    const int64_t vidPts = (sameTimebase) ? pts : av_rescale_q_rnd(pts, timebase, vid_pkt_timebase, AV_ROUND_DOWN);
+    //timebaseが同じなら一致するフレームを、異なるならpts < list(i).ptsとなる最初のフレームを探す
+    const int i = m_Demux.frames.searchPts(vidPts, iStart, !sameTimebase);
+    if (i >= framePosCount) {
+        return framePosCount;
+    }
+    if (sameTimebase && pts == m_Demux.frames.list(i).pts) {
+        return i;
     }
-    return framePosCount;
+    //pts < demux.videoFramePts[i]であるなら、その前のフレームを返す
+    //0フレーム目なら、仮想的に -1 フレーム目を考えて、それよりも前かどうかを判定する
+    //-2を返すことで、そのパケットは削除される
+    if (i == 0 && vidPts < m_Demux.frames.list(i).pts - m_Demux.frames.list(i).duration) {
+        return -2;
+    }
+    return i-1;
 }
 
 int64_t RGYInputAvcodec::convertTimebaseVidToStream(int64_t pts, const AVDemuxStream *stream) {
@@ -2819,7 +2912,7 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
     int ret_read_frame = 0;
 
     auto pkt = m_poolPkt->getFree();
-    for (; ((ret_read_frame = av_read_frame(m_Demux.format.formatCtx, pkt.get())) >= 0 || (ret_read_frame == AVERROR(EAGAIN))) // camera等で、av_read_frameがAVERROR(EAGAIN)を返す場合がある
+    for (; ((ret_read_frame = readFrame(pkt.get())) >= 0 || (ret_read_frame == AVERROR(EAGAIN))) // camera等で、av_read_frameがAVERROR(EAGAIN)を返す場合がある
         //trimからわかるフレーム数の上限値よりfixedNumがある程度の量の処理を進めたら読み込みを打ち切る
         && m_Demux.frames.fixedNum() - TRIM_OVERREAD_FRAMES < getVideoTrimMaxFramIdx()
         && checkTimeSeekTo(pkt->pts, m_Demux.format.formatCtx->streams[pkt->stream_index]->time_base, 10.0f);
@@ -2853,6 +2946,21 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
                 const auto timestamp = (pkt->pts == AV_NOPTS_VALUE) ? pkt->dts : pkt->pts;
                 AddMessage(RGY_LOG_WARN, _T("corrupt packet in video: %lld (%s)\n"), (long long int)timestamp, getTimestampString(timestamp, m_Demux.video.stream->time_base).c_str());
             }
+            //並列エンコードの親で子に入力を分配する場合は、bsf等の処理前のパケットを複製しておき、
+            //framePosListに追加するパケットのみ分配用のキューに追加する
+            //(ここで使用するbsfはパケットを1対1で変換するので、処理後のパケットと対応がとれる)
+            std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>> pktFanOut(nullptr, RGYAVDeleter<AVPacket>(av_packet_free));
+            if (m_Demux.fanOut.enable) {
+                pktFanOut.reset(av_packet_clone(pkt.get()));
+                //mp42Annexb等はパケットのデータを直接書き換えるので、データも複製する
+                if (!pktFanOut || av_packet_make_writable(pktFanOut.get()) < 0) {
+                    AddMessage(RGY_LOG_ERROR, _T("Failed to copy video packet for parallel encoding.\n"));
+                    pkt.reset();
+                    ret_read_frame = AVERROR(ENOMEM);
+                    break;
+                }
+                pktFanOut->stream_index = 0; //子は映像ストリームのみとなる
+            }
             if (m_Demux.video.bsfcCtx) {
                 auto ret = av_bsf_send_packet(m_Demux.video.bsfcCtx, pkt.get());
                 if (ret < 0) {
@@ -2878,7 +2986,7 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
                 vc1AddFrameHeader(pkt.get());
             }
             if (m_Demux.video.bUseHEVCmp42AnnexB) {
-                hevcMp42Annexb(pkt.get());
+                mp42Annexb(pkt.get());
             }
             if (m_Demux.video.stream->codecpar->codec_id == AV_CODEC_ID_HEVC || m_Demux.video.stream->codecpar->codec_id == AV_CODEC_ID_AV1) {
                 if (m_Demux.video.hdr10plusMetadataCopy || m_Demux.video.doviRpuMetadataCopy) {
@@ -2917,6 +3025,9 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
             //mkv入りのVC-1をカットしたものなど、動画によってはpkt->flagsにフラグがセットされていないことがある
             //parserの情報も活用してキーフレームかどうかを判定する
             const bool keyframe = (pkt->flags & AV_PKT_FLAG_KEY) != 0 || pos.pict_type == AV_PICTURE_TYPE_I;
+            if (keyframe && m_seekIndex.recording() && pkt->pts != AV_NOPTS_VALUE && (pkt->flags & AV_PKT_FLAG_DISCARD) == 0) {
+                m_seekIndex.addKeyframe(pkt->pts, pkt->dts, pkt->pos);
+            }
             //最初のキーフレームを取得するまではスキップする
             //スキップした枚数はi_samplesでカウントし、trim時に同期を適切にとるため、m_trimParam.offsetに格納する
             //  ただし、bTreatFirstPacketAsKeyframeが指定されている場合には、キーフレームでなくてもframePosListへの追加を許可する
@@ -2957,6 +3068,9 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
                     m_trimParam.offset++;
                 }
                 m_Demux.frames.add(pos);
+                if (pktFanOut) {
+                    pushFanOutPacket(pktFanOut.release());
+                }
             }
             //ptsの確定したところまで、音声を出力する
             CheckAndMoveStreamPacketList();
@@ -2985,7 +3099,21 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
         AddMessage(RGY_LOG_ERROR, _T("error while reading file: %d frames, %s\n"), m_Demux.frames.frameNum(), qsv_av_err2str(ret_read_frame).c_str());
         m_Demux.format.inputError = RGY_ERR_INVALID_DATA_TYPE;
     }
+    if (m_Demux.fanOut.enable) {
+        //子への分配側に入力の終端を通知する
+        std::lock_guard<std::mutex> lock(m_Demux.fanOut.mtx);
+        m_Demux.fanOut.eof = true;
+        m_Demux.fanOut.cv.notify_all();
+    }
     AddMessage(RGY_LOG_DEBUG, _T("%d frames, %s\n"), m_Demux.frames.frameNum(), qsv_av_err2str(ret_read_frame).c_str());
+    //先頭から最後まで読み込んだので、indexファイルを作成する
+    if (ret_read_frame == AVERROR_EOF && m_seekIndex.recording()) {
+        if (m_seekIndex.write() != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_WARN, _T("Failed to write index file \"%s\".\n"), m_seekIndex.filename().c_str());
+        } else {
+            AddMessage(RGY_LOG_DEBUG, _T("Wrote index file \"%s\".\n"), m_seekIndex.filename().c_str());
+        }
+    }
     //たまっている字幕があれば送出する
     sortAndPushSubtitlePacket();
     //動画の終端を表す最後のptsを挿入する
@@ -2999,8 +3127,10 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
     }
     //もし選択範囲が手動で決定されていないのなら、音声を最大限取得する
     if (m_trimParam.list.size() == 0 || m_trimParam.list.back().fin == TRIM_MAX) {
-        for (uint32_t i = 0; i < m_Demux.qStreamPktL2.size(); i++) {
-            videoFinPts = (std::max)(videoFinPts, m_Demux.qStreamPktL2[i].data->pts);
+        //qStreamPktL2に残っているパケットだけでなく、Writer側が取り出し済みのパケットのptsも含めた最大値となる
+        //(いずれも出力対象と判定されたパケットなので、映像の終端をその分延ばしても出力対象の音声が欠けることはない)
+        if (m_Demux.qStreamPktL2.size() > 0) {
+            videoFinPts = (std::max)(videoFinPts, m_Demux.qStreamPktL2PushedMaxPts);
         }
         for (uint32_t i = 0; i < m_Demux.qStreamPktL1.size(); i++) {
             videoFinPts = (std::max)(videoFinPts, m_Demux.qStreamPktL1[i]->pts);
@@ -3022,6 +3152,14 @@ std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> RGYInputAvcod
     return { AVERROR_EOF, nullptr };
 }
 
+int RGYInputAvcodec::readFrame(AVPacket *pkt) {
+    if (m_inputChunk) {
+        //並列エンコードの子で、親が読み込んで分配したパケットを使用する
+        return (m_inputChunk->nextPacket(pkt)) ? 0 : AVERROR_EOF;
+    }
+    return av_read_frame(m_Demux.format.formatCtx, pkt);
+}
+
 //動画ストリームの1フレーム分のデータをbitstreamに追加する (リーダー側のデータは消す)
 RGY_ERR RGYInputAvcodec::GetNextBitstream(RGYBitstream *pBitstream) {
     if (!m_Demux.thread.thInput.joinable() //入力スレッドがなければ、自分で読み込む
@@ -3036,7 +3174,7 @@ RGY_ERR RGYInputAvcodec::GetNextBitstream(RGYBitstream *pBitstream) {
 
     bool bGetPacket = false;
     AVPacket *pkt = nullptr;
-    for (int i = 0; false == (bGetPacket = m_Demux.qVideoPkt.front_copy_and_pop_no_lock(&pkt, (m_Demux.thread.queueInfo) ? &m_Demux.thread.queueInfo->usage_vid_in : nullptr)) && m_Demux.qVideoPkt.size() > 0; i++) {
+    for (int i = 0; false == (bGetPacket = m_Demux.qVideoPkt.try_pop(&pkt, (m_Demux.thread.queueInfo) ? &m_Demux.thread.queueInfo->usage_vid_in : nullptr)) && m_Demux.qVideoPkt.size() > 0; i++) {
         m_Demux.qVideoPkt.wait_for_push();
     }
     RGY_ERR sts = RGY_ERR_MORE_BITSTREAM;
@@ -3122,6 +3260,7 @@ void RGYInputAvcodec::GetAudioDataPacketsWhenNoVideoRead(int inputFrame) {
                 break;
             }
             pktFlagSetTrackID(pkt2, pStream2->trackId);
+            m_Demux.qStreamPktL2PushedMaxPts = (std::max)(m_Demux.qStreamPktL2PushedMaxPts, pkt2->pts);
             m_Demux.qStreamPktL2.push(pkt2); //Writer側に渡したパケットはWriter側で開放する
             m_Demux.qStreamPktL1.pop_front();
         }
@@ -3218,6 +3357,229 @@ bool RGYInputAvcodec::isPipe() const {
     return m_Demux.format.isPipe;
 }
 
+void RGYInputAvcodec::startSeekIndexBuild() {
+    //並列エンコードでは、各子プロセスは入力の一部のみを読み込むので、indexファイルを作成できない
+    //そこで親で入力ファイルを別途開き、映像パケットのキーフレーム情報のみを先頭から最後まで読み取ってindexファイルを作成する
+    //(以降に開始するchunkや、次回以降の起動で使用される)
+    if (!m_seekIndex.recording() || m_seekIndexThread.joinable() || !m_Demux.format.formatCtx || !m_Demux.video.stream) {
+        return;
+    }
+    const auto indexFile = m_seekIndex.filename();
+    const auto analysis = m_seekIndex.analysis();
+    //通常の読み込み側では記録しない
+    m_seekIndex.close();
+
+    std::string filename_char;
+    if (0 == tchar_to_string(m_seekIndexSrcFile.c_str(), filename_char, CP_UTF8)) {
+        return;
+    }
+    const auto inFormat = m_Demux.format.formatCtx->iformat;
+    const int streamIndex = m_Demux.video.index;
+    const auto codecId = m_Demux.video.stream->codecpar->codec_id;
+    const auto timebase = m_Demux.video.stream->time_base;
+    m_seekIndexAbort = false;
+    m_seekIndexThread = std::thread([this, indexFile, filename_char, inFormat, streamIndex, codecId, timebase, analysis]() {
+        RGYTrace::setThreadName("input index");
+        RGYSeekIndex seekIndex;
+        if (seekIndex.open(indexFile, m_seekIndexSrcFile, streamIndex, timebase.num, timebase.den) != RGY_ERR_NOT_FOUND) {
+            return; //すでに有効なindexファイルがある(ほかのプロセスが作成した)か、作成できない
+        }
+        seekIndex.setAnalysis(analysis);
+        AVFormatContext *formatCtx = nullptr;
+        AVDictionary *formatOptions = nullptr;
+        av_dict_set(&formatOptions, "scan_all_pmts", "1", 0);
+        int ret = avformat_open_input(&formatCtx, filename_char.c_str(), inFormat, &formatOptions);
+        av_dict_free(&formatOptions);
+        if (ret != 0) {
+            AddMessage(RGY_LOG_WARN, _T("Failed to open input to create index file: %s.\n"), qsv_av_err2str(ret).c_str());
+            return;
+        }
+        //streamのindexが通常の読み込み側と一致することを確認する
+        if ((ret = avformat_find_stream_info(formatCtx, nullptr)) < 0
+            || streamIndex >= (int)formatCtx->nb_streams
+            || formatCtx->streams[streamIndex]->codecpar->codec_id != codecId
+            || av_cmp_q(formatCtx->streams[streamIndex]->time_base, timebase) != 0) {
+            AddMessage(RGY_LOG_WARN, _T("Failed to find video stream to create index file.\n"));
+            avformat_close_input(&formatCtx);
+            return;
+        }
+        AVPacket *pkt = av_packet_alloc();
+        while (!m_seekIndexAbort && (ret = av_read_frame(formatCtx, pkt)) >= 0) {
+            if (pkt->stream_index == streamIndex
+                && (pkt->flags & AV_PKT_FLAG_KEY) != 0
+                && (pkt->flags & AV_PKT_FLAG_DISCARD) == 0
+                && pkt->pts != AV_NOPTS_VALUE) {
+                seekIndex.addKeyframe(pkt->pts, pkt->dts, pkt->pos);
+            }
+            av_packet_unref(pkt);
+        }
+        av_packet_free(&pkt);
+        avformat_close_input(&formatCtx);
+        if (ret != AVERROR_EOF) {
+            AddMessage(RGY_LOG_DEBUG, _T("Index file \"%s\" not created: %s.\n"), indexFile.c_str(), (m_seekIndexAbort) ? _T("aborted") : qsv_av_err2str(ret).c_str());
+        } else if (seekIndex.write() != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_WARN, _T("Failed to write index file \"%s\".\n"), indexFile.c_str());
+        } else {
+            AddMessage(RGY_LOG_DEBUG, _T("Wrote index file \"%s\".\n"), indexFile.c_str());
+        }
+    });
+    AddMessage(RGY_LOG_DEBUG, _T("Started creating index file \"%s\".\n"), indexFile.c_str());
+}
+
+bool RGYInputAvcodec::parallelEncFanOutSupported() const {
+    //パイプ等で子が個別に入力を開けない場合は、親が読み込んだ映像パケットをキーフレームで区切って子に分配する
+    return m_Demux.fanOut.enable && m_Demux.video.stream != nullptr;
+}
+
+void RGYInputAvcodec::pushFanOutPacket(AVPacket *pkt) {
+    auto& fanOut = m_Demux.fanOut;
+    std::unique_lock<std::mutex> lock(fanOut.mtx);
+    //分配を開始したら、まだ子に渡していないデータ量が上限を超えないよう読み込みを待機する
+    fanOut.cv.wait(lock, [&fanOut]() { return fanOut.abort || fanOut.maxQueuedSize == 0 || fanOut.queuedSize < fanOut.maxQueuedSize; });
+    if (fanOut.abort) {
+        av_packet_free(&pkt);
+        return;
+    }
+    fanOut.queuedSize += pkt->size;
+    fanOut.pkts.push_back(pkt);
+    fanOut.cv.notify_all();
+}
+
+RGY_ERR RGYInputAvcodec::popFanOutPacket(std::deque<AVPacket*>& carried, AVPacket **pkt) {
+    //前回のチャンクから持ち越したパケットがあれば、そちらを先に使う
+    if (carried.size() > 0) {
+        *pkt = carried.front();
+        carried.pop_front();
+        return RGY_ERR_NONE;
+    }
+    auto& fanOut = m_Demux.fanOut;
+    std::unique_lock<std::mutex> lock(fanOut.mtx);
+    fanOut.cv.wait(lock, [&fanOut]() { return fanOut.abort || fanOut.eof || fanOut.pkts.size() > 0; });
+    if (fanOut.abort) {
+        return RGY_ERR_ABORTED;
+    }
+    if (fanOut.pkts.size() == 0) { //入力の終端
+        return (m_Demux.format.inputError != RGY_ERR_NONE) ? m_Demux.format.inputError : RGY_ERR_MORE_DATA;
+    }
+    *pkt = fanOut.pkts.front();
+    fanOut.pkts.pop_front();
+    fanOut.queuedSize -= (*pkt)->size;
+    fanOut.cv.notify_all();
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYInputAvcodec::parallelEncFanOut(RGYInputChunk *chunk, const RGYInputChunkLimit& limit) {
+    auto& fanOut = m_Demux.fanOut;
+    auto err = chunk->setVideoStream(m_Demux.video.stream);
+    if (err != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to copy video stream information for parallel encoding.\n"));
+        return err;
+    }
+    auto freePackets = [](std::deque<AVPacket*>& pkts) {
+        for (auto& pkt : pkts) {
+            av_packet_free(&pkt);
+        }
+        pkts.clear();
+    };
+    std::deque<AVPacket*> carried;   //前回のチャンクの分割位置のキーフレーム以降のパケット
+    std::deque<AVPacket*> carryNext; //このチャンクの分割位置のキーフレーム以降のパケット (次のチャンクの先頭となる)
+    {
+        std::lock_guard<std::mutex> lock(fanOut.mtx);
+        //分配を開始したら、読み込み側で保持するデータ量を制限する
+        fanOut.maxQueuedSize = limit.maxSize;
+        carried.swap(fanOut.carry);
+    }
+    const double timebase = av_q2d(m_Demux.video.stream->time_base);
+    int64_t chunkFirstKeyPts = AV_NOPTS_VALUE;
+    int64_t splitKeyPts = AV_NOPTS_VALUE;
+    size_t gopSize = 0; //現在のGOPのデータ量
+    for (;;) {
+        AVPacket *pkt = nullptr;
+        if ((err = popFanOutPacket(carried, &pkt)) != RGY_ERR_NONE) {
+            break;
+        }
+        const auto timestamp = (pkt->pts == AV_NOPTS_VALUE) ? pkt->dts : pkt->pts;
+        //チャンクのデータ量は上限を超えないようにする
+        //区切れるキーフレームに達する前に上限に達した場合は、分配できないのでエラーとする
+        if (!limit.fits(chunk->size(), pkt->size)) {
+            carryNext.push_back(pkt);
+            err = RGY_ERR_NOT_ENOUGH_BUFFER;
+            AddMessage(RGY_LOG_WARN, _T("Input chunk reached the limit %lld MB at %.1f sec before it can be split at a keyframe.\n"),
+                (long long int)(limit.maxSize >> 20), (chunkFirstKeyPts != AV_NOPTS_VALUE && timestamp != AV_NOPTS_VALUE) ? (timestamp - chunkFirstKeyPts) * timebase : 0.0);
+            break;
+        }
+        if (splitKeyPts == AV_NOPTS_VALUE) {
+            if (chunkFirstKeyPts == AV_NOPTS_VALUE) {
+                chunkFirstKeyPts = timestamp; //チャンクの先頭は必ずキーフレーム
+            } else if ((pkt->flags & AV_PKT_FLAG_KEY) != 0 && timestamp != AV_NOPTS_VALUE) {
+                //キーフレームでしか区切れないので、次のGOPが上限に収まらなくなる見込みなら、ここで区切る
+                fanOut.maxGopSize = std::max(fanOut.maxGopSize, gopSize);
+                gopSize = 0;
+                if (limit.fin(chunk->size(), fanOut.maxGopSize, (timestamp - chunkFirstKeyPts) * timebase)) {
+                    splitKeyPts = timestamp; //このキーフレームで分割する
+                }
+            }
+            if (splitKeyPts == AV_NOPTS_VALUE) {
+                gopSize += pkt->size;
+                chunk->addPacket(pkt, false);
+                continue;
+            }
+        } else if (timestamp == AV_NOPTS_VALUE || timestamp >= splitKeyPts) {
+            carryNext.push_back(pkt);
+            break;
+        }
+        //分割位置のキーフレームと、その後ろにある表示順で前となるフレーム (OpenGOPのleading picture) は、
+        //このチャンクで出力するフレームのデコードに必要なので、次のチャンクの先頭とするとともにこのチャンクにも複製して追加する
+        carryNext.push_back(pkt);
+        AVPacket *pktCopy = av_packet_clone(pkt);
+        //子ではパケットのデータを直接書き換えることがあるので、データも複製する
+        if (!pktCopy || av_packet_make_writable(pktCopy) < 0) {
+            av_packet_free(&pktCopy);
+            err = RGY_ERR_NULL_PTR;
+            break;
+        }
+        chunk->addPacket(pktCopy, true);
+    }
+    if (err != RGY_ERR_NONE && err != RGY_ERR_MORE_DATA) {
+        freePackets(carried);
+        freePackets(carryNext);
+        if (err != RGY_ERR_ABORTED && err != RGY_ERR_NOT_ENOUGH_BUFFER) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to read input for parallel encoding: %s.\n"), get_err_mes(err));
+        }
+        return err;
+    }
+    //持ち越したパケットが残っていれば、次のチャンクに回す
+    carryNext.insert(carryNext.end(), carried.begin(), carried.end());
+    carried.clear();
+    //分割位置を決めたところで入力の終端に達した場合は、次のチャンクの先頭が残っているので終端としない
+    const bool eof = err == RGY_ERR_MORE_DATA && carryNext.size() == 0;
+    {
+        std::lock_guard<std::mutex> lock(fanOut.mtx);
+        if (fanOut.abort) {
+            freePackets(carryNext);
+            return RGY_ERR_ABORTED;
+        }
+        fanOut.carry.swap(carryNext);
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("Fan-out chunk: %d packets (%d overlapped), %lld bytes, %.2f sec.\n"),
+        chunk->packets(), chunk->packets() - chunk->frames(), (long long int)chunk->size(),
+        (splitKeyPts != AV_NOPTS_VALUE && chunkFirstKeyPts != AV_NOPTS_VALUE) ? (splitKeyPts - chunkFirstKeyPts) * timebase : 0.0);
+    return (eof) ? RGY_ERR_MORE_DATA : RGY_ERR_NONE;
+}
+
+void RGYInputAvcodec::parallelEncFanOutClose() {
+    if (!m_Demux.fanOut.enable) {
+        return;
+    }
+    //保持しているパケットを解放し、待機している読み込み・分配を終了させる
+    m_Demux.fanOut.close();
+    //並列エンコードを無効化して続行する場合のため、映像キューの上限を元に戻す
+    if (m_Demux.thread.threadInput && !m_Demux.thread.bAbortInput) {
+        m_Demux.qVideoPkt.set_capacity(256);
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("Closed input fan-out for parallel encoding.\n"));
+}
+
 //qStreamPktL1をチェックし、framePosListから必要な音声パケットかどうかを判定し、
 //必要ならqStreamPktL2に移し、不要ならパケットを開放する
 void RGYInputAvcodec::CheckAndMoveStreamPacketList() {
@@ -3243,6 +3605,7 @@ void RGYInputAvcodec::CheckAndMoveStreamPacketList() {
         if (pkt->dts != AV_NOPTS_VALUE) pkt->dts += delay_ts;
         if (checkStreamPacketToAdd(pkt, pStream)) {
             pktFlagSetTrackID(pkt, pStream->trackId);
+            m_Demux.qStreamPktL2PushedMaxPts = (std::max)(m_Demux.qStreamPktL2PushedMaxPts, pkt->pts);
             m_Demux.qStreamPktL2.push(pkt); //Writer側に渡したパケットはWriter側で開放する
         } else {
             m_poolPkt->returnFree(&pkt); //Writer側に渡さないパケットはここで開放する
@@ -3259,7 +3622,7 @@ std::vector<AVPacket*> RGYInputAvcodec::GetStreamDataPackets(int inputFrame) {
     //出力するパケットを選択する
     std::vector<AVPacket*> packets;
     AVPacket *pkt = nullptr;
-    while (m_Demux.qStreamPktL2.front_copy_and_pop_no_lock(&pkt, (m_Demux.thread.queueInfo) ? &m_Demux.thread.queueInfo->usage_aud_in : nullptr)) {
+    while (m_Demux.qStreamPktL2.try_pop(&pkt, (m_Demux.thread.queueInfo) ? &m_Demux.thread.queueInfo->usage_aud_in : nullptr)) {
         packets.push_back(pkt);
     }
     return packets;
@@ -3300,7 +3663,7 @@ RGY_ERR RGYInputAvcodec::GetHeader(RGYBitstream *pBitstream) {
         }
 
         if (m_Demux.video.bUseHEVCmp42AnnexB) {
-            hevcMp42Annexb(nullptr);
+            mp42Annexb(nullptr);
         } else if (m_Demux.video.bsfcCtx && m_Demux.video.extradata[0] == 1) {
             if (m_Demux.video.extradataSize < m_Demux.video.bsfcCtx->par_out->extradata_size) {
                 m_Demux.video.extradata = (uint8_t *)av_realloc(m_Demux.video.extradata, m_Demux.video.bsfcCtx->par_out->extradata_size + AV_INPUT_BUFFER_PADDING_SIZE);
@@ -3413,7 +3776,7 @@ RGY_ERR RGYInputAvcodec::LoadNextFrameInternal(RGYFrame *pSurface) {
 
             bool bGetPacket = false;
             AVPacket *pkt = nullptr;
-            for (int i = 0; false == (bGetPacket = m_Demux.qVideoPkt.front_copy_no_lock(&pkt, (m_Demux.thread.queueInfo) ? &m_Demux.thread.queueInfo->usage_vid_in : nullptr)) && m_Demux.qVideoPkt.size() > 0; i++) {
+            for (int i = 0; false == (bGetPacket = m_Demux.qVideoPkt.front_copy(&pkt, (m_Demux.thread.queueInfo) ? &m_Demux.thread.queueInfo->usage_vid_in : nullptr)) && m_Demux.qVideoPkt.size() > 0; i++) {
                 m_Demux.qVideoPkt.wait_for_push();
             }
             if (!bGetPacket && pkt) {
@@ -3425,7 +3788,7 @@ RGY_ERR RGYInputAvcodec::LoadNextFrameInternal(RGYFrame *pSurface) {
             //AVERROR(EAGAIN) -> パケットを送る前に受け取る必要がある
             //パケットが受け取られていないのでpopしない
             if (ret != AVERROR(EAGAIN)) {
-                m_Demux.qVideoPkt.pop();
+                m_Demux.qVideoPkt.try_pop(&pkt);
                 m_poolPkt->returnFree(&pkt);
             }
             if (ret == AVERROR_EOF) { //これ以上パケットを送れない
@@ -3554,12 +3917,15 @@ HANDLE RGYInputAvcodec::getThreadHandleInput() {
 RGY_ERR RGYInputAvcodec::ThreadFuncRead(RGYParamThread threadParam) {
     threadParam.apply(GetCurrentThread());
     AddMessage(RGY_LOG_DEBUG, _T("Set input thread param: %s.\n"), threadParam.desc().c_str());
+    RGYTrace::setThreadName("demux");
     while (!m_Demux.thread.bAbortInput) {
+        RGYTraceScope trace("demux");
         auto [ret, pkt] = getSample();
         if (ret) {
             break;
         }
         m_Demux.qVideoPkt.push(pkt.release());
+        trace.setQueue((int)m_Demux.qVideoPkt.size());
     }
     return RGY_ERR_NONE;
 }
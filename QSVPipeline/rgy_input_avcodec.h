@@ -37,11 +37,14 @@
 #include "rgy_queue.h"
 #include "rgy_perf_monitor.h"
 #include "rgy_bitstream.h"
+#include "rgy_seek_index.h"
 #include "convert_csp.h"
 #include <deque>
 #include <set>
 #include <atomic>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <cassert>
 
 using std::vector;
@@ -163,6 +166,8 @@ public:
         m_maxPts(0),
         m_PAFFRewind(0),
         m_ptsWrapArroundThreshold(0xFFFFFFFF),
+        m_ptsIndex(),
+        m_ptsIndexStopped(false),
         m_fpDebugCopyFrameData() {
         m_list.init();
         static_assert(sizeof(m_list.get()[0]) == sizeof(m_list.get()->data), "FramePos must not have padding.");
@@ -233,6 +238,8 @@ public:
         m_maxPts = 0;
         m_PAFFRewind = 0;
         m_ptsWrapArroundThreshold = 0xFFFFFFFF;
+        m_ptsIndex.clear();
+        m_ptsIndexStopped = false;
         m_fpDebugCopyFrameData.reset();
         m_list.init();
     }
@@ -270,10 +277,43 @@ public:
         m_streamPtsStatus = RGY_PTS_UNKNOWN;
         m_PAFFRewind = 0;
         m_ptsWrapArroundThreshold = 0xFFFFFFFF;
+        m_ptsIndex.clear();
+        m_ptsIndexStopped = false;
     }
     RGYPtsStatus getStreamPtsStatus() const {
         return m_streamPtsStatus;
     }
+    //iStart以降で、pts <= list(i).pts (bUpperBoundなら pts < list(i).pts) となる最初のインデックスを返す
+    //該当するフレームがなければframeNum()を返す
+    //ptsが確定している範囲はm_ptsIndexを二分探索し、それ以降は線形探索する
+    // !! push側のスレッドからのみ有効 !!
+    int searchPts(int64_t pts, int iStart, bool bUpperBound) {
+        const int nIndexed = (int)m_ptsIndex.size();
+        int i = (std::max)(0, iStart);
+        if (i < nIndexed) {
+            //iStartから1,2,4,...と幅を広げて範囲を絞ってから二分探索する
+            //(ptsが単調に増加する順で呼ばれる場合は、ほぼ定数時間で見つかる)
+            int lo = i;
+            for (int step = 1; i < nIndexed && ((bUpperBound) ? m_ptsIndex[i] <= pts : m_ptsIndex[i] < pts); step <<= 1) {
+                lo = i + 1;
+                i += step;
+            }
+            const auto itStart = m_ptsIndex.begin() + lo;
+            const auto itEnd = m_ptsIndex.begin() + (std::min)(i + 1, nIndexed);
+            const auto it = (bUpperBound) ? std::upper_bound(itStart, itEnd, pts) : std::lower_bound(itStart, itEnd, pts);
+            if (it != itEnd) {
+                return (int)(it - m_ptsIndex.begin());
+            }
+            i = nIndexed;
+        }
+        const int nListSize = (int)m_list.size();
+        for (; i < nListSize; i++) {
+            if ((bUpperBound) ? pts < m_list[i].data.pts : pts <= m_list[i].data.pts) {
+                return i;
+            }
+        }
+        return nListSize;
+    }
     FramePos findpts(int64_t pts, uint32_t *lastIndex) {
         FramePos pos_last = framePosInit();
         for (uint32_t index = *lastIndex + 1; ; index++) {
@@ -388,6 +428,7 @@ public:
         m_PAFFRewind = 0;
         m_duration = total_duration;
         m_durationNum = m_nextFixNumIndex;
+        updatePtsIndex();
     }
     bool isEof() const {
         return m_inputFin;
@@ -663,6 +704,9 @@ protected:
                 m_list.pop();
                 m_nextFixNumIndex--;
                 nSortFixedSize--;
+                //インデックスがずれるので作り直す
+                m_ptsIndex.clear();
+                m_ptsIndexStopped = false;
             } else {
                 adjustDurationAfterSort(m_nextFixNumIndex);
                 //ソートにより確定したptsに対して、pocとdurationを設定する
@@ -678,6 +722,24 @@ protected:
             m_nextFixNumIndex--;
             m_PAFFRewind = 1;
         }
+        updatePtsIndex();
+    }
+    //ptsの確定したフレームのptsをm_ptsIndexに追加する
+    //ptsが単調増加でなくなった場合(wrap arroundなど)は、それ以降は追加せず線形探索に任せる
+    void updatePtsIndex() {
+        //PAFFで確定を戻したフレームは再度ソートされうるので、インデックスからも除く
+        if ((int)m_ptsIndex.size() > m_nextFixNumIndex) {
+            m_ptsIndex.resize(m_nextFixNumIndex);
+            m_ptsIndexStopped = false;
+        }
+        for (int i = (int)m_ptsIndex.size(); !m_ptsIndexStopped && i < m_nextFixNumIndex; i++) {
+            const int64_t pts = m_list[i].data.pts;
+            if (pts == AV_NOPTS_VALUE || (m_ptsIndex.size() > 0 && pts < m_ptsIndex.back())) {
+                m_ptsIndexStopped = true;
+            } else {
+                m_ptsIndex.push_back(pts);
+            }
+        }
     }
 protected:
     double m_frameDuration; //CFRを仮定する際のフレーム長 (RGY_PTS_ALL_INVALID, RGY_PTS_NONKEY_INVALID, RGY_PTS_NONKEY_INVALID時有効)
@@ -694,6 +756,8 @@ protected:
     int64_t m_maxPts; //最大のpts
     int m_PAFFRewind; //PAFFのdurationを確定させるため、戻した枚数
     uint32_t m_ptsWrapArroundThreshold; //wrap arroundを判定する閾値
+    vector<int64_t> m_ptsIndex; //ptsが確定したフレームのpts (先頭から単調増加している範囲のみ、searchPts用)
+    bool m_ptsIndexStopped; //ptsが単調増加でなくなり、m_ptsIndexへの追加を停止した
     unique_ptr<FILE, fp_deleter> m_fpDebugCopyFrameData; //copyのデバッグ用
 };
 
@@ -765,8 +829,7 @@ struct AVDemuxVideo {
     std::set<int>             HWDecodeDeviceId;      //HWデコードする場合に選択したデバイス
 
     RGYHEVCBsf                hevcbsf;               //HEVCのbsfの選択
-    bool                      bUseHEVCmp42AnnexB;
-    int                       hevcNaluLengthSize;
+    bool                      bUseHEVCmp42AnnexB;    //内部実装(mp42Annexb)でAnnexB形式に変換する (H.264/HEVC)
     bool                      hdr10plusMetadataCopy; //HDR10plusのメタ情報を取得する
     bool                      doviRpuMetadataCopy;   //dovi rpuのメタ情報を取得する
 
@@ -795,6 +858,24 @@ struct AVDemuxThread {
     void close(RGYLog *log = nullptr);
 };
 
+//並列エンコードの親で、子に分配するため読み込んだ映像パケット (bsf等の処理前) を保持するキュー
+struct AVDemuxFanOut {
+    std::atomic<bool>            enable;       //読み込んだ映像パケットをキューに保持する
+    std::mutex                   mtx;
+    std::condition_variable      cv;
+    std::deque<AVPacket*>        pkts;         //まだチャンクに格納していないパケット
+    size_t                       queuedSize;   //pktsのデータ量の合計
+    size_t                       maxQueuedSize; //pktsのデータ量の上限 (分配を開始するまでは0=制限なし)
+    bool                         eof;          //入力の終端に達した
+    bool                         abort;        //分配を終了した
+    std::deque<AVPacket*>        carry;        //分割位置のキーフレーム以降で、次のチャンクの先頭となるパケット (分配側からのみ参照)
+    size_t                       maxGopSize;   //これまでのGOPのデータ量の最大値 (チャンクの分割位置の判定用、分配側からのみ参照)
+
+    AVDemuxFanOut() : enable(false), mtx(), cv(), pkts(), queuedSize(0), maxQueuedSize(0), eof(false), abort(false), carry(), maxGopSize(0) {};
+    ~AVDemuxFanOut() { close(); }
+    void close();
+};
+
 struct AVDemuxer {
     AVDemuxFormat                 format;
     AVDemuxVideo                  video;
@@ -802,11 +883,14 @@ struct AVDemuxer {
     std::vector<AVDemuxStream>    stream;
     std::vector<const AVChapter*> chapter;
     AVDemuxThread                 thread;
-    RGYQueueMPMP<AVPacket*>       qVideoPkt;
+    RGYQueueBounded<AVPacket*, RGYQueueBoundedMode::SPSC> qVideoPkt;
     std::deque<AVPacket*>         qStreamPktL1;
-    RGYQueueMPMP<AVPacket*>       qStreamPktL2;
+    RGYQueueBounded<AVPacket*, RGYQueueBoundedMode::SPSC> qStreamPktL2;
+    int64_t                       qStreamPktL2PushedMaxPts; //これまでにqStreamPktL2に追加したパケットのptsの最大値 (Writer側が取り出し済みのものも含む)
+                                                            //qStreamPktL2はpush側から参照できないため、キューに残っているものの最大値ではなくこちらを使う
+    AVDemuxFanOut                 fanOut;
 
-    AVDemuxer() : format(), video(), frames(), stream(), chapter(), thread(), qVideoPkt(), qStreamPktL1(), qStreamPktL2() {};
+    AVDemuxer() : format(), video(), frames(), stream(), chapter(), thread(), qVideoPkt(), qStreamPktL1(), qStreamPktL2(), qStreamPktL2PushedMaxPts(AV_NOPTS_VALUE), fanOut() {};
 };
 
 class RGYInputAvcodecPrm : public RGYInputPrm {
@@ -848,6 +932,7 @@ public:
     tstring        logFramePosList;         //FramePosListの内容を入力終了時に出力する (デバッグ用)
     tstring        logCopyFrameData;        //frame情報copy関数のログ出力先 (デバッグ用)
     tstring        logPackets;              //読み込んだパケットの情報を出力する
+    tstring        seekIndexFile;           //キーフレーム位置等を保存するindexファイル (空なら使用しない)
     int            threadInput;             //入力スレッドを有効にする
     RGYParamThread threadParamInput;        //入力スレッドのスレッドアフィニティ
     PerfQueueInfo *queueInfo;               //キューの情報を格納する構造体
@@ -863,6 +948,8 @@ public:
     RGYOptList     inputOpt;                //入力オプション
     RGYHEVCBsf     hevcbsf;
     tstring        avswDecoder;             //avswデコーダの指定
+    bool           parallelEncParent;       //並列エンコードの親
+    RGYInputChunk *inputChunk;              //並列エンコードの子で、親が読み込んだパケットを使用する場合
 
     RGYInputAvcodecPrm(RGYInputPrm base);
     virtual ~RGYInputAvcodecPrm() {};
@@ -921,6 +1008,14 @@ public:
 
     virtual bool isPipe() const override;
 
+    virtual void startSeekIndexBuild() override;
+
+    virtual bool parallelEncFanOutSupported() const override;
+
+    virtual RGY_ERR parallelEncFanOut(RGYInputChunk *chunk, const RGYInputChunkLimit& limit) override;
+
+    virtual void parallelEncFanOutClose() override;
+
     //入力ファイルに存在する音声のトラック数を返す
     int GetAudioTrackCount() override;
 
@@ -981,6 +1076,8 @@ protected:
     RGY_ERR parseHDR10plusDOVIRpuAV1(AVPacket *pkt, const bool hdr10plus, const bool doviRpu);
 
     RGY_ERR initFormatCtx(const TCHAR *strFileName, const RGYInputAvcodecPrm *input_prm, const int iretry);
+    //並列エンコードの子で、親から渡された映像ストリームの情報からformatCtxを作成する
+    RGY_ERR initFormatCtxFromChunk(const RGYInputChunk *chunk);
     RGY_ERR initVideoBsfs();
     RGY_ERR initVideoParser();
     RGY_ERR parseVideoExtraData(const AVPacket *pkt);
@@ -1008,6 +1105,13 @@ protected:
     //対象ストリームのパケットを取得
     std::tuple<int, std::unique_ptr<AVPacket, RGYAVDeleter<AVPacket>>> getSample(bool bTreatFirstPacketAsKeyframe = false);
 
+    //入力からパケットを読み込む (並列エンコードの子で親から渡されたパケットがあれば、そこから取得する)
+    int readFrame(AVPacket *pkt);
+
+    //並列エンコードの親で、子に分配するパケットをキューに追加する/キューから取り出す
+    void pushFanOutPacket(AVPacket *pkt);
+    RGY_ERR popFanOutPacket(std::deque<AVPacket*>& carried, AVPacket **pkt);
+
     //対象・字幕の音声パケットを追加するかどうか
     bool checkStreamPacketToAdd(AVPacket *pkt, AVDemuxStream *stream);
 
@@ -1045,7 +1149,8 @@ protected:
     //subPacketTemporalBufferにたまっている字幕パケットをソートして送出する
     void sortAndPushSubtitlePacket();
 
-    void hevcMp42Annexb(AVPacket *pkt);
+    //mp4/mkv形式のH.264/HEVCのパケットをAnnexB形式に変換する (pkt=nullptrならextradataを変換する)
+    void mp42Annexb(AVPacket *pkt);
 
     //VC-1のヘッダの修正を行う
     void vc1FixHeader(int nLengthFix = -1);
@@ -1061,7 +1166,12 @@ protected:
     AVDemuxer        m_Demux;                      //デコード用情報
     tstring          m_logFramePosList;           //FramePosListの内容を入力終了時に出力する (デバッグ用)
     std::unique_ptr<FILE, fp_deleter> m_fpPacketList; // 読み取ったパケット情報を出力するファイル
-    vector<uint8_t>  m_hevcMp42AnnexbBuffer;       //HEVCのmp4->AnnexB簡易変換用バッファ
+    RGYMp4ToAnnexb   m_mp42Annexb;                //H.264/HEVCのmp4->AnnexB簡易変換
+    RGYSeekIndex     m_seekIndex;                 //キーフレーム位置等を保存するindexファイル
+    tstring          m_seekIndexSrcFile;          //indexファイルに対応する入力ファイル
+    std::thread      m_seekIndexThread;           //並列エンコードの親でindexファイルを作成するスレッド
+    std::atomic<bool> m_seekIndexAbort;           //m_seekIndexThreadの中断
+    RGYInputChunk   *m_inputChunk;                //並列エンコードの子で、親が読み込んで分配したパケット
 };
 
 #endif //ENABLE_AVSW_READER
@@ -26,11 +26,25 @@
 // ------------------------------------------------------------------------------------------
 
 #include <sstream>
+#include <future>
+#include <chrono>
 #include <fcntl.h>
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
 #include "rgy_input_raw.h"
+#include "rgy_trace.h"
 
 #if ENABLE_RAW_READER
 
+//先読みするフレーム数
+static const int RAW_READ_AHEAD_FRAMES = 4;
+
 RGY_ERR RGYInputRaw::ParseY4MHeader(char *buf, VideoInfo *pInfo) {
     //どういうわけかCを指定しないy4mファイルが世の中にはあるようなので、
     //とりあえずデフォルトはYV12にしておく
@@ -115,9 +129,31 @@ RGY_ERR RGYInputRaw::ParseY4MHeader(char *buf, VideoInfo *pInfo) {
 RGYInputRaw::RGYInputRaw() :
     m_fSource(NULL),
     m_nBufSize(0),
+    m_frameSize(0),
     m_pBuffer(),
+    m_mapPtr(nullptr),
+    m_mapSize(0),
+    m_mapOffset(0),
+#if defined(_WIN32) || defined(_WIN64)
+    m_mapHandle(nullptr),
+#endif
+    m_readAheadBuf(),
+    m_qReadAheadFree(),
+    m_qReadAheadFilled(),
+    m_thReadAhead(),
+    m_threadParamReadAhead(),
+    m_readAheadEOF(false),
+    m_readInterruptible(false),
+    m_readAbort(false),
+#if !(defined(_WIN32) || defined(_WIN64))
+    m_readAbortPipe{ -1, -1 },
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
     m_isPipe(false),
     m_chunkPipeHandle(),
+    m_inputChunk(nullptr),
+    m_y4mHeader(),
+    m_fanOutFrames(0),
+    m_fanOutEOF(false),
     m_firstKeyPts(-1) {
     m_readerName = _T("raw");
 }
@@ -127,27 +163,349 @@ RGYInputRaw::~RGYInputRaw() {
 }
 
 void RGYInputRaw::Close() {
+    StopReadAhead();
+    CloseMap();
     if (m_fSource) {
         fclose(m_fSource);
         m_fSource = NULL;
     }
+    CloseSourceRead();
     m_pBuffer.reset();
+    m_inputChunk = nullptr;
     m_nBufSize = 0;
+    m_frameSize = 0;
     RGYInput::Close();
 }
 
+bool RGYInputRaw::OpenMap() {
+    const int64_t offset = _ftelli64(m_fSource);
+    if (offset < 0) {
+        return false;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(m_fSource));
+    LARGE_INTEGER fileSize = { 0 };
+    if (hFile == INVALID_HANDLE_VALUE
+        || GetFileType(hFile) != FILE_TYPE_DISK
+        || !GetFileSizeEx(hFile, &fileSize)
+        || fileSize.QuadPart <= offset) {
+        return false;
+    }
+    m_mapHandle = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapHandle == nullptr) {
+        return false;
+    }
+    m_mapPtr = (const uint8_t *)MapViewOfFile(m_mapHandle, FILE_MAP_READ, 0, 0, 0);
+    if (m_mapPtr == nullptr) {
+        CloseHandle(m_mapHandle);
+        m_mapHandle = nullptr;
+        return false;
+    }
+    m_mapSize = (uint64_t)fileSize.QuadPart;
+#else
+    const int fd = fileno(m_fSource);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= offset) {
+        return false;
+    }
+    void *ptr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+        return false;
+    }
+    madvise(ptr, (size_t)st.st_size, MADV_SEQUENTIAL);
+    m_mapPtr = (const uint8_t *)ptr;
+    m_mapSize = (uint64_t)st.st_size;
+#endif //#if defined(_WIN32) || defined(_WIN64)
+    m_mapOffset = (uint64_t)offset;
+    return true;
+}
+
+void RGYInputRaw::CloseMap() {
+    if (m_mapPtr) {
+#if defined(_WIN32) || defined(_WIN64)
+        UnmapViewOfFile(m_mapPtr);
+#else
+        munmap((void *)m_mapPtr, (size_t)m_mapSize);
+#endif //#if defined(_WIN32) || defined(_WIN64)
+        m_mapPtr = nullptr;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    if (m_mapHandle) {
+        CloseHandle(m_mapHandle);
+        m_mapHandle = nullptr;
+    }
+#endif //#if defined(_WIN32) || defined(_WIN64)
+    m_mapSize = 0;
+    m_mapOffset = 0;
+}
+
+RGY_ERR RGYInputRaw::GetNextFrameFromMap(const uint8_t **ptr) {
+    if (m_inputVideoInfo.type == RGY_INPUT_FMT_Y4M) {
+        const uint8_t *header = m_mapPtr + m_mapOffset;
+        const uint64_t remain = m_mapSize - m_mapOffset;
+        if (remain < strlen("FRAME")) {
+            AddMessage(RGY_LOG_DEBUG, _T("header1: finish.\n"));
+            return RGY_ERR_MORE_DATA;
+        }
+        if (memcmp(header, "FRAME", strlen("FRAME")) != 0) {
+            AddMessage(RGY_LOG_DEBUG, _T("header2: finish.\n"));
+            return RGY_ERR_MORE_DATA;
+        }
+        const uint8_t *lf = (const uint8_t *)memchr(header + strlen("FRAME"), '\n', (size_t)std::min<uint64_t>(remain - strlen("FRAME"), 65));
+        if (lf == nullptr) {
+            AddMessage(RGY_LOG_DEBUG, _T("header3: finish.\n"));
+            return RGY_ERR_MORE_DATA;
+        }
+        m_mapOffset += (uint64_t)(lf - header) + 1;
+    }
+    if (m_mapOffset + m_frameSize > m_mapSize) {
+        AddMessage(RGY_LOG_DEBUG, _T("map: finish: %d.\n"), m_frameSize);
+        return RGY_ERR_MORE_DATA;
+    }
+    const uint8_t *frame = m_mapPtr + m_mapOffset;
+    m_mapOffset += m_frameSize;
+    if (m_mapOffset + (m_nBufSize - m_frameSize) > m_mapSize) {
+        //ファイル末尾のフレームは、変換時にAVX2等で読みすぎてマップした範囲外を参照しないよう、
+        //余裕をもって確保したバッファにコピーしてから変換する
+        memcpy(m_pBuffer.get(), frame, m_frameSize);
+        frame = m_pBuffer.get();
+    }
+#if !(defined(_WIN32) || defined(_WIN64))
+    else {
+        //数フレーム先を非同期に読み込ませておく
+        const uint64_t pageMask = (uint64_t)sysconf(_SC_PAGESIZE) - 1;
+        const uint64_t prefetchStart = (m_mapOffset + (uint64_t)m_frameSize * (RAW_READ_AHEAD_FRAMES - 1)) & ~pageMask;
+        if (prefetchStart < m_mapSize) {
+            madvise((void *)(m_mapPtr + prefetchStart), (size_t)std::min<uint64_t>(m_frameSize + pageMask, m_mapSize - prefetchStart), MADV_WILLNEED);
+        }
+    }
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+    *ptr = frame;
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYInputRaw::InitSourceRead() {
+    //通常のファイルは終端があり読み込みが止まり続けることはないので、これまで通りfreadで読み込む
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(m_fSource));
+    m_readInterruptible = hFile != INVALID_HANDLE_VALUE && GetFileType(hFile) != FILE_TYPE_DISK;
+#else
+    struct stat st;
+    m_readInterruptible = fstat(fileno(m_fSource), &st) == 0 && !S_ISREG(st.st_mode);
+#endif //#if defined(_WIN32) || defined(_WIN64)
+    if (!m_readInterruptible) {
+        return RGY_ERR_NONE;
+    }
+    //パイプ等では、書き込み側がデータを送らないまま開いたままにしていると読み込みがいつまでも戻らない
+    //--framesやtrimで途中で終了する場合などに読み込みを中断できるよう、FILEのバッファを使わずに直接読み込む
+    //(ヘッダもこの後に読むので、FILEのバッファにデータが残ることはない)
+    if (setvbuf(m_fSource, nullptr, _IONBF, 0) != 0) {
+        AddMessage(RGY_LOG_ERROR, _T("Failed to disable buffering of input.\n"));
+        return RGY_ERR_UNDEFINED_BEHAVIOR;
+    }
+#if !(defined(_WIN32) || defined(_WIN64))
+    if (pipe(m_readAbortPipe) != 0) {
+        m_readAbortPipe[0] = m_readAbortPipe[1] = -1;
+        AddMessage(RGY_LOG_ERROR, _T("Failed to create pipe to abort reading.\n"));
+        return RGY_ERR_UNDEFINED_BEHAVIOR;
+    }
+    for (auto fd : m_readAbortPipe) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+    AddMessage(RGY_LOG_DEBUG, _T("Input is not a regular file, reading without buffering.\n"));
+    return RGY_ERR_NONE;
+}
+
+void RGYInputRaw::CloseSourceRead() {
+#if !(defined(_WIN32) || defined(_WIN64))
+    for (auto& fd : m_readAbortPipe) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+    m_readInterruptible = false;
+    m_readAbort = false;
+}
+
+RGY_ERR RGYInputRaw::ReadSource(void *buf, size_t size) {
+    if (!m_readInterruptible) {
+        return (_fread_nolock(buf, 1, size, m_fSource) == size) ? RGY_ERR_NONE : RGY_ERR_MORE_DATA;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    const int fd = _fileno(m_fSource);
+#else
+    const int fd = fileno(m_fSource);
+#endif //#if defined(_WIN32) || defined(_WIN64)
+    uint8_t *ptr = (uint8_t *)buf;
+    while (size > 0) {
+        if (m_readAbort) {
+            return RGY_ERR_ABORTED;
+        }
+#if defined(_WIN32) || defined(_WIN64)
+        //中断要求時はStopReadAhead()からCancelSynchronousIoで読み込みを中断させる
+        const int ret = _read(fd, ptr, (unsigned int)std::min<size_t>(size, INT_MAX));
+        if (ret < 0 && m_readAbort) {
+            return RGY_ERR_ABORTED;
+        }
+#else
+        //入力とともに中断用のパイプを待ち、中断要求時はそちらに書き込んで待機を解除する
+        struct pollfd fds[2] = { { fd, POLLIN, 0 }, { m_readAbortPipe[0], POLLIN, 0 } };
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return RGY_ERR_MORE_DATA;
+        }
+        if (fds[1].revents != 0) {
+            return RGY_ERR_ABORTED;
+        }
+        const auto ret = read(fd, ptr, size);
+        if (ret < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+#endif //#if defined(_WIN32) || defined(_WIN64)
+        if (ret <= 0) {
+            return RGY_ERR_MORE_DATA;
+        }
+        ptr += ret;
+        size -= (size_t)ret;
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYInputRaw::ReadFrame(uint8_t *buf) {
+    RGY_ERR err = RGY_ERR_NONE;
+    if (m_inputVideoInfo.type == RGY_INPUT_FMT_Y4M) {
+        uint8_t y4m_buf[8] = { 0 };
+        if ((err = ReadSource(y4m_buf, strlen("FRAME"))) != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_DEBUG, _T("header1: finish: %s.\n"), get_err_mes(err));
+            return err;
+        }
+        if (memcmp(y4m_buf, "FRAME", strlen("FRAME")) != 0) {
+            AddMessage(RGY_LOG_DEBUG, _T("header2: finish.\n"));
+            return RGY_ERR_MORE_DATA;
+        }
+        for (int i = 0; ; i++) {
+            char c = 0;
+            if ((err = ReadSource(&c, 1)) != RGY_ERR_NONE) {
+                AddMessage(RGY_LOG_DEBUG, _T("header3: finish: %s.\n"), get_err_mes(err));
+                return err;
+            }
+            if (c == '\n') {
+                break;
+            }
+            if (i >= 64) {
+                AddMessage(RGY_LOG_DEBUG, _T("header3: finish.\n"));
+                return RGY_ERR_MORE_DATA;
+            }
+        }
+    }
+    if ((err = ReadSource(buf, m_frameSize)) != RGY_ERR_NONE) {
+        AddMessage(RGY_LOG_DEBUG, _T("fread: finish: %d, %s.\n"), m_frameSize, get_err_mes(err));
+        return err;
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYInputRaw::StartReadAhead() {
+    m_readAheadBuf.clear();
+    for (int i = 0; i < RAW_READ_AHEAD_FRAMES; i++) {
+        std::unique_ptr<uint8_t, aligned_malloc_deleter> buf((uint8_t *)_aligned_malloc(m_nBufSize, 64), aligned_malloc_deleter());
+        if (!buf) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to allocate input buffer.\n"));
+            return RGY_ERR_NULL_PTR;
+        }
+        m_readAheadBuf.push_back(std::move(buf));
+    }
+    //空きバッファのキューには終了要求(-1)も積むので、1つ多めに確保する
+    m_qReadAheadFree.init(RAW_READ_AHEAD_FRAMES + 1);
+    m_qReadAheadFilled.init(RAW_READ_AHEAD_FRAMES + 1);
+    for (int i = 0; i < RAW_READ_AHEAD_FRAMES; i++) {
+        m_qReadAheadFree.push(i);
+    }
+    m_readAheadEOF = false;
+    m_thReadAhead = std::thread(&RGYInputRaw::ThreadFuncReadAhead, this, m_threadParamReadAhead);
+    AddMessage(RGY_LOG_DEBUG, _T("Started read-ahead thread: %d frames.\n"), RAW_READ_AHEAD_FRAMES);
+    return RGY_ERR_NONE;
+}
+
+void RGYInputRaw::StopReadAhead() {
+    if (m_thReadAhead.joinable()) {
+        //パイプ等で読み込み待ちのまま止まっていても終了できるよう、読み込みを中断させる
+        m_readAbort = true;
+        m_qReadAheadFree.push(-1);
+#if !(defined(_WIN32) || defined(_WIN64))
+        bool abortRequested = false;
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+        if (m_readInterruptible) {
+#if defined(_WIN32) || defined(_WIN64)
+            //読み込みに入る直前だった場合は中断できないので、スレッドが終了するまで繰り返す
+            HANDLE hThread = (HANDLE)m_thReadAhead.native_handle();
+            while (WaitForSingleObject(hThread, 10) == WAIT_TIMEOUT) {
+                CancelSynchronousIo(hThread);
+            }
+#else
+            const char c = 0;
+            abortRequested = write(m_readAbortPipe[1], &c, 1) == 1;
+            if (!abortRequested) {
+                AddMessage(RGY_LOG_WARN, _T("Failed to abort reading input.\n"));
+            }
+#endif //#if defined(_WIN32) || defined(_WIN64)
+        }
+        m_thReadAhead.join();
+#if !(defined(_WIN32) || defined(_WIN64))
+        if (abortRequested) {
+            char c = 0;
+            if (read(m_readAbortPipe[0], &c, 1) != 1) { //次の読み込みに影響しないよう、中断要求を取り除いておく
+                AddMessage(RGY_LOG_WARN, _T("Failed to reset abort request of input.\n"));
+            }
+        }
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+        m_readAbort = false;
+        AddMessage(RGY_LOG_DEBUG, _T("Closed read-ahead thread.\n"));
+    }
+    m_qReadAheadFree.close();
+    m_qReadAheadFilled.close();
+    m_readAheadBuf.clear();
+    m_readAheadEOF = false;
+}
+
+RGY_ERR RGYInputRaw::ThreadFuncReadAhead(RGYParamThread threadParam) {
+    threadParam.apply(GetCurrentThread());
+    AddMessage(RGY_LOG_DEBUG, _T("Set read-ahead thread param: %s.\n"), threadParam.desc().c_str());
+    RGYTrace::setThreadName("input read-ahead");
+    int idx = -1;
+    while (m_qReadAheadFree.pop(&idx) && idx >= 0) {
+        RGYTraceScope trace("input read");
+        if (ReadFrame(m_readAheadBuf[idx].get()) != RGY_ERR_NONE) {
+            break;
+        }
+        m_qReadAheadFilled.push(idx);
+    }
+    m_qReadAheadFilled.push(-1);
+    return RGY_ERR_NONE;
+}
+
 RGY_ERR RGYInputRaw::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const RGYInputPrm *prm) {
     m_inputVideoInfo = *pInputInfo;
     m_readerName = (m_inputVideoInfo.type == RGY_INPUT_FMT_Y4M) ? _T("y4m") : _T("raw");
 
     m_convert = std::make_unique<RGYConvertCSP>(prm->threadCsp, prm->threadParamCsp);
     m_chunkPipeHandle = reinterpret_cast<const RGYInputPrmRaw *>(prm)->chunkPipeHandle;
+    m_inputChunk = reinterpret_cast<const RGYInputPrmRaw *>(prm)->inputChunk;
 
-    m_isPipe = _tcscmp(strFileName, _T("-")) == 0;
+    m_isPipe = _tcscmp(strFileName, _T("-")) == 0 && m_inputChunk == nullptr;
     // 並列エンコード時
     // 親 -> 普通に標準入力を開いてヘッダ取得(m_chunkPipeHandleはセットされていない)
     // 子 -> m_chunkPipeHandle.handleを開いてヘッダ取得(担当するchunkPipeHandleがセットされている)
-    if (m_chunkPipeHandle.startFrameId >= 0) {
+    // 子 -> 親が読み込んだ入力データ(m_inputChunk)からヘッダ取得(パイプ入力を親が分配する場合)
+    if (m_inputChunk) {
+        m_chunkPipeHandle = RGYParamParallelEncPipeHandle(0, m_inputChunk->startFrameId());
+        AddMessage(RGY_LOG_DEBUG, _T("input chunk from parent: first frame %d, %d frames.\n"), m_inputChunk->startFrameId(), m_inputChunk->frames());
+    } else if (m_chunkPipeHandle.startFrameId >= 0) {
         if (m_chunkPipeHandle.handle == 0) {
             AddMessage(RGY_LOG_ERROR, _T("chunk-handle is not set.\n"));
             return RGY_ERR_INVALID_HANDLE;
@@ -197,16 +555,29 @@ RGY_ERR RGYInputRaw::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         }
     }
 
+    if (m_fSource) {
+        auto err = InitSourceRead();
+        if (err != RGY_ERR_NONE) {
+            return err;
+        }
+    }
+
     auto nOutputCSP = m_inputVideoInfo.csp; //RGYInputRawがエンコーダに渡すべき色空間
     m_inputCsp = RGY_CSP_YV12;
     if (m_inputVideoInfo.type == RGY_INPUT_FMT_Y4M) {
         //read y4m header
         auto orig_picstruct = m_inputVideoInfo.picstruct; // ParseY4MHeaderで書き換えられるので退避
         char buf[128] = { 0 };
-        if (fread(buf, 1, strlen("YUV4MPEG2"), m_fSource) != strlen("YUV4MPEG2")
+        if (m_inputChunk) {
+            strncpy_s(buf, _countof(buf), m_inputChunk->header().c_str(), _countof(buf) - 1);
+        } else if (fread(buf, 1, strlen("YUV4MPEG2"), m_fSource) != strlen("YUV4MPEG2")
             || strcmp(buf, "YUV4MPEG2") != 0
-            || !fgets(buf, sizeof(buf), m_fSource)
-            || RGY_ERR_NONE != ParseY4MHeader(buf, &m_inputVideoInfo)) {
+            || !fgets(buf, sizeof(buf), m_fSource)) {
+            AddMessage(RGY_LOG_ERROR, _T("failed to read y4m header: %s."), char_to_tstring(buf).c_str());
+            return RGY_ERR_INVALID_FORMAT;
+        }
+        m_y4mHeader = buf; // ParseY4MHeaderで書き換えられるので、先に保存しておく
+        if (RGY_ERR_NONE != ParseY4MHeader(buf, &m_inputVideoInfo)) {
             AddMessage(RGY_LOG_ERROR, _T("failed to parse y4m header: %s."), buf);
             return RGY_ERR_INVALID_FORMAT;
         }
@@ -283,6 +654,10 @@ RGY_ERR RGYInputRaw::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         AddMessage(RGY_LOG_ERROR, _T("Unknown color foramt.\n"));
         return RGY_ERR_INVALID_COLOR_FORMAT;
     }
+    if (rgy_csp_has_alpha(m_inputCsp)) {
+        bufferSize += m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight;
+    }
+    m_frameSize = bufferSize;
     // 幅が割り切れない場合に備え、変換時にAVX2等で読みすぎて異常終了しないようにあらかじめ多めに確保する
     bufferSize += (ALIGN(m_inputVideoInfo.srcWidth, 128) - m_inputVideoInfo.srcWidth) * bytesPerPix(m_inputCsp);
     AddMessage(RGY_LOG_DEBUG, _T("%dx%d, pitch:%d, bufferSize:%d.\n"), m_inputVideoInfo.srcWidth, m_inputVideoInfo.srcHeight, m_inputVideoInfo.srcPitch, bufferSize);
@@ -301,11 +676,7 @@ RGY_ERR RGYInputRaw::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
     if (cspShiftUsed(m_inputVideoInfo.csp) && RGY_CSP_BIT_DEPTH[m_inputVideoInfo.csp] > RGY_CSP_BIT_DEPTH[m_inputCsp]) {
         m_inputVideoInfo.bitdepth = RGY_CSP_BIT_DEPTH[m_inputCsp];
     }
-    m_pBuffer = std::shared_ptr<uint8_t>((uint8_t *)_aligned_malloc(bufferSize, 32), aligned_malloc_deleter());
-    if (!m_pBuffer) {
-        AddMessage(RGY_LOG_ERROR, _T("Failed to allocate input buffer.\n"));
-        return RGY_ERR_NULL_PTR;
-    }
+    m_nBufSize = bufferSize;
 
     if (m_convert->getFunc(m_inputCsp, m_inputVideoInfo.csp, false, prm->simdCsp) == nullptr) {
         AddMessage(RGY_LOG_ERROR, _T("raw/y4m: color conversion not supported: %s -> %s.\n"),
@@ -313,12 +684,59 @@ RGY_ERR RGYInputRaw::Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const
         return RGY_ERR_INVALID_COLOR_FORMAT;
     }
 
+    // 通常のファイルはメモリにマップし、マップしたページから直接変換する
+    // パイプ等マップできない場合は、先読みスレッドでリングバッファに読み込む
+    // (並列エンコードの親はフレームを読まないので、先読みスレッドは最初のフレームの読み込み時に起動する)
+    m_threadParamReadAhead = reinterpret_cast<const RGYInputPrmRaw *>(prm)->threadParamInput;
+    if (!m_isPipe && m_chunkPipeHandle.startFrameId < 0 && OpenMap()) {
+        AddMessage(RGY_LOG_DEBUG, _T("Mapped input file: %lld bytes.\n"), (long long int)m_mapSize);
+        m_pBuffer = std::shared_ptr<uint8_t>((uint8_t *)_aligned_malloc(bufferSize, 32), aligned_malloc_deleter());
+        if (!m_pBuffer) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to allocate input buffer.\n"));
+            return RGY_ERR_NULL_PTR;
+        }
+    }
+
     CreateInputInfo(m_readerName.c_str(), RGY_CSP_NAMES[m_convert->getFunc()->csp_from], RGY_CSP_NAMES[m_convert->getFunc()->csp_to], get_simd_str(m_convert->getFunc()->simd), &m_inputVideoInfo);
     AddMessage(RGY_LOG_DEBUG, m_inputInfo);
     *pInputInfo = m_inputVideoInfo;
     return RGY_ERR_NONE;
 }
 
+RGY_ERR RGYInputRaw::parallelEncFanOut(RGYInputChunk *chunk, const RGYInputChunkLimit& limit) {
+    //並列エンコードの親で、標準入力からチャンク分のフレームを読み込む
+    //(並列エンコードの親は自身ではフレームを読まないので、先読みスレッドとは競合しない)
+    chunk->setHeader(m_y4mHeader);
+    //チャンクの長さはフレームレートから求める
+    const double frameSec = (m_inputVideoInfo.fpsN > 0 && m_inputVideoInfo.fpsD > 0) ? m_inputVideoInfo.fpsD / (double)m_inputVideoInfo.fpsN : 1.0 / 30.0;
+    //フレームのサイズは一定なので、最短のチャンクが上限に収まるかは読み込む前に判定できる
+    //収まらない場合は、まだ入力を読み込んでいないので、並列エンコードを無効化して続行できる
+    int minFrames = std::max(1, (int)(limit.minSec / frameSec));
+    while (minFrames * frameSec < limit.minSec) {
+        minFrames++;
+    }
+    if (!limit.fits(0, (size_t)m_frameSize * minFrames)) {
+        AddMessage(RGY_LOG_WARN, _T("%d frames (%.1f sec) of input need %lld MB, exceeding the limit per chunk %lld MB.\n"),
+            minFrames, minFrames * frameSec, (long long int)(((size_t)m_frameSize * minFrames + (1 << 20) - 1) >> 20), (long long int)(limit.maxSize >> 20));
+        return RGY_ERR_NOT_ENOUGH_BUFFER;
+    }
+    while (!limit.fin(chunk->size(), m_frameSize, chunk->frames() * frameSec)) {
+        std::unique_ptr<uint8_t, aligned_malloc_deleter> buf((uint8_t *)_aligned_malloc(m_nBufSize, 64), aligned_malloc_deleter());
+        if (!buf) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to allocate input buffer.\n"));
+            return RGY_ERR_NULL_PTR;
+        }
+        auto err = ReadFrame(buf.get());
+        if (err != RGY_ERR_NONE) {
+            m_fanOutEOF = true;
+            return err;
+        }
+        chunk->addFrame(std::move(buf), m_frameSize);
+        m_fanOutFrames++;
+    }
+    return RGY_ERR_NONE;
+}
+
 int64_t RGYInputRaw::GetVideoFirstKeyPts() const {
     if (m_chunkPipeHandle.startFrameId < 0) {
         return 0;
@@ -340,75 +758,44 @@ RGY_ERR RGYInputRaw::LoadNextFrameInternal(RGYFrame *pSurface) {
         return RGY_ERR_MORE_DATA;
     }
     if (!pSurface) { // 並列エンコードで進捗表示を出すため
+        if (m_fanOutEOF && (int)m_encSatusInfo->m_sData.frameIn >= m_fanOutFrames) {
+            return RGY_ERR_MORE_DATA; // 子に分配した入力が終端に達した
+        }
         m_encSatusInfo->m_sData.frameIn++;
         return m_encSatusInfo->UpdateDisplay();
     }
 
-    if (m_inputVideoInfo.type == RGY_INPUT_FMT_Y4M) {
-        uint8_t y4m_buf[8] = { 0 };
-        if (_fread_nolock(y4m_buf, 1, strlen("FRAME"), m_fSource) != strlen("FRAME")) {
-            AddMessage(RGY_LOG_DEBUG, _T("header1: finish.\n"));
-            return RGY_ERR_MORE_DATA;
+    const uint8_t *frameData = nullptr;
+    int readAheadIdx = -1;
+    if (m_mapPtr) {
+        auto err = GetNextFrameFromMap(&frameData);
+        if (err != RGY_ERR_NONE) {
+            return err;
         }
-        if (memcmp(y4m_buf, "FRAME", strlen("FRAME")) != 0) {
-            AddMessage(RGY_LOG_DEBUG, _T("header2: finish.\n"));
+    } else if (m_inputChunk) {
+        //並列エンコードの子で、親が読み込んだフレームを使用する
+        if ((frameData = m_inputChunk->nextFrame()) == nullptr) {
             return RGY_ERR_MORE_DATA;
         }
-        int i;
-        for (i = 0; _fgetc_nolock(m_fSource) != '\n'; i++) {
-            if (i >= 64) {
-                AddMessage(RGY_LOG_DEBUG, _T("header3: finish.\n"));
-                return RGY_ERR_MORE_DATA;
+    } else {
+        if (!m_thReadAhead.joinable()) {
+            auto err = StartReadAhead();
+            if (err != RGY_ERR_NONE) {
+                return err;
             }
         }
-    }
-
-    uint32_t frameSize = 0;
-    switch (m_convert->getFunc()->csp_from) {
-    case RGY_CSP_NV12:
-    case RGY_CSP_YV12:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 3 / 2; break;
-    case RGY_CSP_P010:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 3; break;
-    case RGY_CSP_YUV422:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 2; break;
-    case RGY_CSP_YUV444:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 3; break;
-    case RGY_CSP_YV12_09:
-    case RGY_CSP_YV12_10:
-    case RGY_CSP_YV12_12:
-    case RGY_CSP_YV12_14:
-    case RGY_CSP_YV12_16:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 3; break;
-    case RGY_CSP_YUV422_09:
-    case RGY_CSP_YUV422_10:
-    case RGY_CSP_YUV422_12:
-    case RGY_CSP_YUV422_14:
-    case RGY_CSP_YUV422_16:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 4; break;
-    case RGY_CSP_YUV444_09:
-    case RGY_CSP_YUV444_10:
-    case RGY_CSP_YUV444_12:
-    case RGY_CSP_YUV444_14:
-    case RGY_CSP_YUV444_16:
-        frameSize = m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight * 6; break;
-    default:
-        AddMessage(RGY_LOG_ERROR, _T("Unknown color foramt.\n"));
-        return RGY_ERR_INVALID_COLOR_FORMAT;
-    }
-    if (rgy_csp_has_alpha(m_convert->getFunc()->csp_from)) {
-        frameSize += m_inputVideoInfo.srcWidth * m_inputVideoInfo.srcHeight;
-    }
-    if (frameSize != _fread_nolock(m_pBuffer.get(), 1, frameSize, m_fSource)) {
-        AddMessage(RGY_LOG_DEBUG, _T("fread: finish: %d.\n"), frameSize);
-        return RGY_ERR_MORE_DATA;
+        if (m_readAheadEOF || !m_qReadAheadFilled.pop(&readAheadIdx) || readAheadIdx < 0) {
+            m_readAheadEOF = true;
+            return RGY_ERR_MORE_DATA;
+        }
+        frameData = m_readAheadBuf[readAheadIdx].get();
     }
 
     void *dst_array[RGY_MAX_PLANES];
     pSurface->ptrArray(dst_array);
 
     const void *src_array[RGY_MAX_PLANES];
-    src_array[0] = m_pBuffer.get();
+    src_array[0] = frameData;
     src_array[1] = (uint8_t *)src_array[0] + m_inputVideoInfo.srcPitch * m_inputVideoInfo.srcHeight;
     switch (m_convert->getFunc()->csp_from) {
     case RGY_CSP_YV12:
@@ -460,6 +847,10 @@ RGY_ERR RGYInputRaw::LoadNextFrameInternal(RGYFrame *pSurface) {
     m_convert->run((m_inputVideoInfo.picstruct & RGY_PICSTRUCT_INTERLACED) ? 1 : 0,
         dst_array, src_array, m_inputVideoInfo.srcWidth, m_inputVideoInfo.srcPitch,
         src_uv_pitch, pSurface->pitch(), pSurface->pitch(RGY_PLANE_C), m_inputVideoInfo.srcHeight, m_inputVideoInfo.srcHeight, m_inputVideoInfo.crop.c);
+    if (readAheadIdx >= 0) {
+        //変換が終わったので、バッファを先読みスレッドに返却する
+        m_qReadAheadFree.push(readAheadIdx);
+    }
     auto inputFps = rgy_rational<int>(m_inputVideoInfo.fpsN, m_inputVideoInfo.fpsD);
     pSurface->setDuration(rational_rescale(1, getInputTimebase().inv(), inputFps));
     pSurface->setTimestamp(rational_rescale(GetVideoFirstKeyPts() + m_encSatusInfo->m_sData.frameIn, getInputTimebase().inv(), inputFps));
@@ -468,4 +859,155 @@ RGY_ERR RGYInputRaw::LoadNextFrameInternal(RGYFrame *pSurface) {
     return m_encSatusInfo->UpdateDisplay();
 }
 
+// --check-raw-pipe-stop用
+// 先読みスレッドを起動し、読み込んだフレームを取り出す
+class RGYInputRawPipeStopCheck : public RGYInputRaw {
+public:
+    RGYInputRawPipeStopCheck() : RGYInputRaw() {};
+    virtual ~RGYInputRawPipeStopCheck() {};
+    RGY_ERR startReadAhead() {
+        return StartReadAhead();
+    }
+    //先読みスレッドが読み込んだフレームを1つ取り出す (終端に達した場合、あるいはmillisec以内に読み込まれなければfalse)
+    bool popFrame(uint32_t millisec) {
+        int idx = -1;
+        if (!m_qReadAheadFilled.pop(&idx, millisec) || idx < 0) {
+            return false;
+        }
+        m_qReadAheadFree.push(idx);
+        return true;
+    }
+};
+
+struct RawPipeStopCheckCase {
+    const char *name;
+    int frames;       // 書き込むフレーム数
+    int partialBytes; // 最後のフレームの後に書き込む、次のフレームの途中までのデータ量 (-1なら次のフレームのヘッダも書かない)
+    bool closeWriter; // 書き込み後に書き込み側を閉じる (falseなら開いたまま何も書かない)
+};
+
+static const int RAW_PIPE_STOP_CHECK_TIMEOUT = 5000; // Close()が戻るまでの待機時間の上限 (ms)
+
+static tstring raw_pipe_stop_check_run(const RawPipeStopCheckCase& c, int& readFrames) {
+    readFrames = 0;
+    const int width = 64, height = 64;
+    const std::string header = strsprintf("YUV4MPEG2 W%d H%d F30:1 Ip A1:1 C420jpeg\n", width, height);
+    const std::vector<uint8_t> frame(width * height * 3 / 2, 128);
+    std::string data = header;
+    for (int i = 0; i < c.frames; i++) {
+        data += "FRAME\n";
+        data.append((const char *)frame.data(), frame.size());
+    }
+    if (c.partialBytes >= 0) {
+        data += "FRAME\n";
+        data.append((const char *)frame.data(), std::min<size_t>(c.partialBytes, frame.size() - 1));
+    }
+
+    // 子プロセスの入力と同様に、パイプのハンドルを渡して読み込ませる
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE hRead = nullptr, hWrite = nullptr;
+    if (!CreatePipe(&hRead, &hWrite, nullptr, (DWORD)data.size() + 4096)) {
+        return _T("failed to create pipe");
+    }
+    DWORD written = 0;
+    const bool writeOK = WriteFile(hWrite, data.data(), (DWORD)data.size(), &written, nullptr) && written == (DWORD)data.size();
+    const uint64_t readHandle = (uint64_t)hRead;
+    auto closeWriter = [&hWrite]() { if (hWrite) { CloseHandle(hWrite); hWrite = nullptr; } };
+#else
+    int fds[2] = { -1, -1 };
+    if (pipe(fds) != 0) {
+        return _T("failed to create pipe");
+    }
+    // パイプのバッファに収まる量なので、書き込みは待機しない
+    const bool writeOK = write(fds[1], data.data(), data.size()) == (ssize_t)data.size();
+    const uint64_t readHandle = (uint64_t)fds[0];
+    auto closeWriter = [&fds]() { if (fds[1] >= 0) { close(fds[1]); fds[1] = -1; } };
+#endif //#if defined(_WIN32) || defined(_WIN64)
+    if (!writeOK) {
+        closeWriter();
+        return _T("failed to write to pipe");
+    }
+    if (c.closeWriter) {
+        closeWriter();
+    }
+
+    tstring mes;
+    auto input = std::make_unique<RGYInputRawPipeStopCheck>();
+    VideoInfo inputInfo;
+    inputInfo.type = RGY_INPUT_FMT_Y4M;
+    RGYInputPrmRaw prm((RGYInputPrm()));
+    prm.chunkPipeHandle = RGYParamParallelEncPipeHandle(readHandle, 0);
+    auto err = input->RGYInput::Init(_T("-"), &inputInfo, &prm, nullptr, nullptr);
+    if (err != RGY_ERR_NONE) {
+        mes = tstring(_T("failed to init input: ")) + get_err_mes(err);
+    } else if ((err = input->startReadAhead()) != RGY_ERR_NONE) {
+        mes = tstring(_T("failed to start read-ahead: ")) + get_err_mes(err);
+    } else {
+        // 書き込んだフレームはすべて読み込めるはず
+        while (readFrames < c.frames && input->popFrame(RAW_PIPE_STOP_CHECK_TIMEOUT)) {
+            readFrames++;
+        }
+        if (readFrames != c.frames) {
+            mes = strsprintf(_T("read %d frames (expected %d)"), readFrames, c.frames);
+        } else if (c.closeWriter && input->popFrame(RAW_PIPE_STOP_CHECK_TIMEOUT)) {
+            mes = _T("read frame after end of input");
+        }
+    }
+    // 読み込みスレッドがパイプの読み込み待ちに入ってから、
+    // 書き込み側が開いたままでも、Close()が読み込み待ちで止まらずに戻ること
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    std::promise<void> closed;
+    auto closedFuture = closed.get_future();
+    std::thread thClose([&input, &closed]() {
+        input->Close();
+        closed.set_value();
+    });
+    if (closedFuture.wait_for(std::chrono::milliseconds(RAW_PIPE_STOP_CHECK_TIMEOUT)) != std::future_status::ready) {
+        if (mes.length() == 0) {
+            mes = _T("Close() did not return while pipe was stalled");
+        }
+        closeWriter(); // 書き込み側を閉じて、読み込みを終了させる
+    }
+    thClose.join();
+    closeWriter();
+    return mes;
+}
+
+std::string check_raw_pipe_stop(int& errorCount) {
+    const RawPipeStopCheckCase cases[] = {
+        { "eof",                2, -1,   true  },
+        { "stall_no_frame",     0, -1,   false },
+        { "stall_frame_header", 1, -1,   false },
+        { "stall_mid_frame",    1, 1000, false },
+    };
+    errorCount = 0;
+    std::string json = "{\n";
+    json += strsprintf("  \"timeout_ms\": %d,\n", RAW_PIPE_STOP_CHECK_TIMEOUT);
+    json += "  \"results\": [\n";
+    bool first = true;
+    for (const auto& c : cases) {
+        int readFrames = 0;
+        const auto start = std::chrono::steady_clock::now();
+        const auto mes = raw_pipe_stop_check_run(c, readFrames);
+        const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (mes.length() > 0) {
+            errorCount++;
+        }
+        if (!first) {
+            json += ",\n";
+        }
+        first = false;
+        json += strsprintf("    { \"scenario\": \"%s\", \"frames\": %d, \"read_frames\": %d, \"sec\": %.3f, \"valid\": %s",
+            c.name, c.frames, readFrames, sec, (mes.length() == 0) ? "true" : "false");
+        if (mes.length() > 0) {
+            json += strsprintf(", \"message\": \"%s\"", tchar_to_string(mes).c_str());
+        }
+        json += " }";
+    }
+    json += "\n  ],\n";
+    json += strsprintf("  \"error\": %d\n", errorCount);
+    json += "}\n";
+    return json;
+}
+
 #endif
@@ -29,7 +29,9 @@
 #ifndef __RGY_INPUT_RAW_H__
 #define __RGY_INPUT_RAW_H__
 
+#include <atomic>
 #include "rgy_input.h"
+#include "rgy_queue.h"
 
 #if ENABLE_RAW_READER
 
@@ -39,8 +41,10 @@ class RGYInputPrmRaw : public RGYInputPrm {
 public:
     RGY_CSP inputCsp;
     RGYParamParallelEncPipeHandle chunkPipeHandle;
+    RGYInputChunk *inputChunk; //並列エンコードの子で、親が読み込んだ入力データを使用する場合
+    RGYParamThread threadParamInput; //先読みスレッドのスレッドアフィニティ
 
-    RGYInputPrmRaw(RGYInputPrm base) : RGYInputPrm(base), inputCsp(RGY_CSP_YV12), chunkPipeHandle() {};
+    RGYInputPrmRaw(RGYInputPrm base) : RGYInputPrm(base), inputCsp(RGY_CSP_YV12), chunkPipeHandle(), inputChunk(nullptr), threadParamInput() {};
     virtual ~RGYInputPrmRaw() {};
 };
 
@@ -61,21 +65,73 @@ public:
         return true;
     }
     virtual int64_t GetVideoFirstKeyPts() const override;
+    virtual bool parallelEncFanOutSupported() const override {
+        return m_isPipe && m_chunkPipeHandle.startFrameId < 0;
+    }
+    virtual RGY_ERR parallelEncFanOut(RGYInputChunk *chunk, const RGYInputChunkLimit& limit) override;
 
 protected:
     virtual RGY_ERR Init(const TCHAR *strFileName, VideoInfo *pInputInfo, const RGYInputPrm *prm) override;
     virtual RGY_ERR LoadNextFrameInternal(RGYFrame *pSurface) override;
     RGY_ERR ParseY4MHeader(char *buf, VideoInfo *pInfo);
 
+    //ファイルをメモリにマップする (通常ファイルのみ)
+    bool OpenMap();
+    void CloseMap();
+    //マップしたファイルから次のフレームの先頭位置を取得する
+    RGY_ERR GetNextFrameFromMap(const uint8_t **ptr);
+
+    //m_fSourceがパイプ等の場合は、読み込み待ちを中断できるよう、バッファを使わずに直接読み込むよう設定する
+    RGY_ERR InitSourceRead();
+    void CloseSourceRead();
+    //m_fSourceからsizeバイトをbufに読み込む (終端に達した場合はRGY_ERR_MORE_DATA、中断された場合はRGY_ERR_ABORTED)
+    RGY_ERR ReadSource(void *buf, size_t size);
+    //m_fSourceから1フレーム分をbufに読み込む
+    RGY_ERR ReadFrame(uint8_t *buf);
+    //先読みスレッド
+    RGY_ERR StartReadAhead();
+    void StopReadAhead();
+    RGY_ERR ThreadFuncReadAhead(RGYParamThread threadParam);
+
     FILE *m_fSource;
 
-    uint32_t m_nBufSize;
+    uint32_t m_nBufSize;   //変換時の読みすぎを考慮したバッファサイズ
+    uint32_t m_frameSize;  //1フレームのデータサイズ
     shared_ptr<uint8_t> m_pBuffer;
+
+    //マップしたファイル
+    const uint8_t *m_mapPtr;
+    uint64_t m_mapSize;
+    uint64_t m_mapOffset;   //次に読み出す位置
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE m_mapHandle;
+#endif
+
+    //先読み用のリングバッファ
+    std::vector<std::unique_ptr<uint8_t, aligned_malloc_deleter>> m_readAheadBuf;
+    RGYQueueBounded<int, RGYQueueBoundedMode::SPSC> m_qReadAheadFree;   //空いているバッファのindex
+    RGYQueueBounded<int, RGYQueueBoundedMode::SPSC> m_qReadAheadFilled; //読み込み済みのバッファのindex (-1で終端)
+    std::thread m_thReadAhead;
+    RGYParamThread m_threadParamReadAhead;
+    bool m_readAheadEOF;    //先読みスレッドが終端に達し、すべてのフレームを取り出した
+    bool m_readInterruptible;      //m_fSourceがパイプ等で、読み込み待ちを中断できるよう直接読み込む
+    std::atomic<bool> m_readAbort; //読み込みの中断要求
+#if !(defined(_WIN32) || defined(_WIN64))
+    int m_readAbortPipe[2];        //読み込み待ちを中断するためのパイプ
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
     bool m_isPipe;
     RGYParamParallelEncPipeHandle m_chunkPipeHandle;
+    RGYInputChunk *m_inputChunk; //親が読み込んだ入力データ (並列エンコードの子)
+    std::string m_y4mHeader;     //並列エンコードの子に渡すy4mヘッダ
+    std::atomic<int> m_fanOutFrames; //並列エンコードの親で、子に分配したフレーム数
+    std::atomic<bool> m_fanOutEOF;   //並列エンコードの親で、分配中に入力の終端に達した
     int64_t m_firstKeyPts;
 };
 
+//--check-raw-pipe-stop用
+//パイプ入力の読み込みが途中で止まった状態から、読み込みを終了できるかを確認する (json形式で返す)
+std::string check_raw_pipe_stop(int& errorCount);
+
 #endif //ENABLE_RAW_READER
 
 #endif //__RGY_INPUT_RAW_H__
@@ -28,6 +28,7 @@
 #include <algorithm>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
 #include <chrono>
 #include "rgy_log.h"
 #include "rgy_version.h"
@@ -243,6 +244,148 @@ tstring RGYParamLogLevel::to_string() const {
     return tmp.str();
 }
 
+// ログファイルへの書き込みを行う
+// ファイルは開いたままにしておき、ログはバッファに追加するだけで、
+// バックグラウンドのスレッドが一定量たまるか一定時間ごとにまとめて書き込む
+// 同じファイルに出力するRGYLog(並列エンコードの各チャンクなど)の間では同じものを共有する
+class RGYLogFileWriter {
+public:
+    static std::shared_ptr<RGYLogFileWriter> get(const tstring& filename, const bool html, const char *htmlFooter);
+
+    RGYLogFileWriter(const tstring& filename, const bool html, const char *htmlFooter);
+    ~RGYLogFileWriter();
+    const tstring& filename() const { return m_filename; }
+    bool opened() const { return (bool)m_fp; }
+    // syncがtrueの場合は、ファイルへの書き込みまで行ってから戻る
+    void write(const char *str, const size_t len, const bool sync);
+    // バッファの内容をファイルに書き込む
+    void flush();
+private:
+    void threadFunc();
+
+    static const size_t FLUSH_SIZE = 64 * 1024; // バッファがこれ以上たまったら書き込む
+    static const int FLUSH_INTERVAL_MS = 200;   // 最大でこの間隔で書き込む
+
+    tstring m_filename;
+    bool m_html;
+    const char *m_htmlFooter;
+    std::unique_ptr<FILE, fp_deleter> m_fp;
+    std::mutex m_mtxBuf;   // m_buf, m_abort用
+    std::mutex m_mtxFile;  // ファイルへの書き込み用 (書き込み順を保つ)
+    std::condition_variable m_cv;
+    std::string m_buf;
+    std::string m_bufWrite;
+    bool m_abort;
+    std::thread m_thread;
+};
+
+std::shared_ptr<RGYLogFileWriter> RGYLogFileWriter::get(const tstring& filename, const bool html, const char *htmlFooter) {
+    static std::mutex mtx;
+    static std::vector<std::weak_ptr<RGYLogFileWriter>> writers;
+    std::lock_guard<std::mutex> lock(mtx);
+    writers.erase(std::remove_if(writers.begin(), writers.end(), [](const std::weak_ptr<RGYLogFileWriter>& w) { return w.expired(); }), writers.end());
+    for (auto& w : writers) {
+        auto writer = w.lock();
+        if (writer && writer->filename() == filename) {
+            return writer;
+        }
+    }
+    auto writer = std::make_shared<RGYLogFileWriter>(filename, html, htmlFooter);
+    if (!writer->opened()) {
+        return nullptr;
+    }
+    writers.push_back(writer);
+    return writer;
+}
+
+RGYLogFileWriter::RGYLogFileWriter(const tstring& filename, const bool html, const char *htmlFooter) :
+    m_filename(filename),
+    m_html(html),
+    m_htmlFooter(htmlFooter),
+    m_fp(),
+    m_mtxBuf(),
+    m_mtxFile(),
+    m_cv(),
+    m_buf(),
+    m_bufWrite(),
+    m_abort(false),
+    m_thread() {
+    //logはANSI(まあようはShift-JIS)で保存する
+    //ほかのプロセスからも読めるよう、共有モードで開く
+    m_fp.reset(_tfsopen(m_filename.c_str(), (m_html) ? _T("rb+") : _T("a"), _SH_DENYNO));
+    if (!m_fp) {
+        return;
+    }
+    if (m_html) {
+        //フッターの位置から書き込み、フッターは閉じるときに書き込む
+        _fseeki64(m_fp.get(), 0, SEEK_END);
+        const int64_t pos = _ftelli64(m_fp.get()) - (int64_t)strlen(m_htmlFooter);
+        _fseeki64(m_fp.get(), (std::max<int64_t>)(pos, 0), SEEK_SET);
+    }
+    m_buf.reserve(FLUSH_SIZE * 2);
+    m_bufWrite.reserve(FLUSH_SIZE * 2);
+    m_thread = std::thread(&RGYLogFileWriter::threadFunc, this);
+}
+
+RGYLogFileWriter::~RGYLogFileWriter() {
+    if (m_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mtxBuf);
+            m_abort = true;
+        }
+        m_cv.notify_all();
+        m_thread.join();
+    }
+    if (m_fp) {
+        flush();
+        if (m_html) {
+            fwrite(m_htmlFooter, 1, strlen(m_htmlFooter), m_fp.get());
+        }
+        m_fp.reset();
+    }
+}
+
+void RGYLogFileWriter::write(const char *str, const size_t len, const bool sync) {
+    {
+        std::lock_guard<std::mutex> lock(m_mtxBuf);
+        m_buf.append(str, len);
+        if (m_buf.size() >= FLUSH_SIZE) {
+            m_cv.notify_one();
+        }
+    }
+    if (sync) {
+        flush();
+    }
+}
+
+void RGYLogFileWriter::flush() {
+    std::lock_guard<std::mutex> lockFile(m_mtxFile);
+    {
+        std::lock_guard<std::mutex> lock(m_mtxBuf);
+        std::swap(m_buf, m_bufWrite);
+    }
+    if (m_bufWrite.size() > 0) {
+        fwrite(m_bufWrite.data(), 1, m_bufWrite.size(), m_fp.get());
+        fflush(m_fp.get());
+        m_bufWrite.clear();
+    }
+}
+
+void RGYLogFileWriter::threadFunc() {
+    for (;;) {
+        bool abort = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mtxBuf);
+            m_cv.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS), [this]() { return m_abort || m_buf.size() >= FLUSH_SIZE; });
+            abort = m_abort;
+        }
+        flush();
+        if (abort) {
+            break;
+        }
+    }
+}
+
 RGYLog::RGYLog(const TCHAR *pLogFile, const RGYLogLevel log_level, bool showTime, bool addLogLevel, bool disableColor) :
     m_nLogLevel(),
     m_pStrLog(),
@@ -250,7 +393,8 @@ RGYLog::RGYLog(const TCHAR *pLogFile, const RGYLogLevel log_level, bool showTime
     m_showTime(showTime),
     m_addLogLevel(addLogLevel),
     m_disableColor(disableColor),
-    m_mtx() {
+    m_mtx(),
+    m_fileWriter() {
     init(pLogFile, RGYParamLogLevel(log_level));
 };
 
@@ -261,11 +405,20 @@ RGYLog::RGYLog(const TCHAR *pLogFile, const RGYParamLogLevel& log_level, bool sh
     m_showTime(showTime),
     m_addLogLevel(addLogLevel),
     m_disableColor(disableColor),
-    m_mtx() {
+    m_mtx(),
+    m_fileWriter() {
     init(pLogFile, log_level);
 }
 
 RGYLog::~RGYLog() {
+    //共有しているほかのRGYLogがなければ、ここでファイルへの書き込みとフッターの書き込みが行われる
+    m_fileWriter.reset();
+}
+
+void RGYLog::flush() {
+    if (m_fileWriter) {
+        m_fileWriter->flush();
+    }
 }
 
 void RGYLog::init(const TCHAR *pLogFile, const RGYParamLogLevel& log_level) {
@@ -467,20 +620,16 @@ void RGYLog::write_log(RGYLogLevel log_level, const RGYLogType logtype, const TC
 #endif
     std::lock_guard<std::mutex> lock(*m_mtx.get());
     if (m_pStrLog.length() > 0) {
-        FILE *fp_log = NULL;
-        //logはANSI(まあようはShift-JIS)で保存する
-        if (0 == _tfopen_s(&fp_log, m_pStrLog.c_str(), (m_bHtml) ? _T("rb+") : _T("a")) && fp_log) {
-            if (m_bHtml) {
-                _fseeki64(fp_log, 0, SEEK_END);
-                int64_t pos = _ftelli64(fp_log);
-                _fseeki64(fp_log, 0, SEEK_SET);
-                _fseeki64(fp_log, pos -1 * strlen(HTML_FOOTER), SEEK_CUR);
+        if (!m_fileWriter || m_fileWriter->filename() != m_pStrLog) {
+            m_fileWriter = RGYLogFileWriter::get(m_pStrLog, m_bHtml, HTML_FOOTER);
+            if (!m_fileWriter) {
+                fprintf(stderr, "failed to open log file, log writing disabled.\n");
+                m_pStrLog.clear();
             }
-            fwrite(buffer_ptr, 1, strlen(buffer_ptr), fp_log);
-            if (m_bHtml) {
-                fwrite(HTML_FOOTER, 1, strlen(HTML_FOOTER), fp_log);
-            }
-            fclose(fp_log);
+        }
+        if (m_fileWriter) {
+            //エラーの場合は直後に終了する可能性があるので、ファイルへの書き込みまで行う
+            m_fileWriter->write(buffer_ptr, strlen(buffer_ptr), log_level >= RGY_LOG_ERROR);
         }
     }
     if (!file_only) {
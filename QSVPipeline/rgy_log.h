@@ -40,6 +40,7 @@
 namespace std {
     class mutex;
 }
+class RGYLogFileWriter;
 
 enum RGYLogLevel {
     RGY_LOG_TRACE = -3,
@@ -168,6 +169,7 @@ protected:
     bool m_addLogLevel;
     bool m_disableColor;
     std::shared_ptr<std::mutex> m_mtx;
+    std::shared_ptr<RGYLogFileWriter> m_fileWriter; //ログファイルへの書き込み (同じファイルに出力するRGYLog間で共有)
     static const char *HTML_FOOTER;
 public:
     RGYLog(const TCHAR *pLogFile, const RGYLogLevel log_level = RGY_LOG_INFO, bool showTime = false, bool addLogLevel = false, bool disableColor = false);
@@ -198,6 +200,8 @@ public:
         m_pStrLog.clear();
         if (pLogFile) m_pStrLog = pLogFile;
     }
+    //ログファイルへ未書き込みのログを書き込む
+    void flush();
     void setLock(std::shared_ptr<std::mutex> mtx) { m_mtx = mtx; }
     std::shared_ptr<std::mutex> getLock() { return m_mtx; }
     virtual void write_log(RGYLogLevel log_level, const RGYLogType logtype, const TCHAR *buffer, bool file_only = false);
@@ -30,6 +30,7 @@
 #include <vector>
 #include <atomic>
 #include <fstream>
+#include <random>
 #include "rgy_osdep.h"
 #define CL_EXTERN
 #include "rgy_opencl.h"
@@ -323,6 +324,7 @@ int initOpenCLGlobal() {
     LOAD(clGetSupportedImageFormats);
 
     LOAD(clCreateProgramWithSource);
+    LOAD(clCreateProgramWithBinary);
     LOAD(clBuildProgram);
     LOAD(clGetProgramBuildInfo);
     LOAD(clGetProgramInfo);
@@ -1343,7 +1345,9 @@ RGYOpenCLContext::RGYOpenCLContext(shared_ptr<RGYOpenCLPlatform> platform, int b
     m_copy(),
     m_threadPool(),
     m_buildThreads(buildThreads > 0 ? buildThreads : std::min(RGY_OPENCL_BUILD_THREAD_DEFAULT_MAX, (int)std::thread::hardware_concurrency())),
-    m_hmodule(NULL) {
+    m_hmodule(NULL),
+    m_programCacheDir(),
+    m_programCacheDevKey() {
 
 }
 
@@ -1565,13 +1569,17 @@ std::vector<uint8_t> RGYOpenCLProgram::getBinary() {
         return binary;
     }
 
-    binary.resize(binary_size + 1, 0);
-    err = clGetProgramInfo(m_program, CL_PROGRAM_BINARIES, binary_size, binary.data(), &binary_size);
+    if (binary_size == 0) {
+        return binary;
+    }
+    //CL_PROGRAM_BINARIESには、デバイスごとの出力先のポインタの配列を渡す
+    binary.resize(binary_size, 0);
+    unsigned char *binary_ptr = binary.data();
+    err = clGetProgramInfo(m_program, CL_PROGRAM_BINARIES, sizeof(binary_ptr), &binary_ptr, nullptr);
     if (err != CL_SUCCESS) {
         CL_LOG(RGY_LOG_ERROR, _T("Failed to get program binary: %s\n"), cl_errmes(err));
         binary.clear();
     }
-    binary.resize(binary_size);
     return binary;
 }
 
@@ -2522,6 +2530,171 @@ RGY_ERR RGYOpenCLContext::setBuf(const void *pattern, size_t pattern_size, size_
     return RGY_ERR_NONE;
 }
 
+// プログラムのバイナリのキャッシュ
+// ファイル名はキー全体のハッシュとし、ファイル内にもキーを保存して一致を確認する
+// 書き込みは一時ファイルに行ってからリネームするので、複数のプロセスが同時に書き込んでも壊れたファイルは読まない
+static const char RGY_CL_PROGRAM_CACHE_MAGIC[8] = { 'R', 'G', 'Y', 'C', 'L', 'B', 'I', 'N' };
+static const uint32_t RGY_CL_PROGRAM_CACHE_VERSION = 1;
+
+struct RGYCLProgramCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t keySize;     // ヘッダの直後にキーを格納
+    uint64_t binarySize;  // キーの直後にバイナリを格納
+    uint64_t binaryHash;  // バイナリの破損の確認用
+};
+
+static uint64_t rgy_cl_cache_hash(const void *data, const size_t size, uint64_t hash = 14695981039346656037ull) {
+    //FNV-1a
+    const uint8_t *ptr = (const uint8_t *)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= ptr[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool readProgramCacheFile(const tstring& filename, const std::string& key, std::vector<uint8_t>& binary) {
+    std::unique_ptr<FILE, fp_deleter> fp(_tfsopen(filename.c_str(), _T("rb"), _SH_DENYNO));
+    if (!fp) {
+        return false;
+    }
+    RGYCLProgramCacheHeader header;
+    if (fread(&header, sizeof(header), 1, fp.get()) != 1
+        || memcmp(header.magic, RGY_CL_PROGRAM_CACHE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != RGY_CL_PROGRAM_CACHE_VERSION
+        || header.keySize != key.size()
+        || header.binarySize == 0) {
+        return false;
+    }
+    std::string fileKey(header.keySize, '\0');
+    if (fread(&fileKey[0], 1, fileKey.size(), fp.get()) != fileKey.size() || fileKey != key) {
+        return false;
+    }
+    binary.resize((size_t)header.binarySize);
+    if (fread(binary.data(), 1, binary.size(), fp.get()) != binary.size()
+        || rgy_cl_cache_hash(binary.data(), binary.size()) != header.binaryHash) {
+        binary.clear();
+        return false;
+    }
+    return true;
+}
+
+static bool writeProgramCacheFile(const tstring& filename, const std::string& key, const std::vector<uint8_t>& binary) {
+    std::random_device rd;
+    const tstring tmpfile = filename + strsprintf(_T(".%08x%08x.tmp"), rd(), rd());
+    {
+        FILE *fp = _tfsopen(tmpfile.c_str(), _T("wb"), _SH_DENYWR);
+        if (fp == nullptr) {
+            return false;
+        }
+        RGYCLProgramCacheHeader header;
+        memcpy(header.magic, RGY_CL_PROGRAM_CACHE_MAGIC, sizeof(header.magic));
+        header.version = RGY_CL_PROGRAM_CACHE_VERSION;
+        header.keySize = (uint32_t)key.size();
+        header.binarySize = binary.size();
+        header.binaryHash = rgy_cl_cache_hash(binary.data(), binary.size());
+        bool ret = fwrite(&header, sizeof(header), 1, fp) == 1
+            && fwrite(key.data(), 1, key.size(), fp) == key.size()
+            && fwrite(binary.data(), 1, binary.size(), fp) == binary.size();
+        ret &= fclose(fp) == 0;
+        if (!ret) {
+            rgy_file_remove(tmpfile.c_str());
+            return false;
+        }
+    }
+    if (!rgy_file_rename(tmpfile, filename, true)) {
+        //ほかのプロセスが読み込み中などで置き換えられなかった場合は、そのまま使ってもらう
+        rgy_file_remove(tmpfile.c_str());
+        return false;
+    }
+    return true;
+}
+
+tstring RGYOpenCLContext::defaultProgramCacheDir() {
+#if defined(_WIN32) || defined(_WIN64)
+    const TCHAR *base = _tgetenv(_T("LOCALAPPDATA"));
+    if (base == nullptr || _tcslen(base) == 0) {
+        return tstring();
+    }
+    return tstring(base) + _T("\\") + _T(ENCODER_NAME) + _T("\\clcache");
+#else
+    const char *xdgCache = getenv("XDG_CACHE_HOME");
+    if (xdgCache != nullptr && strlen(xdgCache) > 0) {
+        return tstring(xdgCache) + _T("/") + _T(ENCODER_NAME) + _T("/clcache");
+    }
+    const char *home = getenv("HOME");
+    if (home == nullptr || strlen(home) == 0) {
+        return tstring();
+    }
+    return tstring(home) + _T("/.cache/") + _T(ENCODER_NAME) + _T("/clcache");
+#endif
+}
+
+void RGYOpenCLContext::setProgramCacheDir(const tstring& dir) {
+    m_programCacheDir.clear();
+    m_programCacheDevKey.clear();
+    if (dir.length() == 0) {
+        return;
+    }
+    //バイナリは1デバイス分のみ保存するので、複数デバイスでビルドする場合は使用しない
+    if (m_platform->devs().size() != 1) {
+        CL_LOG(RGY_LOG_DEBUG, _T("Program cache disabled: %d devices.\n"), (int)m_platform->devs().size());
+        return;
+    }
+    if (!rgy_directory_exists(dir) && !CreateDirectoryRecursive(dir.c_str())) {
+        CL_LOG(RGY_LOG_WARN, _T("Failed to create program cache dir \"%s\", program cache disabled.\n"), dir.c_str());
+        return;
+    }
+    const auto platformInfo = m_platform->info();
+    const auto devInfo = RGYOpenCLDevice(m_platform->devs()[0]).info();
+    m_programCacheDevKey = strsprintf("platform=%s %s\ndevice=%s\ndriver=%s %s\n",
+        platformInfo.name.c_str(), platformInfo.version.c_str(),
+        devInfo.name.c_str(), devInfo.driver_version.c_str(), devInfo.version.c_str());
+    m_programCacheDir = dir;
+    CL_LOG(RGY_LOG_DEBUG, _T("Program cache dir: %s\n"), m_programCacheDir.c_str());
+}
+
+std::unique_ptr<RGYOpenCLProgram> RGYOpenCLContext::loadProgramCache(const tstring& cacheFile, const std::string& cacheKey, const std::string& options) {
+    std::vector<uint8_t> binary;
+    if (!readProgramCacheFile(cacheFile, cacheKey, binary)) {
+        return nullptr;
+    }
+    cl_device_id dev = m_platform->devs()[0];
+    const unsigned char *binaryPtr = binary.data();
+    const size_t binarySize = binary.size();
+    cl_int binaryStatus = CL_SUCCESS;
+    cl_int err = CL_SUCCESS;
+    cl_program program = clCreateProgramWithBinary(m_context.get(), 1, &dev, &binarySize, &binaryPtr, &binaryStatus, &err);
+    if (err == CL_SUCCESS && binaryStatus != CL_SUCCESS) {
+        err = binaryStatus;
+    }
+    if (err == CL_SUCCESS) {
+        err = clBuildProgram(program, 1, &dev, options.c_str(), NULL, NULL);
+    }
+    if (err != CL_SUCCESS) {
+        CL_LOG(RGY_LOG_DEBUG, _T("Failed to load program cache %s: %s, build from source.\n"), cacheFile.c_str(), cl_errmes(err));
+        if (program) {
+            clReleaseProgram(program);
+        }
+        return nullptr;
+    }
+    CL_LOG(RGY_LOG_DEBUG, _T("Loaded program cache %s.\n"), cacheFile.c_str());
+    return std::make_unique<RGYOpenCLProgram>(program, m_log);
+}
+
+void RGYOpenCLContext::saveProgramCache(const tstring& cacheFile, const std::string& cacheKey, RGYOpenCLProgram *program) {
+    const auto binary = program->getBinary();
+    if (binary.size() == 0) {
+        return;
+    }
+    if (writeProgramCacheFile(cacheFile, cacheKey, binary)) {
+        CL_LOG(RGY_LOG_DEBUG, _T("Saved program cache %s.\n"), cacheFile.c_str());
+    } else {
+        CL_LOG(RGY_LOG_DEBUG, _T("Failed to save program cache %s.\n"), cacheFile.c_str());
+    }
+}
+
 std::unique_ptr<RGYOpenCLProgram> RGYOpenCLContext::buildProgram(const std::string datacopy, const std::string options) {
     auto datalen = datacopy.length();
     if (datacopy.size() == 0) {
@@ -2537,6 +2710,18 @@ std::unique_ptr<RGYOpenCLProgram> RGYOpenCLContext::buildProgram(const std::stri
     }
     CL_LOG(RGY_LOG_DEBUG, _T("building OpenCL source: size %u.\n"), datalen);
 
+    std::string cacheKey;
+    tstring cacheFile;
+    if (m_programCacheDir.length() > 0) {
+        cacheKey = m_programCacheDevKey + strsprintf("options=%s\nsource=%016llx:%llu\n",
+            options.c_str(), (unsigned long long)rgy_cl_cache_hash(data, datalen), (unsigned long long)datalen);
+        cacheFile = PathCombineS(m_programCacheDir, strsprintf(_T("%016llx.clbin"), (unsigned long long)rgy_cl_cache_hash(cacheKey.data(), cacheKey.size())));
+        auto program = loadProgramCache(cacheFile, cacheKey, options);
+        if (program) {
+            return program;
+        }
+    }
+
     bool buildCrush = false;
     cl_int err = CL_SUCCESS;
     cl_program program = nullptr;
@@ -2581,7 +2766,11 @@ std::unique_ptr<RGYOpenCLProgram> RGYOpenCLContext::buildProgram(const std::stri
         }
     }
     CL_LOG(RGY_LOG_DEBUG, _T("clBuildProgram success!\n"));
-    return std::make_unique<RGYOpenCLProgram>(program, m_log);
+    auto clprogram = std::make_unique<RGYOpenCLProgram>(program, m_log);
+    if (cacheFile.length() > 0) {
+        saveProgramCache(cacheFile, cacheKey, clprogram.get());
+    }
+    return clprogram;
 }
 
 std::unique_ptr<RGYOpenCLProgram> RGYOpenCLContext::build(const std::string &source, const char *options) {
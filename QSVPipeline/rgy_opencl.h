@@ -207,6 +207,7 @@ CL_EXTERN cl_int (CL_API_CALL* f_clReleaseCommandQueue) (cl_command_queue comman
 CL_EXTERN cl_int (CL_API_CALL* f_clGetSupportedImageFormats)(cl_context context, cl_mem_flags flags, cl_mem_object_type image_type, cl_uint num_entries, cl_image_format * image_formats, cl_uint * num_image_formats);
 
 CL_EXTERN cl_program(CL_API_CALL* f_clCreateProgramWithSource) (cl_context context, cl_uint count, const char **strings, const size_t *lengths, cl_int *errcode_ret);
+CL_EXTERN cl_program(CL_API_CALL* f_clCreateProgramWithBinary) (cl_context context, cl_uint num_devices, const cl_device_id *device_list, const size_t *lengths, const unsigned char **binaries, cl_int *binary_status, cl_int *errcode_ret);
 CL_EXTERN cl_int (CL_API_CALL* f_clBuildProgram) (cl_program program, cl_uint num_devices, const cl_device_id *device_list, const char *options, void (CL_CALLBACK *pfn_notify)(cl_program program, void *user_data), void* user_data);
 CL_EXTERN cl_int (CL_API_CALL* f_clGetProgramBuildInfo) (cl_program program, cl_device_id device, cl_program_build_info param_name, size_t param_value_size, void *param_value, size_t *param_value_size_ret);
 CL_EXTERN cl_int (CL_API_CALL* f_clGetProgramInfo)(cl_program program, cl_program_info param_name, size_t param_value_size, void *param_value, size_t *param_value_size_ret);
@@ -306,6 +307,7 @@ CL_EXTERN cl_int(CL_API_CALL* f_clEnqueueReleaseVA_APIMediaSurfacesINTEL)(cl_com
 #define clGetSupportedImageFormats f_clGetSupportedImageFormats
 
 #define clCreateProgramWithSource f_clCreateProgramWithSource
+#define clCreateProgramWithBinary f_clCreateProgramWithBinary
 #define clBuildProgram f_clBuildProgram
 #define clGetProgramBuildInfo f_clGetProgramBuildInfo
 #define clGetProgramInfo f_clGetProgramInfo
@@ -1166,6 +1168,10 @@ public:
 
     void setModuleHandle(const HMODULE hmodule) { m_hmodule = hmodule; }
     HMODULE getModuleHandle() const { return m_hmodule; }
+    //ビルドしたプログラムのバイナリを保存するディレクトリを設定する (空ならキャッシュしない)
+    //キャッシュはソース・ビルドオプション・デバイス・ドライバのバージョンが一致する場合のみ使用する
+    void setProgramCacheDir(const tstring& dir);
+    static tstring defaultProgramCacheDir();
     std::unique_ptr<RGYOpenCLProgram> build(const std::string& source, const char *options);
     std::unique_ptr<RGYOpenCLProgram> buildFile(const tstring filename, const std::string options);
     std::unique_ptr<RGYOpenCLProgram> buildResource(const tstring name, const tstring type, const std::string options);
@@ -1218,6 +1224,8 @@ public:
     tstring getSupportedImageFormatsStr(const cl_mem_object_type image_type = CL_MEM_OBJECT_IMAGE2D) const;
 protected:
     std::unique_ptr<RGYOpenCLProgram> buildProgram(std::string datacopy, const std::string options);
+    std::unique_ptr<RGYOpenCLProgram> loadProgramCache(const tstring& cacheFile, const std::string& cacheKey, const std::string& options);
+    void saveProgramCache(const tstring& cacheFile, const std::string& cacheKey, RGYOpenCLProgram *program);
 
     shared_ptr<RGYOpenCLPlatform> m_platform;
     unique_context m_context;
@@ -1227,6 +1235,8 @@ protected:
     std::unique_ptr<RGYThreadPool> m_threadPool;
     int m_buildThreads;
     HMODULE m_hmodule;
+    tstring m_programCacheDir;        //プログラムのバイナリのキャッシュの保存先 (空なら無効)
+    std::string m_programCacheDevKey; //キャッシュのキーのうち、プラットフォーム・デバイス・ドライバの部分
 };
 
 class RGYOpenCL {
@@ -35,6 +35,9 @@
 #if defined(_M_IX86) || defined(_M_X64) || defined(__x86_64)
 #include <smmintrin.h>
 #endif
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <sys/uio.h>
+#endif
 
 // H.264とHEVCのAUD(Access Unit Delimiter)の固定ビット列
 static const uint8_t AUD_H264_PRIMARY[] = { 0x00, 0x00, 0x00, 0x01, 0x09, 0x10 }; // AUD (primary_pic_type = 0)
@@ -70,6 +73,220 @@ static RGY_ERR WriteY4MHeader(FILE *fp, const VideoInfo *info, const RGY_CSP csp
         return RGY_ERR_UNDEFINED_BEHAVIOR; \
     } }
 
+void RGYTimestampIndex::init(size_t capacity) {
+    m_table.assign(capacity, Entry{ 0, -1 });
+    m_mask = capacity - 1;
+}
+
+void RGYTimestampIndex::clear() {
+    std::fill(m_table.begin(), m_table.end(), Entry{ 0, -1 });
+}
+
+int64_t RGYTimestampIndex::find(int64_t key) const {
+    for (size_t i = hash(key); m_table[i].seq >= 0; i = (i + 1) & m_mask) {
+        if (m_table[i].key == key) {
+            return m_table[i].seq;
+        }
+    }
+    return -1;
+}
+
+void RGYTimestampIndex::set(int64_t key, int64_t seq) {
+    size_t i = hash(key);
+    for (; m_table[i].seq >= 0; i = (i + 1) & m_mask) {
+        if (m_table[i].key == key) {
+            break;
+        }
+    }
+    m_table[i].key = key;
+    m_table[i].seq = seq;
+}
+
+void RGYTimestampIndex::erase(int64_t key, int64_t seq) {
+    size_t i = hash(key);
+    for (; m_table[i].seq >= 0; i = (i + 1) & m_mask) {
+        if (m_table[i].key == key) {
+            break;
+        }
+    }
+    if (m_table[i].seq < 0 || m_table[i].seq != seq) {
+        return;
+    }
+    // 後続のクラスタを詰めて、探索が途切れないようにする
+    for (size_t j = (i + 1) & m_mask; m_table[j].seq >= 0; j = (j + 1) & m_mask) {
+        const size_t home = hash(m_table[j].key);
+        // homeが(i, j]の外にあるなら、iに移動しても探索可能
+        if (((j - home) & m_mask) >= ((j - i) & m_mask)) {
+            m_table[i] = m_table[j];
+            i = j;
+        }
+    }
+    m_table[i].seq = -1;
+}
+
+RGYTimestamp::RGYTimestamp(bool timestampPassThrough_, bool noDurationFix_) :
+    m_ring(INITIAL_RING_SIZE),
+    m_ringMask(INITIAL_RING_SIZE - 1),
+    m_head(0),
+    m_tail(0),
+    m_idxPts(),
+    m_idxEncodeFrameId(),
+    mtx(),
+    last_add_seq(-1),
+    last_check_seq(-1),
+    last_input_frame_id(-1),
+    offset(0),
+    timestampPassThrough(timestampPassThrough_),
+    noDurationFix(noDurationFix_) {
+    // 索引の負荷率が1/2以下になるよう、リングの2倍の大きさを確保する
+    m_idxPts.init(INITIAL_RING_SIZE * 2);
+    m_idxEncodeFrameId.init(INITIAL_RING_SIZE * 2);
+}
+
+void RGYTimestamp::clear() {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (int64_t seq = m_tail; seq < m_head; seq++) {
+        auto& slot = m_ring[seq & m_ringMask];
+        slot.val.dataList.clear();
+        slot.valid = false;
+    }
+    m_tail = m_head;
+    m_idxPts.clear();
+    m_idxEncodeFrameId.clear();
+    last_add_seq = -1;
+    last_check_seq = -1;
+    offset = 0;
+}
+
+RGYTimestamp::Slot *RGYTimestamp::getSlot(int64_t seq) {
+    if (seq < m_tail || seq >= m_head) {
+        return nullptr;
+    }
+    auto slot = &m_ring[seq & m_ringMask];
+    return (slot->valid) ? slot : nullptr;
+}
+
+void RGYTimestamp::expand() {
+    // リングが一杯のときのみ倍に拡張する (seqは変わらないので、索引は大きさのみ変更して再登録する)
+    const size_t newSize = m_ring.size() * 2;
+    std::vector<Slot> newRing(newSize);
+    for (int64_t seq = m_tail; seq < m_head; seq++) {
+        newRing[seq & (newSize - 1)] = std::move(m_ring[seq & m_ringMask]);
+    }
+    m_ring = std::move(newRing);
+    m_ringMask = newSize - 1;
+    m_idxPts.init(newSize * 2);
+    m_idxEncodeFrameId.init(newSize * 2);
+    for (int64_t seq = m_tail; seq < m_head; seq++) {
+        const auto& slot = m_ring[seq & m_ringMask];
+        if (slot.valid) {
+            // 同じキーの場合は後から追加したものが優先される
+            m_idxPts.set(slot.val.timestamp, seq);
+            m_idxEncodeFrameId.set(slot.val.encodeFrameId, seq);
+        }
+    }
+}
+
+int64_t RGYTimestamp::push(int64_t pts, int64_t inputFrameId, int64_t encodeFrameId, int64_t duration) {
+    if (m_head - m_tail >= (int64_t)m_ring.size()) {
+        expand();
+    }
+    // 同じptsのフレームは置き換える
+    if (auto prev = getSlot(m_idxPts.find(pts)); prev != nullptr) {
+        m_idxEncodeFrameId.erase(prev->val.encodeFrameId, prev->seq);
+        prev->val.dataList.clear();
+        prev->valid = false;
+    }
+    const int64_t seq = m_head++;
+    auto& slot = m_ring[seq & m_ringMask];
+    slot.val.timestamp = pts;
+    slot.val.inputFrameId = inputFrameId;
+    slot.val.encodeFrameId = encodeFrameId;
+    slot.val.duration = duration;
+    slot.seq = seq;
+    slot.valid = true;
+    m_idxPts.set(pts, seq);
+    m_idxEncodeFrameId.set(encodeFrameId, seq);
+    return seq;
+}
+
+void RGYTimestamp::add(int64_t pts, int64_t inputFrameId, int64_t encodeFrameId, int64_t duration, const std::vector<std::shared_ptr<RGYFrameData>>& metadatalist) {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (auto last_add_pos = getSlot(last_add_seq); last_add_pos != nullptr) { // 前のフレームのdurationの更新
+        if (!noDurationFix) last_add_pos->val.duration = pts - last_add_pos->val.timestamp;
+        if (duration == 0) duration = last_add_pos->val.duration;
+    }
+    last_add_seq = push(pts, inputFrameId, encodeFrameId, duration);
+    m_ring[last_add_seq & m_ringMask].val.dataList.assign(metadatalist);
+}
+
+RGYTimestampMapVal RGYTimestamp::check(int64_t pts) {
+    if (last_check_seq < 0 && pts > 0 && !timestampPassThrough) {
+        offset = -pts;
+    }
+    std::lock_guard<std::mutex> lock(mtx);
+    pts += offset;
+    auto pos = getSlot(m_idxPts.find(pts));
+    if (pos == nullptr) {
+        auto last_check_pos = getSlot(last_check_seq);
+        if (last_check_pos == nullptr) {
+            return RGYTimestampMapVal();
+        }
+        pts = last_check_pos->val.timestamp + last_check_pos->val.duration / 2;
+        const auto next_pts = last_check_pos->val.timestamp + last_check_pos->val.duration;
+        last_check_pos->val.duration = pts - last_check_pos->val.timestamp;
+        const auto encodeFrameId = last_check_pos->val.encodeFrameId;
+        const auto dataList = last_check_pos->val.dataList; // pushでリングが拡張されることがあるので先にコピーしておく
+        const auto seq = push(pts, last_input_frame_id, encodeFrameId, next_pts - pts);
+        pos = &m_ring[seq & m_ringMask];
+        pos->val.dataList = dataList;
+    }
+    last_input_frame_id = pos->val.inputFrameId;
+    last_check_seq = pos->seq;
+    auto ret = pos->val;
+    clean(ret.inputFrameId);
+    return ret;
+}
+
+void RGYTimestamp::clean(const int64_t current_id) {
+    // 古いものから順に、不要になったフレームを解放する
+    while (m_tail < m_head) {
+        auto& slot = m_ring[m_tail & m_ringMask];
+        if (slot.valid) {
+            if (slot.val.inputFrameId >= current_id - CLEAN_MARGIN) {
+                break;
+            }
+            m_idxPts.erase(slot.val.timestamp, slot.seq);
+            m_idxEncodeFrameId.erase(slot.val.encodeFrameId, slot.seq);
+            slot.val.dataList.clear();
+            slot.valid = false;
+        }
+        m_tail++;
+    }
+}
+
+RGYTimestampMapVal RGYTimestamp::getByEncodeFrameID(const int64_t id) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto pos = getSlot(m_idxEncodeFrameId.find(id));
+    if (pos == nullptr) {
+        return RGYTimestampMapVal();
+    }
+    auto ret = pos->val;
+    clean(ret.inputFrameId);
+    return ret;
+}
+
+RGYTimestampMapVal RGYTimestamp::get(int64_t pts) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto pos = getSlot(m_idxPts.find(pts));
+    if (pos == nullptr) {
+        return RGYTimestampMapVal();
+    }
+    auto ret = pos->val;
+    clean(ret.inputFrameId);
+    return ret;
+}
+
 const char *RGYOutput::OUT_DEBUG_FILE_HEADER = "size %d, pts %lld, dts %lld, duration %lld, frametype %d, frameidx %d, picstruct %d";
 
 RGYOutput::RGYOutput() :
@@ -96,8 +313,7 @@ RGYOutput::RGYOutput() :
     m_bsf(),
     m_parse_nal_hevc(get_parse_nal_unit_hevc_func()),
     m_insertHeader(INSERT_HEADER_NONE),
-    m_storedHeaders(),
-    m_parse_nal_h264(get_parse_nal_unit_h264_func()) {
+    m_storedHeaders() {
 }
 
 RGYOutput::~RGYOutput() {
@@ -418,35 +634,34 @@ RGY_ERR RGYOutput::InsertHeader(RGYBitstream *bitstream, bool isIDR) {
         return RGY_ERR_NONE;
     }
     
-    std::vector<nal_info> nal_list;
+    const auto codec = m_VideoOutputInfo.codec;
+    auto isHeader = [codec](const nal_info& nal) {
+        return (codec == RGY_CODEC_H264) ? (nal.type == NALU_H264_SPS || nal.type == NALU_H264_PPS)
+                                         : (nal.type == NALU_HEVC_VPS || nal.type == NALU_HEVC_SPS || nal.type == NALU_HEVC_PPS);
+    };
     bool foundHeaders = false;
     bool foundAUD = false;
     bool isIDRFrame = isIDR;
-    
-    if (m_VideoOutputInfo.codec == RGY_CODEC_H264) {
-        nal_list = m_parse_nal_h264(bitstream->data(), bitstream->size());
-        // H.264の場合、SPS/PPSがあるかチェック
-        foundHeaders = std::find_if(nal_list.begin(), nal_list.end(), [](const nal_info& info) { 
-            return info.type == NALU_H264_SPS || info.type == NALU_H264_PPS; 
-        }) != nal_list.end();
-        // H.264の場合、IDRフレームがあるかチェック
-        isIDRFrame |= std::find_if(nal_list.begin(), nal_list.end(), [](const nal_info& info) { 
-            return info.type == NALU_H264_IDR; 
-        }) != nal_list.end();
-        // H.264の場合、AUDがあるかチェック
-        foundAUD = std::find_if(nal_list.begin(), nal_list.end(), [](const nal_info& info) { 
-            return info.type == NALU_H264_AUD; 
-        }) != nal_list.end();
-    } else if (m_VideoOutputInfo.codec == RGY_CODEC_HEVC) {
-        nal_list = m_parse_nal_hevc(bitstream->data(), bitstream->size());
-        // HEVCの場合、VPS/SPS/PPSがあるかチェック
-        foundHeaders = std::find_if(nal_list.begin(), nal_list.end(), [](const nal_info& info) { 
-            return info.type == NALU_HEVC_VPS || info.type == NALU_HEVC_SPS || info.type == NALU_HEVC_PPS; 
-        }) != nal_list.end();
-        // HEVCの場合、AUDがあるかチェック
-        foundAUD = std::find_if(nal_list.begin(), nal_list.end(), [](const nal_info& info) { 
-            return info.type == NALU_HEVC_AUD; 
-        }) != nal_list.end();
+    size_t insert_offset = 0; // ヘッダーを挿入する位置 (AUDがあればその直後)
+    {
+        // 毎フレーム呼ばれるので、nal unitのリストは作らずに1回の走査で確認する
+        const uint8_t *firstNal = nullptr;
+        RGYNalUnitReader reader(codec, bitstream->data(), bitstream->size());
+        nal_info nal;
+        while (reader.next(nal)) {
+            if (firstNal == nullptr) {
+                firstNal = nal.ptr;
+            }
+            // SPS/PPS(/VPS)があるかチェック
+            foundHeaders |= isHeader(nal);
+            // H.264の場合、IDRフレームがあるかチェック
+            isIDRFrame |= (codec == RGY_CODEC_H264 && nal.type == NALU_H264_IDR);
+            // AUDがあるかチェック
+            if (!foundAUD && nal.type == ((codec == RGY_CODEC_H264) ? NALU_H264_AUD : NALU_HEVC_AUD)) {
+                foundAUD = true;
+                insert_offset = (nal.ptr - firstNal) + nal.size;
+            }
+        }
     }
     
     // SPS/PPS/VPSヘッダー挿入処理
@@ -455,15 +670,10 @@ RGY_ERR RGYOutput::InsertHeader(RGYBitstream *bitstream, bool isIDR) {
             // ヘッダーが見つかった場合、保存する
             m_storedHeaders.clear();
             
-            for (const auto& nal : nal_list) {
-                bool isHeader = false;
-                if (m_VideoOutputInfo.codec == RGY_CODEC_H264) {
-                    isHeader = (nal.type == NALU_H264_SPS || nal.type == NALU_H264_PPS);
-                } else if (m_VideoOutputInfo.codec == RGY_CODEC_HEVC) {
-                    isHeader = (nal.type == NALU_HEVC_VPS || nal.type == NALU_HEVC_SPS || nal.type == NALU_HEVC_PPS);
-                }
-                
-                if (isHeader) {
+            RGYNalUnitReader reader(codec, bitstream->data(), bitstream->size());
+            nal_info nal;
+            while (reader.next(nal)) {
+                if (isHeader(nal)) {
                     const size_t currentSize = m_storedHeaders.size();
                     m_storedHeaders.resize(currentSize + nal.size);
                     memcpy(m_storedHeaders.data() + currentSize, nal.ptr, nal.size);
@@ -475,13 +685,6 @@ RGY_ERR RGYOutput::InsertHeader(RGYBitstream *bitstream, bool isIDR) {
         }
         if (isIDRFrame && !foundHeaders && !m_storedHeaders.empty()) {
             // ヘッダーがないが、既に保存されている場合、ヘッダーを挿入
-            std::vector<nal_info>::iterator it_aud_pos = nal_list.end();
-            if (m_VideoOutputInfo.codec == RGY_CODEC_H264) {
-                it_aud_pos = std::find_if(nal_list.begin(), nal_list.end(), [](const nal_info& info) { return info.type == NALU_H264_AUD; });
-            } else if (m_VideoOutputInfo.codec == RGY_CODEC_HEVC) {
-                it_aud_pos = std::find_if(nal_list.begin(), nal_list.end(), [](const nal_info& info) { return info.type == NALU_HEVC_AUD; });
-            }
-            const size_t insert_offset = (it_aud_pos != nal_list.end()) ? (it_aud_pos->ptr - nal_list.begin()->ptr) + it_aud_pos->size : 0;
             bitstream->resize(bitstream->size() + m_storedHeaders.size());
             memmove(bitstream->data() + insert_offset + m_storedHeaders.size(), bitstream->data() + insert_offset, bitstream->size() - insert_offset - m_storedHeaders.size());
             memcpy(bitstream->data() + insert_offset, m_storedHeaders.data(), m_storedHeaders.size());
@@ -763,6 +966,181 @@ RGY_ERR RGYOutputBSF::applyBitstreamFilter(RGYBitstream *bitstream) {
     return RGY_ERR_NONE;
 }
 
+RGY_ERR RGYOutput::writeVec(const std::vector<RGYOutputIOVec>& vec) {
+#if defined(_WIN32) || defined(_WIN64)
+    for (const auto& v : vec) {
+        WRITE_CHECK(_fwrite_nolock(v.ptr, 1, v.size, m_fDest.get()), v.size);
+    }
+#else
+    // stdioのバッファに残っているデータを先に書き出してから、writevでまとめて書き出す
+    if (fflush(m_fDest.get()) != 0) {
+        AddMessage(RGY_LOG_ERROR, _T("Error writing file.\nNot enough disk space!\n"));
+        return RGY_ERR_UNDEFINED_BEHAVIOR;
+    }
+    static const int RGY_OUTPUT_IOV_MAX = 1024;
+    struct iovec iov[RGY_OUTPUT_IOV_MAX];
+    const int fd = fileno(m_fDest.get());
+    size_t ivec = 0;   // 書き込み中のvecのindex
+    size_t offset = 0; // vec[ivec]のうち書き込み済みのサイズ
+    while (ivec < vec.size()) {
+        int count = 0;
+        for (size_t i = ivec; i < vec.size() && count < RGY_OUTPUT_IOV_MAX; i++, count++) {
+            const size_t skip = (i == ivec) ? offset : 0;
+            iov[count].iov_base = (void *)((const uint8_t *)vec[i].ptr + skip);
+            iov[count].iov_len = vec[i].size - skip;
+        }
+        const auto ret = writev(fd, iov, count);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            AddMessage(RGY_LOG_ERROR, _T("Error writing file.\nNot enough disk space!\n"));
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
+        }
+        // 書き込めなかった分から再開する
+        size_t written = (size_t)ret;
+        while (ivec < vec.size() && written >= vec[ivec].size - offset) {
+            written -= vec[ivec].size - offset;
+            ivec++;
+            offset = 0;
+        }
+        offset += written;
+    }
+#endif
+    return RGY_ERR_NONE;
+}
+
+RGYOutputRawPERing::RGYOutputRawPERing() :
+    m_buffer(),
+    m_size(0),
+    m_writePos(0),
+    m_readPos(0),
+    m_readNext(0),
+    m_finished(false),
+    m_eventWrite(unique_event(nullptr, nullptr)),
+    m_spillFile(),
+    m_fpSpillWrite(),
+    m_fpSpillRead(),
+    m_spillCount(0),
+    m_spillRead(0),
+    m_spillBuf() {
+}
+
+RGYOutputRawPERing::~RGYOutputRawPERing() {
+    m_fpSpillWrite.reset();
+    m_fpSpillRead.reset();
+    m_buffer.reset();
+}
+
+RGY_ERR RGYOutputRawPERing::init(const size_t ringSize, const tstring& spillFile) {
+    m_size = ALIGN(ringSize, 64);
+    m_buffer.reset((uint8_t *)_aligned_malloc(m_size, 64));
+    if (!m_buffer) {
+        return RGY_ERR_NULL_PTR;
+    }
+    m_spillFile = spillFile;
+    m_eventWrite = CreateEventUnique(nullptr, FALSE, FALSE);
+    if (!m_eventWrite) {
+        return RGY_ERR_NULL_PTR;
+    }
+    return RGY_ERR_NONE;
+}
+
+RGY_ERR RGYOutputRawPERing::write(const RGYOutputRawPEExtHeader& header, const void *data) {
+    const size_t recordSize = ALIGN(sizeof(header) + header.size, 8);
+    if (!m_fpSpillWrite) {
+        const auto writePos = m_writePos.load(std::memory_order_relaxed);
+        const auto readPos = m_readPos.load(std::memory_order_acquire);
+        const size_t offset = (size_t)(writePos % m_size);
+        // 末尾に収まらない場合は先頭から書き込む
+        const size_t padding = (offset + recordSize > m_size) ? m_size - offset : 0;
+        if ((size_t)(writePos - readPos) + padding + recordSize <= m_size) {
+            if (padding >= sizeof(header)) {
+                ((RGYOutputRawPEExtHeader *)(m_buffer.get() + offset))->allocSize = 0; // 読み飛ばす位置の目印
+            }
+            auto dst = m_buffer.get() + (offset + padding) % m_size;
+            memcpy(dst, &header, sizeof(header));
+            ((RGYOutputRawPEExtHeader *)dst)->allocSize = recordSize;
+            memcpy(dst + sizeof(header), data, header.size);
+            m_writePos.store(writePos + padding + recordSize, std::memory_order_release);
+            SetEvent(m_eventWrite.get());
+            return RGY_ERR_NONE;
+        }
+        // リングが一杯なので、以降はファイルに書き出す
+        // 書き込み中に親が読み込みで開けるよう、共有を拒否しないで開く
+        m_fpSpillWrite.reset(_tfsopen(m_spillFile.c_str(), _T("wb"), _SH_DENYNO));
+        if (!m_fpSpillWrite) {
+            return RGY_ERR_FILE_OPEN;
+        }
+    }
+    RGYOutputRawPEExtHeader spillHeader = header;
+    spillHeader.allocSize = sizeof(header) + header.size;
+    if (fwrite(&spillHeader, 1, sizeof(spillHeader), m_fpSpillWrite.get()) != sizeof(spillHeader)
+        || fwrite(data, 1, header.size, m_fpSpillWrite.get()) != header.size
+        || fflush(m_fpSpillWrite.get()) != 0) {
+        return RGY_ERR_UNDEFINED_BEHAVIOR;
+    }
+    m_spillCount.fetch_add(1, std::memory_order_release);
+    SetEvent(m_eventWrite.get());
+    return RGY_ERR_NONE;
+}
+
+void RGYOutputRawPERing::setFinished() {
+    m_fpSpillWrite.reset();
+    m_finished.store(true, std::memory_order_release);
+    SetEvent(m_eventWrite.get());
+}
+
+void RGYOutputRawPERing::waitWrite(const uint32_t timeout) {
+    WaitForSingleObject(m_eventWrite.get(), timeout);
+}
+
+RGY_ERR RGYOutputRawPERing::read(RGYOutputRawPEExtHeader **ptr) {
+    *ptr = nullptr;
+    // 終了の確認は先に行い、その後残りのデータがないかを確認する
+    const bool finished = m_finished.load(std::memory_order_acquire);
+    auto readPos = m_readPos.load(std::memory_order_relaxed);
+    if (readPos != m_writePos.load(std::memory_order_acquire)) {
+        auto offset = (size_t)(readPos % m_size);
+        if (m_size - offset < sizeof(RGYOutputRawPEExtHeader)
+            || ((RGYOutputRawPEExtHeader *)(m_buffer.get() + offset))->allocSize == 0) {
+            readPos += m_size - offset; // 末尾の残りは読み飛ばす
+            offset = 0;
+        }
+        *ptr = (RGYOutputRawPEExtHeader *)(m_buffer.get() + offset);
+        m_readNext = readPos + (*ptr)->allocSize;
+        return RGY_ERR_NONE;
+    }
+    // リングを読み終えたら、ファイルに書き出された分を読み込む
+    if (m_spillRead < m_spillCount.load(std::memory_order_acquire)) {
+        if (!m_fpSpillRead) {
+            m_fpSpillRead.reset(_tfsopen(m_spillFile.c_str(), _T("rb"), _SH_DENYNO));
+            if (!m_fpSpillRead) {
+                return RGY_ERR_FILE_OPEN;
+            }
+        }
+        clearerr(m_fpSpillRead.get());
+        RGYOutputRawPEExtHeader header;
+        if (fread(&header, 1, sizeof(header), m_fpSpillRead.get()) != sizeof(header)) {
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
+        }
+        m_spillBuf.resize(sizeof(header) + header.size);
+        memcpy(m_spillBuf.data(), &header, sizeof(header));
+        if (fread(m_spillBuf.data() + sizeof(header), 1, header.size, m_fpSpillRead.get()) != header.size) {
+            return RGY_ERR_UNDEFINED_BEHAVIOR;
+        }
+        m_spillRead++;
+        m_readNext = readPos;
+        *ptr = (RGYOutputRawPEExtHeader *)m_spillBuf.data();
+        return RGY_ERR_NONE;
+    }
+    return (finished) ? RGY_ERR_MORE_BITSTREAM : RGY_ERR_MORE_DATA;
+}
+
+void RGYOutputRawPERing::release() {
+    m_readPos.store(m_readNext, std::memory_order_release);
+}
+
 RGYOutputRaw::RGYOutputRaw() :
     m_outputBuf2(),
     m_hdrBitstream(),
@@ -778,7 +1156,9 @@ RGYOutputRaw::RGYOutputRaw() :
     m_debugDirectAV1Out(false),
     m_extPERaw(false),
     m_qFirstProcessData(nullptr),
-    m_qFirstProcessDataFree(nullptr) {
+    m_qFirstProcessDataFree(nullptr),
+    m_qFirstProcessDataFreeLarge(nullptr),
+    m_peRing(nullptr) {
     m_strWriterName = _T("bitstream");
     m_OutType = OUT_TYPE_BITSTREAM;
 }
@@ -788,6 +1168,10 @@ RGYOutputRaw::~RGYOutputRaw() {
         m_qFirstProcessData->push(nullptr);
         m_qFirstProcessData = nullptr;
     }
+    if (m_peRing) {
+        m_peRing->setFinished();
+        m_peRing = nullptr;
+    }
     if (m_fpDebug) {
         m_fpDebug.reset();
     }
@@ -809,6 +1193,8 @@ RGY_ERR RGYOutputRaw::Init(const TCHAR *strFileName, const VideoInfo *pVideoOutp
     } else {
         if (rawPrm->qFirstProcessData) {
             AddMessage(RGY_LOG_DEBUG, _T("using parallel queue\n"));
+        } else if (rawPrm->peRing) {
+            AddMessage(RGY_LOG_DEBUG, _T("using parallel ring buffer\n"));
         } else if (_tcscmp(strFileName, _T("-")) == 0) {
             m_fDest.reset(stdout);
             m_outputIsStdout = true;
@@ -855,6 +1241,7 @@ RGY_ERR RGYOutputRaw::Init(const TCHAR *strFileName, const VideoInfo *pVideoOutp
         m_qFirstProcessData = rawPrm->qFirstProcessData;
         m_qFirstProcessDataFree = rawPrm->qFirstProcessDataFree;
         m_qFirstProcessDataFreeLarge = rawPrm->qFirstProcessDataFreeLarge;
+        m_peRing = rawPrm->peRing;
         m_hdr10plusMetadataCopy = rawPrm->hdr10plusMetadataCopy;
         m_hdr10plus = rawPrm->hdr10plus;
         m_doviProfileDst = rawPrm->doviProfile;
@@ -916,15 +1303,19 @@ RGY_ERR RGYOutputRaw::WriteNextFrame(RGYBitstream *pBitstream) {
     writeRawDebug(pBitstream);
 
     if (m_VideoOutputInfo.codec == RGY_CODEC_AV1) {
-        const auto av1_units = parse_unit_av1(pBitstream->data(), pBitstream->size());
-        const auto td_count = std::count_if(av1_units.begin(), av1_units.end(), [](const std::unique_ptr<unit_info>& info) { return info->type == OBU_TEMPORAL_DELIMITER; });
+        // 毎フレーム呼ばれるので、まずはOBUのコピーを行わずにTEMPORAL_DELIMITERの数を確認する
+        int td_count = 0;
+        obu_info obu;
+        for (RGYOBUReader reader(pBitstream->data(), pBitstream->size()); reader.next(obu) && td_count <= 1; ) {
+            td_count += (obu.type == OBU_TEMPORAL_DELIMITER) ? 1 : 0;
+        }
         if (td_count > 1) {
             RGYBitstream bsCopy = RGYBitstreamInit();
-            for (int i = 0; i < (int)av1_units.size(); i++) {
-                if (av1_units[i]->type == OBU_TEMPORAL_DELIMITER && bsCopy.size() > 0) {
+            for (RGYOBUReader reader(pBitstream->data(), pBitstream->size()); reader.next(obu); ) {
+                if (obu.type == OBU_TEMPORAL_DELIMITER && bsCopy.size() > 0) {
                     WriteNextOneFrame(&bsCopy);
                 }
-                bsCopy.append(av1_units[i]->unit_data.data(), av1_units[i]->unit_data.size());
+                bsCopy.append(obu.ptr, obu.size);
             }
             if (bsCopy.size() > 0) {
                 return WriteNextOneFrame(&bsCopy);
@@ -1024,8 +1415,8 @@ RGY_ERR RGYOutputRaw::WriteNextOneFrame(RGYBitstream *pBitstream) {
         if (m_qFirstProcessData) { // 並列エンコード用のキューが指定されている場合は、ファイル出力せず、キューにデータを渡す
             RGYOutputRawPEExtHeader *ptr = nullptr;
             //空きポインタを保持するキューから取得
-            RGYQueueMPMP<RGYOutputRawPEExtHeader*> *freeQueue = (sizeof(peHeader) + pBitstream->size() <= RGY_PE_EXT_HEADER_DATA_NORMAL_BUF_SIZE) ? m_qFirstProcessDataFree : m_qFirstProcessDataFreeLarge;
-            if (!freeQueue->front_copy_and_pop_no_lock(&ptr)) {
+            RGYQueuePEExtHeaderFree *freeQueue = (sizeof(peHeader) + pBitstream->size() <= RGY_PE_EXT_HEADER_DATA_NORMAL_BUF_SIZE) ? m_qFirstProcessDataFree : m_qFirstProcessDataFreeLarge;
+            if (!freeQueue->try_pop(&ptr)) {
                 ptr = nullptr;
             }
             auto allocSize = (ptr) ? ptr->allocSize : 0;
@@ -1045,12 +1436,18 @@ RGY_ERR RGYOutputRaw::WriteNextOneFrame(RGYBitstream *pBitstream) {
             ptr->allocSize = allocSize; // allocsizeはpeHeaderで上書きされているので、ここで再設定
             m_qFirstProcessData->push(ptr);
             nBytesWritten += pBitstream->size();
+        } else if (m_peRing) { // 並列エンコード用のリングバッファが指定されている場合は、リングバッファにデータを渡す
+            if (auto sts = m_peRing->write(peHeader, pBitstream->data()); sts != RGY_ERR_NONE) {
+                AddMessage(RGY_LOG_ERROR, _T("failed to write to parallel encoding ring buffer: %s.\n"), get_err_mes(sts));
+                return sts;
+            }
+            nBytesWritten += pBitstream->size();
         } else {
             auto ret = _fwrite_nolock(&peHeader, 1, sizeof(peHeader), m_fDest.get());
             WRITE_CHECK(ret, sizeof(peHeader));
         }
     }
-    if (!m_qFirstProcessData) {
+    if (!m_qFirstProcessData && !m_peRing) {
         const auto dataSize = _fwrite_nolock(pBitstream->data(), 1, pBitstream->size(), m_fDest.get());
         WRITE_CHECK(dataSize, pBitstream->size());
         nBytesWritten += dataSize;
@@ -1067,7 +1464,7 @@ RGY_ERR RGYOutputRaw::WriteNextFrame(RGYFrame *pSurface) {
     return RGY_ERR_UNSUPPORTED;
 }
 
-RGYOutFrame::RGYOutFrame() : m_bY4m(true) {
+RGYOutFrame::RGYOutFrame() : m_bY4m(true), m_iov(), m_frameBuffer(), m_frameBufferSize(0) {
     m_strWriterName = _T("yuv writer");
     m_OutType = OUT_TYPE_SURFACE;
 };
@@ -1109,25 +1506,56 @@ RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
     if (!m_fDest) {
         return RGY_ERR_NULL_PTR;
     }
+    const auto csp = pSurface->csp();
+    if (   RGY_CSP_CHROMA_FORMAT[csp] != RGY_CHROMAFMT_YUV420
+        && RGY_CSP_CHROMA_FORMAT[csp] != RGY_CHROMAFMT_YUV444) {
+        AddMessage(RGY_LOG_ERROR, _T("Unsupported colorspace %s.\n"), RGY_CSP_NAMES[csp]);
+        return RGY_ERR_INVALID_COLOR_FORMAT;
+    }
+    const bool cspNV = csp == RGY_CSP_NV12 || csp == RGY_CSP_P010;
+    const int pixSize = RGY_CSP_BIT_DEPTH[csp] > 8 ? 2 : 1;
+    const int chromaShift = (RGY_CSP_CHROMA_FORMAT[csp] == RGY_CHROMAFMT_YUV420) ? 1 : 0;
+    const uint32_t lumaWidthBytes = pSurface->width() * pixSize;
+    const uint32_t widthUV = pSurface->width() >> chromaShift;
+    const uint32_t heightUV = pSurface->height() >> chromaShift;
+    const uint32_t chromaPlaneBytes = widthUV * heightUV * pixSize;
+    const int chromaPlanes = (cspNV) ? 2 : RGY_CSP_PLANES[csp] - 1;
+    const size_t frameSize = (size_t)lumaWidthBytes * pSurface->height() + (size_t)chromaPlaneBytes * chromaPlanes;
 
     if (m_sourceHWMem) {
         if (m_readBuffer.get() == nullptr) {
             m_readBuffer.reset((uint8_t *)_aligned_malloc(pSurface->pitch() + 128, 16));
         }
     }
+    // HWメモリからの読み込みとNV12/P010の色差の分離は、1フレーム分のステージングバッファ上で行う
+    // (行単位の読み込みは128byte単位で行うので、pitch分の余裕を持たせておく)
+    if (m_sourceHWMem || cspNV) {
+        const size_t bufSize = frameSize + 64 + pSurface->pitch() + 128;
+        if (m_frameBufferSize < bufSize) {
+            m_frameBuffer.reset((uint8_t *)_aligned_malloc(bufSize, 64));
+            if (!m_frameBuffer) {
+                m_frameBufferSize = 0;
+                AddMessage(RGY_LOG_ERROR, _T("Failed to allocate frame buffer.\n"));
+                return RGY_ERR_NULL_PTR;
+            }
+            m_frameBufferSize = bufSize;
+        }
+    }
 
+    m_iov.clear();
     if (m_bY4m) {
         if (!m_y4mHeaderWritten) {
-            auto csp = pSurface->csp();
-            if (csp == RGY_CSP_NV12) {
-                csp = RGY_CSP_YV12;
-            } else if (csp == RGY_CSP_P010) {
-                csp = RGY_CSP_YV12_16;
+            auto y4mcsp = csp;
+            if (y4mcsp == RGY_CSP_NV12) {
+                y4mcsp = RGY_CSP_YV12;
+            } else if (y4mcsp == RGY_CSP_P010) {
+                y4mcsp = RGY_CSP_YV12_16;
             }
-            WriteY4MHeader(m_fDest.get(), &m_VideoOutputInfo, csp);
+            WriteY4MHeader(m_fDest.get(), &m_VideoOutputInfo, y4mcsp);
             m_y4mHeaderWritten = true;
         }
-        WRITE_CHECK(fwrite("FRAME\n", 1, strlen("FRAME\n"), m_fDest.get()), strlen("FRAME\n"));
+        static const char Y4M_FRAME_HEADER[] = "FRAME\n";
+        m_iov.push_back({ Y4M_FRAME_HEADER, strlen(Y4M_FRAME_HEADER) });
     }
 
     auto loadLineToBuffer = [](uint8_t *ptrBuf, uint8_t *ptrSrc, const int pitch) {
@@ -1154,6 +1582,14 @@ RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
         memcpy(ptrBuf, ptrSrc, pitch);
 #endif
     };
+    // 隣接するバッファはひとつのiovecにまとめる
+    auto addIOV = [this](const void *ptr, size_t size) {
+        if (m_iov.size() > 0 && (const uint8_t *)m_iov.back().ptr + m_iov.back().size == (const uint8_t *)ptr) {
+            m_iov.back().size += size;
+        } else {
+            m_iov.push_back({ ptr, size });
+        }
+    };
 
     auto crop = initCrop();
 #if ENCODER_QSV
@@ -1161,50 +1597,46 @@ RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
         crop = mfxsurf->crop();
     }
 #endif
-    const int pixSize = RGY_CSP_BIT_DEPTH[pSurface->csp()] > 8 ? 2 : 1;
-    if (   RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV420
-        || RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV444) {
-        const uint32_t lumaWidthBytes = pSurface->width() * pixSize;
-        const uint32_t cropOffset = crop.e.up * pSurface->pitch() + crop.e.left * pixSize;
-        if (m_sourceHWMem) {
-            for (decltype(pSurface->height()) j = 0; j < pSurface->height(); j++) {
-                uint8_t *ptrBuf = m_readBuffer.get();
-                uint8_t *ptrSrc = pSurface->ptrY() + (crop.e.up + j) * pSurface->pitch();
-                loadLineToBuffer(ptrBuf, ptrSrc, pSurface->pitch());
-                WRITE_CHECK(fwrite(ptrBuf + crop.e.left * pixSize, 1, lumaWidthBytes, m_fDest.get()), lumaWidthBytes);
-            }
-        } else {
-            for (decltype(pSurface->height()) j = 0; j < pSurface->height(); j++) {
-                WRITE_CHECK(fwrite(pSurface->ptrY() + cropOffset + j * pSurface->pitch(), 1, lumaWidthBytes, m_fDest.get()), lumaWidthBytes);
+    uint8_t *ptrStage = m_frameBuffer.get();
+    // 1plane分を出力に追加する
+    // システムメモリ上のフレームはcropも含めてiovecで直接指定し、HWメモリ上のフレームはステージングバッファに読み込む
+    auto addPlane = [&](const RGY_PLANE plane, const uint32_t cropLeftBytes, const uint32_t cropUp, const uint32_t widthBytes, const uint32_t height) {
+        const uint32_t pitch = pSurface->pitch(plane);
+        uint8_t *ptrSrc = pSurface->ptrPlane(plane) + cropUp * pitch;
+        for (uint32_t j = 0; j < height; j++, ptrSrc += pitch) {
+            if (!m_sourceHWMem) {
+                addIOV(ptrSrc + cropLeftBytes, widthBytes);
+            } else {
+                if (cropLeftBytes == 0 && ((size_t)ptrStage & 15) == 0) {
+                    loadLineToBuffer(ptrStage, ptrSrc, pitch);
+                } else {
+                    loadLineToBuffer(m_readBuffer.get(), ptrSrc, pitch);
+                    memcpy(ptrStage, m_readBuffer.get() + cropLeftBytes, widthBytes);
+                }
+                addIOV(ptrStage, widthBytes);
+                ptrStage += widthBytes;
             }
         }
-    } else {
-        AddMessage(RGY_LOG_ERROR, _T("Unsupported colorspace %s.\n"), RGY_CSP_NAMES[pSurface->csp()]);
-        return RGY_ERR_INVALID_COLOR_FORMAT;
-    }
+    };
 
-    uint32_t frameSize = 0;
-    if (   pSurface->csp() == RGY_CSP_NV12
-        || pSurface->csp() == RGY_CSP_P010) {
-        const uint32_t widthUV = pSurface->width() >> 1;
-        const uint32_t heightUV = pSurface->height() >> 1;
-        const uint32_t planeOffsetUV = ALIGN32((widthUV * heightUV + 32) * pixSize);
-        if (!m_UVBuffer) {
-            m_UVBuffer.reset((uint8_t *)_aligned_malloc(planeOffsetUV * 2, 32));
-        }
+    addPlane(RGY_PLANE_Y, crop.e.left * pixSize, crop.e.up, lumaWidthBytes, pSurface->height());
 
+    if (cspNV) {
+        // SIMDでの色差の分離は16画素単位で行い、行末からはみ出して書き込むので、UとVの間に余裕を持たせておく
+        uint8_t *const ptrStageU = ptrStage;
+        uint8_t *const ptrStageV = ptrStage + ALIGN32(chromaPlaneBytes + 32);
         for (uint32_t j = 0; j < heightUV; j++) {
-            uint8_t *ptrSrc = pSurface->ptrUV() + (crop.e.up + j) * pSurface->pitch();
+            uint8_t *ptrSrc = pSurface->ptrUV() + ((crop.e.up >> 1) + j) * pSurface->pitch(RGY_PLANE_C);
             uint8_t *ptrBuf = ptrSrc;
             if (m_sourceHWMem) {
-                loadLineToBuffer(m_readBuffer.get(), ptrSrc, pSurface->pitch());
+                loadLineToBuffer(m_readBuffer.get(), ptrSrc, pSurface->pitch(RGY_PLANE_C));
                 ptrBuf = m_readBuffer.get();
             }
 
             const void *ptrLineUV = ptrBuf + crop.e.left * pixSize;
-            void *ptrLineU = m_UVBuffer.get() + j * widthUV * pixSize;
-            void *ptrLineV = m_UVBuffer.get() + j * widthUV * pixSize + planeOffsetUV;
-            if (pSurface->csp() == RGY_CSP_NV12) {
+            void *ptrLineU = ptrStageU + j * widthUV * pixSize;
+            void *ptrLineV = ptrStageV + j * widthUV * pixSize;
+            if (csp == RGY_CSP_NV12) {
                 const uint8_t *ptrUV = (const uint8_t *)ptrLineUV;
                 uint8_t *ptrU = (uint8_t *)ptrLineU;
                 uint8_t *ptrV = (uint8_t *)ptrLineV;
@@ -1223,39 +1655,31 @@ RGY_ERR RGYOutFrame::WriteNextFrame(RGYFrame *pSurface) {
 #else
                 convert_nv12_to_yv12_line_c<uint8_t, 8, uint8_t, 8>(ptrU, ptrV, ptrUV, widthUV);
 #endif
-            } else if (pSurface->csp() == RGY_CSP_P010) {
+            } else {
                 const uint16_t *ptrUV = (const uint16_t *)ptrLineUV;
                 uint16_t *ptrU = (uint16_t *)ptrLineU;
                 uint16_t *ptrV = (uint16_t *)ptrLineV;
-                switch (RGY_CSP_BIT_DEPTH[pSurface->csp()]) {
+                switch (RGY_CSP_BIT_DEPTH[csp]) {
                 case 10: convert_nv12_to_yv12_line_c<uint16_t, 10, uint16_t, 16>(ptrU, ptrV, ptrUV, widthUV); break;
                 case 12: convert_nv12_to_yv12_line_c<uint16_t, 12, uint16_t, 16>(ptrU, ptrV, ptrUV, widthUV); break;
                 case 14: convert_nv12_to_yv12_line_c<uint16_t, 14, uint16_t, 16>(ptrU, ptrV, ptrUV, widthUV); break;
                 case 16:
                 default: convert_nv12_to_yv12_line_c<uint16_t, 16, uint16_t, 16>(ptrU, ptrV, ptrUV, widthUV); break;
                 }
-            } else {
-                return RGY_ERR_INVALID_COLOR_FORMAT;
-            }
-        }
-        WRITE_CHECK(fwrite(m_UVBuffer.get(),                 1, widthUV * heightUV, m_fDest.get()), widthUV * heightUV);
-        WRITE_CHECK(fwrite(m_UVBuffer.get() + planeOffsetUV, 1, widthUV * heightUV, m_fDest.get()), widthUV * heightUV);
-    } else if (RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV420
-            || RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV444) {
-        uint8_t *const ptrBuf = m_readBuffer.get();
-
-        for (int iplane = 1; iplane < RGY_CSP_PLANES[pSurface->csp()]; iplane++) {
-            const uint32_t widthUV = pSurface->width() >> (RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV420 ? 1 : 0);
-            const uint32_t heightUV = pSurface->height() >> (RGY_CSP_CHROMA_FORMAT[pSurface->csp()] == RGY_CHROMAFMT_YUV420 ? 1 : 0);
-            for (uint32_t i = 0; i < heightUV; i++) {
-                loadLineToBuffer(ptrBuf, pSurface->ptrPlane((RGY_PLANE)iplane) + (crop.e.up + i) * pSurface->pitch((RGY_PLANE)iplane), pSurface->pitch((RGY_PLANE)iplane));
-                WRITE_CHECK(fwrite(ptrBuf + (crop.e.left * pixSize >> 1), 1, widthUV * pixSize, m_fDest.get()), widthUV * pixSize);
             }
         }
+        addIOV(ptrStageU, chromaPlaneBytes);
+        addIOV(ptrStageV, chromaPlaneBytes);
     } else {
-        return RGY_ERR_INVALID_COLOR_FORMAT;
+        for (int iplane = 1; iplane < RGY_CSP_PLANES[csp]; iplane++) {
+            addPlane((RGY_PLANE)iplane, (crop.e.left >> chromaShift) * pixSize, crop.e.up >> chromaShift, widthUV * pixSize, heightUV);
+        }
     }
 
+    auto err = writeVec(m_iov);
+    if (err != RGY_ERR_NONE) {
+        return err;
+    }
     m_encSatusInfo->SetOutputData(RGY_FRAMETYPE_IDR, frameSize, 0);
     return RGY_ERR_NONE;
 }
@@ -1424,10 +1848,12 @@ RGY_ERR initWriters(
         writerPrm.bVideoDtsUnavailable    = videoDtsUnavailable;
         writerPrm.threadOutput            = ctrl->threadOutput;
         writerPrm.threadAudio             = ctrl->threadAudio;
+        writerPrm.threadAudioMax          = ctrl->threadAudioMax;
         writerPrm.threadParamOutput       = ctrl->threadParams.get(RGYThreadType::OUTPUT);
         writerPrm.threadParamAudio        = ctrl->threadParams.get(RGYThreadType::AUDIO);
         writerPrm.threadParamCsp          = ctrl->threadParams.get(RGYThreadType::CSP);
         writerPrm.bufSizeMB               = ctrl->outputBufSizeMB;
+        writerPrm.asyncWrite              = ctrl->outputAsync;
         writerPrm.audioResampler          = common->audioResampler;
         writerPrm.audioIgnoreDecodeError  = common->audioIgnoreDecodeError;
         writerPrm.queueInfo = (pPerfMonitor) ? pPerfMonitor->GetQueueInfoPtr() : nullptr;
@@ -1768,6 +2194,7 @@ RGY_ERR initWriters(
             rawPrm.qFirstProcessData = (ctrl->parallelEnc.sendData) ? ctrl->parallelEnc.sendData->qFirstProcessData : nullptr;
             rawPrm.qFirstProcessDataFree = (ctrl->parallelEnc.sendData) ? ctrl->parallelEnc.sendData->qFirstProcessDataFree : nullptr;
             rawPrm.qFirstProcessDataFreeLarge = (ctrl->parallelEnc.sendData) ? ctrl->parallelEnc.sendData->qFirstProcessDataFreeLarge : nullptr;
+            rawPrm.peRing = (ctrl->parallelEnc.sendData) ? ctrl->parallelEnc.sendData->peRing : nullptr;
             rawPrm.extPERaw = ctrl->parallelEnc.isChild();
             rawPrm.debugRawOut = common->debugRawOut;
             rawPrm.outReplayFile = common->outReplayFile;
@@ -1841,6 +2268,7 @@ RGY_ERR initWriters(
                 AvcodecWriterPrm writerAudioPrm;
                 writerAudioPrm.threadOutput   = ctrl->threadOutput;
                 writerAudioPrm.threadAudio    = ctrl->threadAudio;
+                writerAudioPrm.threadAudioMax = ctrl->threadAudioMax;
                 writerAudioPrm.threadParamOutput = ctrl->threadParams.get(RGYThreadType::OUTPUT);
                 writerAudioPrm.threadParamAudio  = ctrl->threadParams.get(RGYThreadType::AUDIO);
                 writerAudioPrm.bufSizeMB      = ctrl->outputBufSizeMB;
@@ -31,10 +31,13 @@
 
 #include <memory>
 #include <vector>
+#include <array>
 #include <unordered_map>
 #include <mutex>
+#include <atomic>
 #include "rgy_osdep.h"
 #include "rgy_tchar.h"
+#include "rgy_event.h"
 #include "rgy_log.h"
 #include "rgy_status.h"
 #include "rgy_avutil.h"
@@ -66,104 +69,117 @@ enum : uint32_t {
     INSERT_HEADER_AUD = 0x02       // AUD挿入
 };
 
+// フレームに付随するRGYFrameDataのリスト
+// フレームごとのヒープ確保を避けるため、固定長の配列で保持する
+// (各RGYFrameDataTypeは1フレームに高々1つなので、RGY_FRAME_DATA_MAX個あれば足りる)
+class RGYTimestampDataList {
+public:
+    static const int MAX_COUNT = 8;
+    static_assert(RGY_FRAME_DATA_MAX <= MAX_COUNT, "RGYTimestampDataList::MAX_COUNT too small.");
+    using iterator = std::shared_ptr<RGYFrameData> *;
+    using const_iterator = const std::shared_ptr<RGYFrameData> *;
+private:
+    std::array<std::shared_ptr<RGYFrameData>, MAX_COUNT> m_data;
+    int m_count;
+public:
+    RGYTimestampDataList() : m_data(), m_count(0) {};
+    RGYTimestampDataList(const std::vector<std::shared_ptr<RGYFrameData>>& list) : m_data(), m_count(0) { assign(list); };
+    int size() const { return m_count; }
+    bool empty() const { return m_count == 0; }
+    iterator begin() { return m_data.data(); }
+    iterator end() { return m_data.data() + m_count; }
+    const_iterator begin() const { return m_data.data(); }
+    const_iterator end() const { return m_data.data() + m_count; }
+    void clear() {
+        for (int i = 0; i < m_count; i++) m_data[i].reset();
+        m_count = 0;
+    }
+    bool push_back(const std::shared_ptr<RGYFrameData>& data) {
+        if (m_count >= MAX_COUNT) return false;
+        m_data[m_count++] = data;
+        return true;
+    }
+    void assign(const std::vector<std::shared_ptr<RGYFrameData>>& list) {
+        clear();
+        for (const auto& data : list) push_back(data);
+    }
+};
+
 struct RGYTimestampMapVal {
     int64_t timestamp, inputFrameId, encodeFrameId, duration;
-    std::vector<std::shared_ptr<RGYFrameData>> dataList;
+    RGYTimestampDataList dataList;
 
     RGYTimestampMapVal() : timestamp(-1), inputFrameId(-1), encodeFrameId(-1), duration(-1), dataList() {};
-    RGYTimestampMapVal(int64_t timestamp_, int64_t inputFrameId_, int64_t encodeFrameId_, int64_t duration_, std::vector<std::shared_ptr<RGYFrameData>>& datalist)
+    RGYTimestampMapVal(int64_t timestamp_, int64_t inputFrameId_, int64_t encodeFrameId_, int64_t duration_, const RGYTimestampDataList& datalist)
         : timestamp(timestamp_), inputFrameId(inputFrameId_), encodeFrameId(encodeFrameId_), duration(duration_), dataList(datalist) {};
-    void addMetadata(std::shared_ptr<RGYFrameData>& data) { dataList.push_back(data); }
-    void addMetadata(std::vector<std::shared_ptr<RGYFrameData>>& list) { dataList.insert(dataList.end(), list.begin(), list.end()); }
+    void addMetadata(const std::shared_ptr<RGYFrameData>& data) { dataList.push_back(data); }
+    void addMetadata(const std::vector<std::shared_ptr<RGYFrameData>>& list) { for (const auto& data : list) dataList.push_back(data); }
 };
 
+// int64_tのキー -> RGYTimestampのリング上の通し番号 の索引
+// 線形探索のオープンアドレス法で、削除はbackward shiftで行うため墓石が残らない
+class RGYTimestampIndex {
+private:
+    struct Entry {
+        int64_t key;
+        int64_t seq; // -1なら空き
+    };
+    std::vector<Entry> m_table;
+    size_t m_mask;
+
+    size_t hash(int64_t key) const {
+        uint64_t x = (uint64_t)key * 0x9E3779B97F4A7C15ull;
+        return (size_t)(x ^ (x >> 32)) & m_mask;
+    }
+public:
+    RGYTimestampIndex() : m_table(), m_mask(0) {};
+    void init(size_t capacity); // capacityは2の累乗
+    void clear();
+    int64_t find(int64_t key) const;
+    void set(int64_t key, int64_t seq);
+    void erase(int64_t key, int64_t seq); // keyがseqを指している場合のみ削除
+};
+
+// pts/encodeFrameIdとフレーム情報の対応を管理する
+// 追加順に通し番号(seq)を振ってリングバッファに格納し、pts/encodeFrameIdからはそれぞれの索引でO(1)で引く
+// 不要になった古いフレームはリングの末尾から順に解放するので、掃除のコストも償却O(1)となる
 class RGYTimestamp {
 private:
-    std::unordered_map<int64_t, RGYTimestampMapVal> m_frame;
+    struct Slot {
+        RGYTimestampMapVal val;
+        int64_t seq;
+        bool valid; // 同じptsで上書きされた場合はfalse
+        Slot() : val(), seq(-1), valid(false) {};
+    };
+    static const int CLEAN_MARGIN = 64; // 直近に取得したフレームからこのフレーム数以上前のinputFrameIdのものを解放する
+    static const size_t INITIAL_RING_SIZE = 256;
+
+    std::vector<Slot> m_ring;
+    size_t m_ringMask;
+    int64_t m_head; // 次に追加するseq
+    int64_t m_tail; // 保持している最も古いseq
+    RGYTimestampIndex m_idxPts;
+    RGYTimestampIndex m_idxEncodeFrameId;
     std::mutex mtx;
-    int64_t last_add_pts;
-    int64_t last_check_pts;
+    int64_t last_add_seq;
+    int64_t last_check_seq;
     int64_t last_input_frame_id;
     int64_t offset;
-    int64_t last_clean_id;
     bool timestampPassThrough;
     bool noDurationFix; // durationの修正を行わない場合にtrue
+
+    Slot *getSlot(int64_t seq);
+    void expand();
+    int64_t push(int64_t pts, int64_t inputFrameId, int64_t encodeFrameId, int64_t duration);
+    void clean(const int64_t current_id);
 public:
-    RGYTimestamp(bool timestampPassThrough_, bool noDurationFix_) : m_frame(), mtx(), last_add_pts(-1), last_check_pts(-1), offset(0), last_clean_id(-1), timestampPassThrough(timestampPassThrough_), noDurationFix(noDurationFix_) {};
+    RGYTimestamp(bool timestampPassThrough_, bool noDurationFix_);
     ~RGYTimestamp() {};
-    void clear() {
-        std::lock_guard<std::mutex> lock(mtx);
-        m_frame.clear();
-        last_check_pts = -1;
-        offset = 0;
-    }
-    void add(int64_t pts, int64_t inputFrameId, int64_t encodeFrameId, int64_t duration, std::vector<std::shared_ptr<RGYFrameData>> metadatalist) {
-        std::lock_guard<std::mutex> lock(mtx);
-        if (last_add_pts >= 0) { // 前のフレームのdurationの更新
-            auto& last_add_pos = m_frame.find(last_add_pts)->second;
-            if (!noDurationFix) last_add_pos.duration = pts - last_add_pos.timestamp;
-            if (duration == 0) duration = last_add_pos.duration;
-        }
-        m_frame[pts] = RGYTimestampMapVal(pts, inputFrameId, encodeFrameId, duration, metadatalist);
-        last_add_pts = pts;
-    }
-    RGYTimestampMapVal check(int64_t pts) {
-        if (last_check_pts < 0 && pts > 0 && !timestampPassThrough) {
-            offset = -pts;
-        }
-        std::lock_guard<std::mutex> lock(mtx);
-        pts += offset;
-        auto pos = m_frame.find(pts);
-        if (pos == m_frame.end()) {
-            auto& last_check_pos = m_frame.find(last_check_pts)->second;
-            pts = last_check_pos.timestamp + last_check_pos.duration / 2;
-            auto next_pts = last_check_pos.timestamp + last_check_pos.duration;
-            last_check_pos.duration = pts - last_check_pos.timestamp;
-            m_frame[pts] = RGYTimestampMapVal(pts, last_input_frame_id, last_check_pos.encodeFrameId, next_pts - pts, last_check_pos.dataList);
-            pos = m_frame.find(pts);
-        }
-        last_input_frame_id = pos->second.inputFrameId;
-        last_check_pts = pos->second.timestamp;
-        return pos->second;
-    }
-    void clean(const int64_t current_id) {
-        if (current_id >= last_clean_id + 64) {
-            for (auto it = m_frame.begin(); it != m_frame.end();) {
-                if (it->second.inputFrameId < current_id - 64) {
-                    it = m_frame.erase(it);
-                } else {
-                    it++;
-                }
-            }
-            last_clean_id = current_id;
-        }
-    }
-    RGYTimestampMapVal getByEncodeFrameID(const int64_t id) {
-        std::lock_guard<std::mutex> lock(mtx);
-        auto pos = m_frame.end();
-        for (auto it = m_frame.begin(); it != m_frame.end(); it++) {
-            if (it->second.encodeFrameId == id) {
-                pos = it;
-                break;
-            }
-        }
-        if (pos == m_frame.end()) {
-            return RGYTimestampMapVal();
-        }
-        auto ret = pos->second;
-        clean(ret.inputFrameId);
-        return ret;
-    }
-    RGYTimestampMapVal get(int64_t pts) {
-        std::lock_guard<std::mutex> lock(mtx);
-        auto pos = m_frame.find(pts);
-        if (pos == m_frame.end()) {
-            return RGYTimestampMapVal();
-        }
-        auto ret = pos->second;
-        clean(ret.inputFrameId);
-        return ret;
-    }
+    void clear();
+    void add(int64_t pts, int64_t inputFrameId, int64_t encodeFrameId, int64_t duration, const std::vector<std::shared_ptr<RGYFrameData>>& metadatalist);
+    RGYTimestampMapVal check(int64_t pts);
+    RGYTimestampMapVal getByEncodeFrameID(const int64_t id);
+    RGYTimestampMapVal get(int64_t pts);
 };
 
 class RGYDurationCheck {
@@ -289,6 +305,56 @@ struct RGYOutputRawPEExtHeader {
 static_assert(std::is_trivially_copyable<RGYOutputRawPEExtHeader>::value);
 
 static const size_t RGY_PE_EXT_HEADER_DATA_NORMAL_BUF_SIZE = 32 * 1024;
+static const size_t RGY_PE_EXT_HEADER_FREE_QUEUE_SIZE = 64; // 使い終わったポインタを回収するキューのサイズ
+
+typedef RGYQueueBounded<RGYOutputRawPEExtHeader*, RGYQueueBoundedMode::SPSC> RGYQueuePEExtHeaderFree;
+
+static const size_t RGY_PE_RING_SIZE = 32 * 1024 * 1024; // cache=ringでのチャンクあたりのリングバッファのサイズ
+
+// 並列エンコードの子から親へエンコード結果を渡すリングバッファ (cache=ring用)
+// 書き込みは子(出力スレッド)、読み込みは親のみのSPSCで、RGYOutputRawPEExtHeader+データを連続して格納する
+// 親は子のエンコード中から読み込みを開始でき、リング上のデータはコピーせずにそのまま参照する
+// リングが一杯になった場合は、順序を保つため以降のデータはすべて一時ファイルに書き出し、親はリングを読み終えた後にファイルから読み込む
+class RGYOutputRawPERing {
+public:
+    RGYOutputRawPERing();
+    ~RGYOutputRawPERing();
+    RGY_ERR init(const size_t ringSize, const tstring& spillFile);
+
+    // 子側: 1フレーム分のデータを書き込む
+    RGY_ERR write(const RGYOutputRawPEExtHeader& header, const void *data);
+    // 子側: 書き込みの終了を通知する
+    void setFinished();
+
+    // 親側: 次のデータを取得する
+    // RGY_ERR_MORE_DATA: まだ書き込まれていない, RGY_ERR_MORE_BITSTREAM: すべて読み終えた
+    // 取得したデータは使い終わったらrelease()を呼ぶこと (それまでは次のデータを取得しないこと)
+    RGY_ERR read(RGYOutputRawPEExtHeader **ptr);
+    void release();
+    // 親側: データの書き込みまたは終了の通知があるか、timeoutが経過するまで待機する
+    void waitWrite(const uint32_t timeout);
+    uint64_t spilledCount() const { return m_spillCount; }
+protected:
+    std::unique_ptr<uint8_t, aligned_malloc_deleter> m_buffer;
+    size_t m_size;
+    std::atomic<uint64_t> m_writePos; // 書き込み位置 (リングのサイズで割った余りがバッファ上の位置)
+    std::atomic<uint64_t> m_readPos;  // 読み込み位置 (release済みの位置)
+    uint64_t m_readNext;              // 読み込み中のデータをreleaseした後の読み込み位置
+    std::atomic<bool> m_finished;
+    unique_event m_eventWrite;        // 書き込み/終了の通知用
+    tstring m_spillFile;
+    std::unique_ptr<FILE, fp_deleter> m_fpSpillWrite;
+    std::unique_ptr<FILE, fp_deleter> m_fpSpillRead;
+    std::atomic<uint64_t> m_spillCount; // ファイルに書き出したフレーム数
+    uint64_t m_spillRead;               // ファイルから読み込んだフレーム数
+    std::vector<uint8_t> m_spillBuf;    // ファイルから読み込んだデータ
+};
+
+// writeVecでまとめて書き出すバッファ
+struct RGYOutputIOVec {
+    const void *ptr;
+    size_t size;
+};
  
 class RGYOutput {
 public:
@@ -368,6 +434,7 @@ protected:
 
     RGY_ERR writeRawDebug(RGYBitstream *pBitstream);
     RGY_ERR readRawDebug(RGYBitstream *pBitstream);
+    RGY_ERR writeVec(const std::vector<RGYOutputIOVec>& vec); // 複数のバッファを(可能なら1回のシステムコールで)まとめて書き出す
 
     tstring     m_outFilename;
     std::shared_ptr<EncodeStatus> m_encSatusInfo;
@@ -393,7 +460,6 @@ protected:
     decltype(parse_nal_unit_hevc_c) *m_parse_nal_hevc; // HEVC用のnal unit分解関数へのポインタ
     uint32_t m_insertHeader; // ヘッダー挿入フラグ
     std::vector<uint8_t> m_storedHeaders; // 保存されたヘッダー情報 (VPS)/SPS/PPS
-    decltype(parse_nal_unit_h264_c) *m_parse_nal_h264; // H.264用のnal unit分解関数へのポインタ
 };
 
 struct RGYOutputRawPEExtHeader;
@@ -419,8 +485,9 @@ struct RGYOutputRawPrm {
     RGYTimestamp *vidTimestamp;
     uint32_t insertHeader; // ヘッダー挿入フラグ
     RGYQueueMPMP<RGYOutputRawPEExtHeader*> *qFirstProcessData;
-    RGYQueueMPMP<RGYOutputRawPEExtHeader*> *qFirstProcessDataFree;
-    RGYQueueMPMP<RGYOutputRawPEExtHeader*> *qFirstProcessDataFreeLarge;
+    RGYQueuePEExtHeaderFree *qFirstProcessDataFree;
+    RGYQueuePEExtHeaderFree *qFirstProcessDataFreeLarge;
+    RGYOutputRawPERing *peRing;
 };
 
 class RGYOutputRaw : public RGYOutput {
@@ -449,8 +516,9 @@ protected:
     bool m_debugDirectAV1Out;
     bool m_extPERaw;
     RGYQueueMPMP<RGYOutputRawPEExtHeader*> *m_qFirstProcessData;
-    RGYQueueMPMP<RGYOutputRawPEExtHeader*> *m_qFirstProcessDataFree;
-    RGYQueueMPMP<RGYOutputRawPEExtHeader*> *m_qFirstProcessDataFreeLarge;
+    RGYQueuePEExtHeaderFree *m_qFirstProcessDataFree;
+    RGYQueuePEExtHeaderFree *m_qFirstProcessDataFreeLarge;
+    RGYOutputRawPERing *m_peRing;
 };
 
 std::unique_ptr<RGYHDRMetadata> createHEVCHDRSei(const std::string &maxCll, const std::string &masterDisplay, CspTransfer atcSei, const RGYInput *reader);
@@ -501,6 +569,9 @@ protected:
     virtual RGY_ERR Init(const TCHAR *strFileName, const VideoInfo *pOutputInfo, const void *prm) override;
 
     bool m_bY4m;
+    std::vector<RGYOutputIOVec> m_iov; // 1フレーム分の出力
+    std::unique_ptr<uint8_t, aligned_malloc_deleter> m_frameBuffer; // 1フレーム分のステージングバッファ
+    size_t m_frameBufferSize;
 };
 
 #endif //__RGY_OUTPUT_H__
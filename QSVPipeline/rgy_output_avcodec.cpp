@@ -32,9 +32,12 @@
 #include <memory>
 #include <fstream>
 #include <iostream>
+#include <queue>
+#include <functional>
 #include "rgy_osdep.h"
 #include "rgy_util.h"
 #include "rgy_filesystem.h"
+#include "rgy_trace.h"
 #include "rgy_output_avcodec.h"
 #include "rgy_avlog.h"
 #include "rgy_bitstream.h"
@@ -42,6 +45,11 @@
 
 #define WRITE_PTS_DEBUG (0)
 
+#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+//audioPoolのタスクを実行中のスレッドかどうか (タスク内では後段のキューへの追加でブロックしない)
+static thread_local bool g_audioPoolTaskRunning = false;
+#endif //#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+
 static bool format_is_mp4(const AVFormatContext *formatCtx) {
     static const char *FORMAT_NAME_MP4[] = {
         "mov",
@@ -116,6 +124,7 @@ AVMuxFormat::AVMuxFormat() :
     fpOutput(nullptr),
     outputBuffer(nullptr),
     outputBufferSize(0),
+    asyncWriter(),
 #endif
     streamError(false),
     isMatroska(false),
@@ -241,6 +250,8 @@ AVMuxOther::AVMuxOther() :
 AVMuxThreadWorker::AVMuxThreadWorker() :
     thread(),
     thAbort(false),
+    taskScheduled(false),
+    pooled(false),
     sentEOS(false),
     heEventPktAdded(nullptr),
     heEventClosing(nullptr),
@@ -296,11 +307,11 @@ void AVMuxThreadAudio::closeProcess() {
 }
 
 bool AVMuxThreadAudio::threadActiveEncode() {
-    return encode.thread.joinable();
+    return encode.pooled;
 }
 
 bool AVMuxThreadAudio::threadActiveProcess() {
-    return process.thread.joinable();
+    return process.pooled;
 }
 
 #if ENABLE_AVCODEC_OUT_THREAD
@@ -310,11 +321,12 @@ AVMuxThread::AVMuxThread() :
     enableAudEncodeThread(false),
     thOutput(),
     thRawVideo(),
-    qVideobitstreamFreeI(),
-    qVideobitstreamFreePB(),
     qVideobitstream(),
     thAud(),
+    audioPool(),
     streamOutMaxDts(0),
+    outputWaitFor(MUX_WAIT_NONE),
+    outputWaitStream(-1),
     queueInfo(nullptr) {
 }
 #endif
@@ -452,7 +464,7 @@ void RGYOutputAvcodec::CloseFormat(AVMuxFormat *muxFormat) {
             av_write_trailer(muxFormat->formatCtx);
         }
 #if USE_CUSTOM_IO
-        if (!muxFormat->fpOutput) {
+        if (!muxFormat->fpOutput && !muxFormat->asyncWriter) {
 #endif
             avio_close(muxFormat->formatCtx->pb);
             AddMessage(RGY_LOG_DEBUG, _T("Closed AVIO Context.\n"));
@@ -471,6 +483,16 @@ void RGYOutputAvcodec::CloseFormat(AVMuxFormat *muxFormat) {
         muxFormat->fpOutput = nullptr;
         AddMessage(RGY_LOG_DEBUG, _T("Closed File Pointer.\n"));
     }
+    if (muxFormat->asyncWriter) {
+        const auto err = muxFormat->asyncWriter->close();
+        if (err != RGY_ERR_NONE && !muxFormat->streamError) {
+            AddMessage(RGY_LOG_ERROR, _T("Error writing file: %s.\n"), _tcserror(muxFormat->asyncWriter->errorNo()));
+        }
+        //書き込みスレッドの処理待ちで出力が止まった時間 (ストレージが律速になっているかの目安)
+        AddMessage(RGY_LOG_INFO, _T("%s\n"), muxFormat->asyncWriter->statsStr().c_str());
+        muxFormat->asyncWriter.reset();
+        AddMessage(RGY_LOG_DEBUG, _T("Closed async writer.\n"));
+    }
 
     if (muxFormat->AVOutBuffer) {
         av_free(muxFormat->AVOutBuffer);
@@ -487,9 +509,7 @@ void RGYOutputAvcodec::CloseFormat(AVMuxFormat *muxFormat) {
 
 void RGYOutputAvcodec::CloseQueues() {
 #if ENABLE_AVCODEC_OUT_THREAD
-    m_Mux.thread.qVideobitstream.close();
-    m_Mux.thread.qVideobitstreamFreeI.close([](RGYBitstream *pBitstream) { pBitstream->clear(); });
-    m_Mux.thread.qVideobitstreamFreePB.close([](RGYBitstream *pBitstream) { pBitstream->clear(); });
+    m_Mux.thread.qVideobitstream.close([](RGYBitstream *pBitstream) { pBitstream->clear(); });
     AddMessage(RGY_LOG_DEBUG, _T("closed queues...\n"));
 #endif
 }
@@ -498,19 +518,23 @@ void RGYOutputAvcodec::CloseThread() {
 #if ENABLE_AVCODEC_OUT_THREAD
     // process -> encode -> output の順に終了させる
     for (auto& [mux, thread] : m_Mux.thread.thAud) {
-        if (thread->process.thread.joinable()) {
-            thread->closeProcess();
+        if (thread->threadActiveProcess()) {
+            CloseAudioTask(&thread->process, AUD_QUEUE_PROCESS);
             const auto target = (mux) ? strsprintf(_T("%d.%d"), trackID(mux->inTrackId), mux->inSubStream) : tstring(_T("default"));
-            AddMessage(RGY_LOG_DEBUG, _T("closed audio process thread %s.\n"), target.c_str());
+            AddMessage(RGY_LOG_DEBUG, _T("closed audio process task %s.\n"), target.c_str());
         }
     }
     for (auto& [mux, thread] : m_Mux.thread.thAud) {
-        if (thread->encode.thread.joinable()) {
-            thread->closeEncode();
+        if (thread->threadActiveEncode()) {
+            CloseAudioTask(&thread->encode, AUD_QUEUE_ENCODE);
             const auto target = (mux) ? strsprintf(_T("%d.%d"), trackID(mux->inTrackId), mux->inSubStream) : tstring(_T("default"));
-            AddMessage(RGY_LOG_DEBUG, _T("closed audio encode thread %s.\n"), target.c_str());
+            AddMessage(RGY_LOG_DEBUG, _T("closed audio encode task %s.\n"), target.c_str());
         }
     }
+    if (m_Mux.thread.audioPool) {
+        m_Mux.thread.audioPool.reset();
+        AddMessage(RGY_LOG_DEBUG, _T("closed audio thread pool.\n"));
+    }
     if (m_Mux.thread.thRawVideo) {
         m_Mux.thread.thRawVideo->close();
         AddMessage(RGY_LOG_DEBUG, _T("closed raw video thread...\n"));
@@ -2360,16 +2384,37 @@ RGY_ERR RGYOutputAvcodec::Init(const TCHAR *strFileName, const VideoInfo *videoO
         AddMessage(RGY_LOG_DEBUG, _T("allocated internal buffer %d MB.\n"), m_Mux.format.AVOutBufferSize / (1024 * 1024));
         CreateDirectoryRecursive(PathRemoveFileSpecFixed(strFileName).second.c_str());
 
-        //"movflags:faststart"にするには、共有モードで開けるようにする必要がある
-        m_Mux.format.fpOutput = _tfsopen(strFileName, _T("wb"), _SH_DENYWR);
-        if (m_Mux.format.fpOutput == NULL) {
-            errno_t error = errno;
-            AddMessage(RGY_LOG_ERROR, _T("failed to open %soutput file \"%s\": %s.\n"), (videoOutputInfo) ? _T("") : _T("audio "), strFileName, _tcserror(error));
-            return RGY_ERR_FILE_OPEN; // Couldn't open file
-        }
-        if (0 < (m_Mux.format.outputBufferSize = (uint32_t)malloc_degeneracy((void **)&m_Mux.format.outputBuffer, m_Mux.format.outputBufferSize, 1024 * 1024))) {
-            setvbuf(m_Mux.format.fpOutput, m_Mux.format.outputBuffer, _IOFBF, m_Mux.format.outputBufferSize);
-            AddMessage(RGY_LOG_DEBUG, _T("set external output buffer %d MB.\n"), m_Mux.format.outputBufferSize / (1024 * 1024));
+        if (prm->asyncWrite.enable) {
+            //出力ファイルへの書き込みは専用のスレッドで行い、mux処理を止めないようにする
+            const size_t asyncBufSize = (std::max)(m_Mux.format.outputBufferSize, (uint32_t)(1024 * 1024));
+            m_Mux.format.outputBufferSize = 0;
+#if defined(_WIN32) || defined(_WIN64)
+            if (prm->asyncWrite.directIO || prm->asyncWrite.preallocMB > 0) {
+                AddMessage(RGY_LOG_WARN, _T("direct/prealloc of --output-async is supported only on Linux, ignored.\n"));
+            }
+#endif //#if defined(_WIN32) || defined(_WIN64)
+            m_Mux.format.asyncWriter = std::make_unique<RGYAsyncFileWriter>();
+            if (m_Mux.format.asyncWriter->open(strFileName, asyncBufSize, prm->asyncWrite.directIO, (int64_t)prm->asyncWrite.preallocMB * 1024 * 1024) != RGY_ERR_NONE) {
+                AddMessage(RGY_LOG_ERROR, _T("failed to open %soutput file \"%s\": %s.\n"), (videoOutputInfo) ? _T("") : _T("audio "), strFileName, _tcserror(m_Mux.format.asyncWriter->errorNo()));
+                return RGY_ERR_FILE_OPEN; // Couldn't open file
+            }
+            if (prm->asyncWrite.directIO && !m_Mux.format.asyncWriter->directIOEnabled()) {
+                AddMessage(RGY_LOG_WARN, _T("failed to open output file with O_DIRECT, using buffered write.\n"));
+            }
+            AddMessage(RGY_LOG_DEBUG, _T("opened async writer: 2x %d MB buffer%s.\n"),
+                (int)(m_Mux.format.asyncWriter->bufSize() / (1024 * 1024)), m_Mux.format.asyncWriter->directIOEnabled() ? _T(", O_DIRECT") : _T(""));
+        } else {
+            //"movflags:faststart"にするには、共有モードで開けるようにする必要がある
+            m_Mux.format.fpOutput = _tfsopen(strFileName, _T("wb"), _SH_DENYWR);
+            if (m_Mux.format.fpOutput == NULL) {
+                errno_t error = errno;
+                AddMessage(RGY_LOG_ERROR, _T("failed to open %soutput file \"%s\": %s.\n"), (videoOutputInfo) ? _T("") : _T("audio "), strFileName, _tcserror(error));
+                return RGY_ERR_FILE_OPEN; // Couldn't open file
+            }
+            if (0 < (m_Mux.format.outputBufferSize = (uint32_t)malloc_degeneracy((void **)&m_Mux.format.outputBuffer, m_Mux.format.outputBufferSize, 1024 * 1024))) {
+                setvbuf(m_Mux.format.fpOutput, m_Mux.format.outputBuffer, _IOFBF, m_Mux.format.outputBufferSize);
+                AddMessage(RGY_LOG_DEBUG, _T("set external output buffer %d MB.\n"), m_Mux.format.outputBufferSize / (1024 * 1024));
+            }
         }
         if (NULL == (m_Mux.format.formatCtx->pb = avio_alloc_context(m_Mux.format.AVOutBuffer, m_Mux.format.AVOutBufferSize, 1, this, funcReadPacket, (RGYArgN<5U, decltype(avio_alloc_context)>::type)funcWritePacket, funcSeek))) {
             AddMessage(RGY_LOG_ERROR, _T("failed to alloc avio context.\n"));
@@ -2517,8 +2562,6 @@ RGY_ERR RGYOutputAvcodec::Init(const TCHAR *strFileName, const VideoInfo *videoO
         AddMessage(RGY_LOG_DEBUG, _T("starting output thread...\n"));
         const int audioQueueCapacity = 4096;
         m_Mux.thread.qVideobitstream.init(4096, (std::max)(256, (m_Mux.video.outputFps.den) ? m_Mux.video.outputFps.num * 4 / m_Mux.video.outputFps.den : 0));
-        m_Mux.thread.qVideobitstreamFreeI.init(256);
-        m_Mux.thread.qVideobitstreamFreePB.init(3840);
         m_Mux.thread.thOutput = std::make_unique<AVMuxThreadWorker>();
         m_Mux.thread.thOutput->thAbort = false;
         m_Mux.thread.thOutput->qPackets.init(16384, audioQueueCapacity * std::max(1, (int)m_Mux.audio.size())); //字幕のみコピーするときのため、最低でもある程度は確保する
@@ -2545,24 +2588,29 @@ RGY_ERR RGYOutputAvcodec::Init(const TCHAR *strFileName, const VideoInfo *videoO
                 }
             }
             const auto audioQueueMultiplizer = (prm->threadAudio > 2) ? 2 : std::max(2, (int)m_Mux.audio.size());
+            //音声処理は各トラックのキューごとにタスクとして共有のスレッドプールで実行する
+            //以前はキューごとに専用スレッドを起動していたので、その数を上限としつつ、threadAudioMaxで制限する
+            const int audioWorkers = (int)muxAudioPtr.size() * ((m_Mux.thread.enableAudEncodeThread) ? 2 : 1);
+            int audioPoolThreads = std::min(audioWorkers, std::max(1, (int)std::thread::hardware_concurrency()));
+            if (prm->threadAudioMax > 0) {
+                audioPoolThreads = std::min(audioPoolThreads, prm->threadAudioMax);
+            }
+            m_Mux.thread.audioPool = std::make_unique<RGYThreadPool>(audioPoolThreads, prm->threadParamAudio, false);
+            AddMessage(RGY_LOG_DEBUG, _T("started audio thread pool: %d threads for %d queues, param %s.\n"), audioPoolThreads, audioWorkers, prm->threadParamAudio.desc().c_str());
             for (auto mux : muxAudioPtr) {
                 const auto target = (mux) ? strsprintf(_T("%d.%d"), trackID(mux->inTrackId), mux->inSubStream) : tstring(_T("default"));
-                AddMessage(RGY_LOG_DEBUG, _T("starting audio process thread %s...\n"), target.c_str());
+                AddMessage(RGY_LOG_DEBUG, _T("starting audio process task %s...\n"), target.c_str());
                 m_Mux.thread.thAud[mux] = std::make_unique<AVMuxThreadAudio>();
                 m_Mux.thread.thAud[mux]->process.thAbort = false;
-                m_Mux.thread.thAud[mux]->process.qPackets.init(16384, audioQueueCapacity * audioQueueMultiplizer, 4);
-                m_Mux.thread.thAud[mux]->process.heEventPktAdded = CreateEvent(NULL, TRUE, FALSE, NULL);
+                m_Mux.thread.thAud[mux]->process.pooled = true;
+                m_Mux.thread.thAud[mux]->process.qPackets.init(16384, audioQueueCapacity * audioQueueMultiplizer);
                 m_Mux.thread.thAud[mux]->process.heEventClosing = CreateEvent(NULL, TRUE, FALSE, NULL);
-                m_Mux.thread.thAud[mux]->process.thread = std::thread(&RGYOutputAvcodec::ThreadFuncAudThread, this, mux, prm->threadParamAudio);
-                AddMessage(RGY_LOG_DEBUG, _T("Set audio process thread param %s: %s.\n"), target.c_str(), prm->threadParamAudio.desc().c_str());
                 if (m_Mux.thread.enableAudEncodeThread) {
-                    AddMessage(RGY_LOG_DEBUG, _T("starting audio encode thread %s...\n"), target.c_str());
+                    AddMessage(RGY_LOG_DEBUG, _T("starting audio encode task %s...\n"), target.c_str());
                     m_Mux.thread.thAud[mux]->encode.thAbort = false;
-                    m_Mux.thread.thAud[mux]->encode.qPackets.init(16384, audioQueueCapacity * audioQueueMultiplizer, 4);
-                    m_Mux.thread.thAud[mux]->encode.heEventPktAdded = CreateEvent(NULL, TRUE, FALSE, NULL);
+                    m_Mux.thread.thAud[mux]->encode.pooled = true;
+                    m_Mux.thread.thAud[mux]->encode.qPackets.init(16384, audioQueueCapacity * audioQueueMultiplizer);
                     m_Mux.thread.thAud[mux]->encode.heEventClosing = CreateEvent(NULL, TRUE, FALSE, NULL);
-                    m_Mux.thread.thAud[mux]->encode.thread = std::thread(&RGYOutputAvcodec::ThreadFuncAudEncodeThread, this, mux, prm->threadParamAudio);
-                    AddMessage(RGY_LOG_DEBUG, _T("Set audio encode thread param %s: %s.\n"), target.c_str(), prm->threadParamAudio.desc().c_str());
                 }
             }
         }
@@ -2575,6 +2623,7 @@ RGY_ERR RGYOutputAvcodec::Init(const TCHAR *strFileName, const VideoInfo *videoO
             return sts;
         }
         m_Mux.format.fileHeaderWritten = true;
+        StartAudioTasks();
     }
     m_inited = true;
     return RGY_ERR_NONE;
@@ -2904,6 +2953,11 @@ tstring RGYOutputAvcodec::GetWriterMes() {
     //if (m_Mux.format.outputBufferSize) {
     //    output += strsprintf(" (%dMB buf)", m_Mux.format.outputBufferSize / (1024 * 1024));
     //}
+#if USE_CUSTOM_IO
+    if (m_Mux.format.asyncWriter) {
+        output += (m_Mux.format.asyncWriter->directIOEnabled()) ? " (async, direct)" : " (async)";
+    }
+#endif //#if USE_CUSTOM_IO
     add_mes(output);
     return char_to_tstring(mes.c_str());
 }
@@ -2931,19 +2985,11 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrame(RGYBitstream *bitstream) {
 #if ENABLE_AVCODEC_OUT_THREAD
     if (m_Mux.thread.thOutput) {
         RGYBitstream copyStream = RGYBitstreamInit();
-        bool bFrameI = (bitstream->frametype() & RGY_FRAMETYPE_I) != 0;
-        bool bFrameP = (bitstream->frametype() & RGY_FRAMETYPE_P) != 0;
-        //IフレームかPBフレームかでサイズが大きく違うため、空きのmfxBistreamは異なるキューで管理する
-        auto& qVideoQueueFree = (bFrameI) ? m_Mux.thread.qVideobitstreamFreeI : m_Mux.thread.qVideobitstreamFreePB;
-        //空いているmfxBistreamを取り出す
-        if (!qVideoQueueFree.front_copy_and_pop_no_lock(&copyStream) || copyStream.bufsize() < bitstream->size()) {
-            //空いているmfxBistreamがない、あるいはそのバッファサイズが小さい場合は、領域を取り直す
-            const auto allocate_bytes = bitstream->size() * ((bFrameI | bFrameP) ? 2 : 8);
-            if (RGY_ERR_NONE != copyStream.init(allocate_bytes)) {
-                AddMessage(RGY_LOG_ERROR, _T("Failed to allocate memory for video bitstream output buffer, %sB.\n"), allocate_bytes);
-                m_Mux.format.streamError = true;
-                return RGY_ERR_MEMORY_ALLOC;
-            }
+        //データ領域はRGYBitstreamBufferPoolから取得し、WriteNextFrameFinishで返却する
+        if (RGY_ERR_NONE != copyStream.init(bitstream->size())) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to allocate memory for video bitstream output buffer, %lldB.\n"), (long long)bitstream->size());
+            m_Mux.format.streamError = true;
+            return RGY_ERR_MEMORY_ALLOC;
         }
         //必要な情報をコピー
         copyStream.setDataflag(bitstream->dataflag());
@@ -2962,7 +3008,7 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrame(RGYBitstream *bitstream) {
         }
         bitstream->setSize(0);
         bitstream->setOffset(0);
-        SetEvent(m_Mux.thread.thOutput->heEventPktAdded);
+        NotifyOutputThread(MUX_WAIT_VIDEO);
         return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
     }
 #endif
@@ -3004,20 +3050,12 @@ RGY_ERR RGYOutputAvcodec::VidCheckStreamAVParser(RGYBitstream *pBitstream) {
     return err;
 }
 
-RGY_ERR RGYOutputAvcodec::WriteNextFrameFinish(RGYBitstream *bitstream, const RGY_FRAMETYPE frameType) {
+RGY_ERR RGYOutputAvcodec::WriteNextFrameFinish(RGYBitstream *bitstream) {
 #if ENABLE_AVCODEC_OUT_THREAD
     //最初のヘッダーを書いたパケットはコピーではないので、キューに入れない
     if (m_Mux.thread.thOutput) {
-        //確保したメモリ領域を使いまわすためにキューに格納
-        const auto frameI = (frameType & (RGY_FRAMETYPE_IDR | RGY_FRAMETYPE_I)) != 0;
-        auto& qVideoQueueFree = (frameI) ? m_Mux.thread.qVideobitstreamFreeI : m_Mux.thread.qVideobitstreamFreePB;
-        auto queueFavoredSize = (frameI) ? VID_BITSTREAM_QUEUE_SIZE_I : VID_BITSTREAM_QUEUE_SIZE_PB;
-        if ((int64_t)qVideoQueueFree.size() > queueFavoredSize) {
-            //あまり多すぎると無駄にメモリを使用するので減らす
-            bitstream->clear();
-        } else {
-            qVideoQueueFree.push(*bitstream);
-        }
+        //確保したメモリ領域はRGYBitstreamBufferPoolに返却して使いまわす
+        bitstream->clear();
     } else {
 #endif
         bitstream->setSize(0);
@@ -3025,7 +3063,10 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrameFinish(RGYBitstream *bitstream, const RG
 #if ENABLE_AVCODEC_OUT_THREAD
     }
 #endif
-    m_Mux.format.fileHeaderWritten = true;
+    if (!m_Mux.format.fileHeaderWritten) {
+        m_Mux.format.fileHeaderWritten = true;
+        StartAudioTasks();
+    }
     return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
 }
 
@@ -3052,10 +3093,14 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrameInternalOneFrame(RGYBitstream *bitstream
     bool isKey = (bitstream->frametype() & (RGY_FRAMETYPE_IDR | RGY_FRAMETYPE_xIDR | RGY_FRAMETYPE_I | RGY_FRAMETYPE_xI)) != 0; //Keyフレームかどうかのフラグ
     if (m_Mux.video.streamOut->codecpar->field_order != AV_FIELD_PROGRESSIVE) {
         if (m_VideoOutputInfo.codec == RGY_CODEC_H264) {
-            const auto nal_list = m_Mux.video.parse_nal_h264(bitstream->data(), bitstream->size());
             //インタレ保持の際、IDRかどうかのフラグが正しく設定されていないことがある
             //どちらかのフィールドがIDRならIDRのフラグを立てる
-            isIDR = std::find_if(nal_list.begin(), nal_list.end(), [](nal_info info) { return info.type == NALU_H264_IDR; }) != nal_list.end();
+            isIDR = false;
+            RGYNalUnitReader reader(RGY_CODEC_H264, bitstream->data(), bitstream->size());
+            nal_info nal;
+            while (!isIDR && reader.next(nal)) {
+                isIDR = nal.type == NALU_H264_IDR;
+            }
             isKey |= isIDR;
         } else if (m_VideoOutputInfo.codec == RGY_CODEC_HEVC) {
             AddMessage(RGY_LOG_ERROR, _T("Interlaced HEVC encoding not supported!\n"));
@@ -3226,7 +3271,7 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrameInternal(RGYBitstream *bitstream, int64_
         if (err != RGY_ERR_NONE) {
             return err;
         }
-        return WriteNextFrameFinish(bitstream, bitstream->frametype());
+        return WriteNextFrameFinish(bitstream);
     }
 
     // AV1の場合、SDKの返すtimestampは滅茶苦茶
@@ -3299,7 +3344,7 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrameInternal(RGYBitstream *bitstream, int64_
             break;
         }
     }
-    return WriteNextFrameFinish(bitstream, bitstream->frametype());
+    return WriteNextFrameFinish(bitstream);
 }
 #pragma warning (pop)
 
@@ -3312,6 +3357,7 @@ RGY_ERR RGYOutputAvcodec::WriteNextFrame(RGYFrame *surface) {
         m_Mux.video.fpsBaseNextDts = 0;
         m_Mux.video.timestampList.clear();
         m_Mux.format.fileHeaderWritten = true;
+        StartAudioTasks();
     }
 
     if (surface == nullptr) { // flush
@@ -3422,6 +3468,7 @@ RGY_ERR RGYOutputAvcodec::VideoEncodeRawFrame(AVFrame *avframe) {
                 if (m_Mux.thread.thOutput) {
                     auto pktFrame = pktMuxData(pkt.release());
                     m_Mux.thread.qVideoRawFrames.push(pktFrame);
+                    NotifyOutputThread(MUX_WAIT_VIDEO);
                 } else {
                     auto writeResult = WriteNextPacketRawVideo(pkt.release(), nullptr);
                     if (writeResult != RGY_ERR_NONE) {
@@ -4156,6 +4203,36 @@ AVMuxThreadWorker *RGYOutputAvcodec::getPacketWorker(const AVMuxAudio *muxAudio,
     return (type == AUD_QUEUE_PROCESS) ? &worker->second->process : &worker->second->encode;
 }
 
+void RGYOutputAvcodec::NotifyOutputThread(int queueType, const AVMuxAudio *muxAudio) {
+#if ENABLE_AVCODEC_OUT_THREAD
+    //出力スレッドは、dtsの最も遅れているストリームのキュー(あるいは映像キュー)のみを待機している
+    //それ以外のキューへの追加では出力できるものがないので、起床させない
+    //ただし、キューが半分以上埋まった場合は、キューの拡大や同期の打ち切りの判定が必要なので起床させる
+    const int waitFor = m_Mux.thread.outputWaitFor.load();
+    if (waitFor == MUX_WAIT_NONE) {
+        return;
+    }
+    bool wake = (waitFor == MUX_WAIT_ANY || waitFor == queueType);
+    if (wake && queueType == MUX_WAIT_AUDIO && muxAudio) {
+        const int waitStream = m_Mux.thread.outputWaitStream.load();
+        wake = (waitStream < 0 || &m_Mux.audio[waitStream] == muxAudio);
+    }
+    if (!wake) {
+        if (queueType == MUX_WAIT_AUDIO) {
+            const auto& qAudio = m_Mux.thread.thOutput->qPackets;
+            wake = qAudio.size() * 2 >= qAudio.capacity();
+        } else if (m_Mux.video.rawVideoCodecCtx) {
+            wake = m_Mux.thread.qVideoRawFrames.size() * 2 >= m_Mux.thread.qVideoRawFrames.capacity();
+        } else {
+            wake = m_Mux.thread.qVideobitstream.size() * 2 >= m_Mux.thread.qVideobitstream.capacity();
+        }
+    }
+    if (wake) {
+        SetEvent(m_Mux.thread.thOutput->heEventPktAdded);
+    }
+#endif
+}
+
 RGY_ERR RGYOutputAvcodec::WriteNextPacket(AVPacket *pkt) {
     AVPktMuxData pktData = pktMuxData(pkt);
 #if ENABLE_AVCODEC_OUT_THREAD
@@ -4179,17 +4256,26 @@ RGY_ERR RGYOutputAvcodec::WriteNextPacket(AVPacket *pkt) {
                         AddMessage(RGY_LOG_ERROR, _T("Failed to allocate memory for audio packet queue.\n"));
                         m_Mux.format.streamError = true;
                     }
+                    if (m_Mux.thread.threadActiveAudioProcess()) {
+                        ScheduleAudioTask(worker, AUD_QUEUE_PROCESS);
+                    }
                 }
             }
+            if (!m_Mux.thread.threadActiveAudioProcess()) {
+                NotifyOutputThread(MUX_WAIT_AUDIO);
+            }
         } else {
             AVMuxThreadWorker *worker = (m_Mux.thread.threadActiveAudioProcess()) ? getPacketWorker(pktData.muxAudio, AUD_QUEUE_PROCESS) : m_Mux.thread.thOutput.get();
             auto& audioQueue = worker->qPackets;
-            auto heEventPktAdd = worker->heEventPktAdded;
             if (!audioQueue.push(pktData)) {
                 AddMessage(RGY_LOG_ERROR, _T("Failed to allocate memory for audio packet queue.\n"));
                 m_Mux.format.streamError = true;
             }
-            SetEvent(heEventPktAdd);
+            if (worker == m_Mux.thread.thOutput.get()) {
+                NotifyOutputThread(MUX_WAIT_AUDIO, pktData.muxAudio);
+            } else {
+                ScheduleAudioTask(worker, AUD_QUEUE_PROCESS);
+            }
         }
         return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
     }
@@ -4217,12 +4303,31 @@ RGY_ERR RGYOutputAvcodec::AddAudQueue(AVPktMuxData *pktData, int type) {
 
         //出力キューに追加する
         auto& qAudio       = worker->qPackets;
-        auto& heEventAdded = worker->heEventPktAdded;
-        if (!qAudio.push(*pktData)) {
+        bool pushed = false;
+        if (g_audioPoolTaskRunning) {
+            //audioPoolのタスク内ではブロックしない
+            //後段のキューを処理するタスクも同じプールで実行されるため、
+            //プールのスレッドがすべて待機するとデッドロックしてしまう
+            //キューが一杯の場合は、上限を引き上げて追加する
+            pushed = qAudio.try_push(*pktData);
+            for (int i = 0; !pushed && i < 4; i++) {
+                const auto capacity = qAudio.capacity();
+                qAudio.set_capacity(capacity * 2);
+                AddMessage(RGY_LOG_DEBUG, _T("audio queue %d is full in audio task, expanded capacity %d -> %d.\n"), type, (int)capacity, (int)(capacity * 2));
+                pushed = qAudio.try_push(*pktData);
+            }
+        } else {
+            pushed = qAudio.push(*pktData);
+        }
+        if (!pushed) {
             AddMessage(RGY_LOG_ERROR, _T("Failed to allocate memory for audio queue.\n"));
             m_Mux.format.streamError = true;
         }
-        SetEvent(heEventAdded);
+        if (type == AUD_QUEUE_OUT) {
+            NotifyOutputThread(MUX_WAIT_AUDIO, pktData->muxAudio);
+        } else {
+            ScheduleAudioTask(worker, type);
+        }
         return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
     } else
 #endif //#if ENABLE_AVCODEC_AUDPROCESS_THREAD
@@ -4561,78 +4666,98 @@ RGY_ERR RGYOutputAvcodec::WriteNextAudioFrame(AVPktMuxData *pktData) {
     return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
 }
 
-RGY_ERR RGYOutputAvcodec::ThreadFuncAudEncodeThread(const AVMuxAudio *const muxAudio, RGYParamThread threadParam) {
+void RGYOutputAvcodec::ScheduleAudioTask(AVMuxThreadWorker *worker, const int type) {
 #if ENABLE_AVCODEC_AUDPROCESS_THREAD
-    threadParam.apply(GetCurrentThread());
-    auto worker = getPacketWorker(muxAudio, AUD_QUEUE_ENCODE);
-    WaitForSingleObject(worker->heEventPktAdded, INFINITE);
-    while (!worker->thAbort) {
-        if (!m_Mux.format.fileHeaderWritten) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        } else {
-            AVPktMuxData pktData = { 0 };
-            while (worker->qPackets.front_copy_and_pop_no_lock(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_aud_enc : nullptr)) {
+    //ヘッダ書き込み前はキューにためておき、StartAudioTasks()で処理を開始する
+    if (!m_Mux.format.fileHeaderWritten && !worker->thAbort) {
+        return;
+    }
+    //すでにタスクが投入済みなら、そのタスクが追加したパケットも処理する
+    if (worker->taskScheduled.exchange(true)) {
+        return;
+    }
+    m_Mux.thread.audioPool->submit([this, worker, type]() { RunAudioTask(worker, type); });
+#endif //#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+}
+
+void RGYOutputAvcodec::RunAudioTask(AVMuxThreadWorker *worker, const int type) {
+#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+    const bool encode = (type == AUD_QUEUE_ENCODE);
+    const char *traceName = (encode) ? "audio encode" : "audio process";
+    size_t *queueUsage = (m_Mux.thread.queueInfo) ? ((encode) ? &m_Mux.thread.queueInfo->usage_aud_enc : &m_Mux.thread.queueInfo->usage_aud_proc) : nullptr;
+    g_audioPoolTaskRunning = true;
+    //1回のタスクで処理するパケット数を制限し、ほかのキューのタスクにもスレッドを回す
+    int packetsLeft = AUDIO_TASK_MAX_PACKETS;
+    for (;;) {
+        AVPktMuxData pktData = { 0 };
+        while (packetsLeft > 0 && worker->qPackets.try_pop(&pktData, queueUsage)) {
+            packetsLeft--;
+            RGYTraceScope trace(traceName);
+            if (encode) {
                 //音声エンコードを実行、出力キューに追加する
                 WriteNextAudioFrame(&pktData);
+            } else {
+                //音声処理を実行、エンコードキュー/出力キューに追加する
+                WriteNextPacketInternal(&pktData, INT64_MAX);
             }
+            trace.setQueue((int)worker->qPackets.size());
         }
-        if (m_Mux.format.lowlatency) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        } else {
-            ResetEvent(worker->heEventPktAdded);
-            WaitForSingleObject(worker->heEventPktAdded, 16);
+        if (packetsLeft <= 0 && worker->qPackets.size() > 0) {
+            //taskScheduledはtrueのまま、残りは新たなタスクとしてプールの後ろに回す
+            g_audioPoolTaskRunning = false;
+            m_Mux.thread.audioPool->submit([this, worker, type]() { RunAudioTask(worker, type); });
+            return;
         }
-    }
-    {   //音声をすべてエンコード
-        AVPktMuxData pktData = { 0 };
-        while (worker->qPackets.front_copy_and_pop_no_lock(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_aud_enc : nullptr)) {
-            WriteNextAudioFrame(&pktData);
+        worker->taskScheduled = false;
+        //taskScheduledを戻す直前に追加されたパケットは、追加側がタスクを投入しないので、ここで再確認する
+        if (worker->qPackets.size() == 0 || worker->taskScheduled.exchange(true)) {
+            break;
         }
+        packetsLeft = AUDIO_TASK_MAX_PACKETS;
+    }
+    g_audioPoolTaskRunning = false;
+    if (worker->thAbort) {
+        SetEvent(worker->heEventClosing);
     }
-    SetEvent(worker->heEventClosing);
 #endif //#if ENABLE_AVCODEC_AUDPROCESS_THREAD
-    return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
 }
 
-RGY_ERR RGYOutputAvcodec::ThreadFuncAudThread(const AVMuxAudio *const muxAudio, RGYParamThread threadParam) {
+void RGYOutputAvcodec::StartAudioTasks() {
 #if ENABLE_AVCODEC_AUDPROCESS_THREAD
-    threadParam.apply(GetCurrentThread());
-    auto worker = getPacketWorker(muxAudio, AUD_QUEUE_PROCESS);
-    WaitForSingleObject(worker->heEventPktAdded, INFINITE);
-    while (!worker->thAbort) {
-        if (!m_Mux.format.fileHeaderWritten) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        } else {
-            AVPktMuxData pktData = { 0 };
-            while (worker->qPackets.front_copy_and_pop_no_lock(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_aud_proc : nullptr)) {
-                //音声処理を実行、出力キューに追加する
-                WriteNextPacketInternal(&pktData, INT64_MAX);
-            }
-        }
-        if (m_Mux.format.lowlatency) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        } else {
-            ResetEvent(worker->heEventPktAdded);
-            WaitForSingleObject(worker->heEventPktAdded, 16);
+    for (auto& [mux, thread] : m_Mux.thread.thAud) {
+        if (thread->threadActiveProcess()) {
+            ScheduleAudioTask(&thread->process, AUD_QUEUE_PROCESS);
         }
-    }
-    {   //音声をすべて書き出す
-        AVPktMuxData pktData = { 0 };
-        while (worker->qPackets.front_copy_and_pop_no_lock(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_aud_proc : nullptr)) {
-            //音声処理を実行、出力キューに追加する
-            WriteNextPacketInternal(&pktData, INT64_MAX);
+        if (thread->threadActiveEncode()) {
+            ScheduleAudioTask(&thread->encode, AUD_QUEUE_ENCODE);
         }
     }
-    SetEvent(worker->heEventClosing);
 #endif //#if ENABLE_AVCODEC_AUDPROCESS_THREAD
-    return (m_Mux.format.streamError) ? RGY_ERR_UNKNOWN : RGY_ERR_NONE;
+}
+
+void RGYOutputAvcodec::CloseAudioTask(AVMuxThreadWorker *worker, const int type) {
+#if ENABLE_AVCODEC_AUDPROCESS_THREAD
+    worker->thAbort = true;
+    //キューが空になり、実行中のタスクが終了するまで待機する
+    while (worker->taskScheduled || worker->qPackets.size() > 0) {
+        ResetEvent(worker->heEventClosing);
+        ScheduleAudioTask(worker, type);
+        WaitForSingleObject(worker->heEventClosing, 16);
+    }
+    worker->pooled = false;
+    if (worker->heEventClosing) {
+        CloseEvent(worker->heEventClosing);
+        worker->heEventClosing = nullptr;
+    }
+    worker->qPackets.close();
+#endif //#if ENABLE_AVCODEC_AUDPROCESS_THREAD
 }
 
 RGY_ERR RGYOutputAvcodec::WriteThreadFuncRawVideo(RGYParamThread threadParam) {
     threadParam.apply(GetCurrentThread());
     while (!m_Mux.thread.thRawVideo->thAbort) {
         AVPktMuxData pktData = { 0 };
-        while (m_Mux.thread.thRawVideo->qPackets.front_copy_and_pop_no_lock(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_vid_out : nullptr)) {
+        while (m_Mux.thread.thRawVideo->qPackets.try_pop(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_vid_out : nullptr)) {
             VideoEncodeRawFrame(pktData.frame);
         }
     }
@@ -4643,6 +4768,7 @@ RGY_ERR RGYOutputAvcodec::WriteThreadFuncRawVideo(RGYParamThread threadParam) {
 RGY_ERR RGYOutputAvcodec::WriteThreadFunc(RGYParamThread threadParam) {
 #if ENABLE_AVCODEC_OUT_THREAD
     threadParam.apply(GetCurrentThread());
+    RGYTrace::setThreadName("mux");
     //映像と音声の同期をとる際に、それをあきらめるまでの閾値
     const int nWaitThreshold = 32;
     //キューにデータが存在するか
@@ -4655,7 +4781,6 @@ RGY_ERR RGYOutputAvcodec::WriteThreadFunc(RGYParamThread threadParam) {
     //syncIgnoreDtsは映像と音声の同期を行う必要がないことを意味する
     //dtsThresholdを加算したときにオーバーフローしないよう、dtsThresholdを引いておく
     const int64_t syncIgnoreDts = INT64_MAX - dtsThreshold;
-    int64_t audioDts = (m_Mux.audio.size() + m_Mux.other.size()) ? 0 : syncIgnoreDts;
     int64_t videoDts = (m_Mux.video.streamOut) ? 0 : syncIgnoreDts;
     auto writeProcessedPacket = [this](AVPktMuxData *pktData) {
         //音声処理スレッドが別にあるなら、出力スレッドがすべきことは単に出力するだけ
@@ -4678,22 +4803,207 @@ RGY_ERR RGYOutputAvcodec::WriteThreadFunc(RGYParamThread threadParam) {
         fprintf(fpMuxDebug.get(), "mux_debug\n");
         fprintf(fpMuxDebug.get(), "dtsThreshold : %20lld\n", (lls)dtsThreshold);
         fprintf(fpMuxDebug.get(), "syncIgnoreDts: %20lld\n", (lls)syncIgnoreDts);
-        fprintf(fpMuxDebug.get(), "audioDts     : %20lld\n", (lls)audioDts);
         fprintf(fpMuxDebug.get(), "videoDts     : %20lld\n", (lls)videoDts);
         fprintf(fpMuxDebug.get(), "\n");
     }
-    bool bThAudProcess = false;
+    auto videoQueueSize = [&]() {
+        return (videoIsRaw) ? m_Mux.thread.qVideoRawFrames.size() : m_Mux.thread.qVideobitstream.size();
+    };
+    auto videoQueueCapacity = [&]() {
+        return (videoIsRaw) ? m_Mux.thread.qVideoRawFrames.capacity() : m_Mux.thread.qVideobitstream.capacity();
+    };
+    //待機対象のキューに、すでに処理すべきデータがあるかを確認する
+    auto outputQueueReady = [&](const int waitFor) {
+        const auto& qAudio = m_Mux.thread.thOutput->qPackets;
+        if (!m_Mux.format.fileHeaderWritten) {
+            //ヘッダー出力前は映像が来るか、音声キューの拡大が必要になるまで待機する
+            return videoQueueSize() > 0 || qAudio.size() >= qAudio.capacity();
+        }
+        if (videoQueueSize() * 2 >= videoQueueCapacity() || qAudio.size() * 2 >= qAudio.capacity()) {
+            return true;
+        }
+        switch (waitFor) {
+        case MUX_WAIT_VIDEO: return videoQueueSize() > 0;
+        case MUX_WAIT_AUDIO: return qAudio.size() > 0;
+        default:             return videoQueueSize() > 0 || qAudio.size() > 0;
+        }
+    };
+    //音声・字幕パケットは、出力キュー(thOutput->qPackets)からストリームごとのキュー(mergeStreams)に移したうえで、
+    //最後に出力したdtsが最も小さいストリームから順に出力する (ストリームごとのk-way merge)
+    //映像は、同期対象の音声ストリームのうち最も遅れているもののdtsを基準に出力する
+    struct MuxMergeStream {
+        std::deque<AVPktMuxData> pkts; //出力待ちのパケット
+        int64_t lastDts;               //最後に出力したパケットのdts (QUEUE_DTS_TIMEBASE)
+        bool sync;                     //映像・ほかの音声との同期の対象か
+        bool ended;                    //終了を示すnullパケットを出力した
+        bool skip;                     //パケットが来ないため、一時的に同期の対象から外している
+        int nWait;                     //パケットが来ないために同期待ちとなった回数
+    };
+    const bool bThAudProcess = m_Mux.thread.threadActiveAudioProcess();
+    const int miscStreamIdx = (int)m_Mux.audio.size(); //m_Mux.audioに対応しないパケット(字幕・データストリーム)用
+    std::vector<MuxMergeStream> mergeStreams(m_Mux.audio.size() + 1);
+    for (auto& stream : mergeStreams) {
+        stream.lastDts = 0;
+        stream.sync = false;
+        stream.ended = false;
+        stream.skip = false;
+        stream.nWait = 0;
+    }
+    for (size_t i = 0; i < m_Mux.audio.size(); i++) {
+        //字幕やデータストリームは連続で来るとは限らないので、同期の対象としない
+        //また、音声処理スレッドがない場合、分離したサブトラックのパケットは親トラックのパケットとして送られてくるので対象外
+        const auto streamOut = m_Mux.audio[i].streamOut;
+        mergeStreams[i].sync = (bThAudProcess || m_Mux.audio[i].inSubStream == 0)
+            && (streamOut == nullptr || streamOut->codecpar->codec_type == AVMEDIA_TYPE_AUDIO);
+    }
+    //出力待ちのパケットがあるストリームを、最後に出力したdtsの小さい順に取り出すヒープ
+    //各ストリームは、出力待ちのパケットがある間、そのときのlastDtsで1つだけ登録される
+    std::priority_queue<std::pair<int64_t, int>, std::vector<std::pair<int64_t, int>>, std::greater<std::pair<int64_t, int>>> mergeHeap;
+    size_t mergeStagedCount = 0; //mergeStreamsで出力待ちのパケットの総数
+    static const int MERGE_WAIT_NONE  = -1; //待機対象なし
+    static const int MERGE_WAIT_VIDEO = -2; //映像を待機
+    //出力キューのパケットをストリームごとのキューに移す
+    //finishingでなければ、出力キューの容量分までとし、出力キューで映像処理側に待機をかけられるようにする
     int audPacketsPerSec = 64;
-    int nWaitAudio = 0;
+    auto stageAudio = [&](const bool finishing) {
+        auto& qAudio = m_Mux.thread.thOutput->qPackets;
+        AVPktMuxData pktData = { 0 };
+        while ((finishing || mergeStagedCount < qAudio.capacity())
+            && qAudio.try_pop(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_aud_out : nullptr)) {
+            const int idx = (pktData.muxAudio) ? (int)(pktData.muxAudio - m_Mux.audio.data()) : miscStreamIdx;
+            auto& stream = mergeStreams[idx];
+            if (pktData.muxAudio && pktData.muxAudio->streamIn && pktData.pkt) {
+                audPacketsPerSec = (pktData.pkt->duration <= 0) ? pktData.muxAudio->streamIn->codecpar->sample_rate * 8 : std::max(audPacketsPerSec, (int)(1.0 / (av_q2d(pktData.muxAudio->streamIn->time_base) * pktData.pkt->duration) + 0.5));
+                const auto videoDelay = (stream.lastDts - videoDts) * av_q2d(QUEUE_DTS_TIMEBASE);
+                const auto streamQueueCapacity = (int)(audPacketsPerSec * std::max(5.0, videoDelay * 1.5) * std::max((int)m_Mux.audio.size(), 1) + 0.5);
+                if ((int)qAudio.capacity() < streamQueueCapacity) {
+                    qAudio.set_capacity(streamQueueCapacity);
+                }
+            }
+            if (stream.pkts.empty()) {
+                mergeHeap.push(std::make_pair(stream.lastDts, idx));
+            }
+            stream.pkts.push_back(pktData);
+            stream.skip = false;
+            stream.nWait = 0;
+            mergeStagedCount++;
+        }
+    };
+    //映像の出力の基準となる、同期対象の音声ストリームのうち最も遅れているもののdtsを返す
+    //waitIdxには、そのストリームのindexを返す (同期対象がなければMERGE_WAIT_NONE)
+    //finishingの場合は、もう追加のパケットは来ないので、出力待ちのパケットがないストリームは対象外とする
+    auto audioFrontier = [&](const bool finishing, int& waitIdx) {
+        int64_t dts = syncIgnoreDts;
+        waitIdx = MERGE_WAIT_NONE;
+        for (int i = 0; i < (int)mergeStreams.size(); i++) {
+            const auto& stream = mergeStreams[i];
+            if (stream.sync && !stream.ended && !stream.skip
+                && !(finishing && stream.pkts.empty())
+                && stream.lastDts < dts) {
+                dts = stream.lastDts;
+                waitIdx = i;
+            }
+        }
+        return dts;
+    };
+    //映像を、音声より先行しすぎない範囲で出力する
+    auto writeVideo = [&](const bool finishing, int& waitIdx) {
+        const int64_t frontierDts = audioFrontier(finishing, waitIdx);
+        const int64_t maxDts = (frontierDts < 0) ? syncIgnoreDts : frontierDts;
+        bool written = false;
+        if (videoIsRaw) {
+            AVPktMuxData pktData = { 0 };
+            while (videoDts <= maxDts + dtsThreshold
+                && m_Mux.thread.qVideoRawFrames.front_copy_and_pop_no_lock(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_vid_out : nullptr)) {
+                RGYTraceScope trace("mux video");
+                WriteNextPacketRawVideo(pktData.pkt, &videoDts);
+                trace.setQueue((int)m_Mux.thread.qVideoRawFrames.size());
+                written = true;
+            }
+        } else {
+            RGYBitstream bitstream = RGYBitstreamInit();
+            while (videoDts <= maxDts + dtsThreshold
+                && m_Mux.thread.qVideobitstream.front_copy_and_pop_no_lock(&bitstream, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_vid_out : nullptr)) {
+                RGYTraceScope trace("mux video");
+                WriteNextFrameInternal(&bitstream, &videoDts);
+                trace.setQueue((int)m_Mux.thread.qVideobitstream.size());
+                written = true;
+            }
+        }
+        if (written) {
+            const auto log_level = RGY_LOG_TRACE;
+            if (m_printMes && log_level >= m_printMes->getLogLevel(RGY_LOGT_OUT)) {
+                AddMessage(log_level, _T("videoDts=%8lld: %s.\n"), (lls)videoDts, getTimestampString(videoDts, QUEUE_DTS_TIMEBASE).c_str());
+            }
+            if (fpMuxDebug) fprintf(fpMuxDebug.get(), "video: v %3d, a %3d, [videoDts=%16lld],  audioDts=%16lld .\n", (int)videoQueueSize(), (int)mergeStagedCount, (lls)videoDts, (lls)frontierDts);
+        }
+        return written;
+    };
+    //ヒープの先頭(最後に出力したdtsが最も小さいストリーム)から、
+    //映像と、出力待ちのパケットがない同期対象のストリームより先行しすぎない範囲で出力する
+    //waitIdxには、出力を止めた原因 (MERGE_WAIT_VIDEO または待機するストリームのindex) を返す
+    auto writeAudio = [&](const bool finishing, int& waitIdx) {
+        bool written = false;
+        waitIdx = MERGE_WAIT_NONE;
+        while (!mergeHeap.empty()) {
+            const int idx = mergeHeap.top().second;
+            auto& stream = mergeStreams[idx];
+            int64_t maxDts = syncIgnoreDts;
+            int maxDtsWait = MERGE_WAIT_NONE;
+            if (videoDts >= 0 && !(finishing && videoQueueSize() == 0)) {
+                maxDts = videoDts;
+                maxDtsWait = MERGE_WAIT_VIDEO;
+            }
+            if (!finishing) {
+                for (int i = 0; i < (int)mergeStreams.size(); i++) {
+                    const auto& other = mergeStreams[i];
+                    if (i != idx && other.sync && !other.ended && !other.skip && other.pkts.empty()
+                        && other.lastDts < maxDts) {
+                        maxDts = other.lastDts;
+                        maxDtsWait = i;
+                    }
+                }
+            }
+            if (stream.lastDts > maxDts + dtsThreshold) {
+                waitIdx = maxDtsWait;
+                break;
+            }
+            mergeHeap.pop();
+            AVPktMuxData pktData = stream.pkts.front();
+            stream.pkts.pop_front();
+            mergeStagedCount--;
+            const bool isFlush = pktData.pkt == nullptr;
+            const int64_t maxDtsToWrite = (maxDts >= syncIgnoreDts) ? INT64_MAX : maxDts + dtsThreshold;
+            {
+                RGYTraceScope trace("mux audio");
+                //音声処理スレッドが別にあるなら、出力スレッドがすべきことは単に出力するだけ
+                (bThAudProcess) ? writeProcessedPacket(&pktData) : WriteNextPacketInternal(&pktData, maxDtsToWrite);
+                trace.setQueue((int)mergeStagedCount);
+            }
+            if (isFlush) {
+                stream.ended = true;
+            } else if (pktData.dts != AV_NOPTS_VALUE && pktData.dts != (int64_t)((uint64_t)AV_NOPTS_VALUE - 1) && pktData.dts < syncIgnoreDts) {
+                stream.lastDts = std::max(stream.lastDts, pktData.dts);
+            }
+            if (!stream.pkts.empty()) {
+                mergeHeap.push(std::make_pair(stream.lastDts, idx));
+            }
+            written = true;
+            const auto log_level = RGY_LOG_TRACE;
+            if (m_printMes && log_level >= m_printMes->getLogLevel(RGY_LOGT_OUT)) {
+                AddMessage(log_level, _T("audioDts=%8lld: %s, stream %d, maxDst=%8lld.\n"), (lls)stream.lastDts, getTimestampString(stream.lastDts, QUEUE_DTS_TIMEBASE).c_str(), idx, (lls)maxDtsToWrite);
+            }
+            if (fpMuxDebug) fprintf(fpMuxDebug.get(), "audio: v %3d, a %3d,  videoDts=%16lld , [audioDts=%16lld] stream %d.\n",
+                (int)videoQueueSize(), (int)mergeStagedCount, (lls)videoDts, (lls)stream.lastDts, idx);
+        }
+        return written;
+    };
     int nWaitVideo = 0;
     while (!m_Mux.thread.thOutput->thAbort) {
-        // 起動遅れの場合がありえるのでここでチェック
-        if (!bThAudProcess && m_Mux.thread.threadActiveAudioProcess()) {
-            bThAudProcess = true;
-        }
+        int videoWaitIdx = MERGE_WAIT_NONE;
+        int audioWaitIdx = MERGE_WAIT_NONE;
         do {
             if (!m_Mux.format.fileHeaderWritten) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
                 //ヘッダー取得前に音声キューのサイズが足りず、エンコードが進まなくなってしまうことがある
                 //キューのcapcityを増やすことでこれを回避する
                 if (!m_Mux.thread.threadActiveAudioProcess()) {
@@ -4714,182 +5024,118 @@ RGY_ERR RGYOutputAvcodec::WriteThreadFunc(RGYParamThread threadParam) {
                     }
                 }
                 //動画キューになにもなかったら再度待機する
-                if ((!videoIsRaw && m_Mux.thread.qVideobitstream.size() == 0) ||
-                    (videoIsRaw && m_Mux.thread.qVideoRawFrames.size() == 0)) {
+                if (videoQueueSize() == 0) {
                     break;
                 }
             }
-
-            //映像・音声の同期待ちが必要な場合、falseとなってループから抜けるよう、ここでfalseに設定する
-            bAudioExists = false;
-            bVideoExists = false;
-            if (videoIsRaw) {
-                AVPktMuxData pktData = { 0 };
-                while ((audioDts < 0 || videoDts <= audioDts + dtsThreshold)
-                    && false != (bVideoExists = m_Mux.thread.qVideoRawFrames.front_copy_and_pop_no_lock(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_vid_out : nullptr))) {
-                    WriteNextPacketRawVideo(pktData.pkt, &videoDts);
-                    nWaitVideo = 0;
-                    const auto log_level = RGY_LOG_TRACE;
-                    if (m_printMes && log_level >= m_printMes->getLogLevel(RGY_LOGT_OUT)) {
-                        AddMessage(log_level, _T("videoDts=%8lld: %s.\n"), (lls)videoDts, getTimestampString(videoDts, QUEUE_DTS_TIMEBASE).c_str());
-                    }
-                    if (fpMuxDebug) fprintf(fpMuxDebug.get(), "video: v %3d, a %3d, [videoDts=%16lld],  audioDts=%16lld .\n", (int)m_Mux.thread.qVideoRawFrames.size(), (int)m_Mux.thread.thOutput->qPackets.size(), (lls)videoDts, (lls)audioDts);
-                }
-            } else {
-                RGYBitstream bitstream = RGYBitstreamInit();
-                while ((audioDts < 0 || videoDts <= audioDts + dtsThreshold)
-                    && false != (bVideoExists = m_Mux.thread.qVideobitstream.front_copy_and_pop_no_lock(&bitstream, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_vid_out : nullptr))) {
-                    WriteNextFrameInternal(&bitstream, &videoDts);
-                    nWaitVideo = 0;
-                    const auto log_level = RGY_LOG_TRACE;
-                    if (m_printMes && log_level >= m_printMes->getLogLevel(RGY_LOGT_OUT)) {
-                        AddMessage(log_level, _T("videoDts=%8lld: %s.\n"), (lls)videoDts, getTimestampString(videoDts, QUEUE_DTS_TIMEBASE).c_str());
-                    }
-                    if (fpMuxDebug) fprintf(fpMuxDebug.get(), "video: v %3d, a %3d, [videoDts=%16lld],  audioDts=%16lld .\n", (int)m_Mux.thread.qVideobitstream.size(), (int)m_Mux.thread.thOutput->qPackets.size(), (lls)videoDts, (lls)audioDts);
-                }
-            }
-            AVPktMuxData pktData = { 0 };
-            while ((videoDts < 0 || audioDts <= videoDts + dtsThreshold)
-                && false != (bAudioExists = m_Mux.thread.thOutput->qPackets.front_copy_and_pop_no_lock(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_aud_out : nullptr))) {
-                bool isAudio = false;
-                if (pktData.muxAudio && pktData.muxAudio->streamIn && pktData.pkt) {
-                    audPacketsPerSec = (pktData.pkt->duration <= 0) ? pktData.muxAudio->streamIn->codecpar->sample_rate * 8 : std::max(audPacketsPerSec, (int)(1.0 / (av_q2d(pktData.muxAudio->streamIn->time_base) * pktData.pkt->duration) + 0.5));
-                    const auto videoDelay = (audioDts - videoDts) * av_q2d(QUEUE_DTS_TIMEBASE);
-                    const auto streamQueueCapacity = (int)(audPacketsPerSec * std::max(5.0, videoDelay * 1.5) * std::max((int)m_Mux.audio.size(), 1) + 0.5);
-                    if ((int)m_Mux.thread.thOutput->qPackets.capacity() < streamQueueCapacity) {
-                        m_Mux.thread.thOutput->qPackets.set_capacity(streamQueueCapacity);
-                    }
-                    isAudio = pktData.muxAudio->streamOut->codecpar->codec_type == AVMEDIA_TYPE_AUDIO;
-                }
-                const int64_t maxDts = (videoDts >= 0) ? videoDts + dtsThreshold : syncIgnoreDts;
-                //音声処理スレッドが別にあるなら、出力スレッドがすべきことは単に出力するだけ
-                (m_Mux.thread.threadActiveAudioProcess()) ? writeProcessedPacket(&pktData) : WriteNextPacketInternal(&pktData, maxDts);
-                // 字幕やデータストリームに関しては、連続で来るとは限らないので、考慮しないことにする
-                if (isAudio
-                    && pktData.dts != AV_NOPTS_VALUE && pktData.dts != (int64_t)((uint64_t)AV_NOPTS_VALUE - 1)) {
-                    // 複数のトラックがあり得るので、最大値をとる
-                    audioDts = (std::max)(audioDts, (std::max)(pktData.dts, m_Mux.thread.streamOutMaxDts.load()));
-                }
-                nWaitAudio = 0;
-                const auto log_level = RGY_LOG_TRACE;
-                if (m_printMes && log_level >= m_printMes->getLogLevel(RGY_LOGT_OUT)) {
-                    AddMessage(log_level, _T("audioDts=%8lld: %s, maxDst=%8lld.\n"), (lls)audioDts, getTimestampString(audioDts, QUEUE_DTS_TIMEBASE).c_str(), (lls)maxDts);
-                }
-                if (fpMuxDebug) fprintf(fpMuxDebug.get(), "audio: v %3d, a %3d,  videoDts=%16lld , [audioDts=%16lld].\n",
-                    (videoIsRaw) ? (int)m_Mux.thread.qVideoRawFrames.size() : (int)m_Mux.thread.qVideobitstream.size(),
-                    (int)m_Mux.thread.thOutput->qPackets.size(), (lls)videoDts, (lls)audioDts);
+            stageAudio(false);
+            //映像・音声の同期待ちが必要な場合、falseとなってループから抜ける
+            bVideoExists = writeVideo(false, videoWaitIdx);
+            if (bVideoExists) {
+                nWaitVideo = 0;
             }
-            //一定以上の動画フレームがキューにたまっており、音声キューになにもなければ、
-            //音声を無視して動画フレームの処理を開始させる
+            bAudioExists = writeAudio(false, audioWaitIdx);
+
+            //出力待ちのパケットがないストリームの同期待ちで出力が止まっている場合、
+            //一定以上の映像フレームがキューにたまっているか、出力待ちのパケットが上限に達していれば、
+            //そのストリームを無視して処理を進める
             //音声が途中までしかなかったり、途中からしかなかったりする場合にこうした処理が必要
-            const size_t videoPacketThreshold = std::max<size_t>(std::min<size_t>(3072, (videoIsRaw) ? (int)m_Mux.thread.qVideoRawFrames.capacity() : (int)m_Mux.thread.qVideobitstream.capacity()), nWaitThreshold) - nWaitThreshold;
-            auto vidQueueSize = (videoIsRaw) ? (int)m_Mux.thread.qVideoRawFrames.size() : (int)m_Mux.thread.qVideobitstream.size();
-            if (m_Mux.thread.thOutput->qPackets.size() == 0 && vidQueueSize > (int)videoPacketThreshold) {
-                nWaitAudio++;
-                if (nWaitAudio <= nWaitThreshold) {
-                    //時折まだパケットが来ているのにタイミングによってsize() == 0が成立することがある
+            const size_t videoPacketThreshold = std::max<size_t>(std::min<size_t>(3072, videoQueueCapacity()), nWaitThreshold) - nWaitThreshold;
+            const bool stageFull = mergeStagedCount >= m_Mux.thread.thOutput->qPackets.capacity();
+            const int waitIdx = (!bVideoExists && videoWaitIdx >= 0 && videoQueueSize() > 0) ? videoWaitIdx : audioWaitIdx;
+            if (!bVideoExists && !bAudioExists && waitIdx >= 0 && mergeStreams[waitIdx].pkts.empty()
+                && (videoQueueSize() > videoPacketThreshold || stageFull)) {
+                auto& stream = mergeStreams[waitIdx];
+                stream.nWait++;
+                if (stream.nWait <= nWaitThreshold) {
+                    //時折まだパケットが来ているのにタイミングによってキューが空になることがある
                     //なのである程度連続でパケットが来ていないときのみ無視するようにする
                     //このようにすることで適切に同期がとれる
-                    //また、映像キューのサイズが足りないことが考えられるので、拡大する
-                    if (videoIsRaw) {
+                    //また、キューのサイズが足りないことが考えられるので、拡大する
+                    if (stageFull) {
+                        m_Mux.thread.thOutput->qPackets.set_capacity(m_Mux.thread.thOutput->qPackets.capacity() * 3 / 2);
+                    } else if (videoIsRaw) {
                         m_Mux.thread.qVideoRawFrames.set_capacity(m_Mux.thread.qVideoRawFrames.capacity() + 50);
                     } else {
                         m_Mux.thread.qVideobitstream.set_capacity(m_Mux.thread.qVideobitstream.capacity() + 50);
                     }
                     break;
                 }
-                audioDts = videoDts;
-                AddMessage(RGY_LOG_TRACE, _T("audio not coming: %d.\n"), nWaitAudio);
+                stream.skip = true;
+                bAudioExists = true; //同期の対象が変わったので、もう一度出力を試みる
+                AddMessage(RGY_LOG_TRACE, _T("audio not coming: stream %d, %d.\n"), waitIdx, stream.nWait);
             }
-            //一定以上の音声フレームがキューにたまっており、動画キューになにもなければ、
-            //動画を無視して音声フレームの処理を開始させる
+            //一定以上の音声パケットがたまっており、動画キューになにもなければ、
+            //動画を無視して音声の処理を開始させる
             const size_t audioPacketThreshold = std::max<size_t>(std::min<size_t>(10 * 1024 * 1024, m_Mux.thread.thOutput->qPackets.capacity()), nWaitThreshold) - nWaitThreshold;
-            vidQueueSize = (videoIsRaw) ? (int)m_Mux.thread.qVideoRawFrames.size() : (int)m_Mux.thread.qVideobitstream.size();
-            if (vidQueueSize == 0 && m_Mux.thread.thOutput->qPackets.size() > audioPacketThreshold) {
+            if (!bAudioExists && audioWaitIdx == MERGE_WAIT_VIDEO && videoQueueSize() == 0
+                && mergeStagedCount + m_Mux.thread.thOutput->qPackets.size() > audioPacketThreshold) {
                 nWaitVideo++;
                 if (nWaitVideo <= nWaitThreshold) {
                     //時折まだパケットが来ているのにタイミングによってsize() == 0が成立することがある
                     //なのである程度連続でパケットが来ていないときのみ無視するようにする
-                    //このようにすることで適切に同期がとれる
                     //また、音声キューのサイズが足りないことが考えられるので、拡大する
                     m_Mux.thread.thOutput->qPackets.set_capacity(m_Mux.thread.thOutput->qPackets.capacity() * 3 / 2);
                     break;
                 }
-                videoDts = audioDts;
+                videoDts = mergeHeap.top().first;
+                bAudioExists = true;
                 AddMessage(RGY_LOG_TRACE, _T("video not coming: %d\n"), nWaitVideo);
             }
         } while (bAudioExists || bVideoExists); //両方のキューがひとまず空になるか、映像・音声の同期待ちが必要になるまで回す
                                                 //次のフレーム・パケットが送られてくるまで待機する
-        //キューの容量が両方とも半分以下なら、すこし待ってみる
-        //一方、どちらかのキューが半分以上使われていれば、なるべく早く処理する必要がある
-        if (   m_Mux.thread.qVideobitstream.size() / (double)m_Mux.thread.qVideobitstream.capacity() < 0.5
-            && m_Mux.thread.thOutput->qPackets.size() / (double)m_Mux.thread.thOutput->qPackets.capacity() < 0.5) {
-            if (m_Mux.format.lowlatency) {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            } else {
-                ResetEvent(m_Mux.thread.thOutput->heEventPktAdded);
+        //どちらかのキューが半分以上使われていれば、なるべく早く処理する必要がある
+        const auto& qAudioOut = m_Mux.thread.thOutput->qPackets;
+        if (m_Mux.format.fileHeaderWritten
+            && (videoQueueSize() * 2 >= videoQueueCapacity() || qAudioOut.size() * 2 >= qAudioOut.capacity())) {
+            std::this_thread::yield();
+        } else {
+            //映像キューにデータが残っていれば、最も遅れている音声ストリームのdtsが進むのを待っているので、そのストリームへの追加のみを待つ
+            //出力待ちの音声パケットが残っていれば、映像、あるいは出力待ちのパケットがないストリームへの追加のみを待つ
+            //ヘッダー出力前は、映像が来るまでなにも出力できない
+            int waitFor = MUX_WAIT_ANY;
+            int waitStream = -1;
+            if (!m_Mux.format.fileHeaderWritten) {
+                waitFor = MUX_WAIT_VIDEO;
+            } else if (videoQueueSize() > 0) {
+                waitFor = MUX_WAIT_AUDIO;
+                waitStream = (videoWaitIdx >= 0 && videoWaitIdx < miscStreamIdx && mergeStreams[videoWaitIdx].pkts.empty()) ? videoWaitIdx : -1;
+            } else if (!mergeHeap.empty()) {
+                waitFor = (audioWaitIdx >= 0) ? MUX_WAIT_AUDIO : MUX_WAIT_VIDEO;
+                waitStream = (audioWaitIdx >= 0 && audioWaitIdx < miscStreamIdx) ? audioWaitIdx : -1;
+            }
+            //ResetEventしてからoutputWaitForを設定し、そのあとキューを再確認することで通知の取りこぼしを防ぐ
+            //(待機時間の上限は念のためのもの)
+            ResetEvent(m_Mux.thread.thOutput->heEventPktAdded);
+            m_Mux.thread.outputWaitStream = waitStream;
+            m_Mux.thread.outputWaitFor = waitFor;
+            if (!outputQueueReady(waitFor)) {
                 WaitForSingleObject(m_Mux.thread.thOutput->heEventPktAdded, 16);
             }
-        } else {
-            std::this_thread::yield();
+            m_Mux.thread.outputWaitFor = MUX_WAIT_NONE;
         }
     }
     //メインループを抜けたことを通知する
     SetEvent(m_Mux.thread.thOutput->heEventClosing);
     m_Mux.thread.thOutput->qPackets.set_keep_length(0);
     m_Mux.thread.qVideobitstream.set_keep_length(0);
-    bAudioExists = !m_Mux.thread.thOutput->qPackets.empty();
-    bVideoExists = !m_Mux.thread.qVideobitstream.empty();
-    //まずは映像と音声の同期をとって出力するためのループ
-    while (bAudioExists && bVideoExists) {
-        AVPktMuxData pktData = { 0 };
-        while (audioDts <= videoDts + dtsThreshold
-            && false != (bAudioExists = m_Mux.thread.thOutput->qPackets.front_copy_and_pop_no_lock(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_aud_out : nullptr))) {
-            //音声処理スレッドが別にあるなら、出力スレッドがすべきことは単に出力するだけ
-            const int64_t maxDts = (videoDts >= 0) ? videoDts + dtsThreshold : INT64_MAX;
-            (bThAudProcess) ? writeProcessedPacket(&pktData) : WriteNextPacketInternal(&pktData, maxDts);
-            //複数のstreamがあり得るので最大値をとる
-            if (pktData.dts != AV_NOPTS_VALUE && pktData.dts != (int64_t)((uint64_t)AV_NOPTS_VALUE - 1)) {
-                audioDts = (std::max)(audioDts, pktData.dts);
-            }
-        }
-        if (videoIsRaw) {
-            pktData = AVPktMuxData();
-            while (videoDts <= audioDts + dtsThreshold
-                && false != (bVideoExists = m_Mux.thread.qVideoRawFrames.front_copy_and_pop_no_lock(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_vid_out : nullptr))) {
-                WriteNextPacketRawVideo(pktData.pkt, &videoDts);
-            }
-        } else {
-            RGYBitstream bitstream = RGYBitstreamInit();
-            while (videoDts <= audioDts + dtsThreshold
-                && false != (bVideoExists = m_Mux.thread.qVideobitstream.front_copy_and_pop_no_lock(&bitstream, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_vid_out : nullptr))) {
-                WriteNextFrameInternal(&bitstream, &videoDts);
-            }
-            bVideoExists = !m_Mux.thread.qVideobitstream.empty();
-        }
-        bAudioExists = !m_Mux.thread.thOutput->qPackets.empty();
-    }
-    { //音声を書き出す
-        AVPktMuxData pktData = { 0 };
-        while (m_Mux.thread.thOutput->qPackets.front_copy_and_pop_no_lock(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_aud_out : nullptr)) {
-            //音声処理スレッドが別にあるなら、出力スレッドがすべきことは単に出力するだけ
-            (bThAudProcess) ? writeProcessedPacket(&pktData) : WriteNextPacketInternal(&pktData, INT64_MAX);
+    //もう追加のパケットは来ないので、残りをすべてストリームごとのキューに移し、映像と音声の同期をとって出力する
+    stageAudio(true);
+    for (;;) {
+        int videoWaitIdx = MERGE_WAIT_NONE;
+        int audioWaitIdx = MERGE_WAIT_NONE;
+        bVideoExists = writeVideo(true, videoWaitIdx);
+        bAudioExists = writeAudio(true, audioWaitIdx);
+        if (!bVideoExists && !bAudioExists) {
+            break;
         }
     }
-    if (videoIsRaw) { //動画を書き出す
-        AVPktMuxData pktData = { 0 };
-        while (m_Mux.thread.qVideoRawFrames.front_copy_and_pop_no_lock(&pktData, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_vid_out : nullptr)) {
-            WriteNextPacketRawVideo(pktData.pkt, &videoDts);
-        }
+    if (videoIsRaw) {
         //nullptrを送って終了を通知する
         WriteNextPacketRawVideo(nullptr, &videoDts);
     } else {
-        RGYBitstream bitstream = RGYBitstreamInit();
-        while (m_Mux.thread.qVideobitstream.front_copy_and_pop_no_lock(&bitstream, (m_Mux.thread.queueInfo) ? &m_Mux.thread.queueInfo->usage_vid_out : nullptr)) {
-            WriteNextFrameInternal(&bitstream, &videoDts);
-        }
         //空のbitstreamを送って終了を通知する
-        bitstream = RGYBitstreamInit();
+        RGYBitstream bitstream = RGYBitstreamInit();
         WriteNextFrameInternal(&bitstream, &videoDts);
     }
 #endif
@@ -4898,6 +5144,12 @@ RGY_ERR RGYOutputAvcodec::WriteThreadFunc(RGYParamThread threadParam) {
 
 void RGYOutputAvcodec::WaitFin() {
     CloseThread();
+#if USE_CUSTOM_IO
+    if (m_Mux.format.asyncWriter && m_encSatusInfo) {
+        const auto stats = m_Mux.format.asyncWriter->stats();
+        m_encSatusInfo->SetOutputStall(stats.stallTime * 1e-9, stats.stallCount);
+    }
+#endif //USE_CUSTOM_IO
 }
 
 HANDLE RGYOutputAvcodec::getThreadHandleOutput() {
@@ -4926,10 +5178,13 @@ HANDLE RGYOutputAvcodec::getThreadHandleAudEncode() {
 
 #if USE_CUSTOM_IO
 int RGYOutputAvcodec::readPacket(uint8_t *buf, int buf_size) {
+    if (m_Mux.format.asyncWriter) {
+        return m_Mux.format.asyncWriter->read(buf, buf_size);
+    }
     return (int)_fread_nolock(buf, 1, buf_size, m_Mux.format.fpOutput);
 }
 int RGYOutputAvcodec::writePacket(const uint8_t *buf, int buf_size) {
-    int res = (int)_fwrite_nolock(buf, 1, buf_size, m_Mux.format.fpOutput);
+    int res = (m_Mux.format.asyncWriter) ? m_Mux.format.asyncWriter->write(buf, buf_size) : (int)_fwrite_nolock(buf, 1, buf_size, m_Mux.format.fpOutput);
     if (res < buf_size) {
         AddMessage(RGY_LOG_ERROR, _T("Error writing file.\nNot enough disk space!\""));
         m_Mux.format.streamError = true;
@@ -4937,6 +5192,9 @@ int RGYOutputAvcodec::writePacket(const uint8_t *buf, int buf_size) {
     return res;
 }
 int64_t RGYOutputAvcodec::seek(int64_t offset, int whence) {
+    if (m_Mux.format.asyncWriter) {
+        return m_Mux.format.asyncWriter->seek(offset, whence);
+    }
     return _fseeki64(m_Mux.format.fpOutput, offset, whence);
 }
 #endif //USE_CUSTOM_IO
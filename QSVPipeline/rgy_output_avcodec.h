@@ -44,6 +44,8 @@
 #include "rgy_output.h"
 #include "rgy_perf_monitor.h"
 #include "rgy_util.h"
+#include "rgy_async_writer.h"
+#include "rgy_thread_pool.h"
 #if ENCODER_NVENC
 #include "NVEncUtil.h"
 #endif //#if ENCODER_NVENC
@@ -60,8 +62,6 @@ using std::vector;
 
 static const int SUB_ENC_BUF_MAX_SIZE = 1024 * 1024;
 
-static const int VID_BITSTREAM_QUEUE_SIZE_I  = 4;
-static const int VID_BITSTREAM_QUEUE_SIZE_PB = 64;
 
 enum RGYMetadataCopyDefault {
     RGY_METADATA_DEFAULT_CLEAR,
@@ -117,6 +117,7 @@ struct AVMuxFormat {
     FILE                 *fpOutput;             //出力ファイルポインタ
     char                 *outputBuffer;         //出力ファイルポインタ用のバッファ
     uint32_t              outputBufferSize;     //出力ファイルポインタ用のバッファサイズ
+    std::unique_ptr<RGYAsyncFileWriter> asyncWriter; //出力ファイルへの非同期書き込み (fpOutputの代わりに使用)
 #endif //USE_CUSTOM_IO
     bool                  streamError;          //エラーが発生
     bool                  isMatroska;           //mkvかどうか
@@ -285,13 +286,23 @@ enum {
     AUD_QUEUE_OUT     = 2,
 };
 
+//出力スレッドが待機中に、どのキューへの追加で起床するか
+enum {
+    MUX_WAIT_NONE  = 0, //待機していない (処理中)
+    MUX_WAIT_ANY   = 1, //いずれのキューへの追加でも起床する
+    MUX_WAIT_VIDEO = 2, //映像キューへの追加でのみ起床する
+    MUX_WAIT_AUDIO = 3, //音声キューへの追加でのみ起床する
+};
+
 struct AVMuxThreadWorker {
-    std::thread                    thread;          //音声処理スレッド(デコード/thAudEncodeがなければエンコードも担当)
+    std::thread                    thread;          //出力/raw video処理スレッド (音声処理はaudioPoolのタスクとして実行するので使用しない)
     std::atomic<bool>              thAbort;         //音声処理スレッドに停止を通知する
+    std::atomic<bool>              taskScheduled;   //audioPoolにキューを処理するタスクを投入済み(または実行中)
+    bool                           pooled;          //audioPoolのタスクとしてキューを処理する
     bool                           sentEOS;         //EOSパケットを送信側からこのworkerに送ったことを示す
     HANDLE                         heEventPktAdded; //キューのいずれかにデータが追加されたことを通知する
     HANDLE                         heEventClosing;  //音声処理スレッドが停止処理を開始したことを通知する
-    RGYQueueMPMP<AVPktMuxData, 64> qPackets;        //音声パケットをスレッドに渡すためのキュー
+    RGYQueueBounded<AVPktMuxData, RGYQueueBoundedMode::MPMC> qPackets; //音声パケットをスレッドに渡すためのキュー
 
     AVMuxThreadWorker();
     ~AVMuxThreadWorker();
@@ -319,11 +330,12 @@ struct AVMuxThread {
     std::unique_ptr<AVMuxThreadWorker> thOutput;              //出力スレッド
     std::unique_ptr<AVMuxThreadWorker> thRawVideo;            //raw映像処理用スレッド
     RGYQueueMPMP<AVPktMuxData, 64> qVideoRawFrames;           //raw映像フレームを出力スレッドに渡すためのキュー
-    RGYQueueMPMP<RGYBitstream, 64> qVideobitstreamFreeI;      //映像 Iフレーム用に空いているデータ領域を格納する
-    RGYQueueMPMP<RGYBitstream, 64> qVideobitstreamFreePB;     //映像 P/Bフレーム用に空いているデータ領域を格納する
     RGYQueueMPMP<RGYBitstream, 64> qVideobitstream;           //映像パケットを出力スレッドに渡すためのキュー
     std::unordered_map<const AVMuxAudio *, std::unique_ptr<AVMuxThreadAudio>> thAud; //音声スレッド
+    std::unique_ptr<RGYThreadPool> audioPool;                 //音声処理(デコード/フィルタ/エンコード)を行う共有スレッドプール (thAudより先に破棄する)
     std::atomic<int64_t>           streamOutMaxDts;           //音声・字幕キューの最後のdts (timebase = QUEUE_DTS_TIMEBASE) (キューの同期に使用)
+    std::atomic<int>               outputWaitFor;             //出力スレッドが待機しているキュー (MUX_WAIT_xxx)
+    std::atomic<int>               outputWaitStream;          //outputWaitFor == MUX_WAIT_AUDIO のとき、出力スレッドが待機している音声ストリーム (m_Mux.audioのindex, -1ならいずれでも)
     PerfQueueInfo                 *queueInfo;                 //キューの情報を格納する構造体
 
     AVMuxThread();
@@ -404,8 +416,10 @@ struct AvcodecWriterPrm {
     int                          audioResampler;          //音声のresamplerの選択
     uint32_t                     audioIgnoreDecodeError;  //音声デコード時に発生したエラーを無視して、無音に置き換える
     int                          bufSizeMB;               //出力バッファサイズ
+    RGYParamOutputAsync          asyncWrite;              //出力の非同期書き込み
     int                          threadOutput;            //出力スレッド数
     int                          threadAudio;             //音声処理スレッド数
+    int                          threadAudioMax;          //音声処理に使用するスレッド数の上限 (0で自動)
     RGYParamThread               threadParamOutput;       //出力スレッドのパラメータ
     RGYParamThread               threadParamAudio;        //音声処理スレッドのパラメータ
     RGYParamThread               threadParamCsp;          //色空間変換用のスレッドのパラメータ
@@ -456,8 +470,10 @@ struct AvcodecWriterPrm {
         audioResampler(0),
         audioIgnoreDecodeError(0),
         bufSizeMB(0),
+        asyncWrite(),
         threadOutput(0),
         threadAudio(0),
+        threadAudioMax(0),
         threadParamOutput(),
         threadParamAudio(),
         threadParamCsp(),
@@ -526,15 +542,26 @@ protected:
     //別のスレッドで実行する場合のスレッド関数 (raw video)
     RGY_ERR WriteThreadFuncRawVideo(RGYParamThread threadParam);
 
-    //別のスレッドで実行する場合のスレッド関数 (音声処理)
-    RGY_ERR ThreadFuncAudThread(const AVMuxAudio *const muxAudio, RGYParamThread threadParam);
+    //音声処理/音声エンコードのキューを処理するタスクをaudioPoolに投入する (type: AUD_QUEUE_PROCESS/AUD_QUEUE_ENCODE)
+    //各workerのタスクは同時に1つしか投入しないので、トラック内のパケットの処理順は保たれる
+    void ScheduleAudioTask(AVMuxThreadWorker *worker, const int type);
 
-    //別のスレッドで実行する場合のスレッド関数 (音声エンコード処理)
-    RGY_ERR ThreadFuncAudEncodeThread(const AVMuxAudio *const muxAudio, RGYParamThread threadParam);
+    //audioPoolで実行されるタスク (音声処理/音声エンコード)
+    void RunAudioTask(AVMuxThreadWorker *worker, const int type);
+
+    //ヘッダ書き込み後に、それまでにたまった音声キューの処理を開始する
+    void StartAudioTasks();
+
+    //音声キューをすべて処理し終えるまで待機する
+    void CloseAudioTask(AVMuxThreadWorker *worker, const int type);
 
     //対象パケットの担当スレッドを探す
     AVMuxThreadWorker *getPacketWorker(const AVMuxAudio *muxAudio, const int type);
 
+    //出力スレッドのキューに追加したことを通知する (queueType: MUX_WAIT_VIDEO/MUX_WAIT_AUDIO, muxAudio: 追加した音声パケットのストリーム)
+    //出力スレッドが追加したキュー(ストリーム)を待機している場合、またはキューが半分以上埋まった場合のみ起床させる
+    void NotifyOutputThread(int queueType, const AVMuxAudio *muxAudio = nullptr);
+
     //音声出力キューに追加 (音声処理スレッドが有効な場合のみ有効)
     RGY_ERR AddAudQueue(AVPktMuxData *pktData, int type);
 
@@ -550,7 +577,7 @@ protected:
     //WriteNextFrameの本体
     RGY_ERR WriteNextFrameInternal(RGYBitstream *bitstream, int64_t *writtenDts);
     RGY_ERR WriteNextFrameInternalOneFrame(RGYBitstream *bitstream, int64_t *writtenDts, const RGYTimestampMapVal& bs_framedata);
-    RGY_ERR WriteNextFrameFinish(RGYBitstream *bitstream, const RGY_FRAMETYPE frameType);
+    RGY_ERR WriteNextFrameFinish(RGYBitstream *bitstream);
     RGY_ERR WriteNextPacketRawVideo(AVPacket *pkt, int64_t *writtenDts);
 
     //WriteNextPacketの本体
@@ -700,6 +727,7 @@ protected:
     void CloseQueues();
 
     static const AVRational QUEUE_DTS_TIMEBASE;
+    static const int AUDIO_TASK_MAX_PACKETS = 64; //audioPoolの1回のタスクで処理するパケット数の上限
     AVMux m_Mux;
     vector<AVPktMuxData> m_AudPktBufFileHead; //ファイルヘッダを書く前にやってきた音声パケットのバッファ
 };
@@ -39,8 +39,28 @@
 #include "mpp_core.h"
 #endif
 #include "rgy_perf_monitor.h"
+#include <limits>
 
 static const int RGY_PARALLEL_ENC_TIMEOUT = 10000;
+// チャンク数の指定がない場合の並列数あたりのチャンク数
+// 細かく分割しておき、空いたエンコーダから順に次のチャンクを割り当てることで、
+// チャンクごとの処理速度のばらつきで最後に一部のエンコーダだけが動いている時間を短くする
+static const int RGY_PARALLEL_ENC_CHUNKS_PER_PROCESS = 4;
+// 親が入力を読み込んで子に分配する場合に、読み込んだデータを保持するバッファの合計の上限 (MB, --parallel fanout-mem=で変更可)
+// 起動中のチャンク(並列数+先行して起動する1チャンク)で分けたものが、チャンクあたりのデータ量の上限となる
+static const int RGY_PARALLEL_ENC_FANOUT_BUFFER_MB = 1024;
+// 親が入力を読み込んで子に分配する場合のチャンクの目標の長さ (秒, --parallel chunk-sec=で変更可)
+static const double RGY_PARALLEL_ENC_FANOUT_CHUNK_SEC = 30.0;
+// チャンクの長さの下限 (秒)
+// チャンクごとにエンコーダを起動してIDRから始めることになるので、短くなりすぎないようにする
+// バッファの上限はこれより優先し、この長さが上限に収まらない場合はチャンクを分配できない
+static const double RGY_PARALLEL_ENC_FANOUT_MIN_CHUNK_SEC = 5.0;
+
+static RGYInputChunkLimit fanOutChunkLimit(const encParams *prm) {
+    const size_t bufferSize = (size_t)((prm->ctrl.parallelEnc.fanOutBufMB > 0) ? prm->ctrl.parallelEnc.fanOutBufMB : RGY_PARALLEL_ENC_FANOUT_BUFFER_MB) * 1024 * 1024;
+    const double targetSec = (prm->ctrl.parallelEnc.chunkSec > 0.0f) ? (double)prm->ctrl.parallelEnc.chunkSec : RGY_PARALLEL_ENC_FANOUT_CHUNK_SEC;
+    return RGYInputChunkLimit(bufferSize / (prm->ctrl.parallelEnc.parallelCount + 1), std::min(targetSec, RGY_PARALLEL_ENC_FANOUT_MIN_CHUNK_SEC), targetSec);
+}
 
 static RGY_CODEC enc_codec(const encParams *prm) {
 #if ENCODER_NVENC
@@ -84,6 +104,8 @@ RGYParallelEncProcess::RGYParallelEncProcess(const int id, const tstring& tmpfil
     m_qFirstProcessData(),
     m_qFirstProcessDataFree(),
     m_qFirstProcessDataFreeLarge(),
+    m_peRing(),
+    m_inputChunk(),
     m_cacheMode(RGYParamParallelEncCache::Mem),
     m_sendData(),
     m_tmpfile(tmpfile),
@@ -102,6 +124,11 @@ RGY_ERR RGYParallelEncProcess::close(const bool deleteTempFiles) {
     auto err = RGY_ERR_NONE;
     if (m_thRunProcess.joinable()) {
         m_thAbort = true;
+        if (m_sendData.processStatus == RGYParallelEncProcessStatus::Init && m_sendData.eventParentHasSentFinKeyPts) {
+            // 終了時刻の転送待ちのまま終了する場合は、待機を解除する (中断フラグが立っているので、すぐに終了する)
+            m_sendData.videoFinKeyPts = m_sendData.videoFirstKeyPts;
+            SetEvent(m_sendData.eventParentHasSentFinKeyPts.get());
+        }
         m_thRunProcess.join();
         m_sendData.processStatus = RGYParallelEncProcessStatus::Finished;
         if (m_qFirstProcessData) {
@@ -116,6 +143,8 @@ RGY_ERR RGYParallelEncProcess::close(const bool deleteTempFiles) {
             m_qFirstProcessDataFreeLarge->close([](RGYOutputRawPEExtHeader **ptr) { if (*ptr) free(*ptr); });
             m_qFirstProcessDataFreeLarge.reset();
         }
+        m_peRing.reset(); // 一時ファイルを削除する前に閉じる
+        m_inputChunk.reset();
     }
     if (deleteTempFiles && m_tmpfile.length() > 0 && rgy_file_exists(m_tmpfile)) {
         rgy_file_remove(m_tmpfile.c_str());
@@ -131,6 +160,7 @@ RGY_ERR RGYParallelEncProcess::run(const encParams& peParams) {
 
     encParams encParam = peParams;
     encParam.ctrl.parallelEnc.sendData = &m_sendData;
+    encParam.ctrl.parallelEnc.inputChunk = m_inputChunk.get();
 #if ENCODER_QSV || ENCODER_NVENC
     auto sts = m_process->Init(&encParam);
 #elif ENCODER_VCEENC
@@ -163,7 +193,8 @@ RGY_ERR RGYParallelEncProcess::run(const encParams& peParams) {
 #endif
 }
 
-RGY_ERR RGYParallelEncProcess::startThread(const encParams& peParams, CPerfMonitor *perfMonitor) {
+RGY_ERR RGYParallelEncProcess::startThread(const encParams& peParams, CPerfMonitor *perfMonitor, std::unique_ptr<RGYInputChunk> inputChunk) {
+    m_inputChunk = std::move(inputChunk);
     m_sendData.logMutex = m_log->getLock();
     m_sendData.eventChildHasSentFirstKeyPts = CreateEventUnique(nullptr, FALSE, FALSE);
     m_sendData.eventParentHasSentFinKeyPts = CreateEventUnique(nullptr, FALSE, FALSE);
@@ -176,14 +207,22 @@ RGY_ERR RGYParallelEncProcess::startThread(const encParams& peParams, CPerfMonit
     if (peParams.ctrl.parallelEnc.parallelId == 0 || peParams.ctrl.parallelEnc.cacheMode == RGYParamParallelEncCache::Mem) {
         // 最初のプロセスあるいはキャッシュメモリモードでは、キューを介してデータをやり取りする
         m_qFirstProcessData = std::make_unique<RGYQueueMPMP<RGYOutputRawPEExtHeader*>>();
-        m_qFirstProcessDataFree = std::make_unique<RGYQueueMPMP<RGYOutputRawPEExtHeader*>>();
-        m_qFirstProcessDataFreeLarge = std::make_unique<RGYQueueMPMP<RGYOutputRawPEExtHeader*>>();
+        m_qFirstProcessDataFree = std::make_unique<RGYQueuePEExtHeaderFree>();
+        m_qFirstProcessDataFreeLarge = std::make_unique<RGYQueuePEExtHeaderFree>();
         m_qFirstProcessData->init();
-        m_qFirstProcessDataFree->init();
-        m_qFirstProcessDataFreeLarge->init();
+        m_qFirstProcessDataFree->init(RGY_PE_EXT_HEADER_FREE_QUEUE_SIZE);
+        m_qFirstProcessDataFreeLarge->init(RGY_PE_EXT_HEADER_FREE_QUEUE_SIZE);
         m_sendData.qFirstProcessData = m_qFirstProcessData.get(); // キューのポインタを渡す
         m_sendData.qFirstProcessDataFree = m_qFirstProcessDataFree.get(); // キューのポインタを渡す
         m_sendData.qFirstProcessDataFreeLarge = m_qFirstProcessDataFreeLarge.get(); // キューのポインタを渡す
+    } else if (peParams.ctrl.parallelEnc.cacheMode == RGYParamParallelEncCache::Ring) {
+        // リングバッファモードでは、リングバッファを介してデータをやり取りし、一杯になった分だけ一時ファイルに書き出す
+        m_peRing = std::make_unique<RGYOutputRawPERing>();
+        if (auto err = m_peRing->init(RGY_PE_RING_SIZE, m_tmpfile); err != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to allocate ring buffer: %s.\n"), get_err_mes(err));
+            return err;
+        }
+        m_sendData.peRing = m_peRing.get(); // リングバッファのポインタを渡す
     }
     m_thRunProcess = std::thread([&]() {
         AddMessage(RGY_LOG_DEBUG, _T("\nPE%d[%d]: Start thread...\n"), m_id, GetCurrentThreadId());
@@ -199,7 +238,7 @@ RGY_ERR RGYParallelEncProcess::startThread(const encParams& peParams, CPerfMonit
             m_sendData.encStatus.set(encStatusData);
         }
         SetEvent(m_processFinished.get()); // 処理終了を通知するのを忘れないように
-        AddMessage(m_thRunProcessRet.value_or(RGY_ERR_UNKNOWN) == RGY_ERR_NONE ? RGY_LOG_DEBUG : RGY_LOG_ERROR,
+        AddMessage((m_thRunProcessRet.value_or(RGY_ERR_UNKNOWN) == RGY_ERR_NONE || m_thAbort) ? RGY_LOG_DEBUG : RGY_LOG_ERROR,
             _T("\nPE%d[%d]: Processing finished: %s\n"), m_id, GetCurrentThreadId(), get_err_mes(m_thRunProcessRet.value()));
         m_sendData.processStatus = RGYParallelEncProcessStatus::Finished;
         // そのチャンクに関する進捗表示はこのまま残す (最後に最終状態が記録されている)
@@ -208,6 +247,20 @@ RGY_ERR RGYParallelEncProcess::startThread(const encParams& peParams, CPerfMonit
 }
 
 RGY_ERR RGYParallelEncProcess::getNextPacket(RGYOutputRawPEExtHeader **ptr) {
+    if (m_peRing) {
+        auto err = RGY_ERR_NONE;
+        while ((err = m_peRing->read(ptr)) == RGY_ERR_MORE_DATA) {
+            if (m_thRunProcessRet.has_value()) { // 処理が終了している
+                if ((err = m_peRing->read(ptr)) == RGY_ERR_MORE_DATA) { // 終了の直前に書き込まれたデータがないか再確認
+                    return m_thRunProcessRet.value() == RGY_ERR_NONE ? RGY_ERR_MORE_BITSTREAM : m_thRunProcessRet.value();
+                }
+                break;
+            }
+            // 子の書き込みを待つ (子の処理が書き込みの通知なしに終了した場合に備え、一定時間で再確認する)
+            m_peRing->waitWrite(16);
+        }
+        return err;
+    }
     if (!m_qFirstProcessData) {
         return RGY_ERR_NULL_PTR;
     }
@@ -226,6 +279,10 @@ RGY_ERR RGYParallelEncProcess::getNextPacket(RGYOutputRawPEExtHeader **ptr) {
 }
 
 RGY_ERR RGYParallelEncProcess::putFreePacket(RGYOutputRawPEExtHeader *ptr) {
+    if (m_peRing) {
+        m_peRing->release(); // リングバッファ上のデータはそのまま参照しているので、読み込み位置を進める
+        return RGY_ERR_NONE;
+    }
     if (!m_qFirstProcessDataFree) {
         return RGY_ERR_NULL_PTR;
     }
@@ -237,8 +294,11 @@ RGY_ERR RGYParallelEncProcess::putFreePacket(RGYOutputRawPEExtHeader *ptr) {
         free(ptr);
         return RGY_ERR_NONE;
     }
-    RGYQueueMPMP<RGYOutputRawPEExtHeader*> *freeQueue = (ptr->allocSize <= RGY_PE_EXT_HEADER_DATA_NORMAL_BUF_SIZE) ? m_qFirstProcessDataFree.get() : m_qFirstProcessDataFreeLarge.get();
-    freeQueue->push(ptr);
+    RGYQueuePEExtHeaderFree *freeQueue = (ptr->allocSize <= RGY_PE_EXT_HEADER_DATA_NORMAL_BUF_SIZE) ? m_qFirstProcessDataFree.get() : m_qFirstProcessDataFreeLarge.get();
+    // 回収用のキューが一杯なら、それ以上再利用する必要はないのでメモリを解放する
+    if (!freeQueue->try_push(ptr)) {
+        free(ptr);
+    }
     return RGY_ERR_NONE;
 }
 
@@ -278,9 +338,19 @@ int RGYParallelEncProcess::waitProcessFinished(const uint32_t timeout) {
 RGYParallelEnc::RGYParallelEnc(std::shared_ptr<RGYLog> log) :
     m_id(-1),
     m_encProcess(),
+    m_mtxEncProcess(),
+    m_cvEncProcess(),
+    m_nextChunkId(0),
+    m_chunkSkipped(0),
+    m_chunkScheduleFin(false),
+    m_fanOutInput(nullptr),
+    m_fanOutFrames(0),
+    m_fanOutEOF(false),
+    m_fanOutChunkFrames(),
     m_log(log),
     m_thParallelRun(),
     m_thParallelRunAbort(false),
+    m_thParallelRunErr(RGY_ERR_NONE),
     m_videoEndKeyPts(-1),
     m_videoFinished(false),
     m_parallelCount(0),
@@ -293,8 +363,16 @@ RGYParallelEnc::~RGYParallelEnc() {
 void RGYParallelEnc::close(const bool deleteTempFiles) {
     if (m_thParallelRun.joinable()) {
         m_thParallelRunAbort = true;
+        if (m_fanOutInput) {
+            m_fanOutInput->parallelEncFanOutClose(); // 入力の分配で待機している場合に終了させる
+        }
         m_thParallelRun.join();
     }
+    {
+        std::lock_guard<std::mutex> lock(m_mtxEncProcess);
+        m_chunkScheduleFin = true;
+        m_cvEncProcess.notify_all();
+    }
     for (auto &proc : m_encProcess) {
         proc->close(deleteTempFiles);
     }
@@ -302,60 +380,85 @@ void RGYParallelEnc::close(const bool deleteTempFiles) {
     m_videoEndKeyPts = -1;
 }
 
+RGYParallelEncProcess *RGYParallelEnc::getProcess(const int ichunk) const {
+    std::lock_guard<std::mutex> lock(m_mtxEncProcess);
+    if (ichunk < 0 || ichunk >= (int)m_encProcess.size()) {
+        return nullptr;
+    }
+    return m_encProcess[ichunk].get(); // 要素はclose()まで破棄されない
+}
+
+bool RGYParallelEnc::waitChunkStarted(const int ichunk) {
+    std::unique_lock<std::mutex> lock(m_mtxEncProcess);
+    m_cvEncProcess.wait(lock, [&]() { return ichunk < (int)m_encProcess.size() || m_chunkScheduleFin; });
+    return ichunk < (int)m_encProcess.size();
+}
+
 int64_t RGYParallelEnc::getVideofirstKeyPts(const int ichunk) const {
-    if (ichunk >= (int)m_encProcess.size()) {
+    auto proc = getProcess(ichunk);
+    if (!proc) {
         return -1;
     }
-    return m_encProcess[ichunk]->getVideoFirstKeyPts();
+    return proc->getVideoFirstKeyPts();
 }
 
 tstring RGYParallelEnc::tmpPath(const int ichunk) const {
-    if (ichunk >= (int)m_encProcess.size()) {
+    auto proc = getProcess(ichunk);
+    if (!proc) {
         return _T("");
     }
-    return m_encProcess[ichunk]->tmpPath();
+    return proc->tmpPath();
 }
 
 RGYParamParallelEncCache RGYParallelEnc::cacheMode(const int ichunk) const {
-    if (ichunk >= (int)m_encProcess.size()) {
+    auto proc = getProcess(ichunk);
+    if (!proc) {
         return RGYParamParallelEncCache::Mem;
     }
-    return m_encProcess[ichunk]->cacheMode();
+    return proc->cacheMode();
 }
 
 RGY_ERR RGYParallelEnc::getNextPacket(const int ichunk, RGYOutputRawPEExtHeader **ptr) {
-    if (m_encProcess.size() == 0) {
+    auto proc = getProcess(ichunk);
+    if (!proc) {
         AddMessage(RGY_LOG_ERROR, _T("Invalid call for getNextPacketFromFirst.\n"));
         return RGY_ERR_UNKNOWN;
     }
-    return m_encProcess[ichunk]->getNextPacket(ptr);
+    return proc->getNextPacket(ptr);
 }
 
 RGY_ERR RGYParallelEnc::putFreePacket(const int ichunk, RGYOutputRawPEExtHeader *ptr) {
-    if (m_encProcess.size() == 0) {
+    auto proc = getProcess(ichunk);
+    if (!proc) {
         AddMessage(RGY_LOG_ERROR, _T("Invalid call for pushNextPacket.\n"));
         return RGY_ERR_UNKNOWN;
     }
-    return m_encProcess[ichunk]->putFreePacket(ptr);
+    return proc->putFreePacket(ptr);
 }
 
 int RGYParallelEnc::waitProcessFinished(const int id, const uint32_t timeout) {
-    if (id >= (int)m_encProcess.size()) {
+    auto proc = getProcess(id);
+    if (!proc) {
         AddMessage(RGY_LOG_ERROR, _T("Invalid parallel id #%d for waitProcess.\n"), id);
         return -1;
     }
-    return m_encProcess[id]->waitProcessFinished(timeout);
+    return proc->waitProcessFinished(timeout);
 }
 
 std::optional<RGY_ERR> RGYParallelEnc::processReturnCode(const int id) {
-    if (id >= (int)m_encProcess.size()) {
+    auto proc = getProcess(id);
+    if (!proc) {
         AddMessage(RGY_LOG_ERROR, _T("Invalid parallel id #%d for processReturnCode.\n"), id);
         return std::nullopt;
     }
-    return m_encProcess[id]->getThreadRunResult();
+    return proc->getThreadRunResult();
 }
 
 RGY_ERR RGYParallelEnc::checkAllProcessErrors() {
+    std::lock_guard<std::mutex> lock(m_mtxEncProcess);
+    if (m_thParallelRunErr != RGY_ERR_NONE) {
+        return m_thParallelRunErr;
+    }
     for (const auto& proc : m_encProcess) {
         auto returnCode = proc->getThreadRunResult();
         if (returnCode.has_value() && returnCode.value() != RGY_ERR_NONE) {
@@ -366,18 +469,21 @@ RGY_ERR RGYParallelEnc::checkAllProcessErrors() {
 }
 
 void RGYParallelEnc::encStatusReset(const int id) {
-    if (id >= (int)m_encProcess.size()) {
+    auto proc = getProcess(id);
+    if (!proc) {
         AddMessage(RGY_LOG_ERROR, _T("Invalid parallel id #%d for encStatusReset.\n"), id);
         return;
     }
-    m_encProcess[id]->getEncodeStatus()->reset();
+    proc->getEncodeStatus()->reset();
 }
 
 std::pair<RGY_ERR, const TCHAR *> RGYParallelEnc::isParallelEncPossible(const encParams *prm, const RGYInput *input) {
-    if (input->isPipe() && prm->ctrl.parallelEnc.chunkPipeHandles.size() == 0) {
+    // パイプ入力等でも、親が入力を読み込んで子に分配できる場合は可能
+    const bool fanOut = prm->ctrl.parallelEnc.isParent() && input->parallelEncFanOutSupported();
+    if (input->isPipe() && prm->ctrl.parallelEnc.chunkPipeHandles.size() == 0 && !fanOut) {
         return { RGY_ERR_UNSUPPORTED, _T("Parallel encoding is not possible: input is pipe.\n") };
     }
-    if (!input->seekable() && prm->ctrl.parallelEnc.chunkPipeHandles.size() == 0) {
+    if (!input->seekable() && prm->ctrl.parallelEnc.chunkPipeHandles.size() == 0 && !fanOut) {
         return { RGY_ERR_UNSUPPORTED, _T("Parallel encoding is not possible: input does not support parallel encoding or input is not seekable.\n") };
     }
     if (!input->timestampStable()) {
@@ -478,6 +584,12 @@ encParams RGYParallelEnc::genPEParam(const int ip, const encParams *prm, rgy_rat
     prmParallel.common.outReplayCodec = RGY_CODEC_UNKNOWN;
     prmParallel.common.outReplayFile.clear();
     prmParallel.common.seekRatio = ip / (float)prmParallel.ctrl.parallelEnc.chunks;
+    if (m_fanOutInput) {
+        // 親が読み込んだ入力を分配するので、子ではseekしない (終了位置は親の読み込みで反映済み)
+        prmParallel.common.seekRatio = 0.0f;
+        prmParallel.common.seekSec = 0.0f;
+        prmParallel.common.seekToSec = 0.0f;
+    }
     prmParallel.common.timebase = outputTimebase; // timebaseがずれると致命的なので、強制的に上書きする
     prmParallel.common.dynamicHdr10plusJson.clear(); // hdr10plusのファイルからの読み込みは親プロセスでmux時に行う
     prmParallel.common.doviRpuFile.clear(); // doviRpuのファイルからの読み込みは親プロセスでmux時に行う
@@ -507,11 +619,11 @@ encParams RGYParallelEnc::genPEParam(const int ip, const encParams *prm, rgy_rat
     return prmParallel;
 }
 
-RGY_ERR RGYParallelEnc::startChunkProcess(const int ip, const encParams *prm, int64_t parentFirstKeyPts, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor) {
+RGY_ERR RGYParallelEnc::startChunkProcess(const int ip, const encParams *prm, int64_t parentFirstKeyPts, rgy_rational<int> outputTimebase, const bool delayChildSync, CPerfMonitor *perfMonitor, std::unique_ptr<RGYInputChunk> inputChunk, std::unique_ptr<RGYParallelEncProcess>& process) {
     const auto tmpfile = prm->common.outputFilename + _T(".pe") + std::to_tstring(ip);
     const auto peParam = genPEParam(ip, prm, outputTimebase, delayChildSync, tmpfile);
-    auto process = std::make_unique<RGYParallelEncProcess>(ip, tmpfile, m_log);
-    if (auto err = process->startThread(peParam, perfMonitor); err != RGY_ERR_NONE) {
+    process = std::make_unique<RGYParallelEncProcess>(ip, tmpfile, m_log);
+    if (auto err = process->startThread(peParam, perfMonitor, std::move(inputChunk)); err != RGY_ERR_NONE) {
         AddMessage(RGY_LOG_ERROR, _T("Failed to run PE%d: %s.\n"), ip, get_err_mes(err));
         return err;
     }
@@ -534,100 +646,196 @@ RGY_ERR RGYParallelEnc::startChunkProcess(const int ip, const encParams *prm, in
         }
     }
     AddMessage(RGY_LOG_DEBUG, _T("PE%d: Got first key pts: raw %lld, offset %lld.\n"), ip, firstKeyPts, firstKeyPts - parentFirstKeyPts);
-    encStatus->addChildStatus({ 1.0f / prm->ctrl.parallelEnc.parallelCount, process->getEncodeStatus() });
-
-    AddMessage(RGY_LOG_DEBUG, _T("Started encoder PE%d.\n"), ip);
-    m_encProcess.push_back(std::move(process));
     return RGY_ERR_NONE;
 }
 
-RGY_ERR RGYParallelEnc::startParallelThreads(const encParams *prm, const RGYInput *input, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor) {
-    const auto parentFirstKeyPts = input->GetVideoFirstKeyPts();
-    m_encProcess.clear();
-    // とりあえず、並列数分起動する
-    int startId = 0;
-    for (; startId < prm->ctrl.parallelEnc.parallelCount; startId++) {
-        if (auto err = startChunkProcess(startId, prm, parentFirstKeyPts, outputTimebase, delayChildSync, encStatus, perfMonitor); err != RGY_ERR_NONE) {
-            return err;
+// 次のチャンクを起動し、ひとつ前のチャンクにその最初のキーフレームのptsを終了時刻として転送する (これでひとつ前のチャンクのエンコードが開始される)
+// 起動したチャンクは終了時刻の転送待ちのまま、m_encProcessの末尾に追加される
+// 分割位置はseek後の最初のキーフレームとなるので、ひとつ前のチャンクと同じキーフレームから開始となったチャンクはスキップする
+// 起動できるチャンクがもうない場合は、最後のチャンクに終了時刻(=終わりまで)を転送し、RGY_ERR_MORE_DATAを返す
+// 親が入力を分配する場合は、チャンク分のフレームを読み込んでから起動し、入力の終端に達したところでチャンク数が確定する
+RGY_ERR RGYParallelEnc::startNextChunk(const encParams *prm, int64_t parentFirstKeyPts, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor) {
+    auto prevProcess = (m_encProcess.size() > 0) ? m_encProcess.back().get() : nullptr;
+    while (m_nextChunkId < m_chunks && !m_thParallelRunAbort) {
+        std::unique_ptr<RGYInputChunk> inputChunk;
+        if (m_fanOutInput) {
+            if (m_fanOutEOF) {
+                m_chunks = m_nextChunkId;
+                setFanOutChildWeight(encStatus);
+                break;
+            }
+            inputChunk = std::make_unique<RGYInputChunk>(m_fanOutFrames);
+            auto err = m_fanOutInput->parallelEncFanOut(inputChunk.get(), fanOutChunkLimit(prm));
+            if (err == RGY_ERR_MORE_DATA) {
+                m_fanOutEOF = true;
+            } else if (err == RGY_ERR_ABORTED) {
+                return err;
+            } else if (err == RGY_ERR_NOT_ENOUGH_BUFFER) {
+                // まだ子に分配していなければ、呼び出し元で並列エンコードを無効化して続行する
+                AddMessage(inputFannedOut() ? RGY_LOG_ERROR : RGY_LOG_WARN,
+                    _T("Input for PE%d does not fit in the fan-out buffer, increase fanout-mem of --parallel%s.\n"),
+                    m_nextChunkId, inputFannedOut() ? _T("") : _T(" (parallel encoding will be disabled)"));
+                return err;
+            } else if (err != RGY_ERR_NONE) {
+                AddMessage(RGY_LOG_ERROR, _T("Failed to read input for PE%d: %s.\n"), m_nextChunkId, get_err_mes(err));
+                return err;
+            }
+            if (inputChunk->frames() == 0) {
+                m_chunks = m_nextChunkId;
+                setFanOutChildWeight(encStatus);
+                break;
+            }
+            m_fanOutFrames += inputChunk->frames();
+            AddMessage(RGY_LOG_DEBUG, _T("Read input for PE%d: frame %d - %d.\n"), m_nextChunkId, inputChunk->startFrameId(), m_fanOutFrames - 1);
         }
-
-        // 起動したプロセスの最初のキーフレームはひとつ前のプロセスのエンコード終了時刻
-        if (startId > 0) {
-            // ひとつ前のプロセスの終了時刻として転送
-            const auto firstKeyPts = m_encProcess[startId]->getVideoFirstKeyPts();
-            AddMessage(RGY_LOG_DEBUG, _T("Send PE%d end key pts %lld.\n"), startId - 1, firstKeyPts);
-            auto err = m_encProcess[startId-1]->sendEndPts(firstKeyPts);
-            if (err != RGY_ERR_NONE) {
-                AddMessage(RGY_LOG_ERROR, _T("Failed to send end pts to PE%d: %s.\n"), startId, get_err_mes(err));
+        const int ip = m_nextChunkId++;
+        const int chunkFrames = (inputChunk) ? inputChunk->frames() : 0;
+        std::unique_ptr<RGYParallelEncProcess> process;
+        auto err = startChunkProcess(ip, prm, parentFirstKeyPts, outputTimebase, delayChildSync, perfMonitor, std::move(inputChunk), process);
+        if (err != RGY_ERR_NONE) {
+            process->close(true);
+            if (!prevProcess || prm->ctrl.parallelEnc.chunkPipeHandles.size() > 0 || m_fanOutInput) { // 最初のチャンクが起動できない場合やチャンクごとに入力が異なる場合はエラー
+                return err;
+            }
+            // 以降のチャンクは起動せず、ひとつ前のチャンクで最後までエンコードする
+            AddMessage(RGY_LOG_WARN, _T("Failed to start chunk PE%d: %s, remaining part will be encoded by PE%d.\n"), ip, get_err_mes(err), prevProcess->id());
+            m_chunkSkipped += m_chunks - ip;
+            m_nextChunkId = m_chunks;
+            break;
+        }
+        const auto firstKeyPts = process->getVideoFirstKeyPts();
+        if (prevProcess && firstKeyPts <= prevProcess->getVideoFirstKeyPts()) {
+            AddMessage(RGY_LOG_DEBUG, _T("PE%d: first key pts %lld is same as PE%d, skip this chunk.\n"), ip, firstKeyPts, prevProcess->id());
+            process->close(true);
+            m_chunkSkipped++;
+            continue;
+        }
+        if (prevProcess) {
+            AddMessage(RGY_LOG_DEBUG, _T("Send PE%d end key pts %lld.\n"), prevProcess->id(), firstKeyPts);
+            if ((err = prevProcess->sendEndPts(firstKeyPts)) != RGY_ERR_NONE) {
+                AddMessage(RGY_LOG_ERROR, _T("Failed to send end pts to PE%d: %s.\n"), prevProcess->id(), get_err_mes(err));
+                process->close(true);
                 return err;
             }
         }
+        // 親が入力を分配する場合は総フレーム数が分からないので、担当割合は入力の終端に達したところで設定する
+        // (それまでは完了したチャンク数から進捗を推定する)
+        encStatus->addChildStatus({ (m_fanOutInput) ? 0.0 : 1.0 / m_chunks, process->getEncodeStatus() });
+        if (m_fanOutInput) {
+            m_fanOutChunkFrames.push_back(chunkFrames);
+        }
+        AddMessage(RGY_LOG_DEBUG, _T("Started encoder PE%d.\n"), ip);
+        std::lock_guard<std::mutex> lock(m_mtxEncProcess);
+        m_encProcess.push_back(std::move(process));
+        m_cvEncProcess.notify_all();
+        return RGY_ERR_NONE;
     }
-    // 並列数とチャック数が同じなら、これで起動は完了
-    if (prm->ctrl.parallelEnc.parallelCount >= prm->ctrl.parallelEnc.chunks) {
-        //最後のプロセスの終了時刻(=終わりまで)を転送
-        AddMessage(RGY_LOG_DEBUG, _T("Send PE%d end key pts -1.\n"), (int)m_encProcess.size() - 1);
-        auto err = m_encProcess.back()->sendEndPts(-1);
-        if (err != RGY_ERR_NONE) {
-            AddMessage(RGY_LOG_ERROR, _T("Failed to send end pts to encoder PE%d: %s.\n"), (int)m_encProcess.size() - 1, get_err_mes(err));
+    if (m_thParallelRunAbort) {
+        return RGY_ERR_ABORTED;
+    }
+    //最後のチャンクの終了時刻(=終わりまで)を転送
+    if (prevProcess) {
+        AddMessage(RGY_LOG_DEBUG, _T("Send PE%d end key pts -1.\n"), prevProcess->id());
+        if (auto err = prevProcess->sendEndPts(-1); err != RGY_ERR_NONE) {
+            AddMessage(RGY_LOG_ERROR, _T("Failed to send end pts to encoder PE%d: %s.\n"), prevProcess->id(), get_err_mes(err));
             return err;
         }
-    } else {
-        // プロセス起動用のスレッドを開始する
-        m_thParallelRun = std::thread([this](int startId, const int parallelCount, const int chunkCount,
-            encParams prm, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor) {
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("All chunks started: %d chunks (%d skipped).\n"), (int)m_encProcess.size(), m_chunkSkipped);
+    std::lock_guard<std::mutex> lock(m_mtxEncProcess);
+    m_chunkScheduleFin = true;
+    m_cvEncProcess.notify_all();
+    return RGY_ERR_MORE_DATA;
+}
+
+void RGYParallelEnc::updateChunkProgress(EncodeStatus *encStatus) {
+    const auto finished = std::count_if(m_encProcess.begin(), m_encProcess.end(), [](const auto& proc) {
+        return proc->processStatus() == RGYParallelEncProcessStatus::Finished;
+    });
+    // 親が入力を分配する場合、入力の終端に達するまでは総チャンク数は不明
+    encStatus->setChunkProgress((int)finished, (m_chunks == std::numeric_limits<int>::max()) ? 0 : m_chunks - m_chunkSkipped);
+}
 
-            int runCount = startId-1; // 実行したチャック数
+// 親が入力を分配する場合に、総フレーム数が確定したところで、各チャンクの担当割合をフレーム数の比率で設定する
+void RGYParallelEnc::setFanOutChildWeight(EncodeStatus *encStatus) {
+    if (m_fanOutFrames <= 0) {
+        return;
+    }
+    std::vector<double> weights;
+    for (const auto frames : m_fanOutChunkFrames) {
+        weights.push_back(frames / (double)m_fanOutFrames);
+    }
+    encStatus->setChildStatusWeight(weights);
+}
 
-            // とりあえず並列数分開始準備
-            for (; startId < chunkCount; startId++) {
-                if (auto err = startChunkProcess(startId, &prm, -1, outputTimebase, delayChildSync, encStatus, perfMonitor); err != RGY_ERR_NONE) {
-                    return err;
+RGY_ERR RGYParallelEnc::startParallelThreads(const encParams *prm, const RGYInput *input, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor) {
+    const auto parentFirstKeyPts = input->GetVideoFirstKeyPts();
+    m_encProcess.clear();
+    m_nextChunkId = 0;
+    m_chunkSkipped = 0;
+    m_chunkScheduleFin = false;
+    m_thParallelRunErr = RGY_ERR_NONE;
+    // チャンクは終了時刻(=次のチャンクの最初のキーフレーム)が決まった時点でエンコードを開始するので、
+    // エンコード中のチャンクに加えて、次のチャンクを1つだけ先行して起動しておく
+    // まずは並列数分のチャンクのエンコードを開始する (ここでのエラーは並列処理を無効化して続行する)
+    for (int i = 0; i <= prm->ctrl.parallelEnc.parallelCount; i++) {
+        auto err = startNextChunk(prm, parentFirstKeyPts, outputTimebase, delayChildSync, encStatus, perfMonitor);
+        if (err == RGY_ERR_MORE_DATA) {
+            break;
+        } else if (err != RGY_ERR_NONE) {
+            return err;
+        }
+    }
+    if (m_chunkScheduleFin) {
+        // チャンク数が並列数以下なら、これで起動は完了
+        return RGY_ERR_NONE;
+    }
+    // 残りのチャンクは、エンコード中のチャンクが終了するたびに順に開始する
+    m_thParallelRun = std::thread([this](encParams prm, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor) {
+        const int parallelCount = prm.ctrl.parallelEnc.parallelCount;
+        while (!m_thParallelRunAbort) {
+            updateChunkProgress(encStatus);
+            // 実行中のプロセスを取得
+            std::vector<HANDLE> eventProcessFinished;
+            for (const auto& proc : m_encProcess) {
+                if (proc->processStatus() == RGYParallelEncProcessStatus::Running) {
+                    eventProcessFinished.push_back(proc->eventProcessFinished());
                 }
             }
-
-            while (!m_thParallelRunAbort && runCount < chunkCount) {
-                // 実行中のプロセス数を取得
-                const auto runningCount = std::count_if(m_encProcess.begin(), m_encProcess.end(), [](const auto& proc) {
-                    return proc->processStatus() == RGYParallelEncProcessStatus::Running;
-                });
-                if (runningCount < parallelCount) {
-                    // 実行中のプロセス数が並列数より少ない場合、新しいプロセスを起動する
-                    if (runCount < chunkCount-1) {
-                        // ひとつ前のプロセスの終了時刻として転送
-                        const auto firstKeyPts = m_encProcess[runCount+1]->getVideoFirstKeyPts();
-                        AddMessage(RGY_LOG_DEBUG, _T("Send PE%d end key pts %lld.\n"), runCount, firstKeyPts);
-                        auto err = m_encProcess[runCount]->sendEndPts(firstKeyPts);
-                        if (err != RGY_ERR_NONE) {
-                            AddMessage(RGY_LOG_ERROR, _T("Failed to send end pts to PE%d: %s.\n"), startId, get_err_mes(err));
-                            return err;
-                        }
-                    } else {
-                        auto err = m_encProcess.back()->sendEndPts(-1);
-                        if (err != RGY_ERR_NONE) {
-                            AddMessage(RGY_LOG_ERROR, _T("Failed to send end pts to encoder PE%d: %s.\n"), (int)m_encProcess.size() - 1, get_err_mes(err));
-                            return err;
-                        }
-                    }
-                    runCount++; // 実行したチャック数をインクリメント
-                } else {
-                    // 実行中のプロセス数が並列数と同じ場合、いずれかのプロセスが終了するまで待つ
-                    std::vector<HANDLE> eventProcessFinished;
-                    for (const auto& proc : m_encProcess) {
-                        if (proc->processStatus() != RGYParallelEncProcessStatus::Finished) {
-                            eventProcessFinished.push_back(proc->eventProcessFinished());
-                        }
+            if (!m_chunkScheduleFin && (int)eventProcessFinished.size() < parallelCount) {
+                // 実行中のプロセス数が並列数より少ない場合、次のチャンクを起動し、先行して起動していたチャンクのエンコードを開始する
+                auto err = startNextChunk(&prm, -1, outputTimebase, delayChildSync, encStatus, perfMonitor);
+                if (err == RGY_ERR_ABORTED) {
+                    break;
+                } else if (err != RGY_ERR_NONE && err != RGY_ERR_MORE_DATA) {
+                    AddMessage(RGY_LOG_ERROR, _T("Failed to start next chunk: %s.\n"), get_err_mes(err));
+                    // 終了時刻の転送待ちのチャンクが待機し続けないよう、終わりまでとして開始させておく
+                    // エラーはcheckAllProcessErrors()で返して、エンコードをエラー終了させる
+                    if (m_encProcess.size() > 0) {
+                        m_encProcess.back()->sendEndPts(-1);
                     }
-                    WaitForMultipleObjects((uint32_t)eventProcessFinished.size(), eventProcessFinished.data(), FALSE, 16);
+                    std::lock_guard<std::mutex> lock(m_mtxEncProcess);
+                    m_thParallelRunErr = err;
+                    break;
                 }
+            } else if (eventProcessFinished.size() > 0) {
+                // 実行中のプロセス数が並列数と同じ場合、いずれかのプロセスが終了するまで待つ
+                WaitForMultipleObjects((uint32_t)eventProcessFinished.size(), eventProcessFinished.data(), FALSE, 16);
+            } else if (m_chunkScheduleFin) {
+                break; // すべてのチャンクが終了した
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(16));
             }
-            return RGY_ERR_NONE;
-        }, startId, prm->ctrl.parallelEnc.parallelCount, prm->ctrl.parallelEnc.chunks, *prm, outputTimebase, delayChildSync, encStatus, perfMonitor);
-    }
+        }
+        updateChunkProgress(encStatus);
+        std::lock_guard<std::mutex> lock(m_mtxEncProcess);
+        m_chunkScheduleFin = true;
+        m_cvEncProcess.notify_all();
+    }, *prm, outputTimebase, delayChildSync, encStatus, perfMonitor);
     return RGY_ERR_NONE;
 }
 
-RGY_ERR RGYParallelEnc::parallelRun(encParams *prm, const RGYInput *input, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor) {
+RGY_ERR RGYParallelEnc::parallelRun(encParams *prm, RGYInput *input, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor) {
     if (!prm->ctrl.parallelEnc.isEnabled()) {
         return RGY_ERR_NONE;
     }
@@ -639,15 +847,26 @@ RGY_ERR RGYParallelEnc::parallelRun(encParams *prm, const RGYInput *input, rgy_r
     if (prm->ctrl.parallelEnc.chunkPipeHandles.size() > 0) {
         prm->ctrl.parallelEnc.chunks = (int)prm->ctrl.parallelEnc.chunkPipeHandles.size();
     } else if (prm->ctrl.parallelEnc.chunks <= 0) {
-        prm->ctrl.parallelEnc.chunks = prm->ctrl.parallelEnc.parallelCount;
+        prm->ctrl.parallelEnc.chunks = prm->ctrl.parallelEnc.parallelCount * RGY_PARALLEL_ENC_CHUNKS_PER_PROCESS;
     }
     m_chunks = prm->ctrl.parallelEnc.chunks;
-    AddMessage(RGY_LOG_DEBUG, _T("parallelRun: parallel count %d, chunks %d\n"), prm->ctrl.parallelEnc.parallelCount, prm->ctrl.parallelEnc.chunks);
+    // パイプ入力等で子が個別に入力を開けない場合は、親が入力を読み込んでチャンクごとに子へ分配する
+    // この場合、総フレーム数が分からないので、チャンク数は入力の終端に達するまで決まらない
+    m_fanOutInput = (prm->ctrl.parallelEnc.chunkPipeHandles.size() == 0
+        && (input->isPipe() || !input->seekable())
+        && input->parallelEncFanOutSupported()) ? input : nullptr;
+    m_fanOutFrames = 0;
+    m_fanOutEOF = false;
+    m_fanOutChunkFrames.clear();
+    if (m_fanOutInput) {
+        m_chunks = std::numeric_limits<int>::max();
+    }
+    AddMessage(RGY_LOG_DEBUG, _T("parallelRun: parallel count %d, chunks %d%s\n"), prm->ctrl.parallelEnc.parallelCount, prm->ctrl.parallelEnc.chunks, (m_fanOutInput) ? _T(" (input fan-out)") : _T(""));
     auto [sts, errmes ] = isParallelEncPossible(prm, input);
     if (sts != RGY_ERR_NONE
         || (sts = startParallelThreads(prm, input, outputTimebase, delayChildSync, encStatus, perfMonitor)) != RGY_ERR_NONE) {
-        // chunkPipeHandlesの場合は、無効にして続行はできないので、エラー終了
-        if (prm->ctrl.parallelEnc.chunkPipeHandles.size() > 0) {
+        // chunkPipeHandlesの場合や、親が入力を読み込んで分配済みの場合は、無効にして続行はできないので、エラー終了
+        if (prm->ctrl.parallelEnc.chunkPipeHandles.size() > 0 || inputFannedOut()) {
             AddMessage(RGY_LOG_ERROR, _T("Failed to start parallel threads: %s.\n"), get_err_mes(sts));
             return RGY_ERR_UNKNOWN;
         }
@@ -661,5 +880,7 @@ RGY_ERR RGYParallelEnc::parallelRun(encParams *prm, const RGYInput *input, rgy_r
         prm->ctrl.parallelEnc.parallelId = -1;
         return sts;
     }
+    // 子プロセスはそれぞれ入力の一部しか読み込まないので、seek用のindexファイルは親が作成する
+    input->startSeekIndexBuild();
     return RGY_ERR_NONE;
 }
\ No newline at end of file
@@ -32,6 +32,7 @@
 #include <thread>
 #include <optional>
 #include <mutex>
+#include <condition_variable>
 #include "rgy_osdep.h"
 #include "rgy_err.h"
 #include "rgy_event.h"
@@ -40,6 +41,7 @@
 #include "rgy_queue.h"
 
 struct RGYOutputRawPEExtHeader;
+class RGYOutputRawPERing;
 class EncodeStatus;
 struct EncodeStatusData;
 class RGYInput;
@@ -103,8 +105,9 @@ struct RGYParallelEncSendData {
     int64_t videoFinKeyPts;  // 子がエンコードすべき最後のpts(このptsを含まない)
     
     RGYQueueMPMP<RGYOutputRawPEExtHeader*> *qFirstProcessData; // 最初の子エンコードから親へエンコード結果を転送するキュー
-    RGYQueueMPMP<RGYOutputRawPEExtHeader*> *qFirstProcessDataFree; // 転送し終わった(不要になった)ポインタを回収するキュー
-    RGYQueueMPMP<RGYOutputRawPEExtHeader*> *qFirstProcessDataFreeLarge; // 転送し終わった(不要になった)ポインタを回収するキュー(大きいサイズ用)
+    RGYQueueBounded<RGYOutputRawPEExtHeader*, RGYQueueBoundedMode::SPSC> *qFirstProcessDataFree; // 転送し終わった(不要になった)ポインタを回収するキュー
+    RGYQueueBounded<RGYOutputRawPEExtHeader*, RGYQueueBoundedMode::SPSC> *qFirstProcessDataFreeLarge; // 転送し終わった(不要になった)ポインタを回収するキュー(大きいサイズ用)
+    RGYOutputRawPERing *peRing; // cache=ringの場合に子から親へエンコード結果を転送するリングバッファ
 
     std::shared_ptr<RGYGPUCounterWin> perfCounter; // 親 → 子にperfCounterのインスタンスを渡す
 
@@ -119,6 +122,7 @@ struct RGYParallelEncSendData {
         qFirstProcessData(nullptr),
         qFirstProcessDataFree(nullptr),
         qFirstProcessDataFreeLarge(nullptr),
+        peRing(nullptr),
         perfCounter() {};
 };
 
@@ -126,7 +130,7 @@ class RGYParallelEncProcess {
 public:
     RGYParallelEncProcess(const int id, const tstring& tmpfile, std::shared_ptr<RGYLog> log);
     ~RGYParallelEncProcess();
-    RGY_ERR startThread(const encParams& peParams, CPerfMonitor *perfMonitor);
+    RGY_ERR startThread(const encParams& peParams, CPerfMonitor *perfMonitor, std::unique_ptr<RGYInputChunk> inputChunk);
     RGY_ERR run(const encParams& peParams);
     int id() const { return m_id; }
     RGY_ERR sendEndPts(const int64_t endPts);
@@ -173,8 +177,10 @@ protected:
     int m_id;
     std::unique_ptr<encCore> m_process;
     std::unique_ptr<RGYQueueMPMP<RGYOutputRawPEExtHeader*>> m_qFirstProcessData;
-    std::unique_ptr<RGYQueueMPMP<RGYOutputRawPEExtHeader*>> m_qFirstProcessDataFree;
-    std::unique_ptr<RGYQueueMPMP<RGYOutputRawPEExtHeader*>> m_qFirstProcessDataFreeLarge;
+    std::unique_ptr<RGYQueueBounded<RGYOutputRawPEExtHeader*, RGYQueueBoundedMode::SPSC>> m_qFirstProcessDataFree;
+    std::unique_ptr<RGYQueueBounded<RGYOutputRawPEExtHeader*, RGYQueueBoundedMode::SPSC>> m_qFirstProcessDataFreeLarge;
+    std::unique_ptr<RGYOutputRawPERing> m_peRing;
+    std::unique_ptr<RGYInputChunk> m_inputChunk; // 親が読み込んだチャンク分の入力データ (親が入力を分配する場合)
     RGYParamParallelEncCache m_cacheMode;
     RGYParallelEncSendData m_sendData;
     tstring m_tmpfile;
@@ -190,7 +196,7 @@ public:
     RGYParallelEnc(std::shared_ptr<RGYLog> log);
     virtual ~RGYParallelEnc();
     static std::pair<RGY_ERR, const TCHAR *> isParallelEncPossible(const encParams *prm, const RGYInput *input);
-    RGY_ERR parallelRun(encParams *prm, const RGYInput *input, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor);
+    RGY_ERR parallelRun(encParams *prm, RGYInput *input, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor);
     void close(const bool deleteTempFiles);
     int64_t getVideoEndKeyPts() const { return m_videoEndKeyPts; }
     void setVideoFinished() { m_videoFinished = true; }
@@ -208,9 +214,15 @@ public:
     tstring tmpPath(const int ichunk) const;
     int parallelCount() const { return m_parallelCount; }
     int chunks() const { return m_chunks; }
+    bool waitChunkStarted(const int ichunk); // ichunk番目のチャンクが起動されるまで待機し、そのチャンクが存在するかを返す (false: すべてのチャンクを処理済み)
+    bool inputFannedOut() const { return m_fanOutFrames > 0; } // 親が入力を読み込んで子に分配済みか (並列処理を無効化して続行できない)
 protected:
     encParams genPEParam(const int ip, const encParams *prm, rgy_rational<int> outputTimebase, const bool delayChildSync, const tstring& tmpfile);
-    RGY_ERR startChunkProcess(int ichunk, const encParams *prm, int64_t parentFirstKeyPts, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor);
+    RGY_ERR startChunkProcess(int ichunk, const encParams *prm, int64_t parentFirstKeyPts, rgy_rational<int> outputTimebase, const bool delayChildSync, CPerfMonitor *perfMonitor, std::unique_ptr<RGYInputChunk> inputChunk, std::unique_ptr<RGYParallelEncProcess>& process);
+    RGY_ERR startNextChunk(const encParams *prm, int64_t parentFirstKeyPts, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor);
+    void updateChunkProgress(EncodeStatus *encStatus);
+    void setFanOutChildWeight(EncodeStatus *encStatus);
+    RGYParallelEncProcess *getProcess(const int ichunk) const;
     RGY_ERR startParallelThreads(const encParams *prm, const RGYInput *input, rgy_rational<int> outputTimebase, const bool delayChildSync, EncodeStatus *encStatus, CPerfMonitor *perfMonitor);
     RGY_ERR parallelChild(const encParams *prm, const RGYInput *input);
     RGYParamLogLevel setChildLogLevel(const RGYParamLogLevel& logLevel);
@@ -242,10 +254,20 @@ protected:
     }
 
     int m_id;
-    std::vector<std::unique_ptr<RGYParallelEncProcess>> m_encProcess;
+    std::vector<std::unique_ptr<RGYParallelEncProcess>> m_encProcess; // 起動したチャンク (出力順、末尾は終了時刻の転送待ちの場合がある)
+    mutable std::mutex m_mtxEncProcess;       // m_encProcessへの追加はチャンク起動スレッドから行われる
+    std::condition_variable m_cvEncProcess;  // m_encProcessへの追加/チャンク起動の終了の通知用
+    int m_nextChunkId;       // 次に起動を試みるチャンクのid
+    int m_chunkSkipped;      // 前のチャンクと同じキーフレームから開始となったため、スキップしたチャンク数
+    bool m_chunkScheduleFin; // すべてのチャンクの起動(終了時刻の転送)が完了した
+    RGYInput *m_fanOutInput; // パイプ入力等で、親が入力を読み込んでチャンクごとに子へ分配する場合の入力
+    int m_fanOutFrames;      // 子へ分配したフレーム数
+    bool m_fanOutEOF;        // 分配中に入力の終端に達した
+    std::vector<int> m_fanOutChunkFrames; // 子へ分配した各チャンクのフレーム数 (addChildStatusした順)
     std::shared_ptr<RGYLog> m_log;
     std::thread m_thParallelRun;
     bool m_thParallelRunAbort;
+    RGY_ERR m_thParallelRunErr; // チャンク起動スレッドで発生したエラー (m_mtxEncProcessで保護)
     int64_t m_videoEndKeyPts;
     bool m_videoFinished;
     int m_parallelCount;
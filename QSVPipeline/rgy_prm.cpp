@@ -2301,6 +2301,7 @@ RGYParamCommon::RGYParamCommon() :
     inputRetry(0),
     demuxAnalyzeSec(-1),
     demuxProbesize(-1),
+    inputIndex(),
     inputPixFmtStr(),
     AVMuxTarget(RGY_MUX_NONE),                       //RGY_MUX_xxx
     videoTrack(0),
@@ -2352,8 +2353,11 @@ RGYParamParallelEnc::RGYParamParallelEnc() :
     chunks(0),
     chunkPipeHandles(),
     cacheMode(RGYParamParallelEncCache::Mem),
+    fanOutBufMB(0),
+    chunkSec(0.0f),
     delayChildSync(false),
-    sendData(nullptr) {
+    sendData(nullptr),
+    inputChunk(nullptr) {
 
 };
 bool RGYParamParallelEnc::operator==(const RGYParamParallelEnc &x) const {
@@ -2362,12 +2366,29 @@ bool RGYParamParallelEnc::operator==(const RGYParamParallelEnc &x) const {
         && chunks == x.chunks
         && chunkPipeHandles.size() == x.chunkPipeHandles.size()
         && std::equal(chunkPipeHandles.begin(), chunkPipeHandles.end(), x.chunkPipeHandles.begin())
-        && cacheMode == x.cacheMode;
+        && cacheMode == x.cacheMode
+        && fanOutBufMB == x.fanOutBufMB
+        && chunkSec == x.chunkSec;
 }
 bool RGYParamParallelEnc::operator!=(const RGYParamParallelEnc &x) const {
     return !(*this == x);
 }
 
+RGYParamOutputAsync::RGYParamOutputAsync() :
+    enable(false),
+    directIO(false),
+    preallocMB(0) {
+
+};
+bool RGYParamOutputAsync::operator==(const RGYParamOutputAsync &x) const {
+    return enable == x.enable
+        && directIO == x.directIO
+        && preallocMB == x.preallocMB;
+}
+bool RGYParamOutputAsync::operator!=(const RGYParamOutputAsync &x) const {
+    return !(*this == x);
+}
+
 RGYParamLogOpt::RGYParamLogOpt() : addTime(false), addLogLevel(false), disableColor(false) {}
 
 bool RGYParamLogOpt::operator==(const RGYParamLogOpt &x) const {
@@ -2392,10 +2413,12 @@ RGYParamControl::RGYParamControl() :
     logMuxVidTs(),
     threadOutput(RGY_OUTPUT_THREAD_AUTO),
     threadAudio(RGY_AUDIO_THREAD_AUTO),
+    threadAudioMax(0),
     threadInput(RGY_INPUT_THREAD_AUTO),
     threadParams(),
     procSpeedLimit(0),      //処理速度制限 (0で制限なし)
     taskPerfMonitor(false),   //タスクの処理時間を計測する
+    traceFile(),
     perfMonitorSelect(0),
     perfMonitorSelectMatplot(0),
     perfMonitorInterval(RGY_DEFAULT_PERF_MONITOR_INTERVAL),
@@ -2409,10 +2432,13 @@ RGYParamControl::RGYParamControl() :
     enableOpenCL(true),
     enableVulkan(RGYParamInitVulkan::TargetVendor),
     openclBuildThreads(0),
+    openclCache(false),
+    openclCacheDir(),
     avoidIdleClock(),
     processMonitorDevUsage(false),
     processMonitorDevUsageReset(false),
     outputBufSizeMB(RGY_OUTPUT_BUF_MB_DEFAULT),
+    outputAsync(),
     parallelEnc() {
 
 }
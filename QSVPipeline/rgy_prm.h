@@ -2492,6 +2492,7 @@ struct RGYParamCommon {
     int inputRetry;
     double demuxAnalyzeSec;
     int64_t demuxProbesize;
+    RGYDebugLogFile inputIndex;            //キーフレーム位置等を保存するindexファイル
     tstring inputPixFmtStr;
     int AVMuxTarget;                       //RGY_MUX_xxx
     int videoTrack;
@@ -2551,15 +2552,18 @@ struct RGYParamAvoidIdleClock {
 };
 
 struct RGYParallelEncSendData;
+class RGYInputChunk;
 
 enum class RGYParamParallelEncCache {
     Mem,
     File,
+    Ring, // 固定サイズのリングバッファ経由で渡し、一杯になったらファイルに書き出す
 };
 
 const CX_DESC list_parallel_enc_cache[] = {
     { _T("mem"),  (int)RGYParamParallelEncCache::Mem  },
     { _T("file"), (int)RGYParamParallelEncCache::File },
+    { _T("ring"), (int)RGYParamParallelEncCache::Ring },
     { NULL, 0 }
 };
 
@@ -2579,8 +2583,11 @@ struct RGYParamParallelEnc {
     int chunks; // 分割数
     std::vector<RGYParamParallelEncPipeHandle> chunkPipeHandles; // 各チャンクの先頭のフレームID (raw読み込み時に使用)
     RGYParamParallelEncCache cacheMode;
+    int fanOutBufMB; // 親が入力を読み込んで子に分配する場合に、読み込んだデータを保持するバッファの合計の上限 (MB, 0で自動)
+    float chunkSec; // 親が入力を読み込んで子に分配する場合の、チャンクの目標の長さ (秒, 0で自動)
     bool delayChildSync; // 親-子間のデータやり取りを少し遅らせる
     RGYParallelEncSendData *sendData; // 並列処理時に親-子間のデータやり取り用
+    RGYInputChunk *inputChunk; // 並列処理時に親が読み込んで子に渡す入力データ (パイプ入力等の場合)
     RGYParamParallelEnc();
     bool operator==(const RGYParamParallelEnc &x) const;
     bool operator!=(const RGYParamParallelEnc &x) const;
@@ -2589,6 +2596,15 @@ struct RGYParamParallelEnc {
     bool isEnabled() const { return parallelCount > 1 || parallelCount == -1; }
 };
 
+struct RGYParamOutputAsync {
+    bool enable;     // 出力ファイルへの書き込みを専用スレッドで行う
+    bool directIO;   // O_DIRECTで書き込む (Linuxのみ)
+    int preallocMB;  // あらかじめ確保するファイルの領域 (MB, Linuxのみ)
+    RGYParamOutputAsync();
+    bool operator==(const RGYParamOutputAsync &x) const;
+    bool operator!=(const RGYParamOutputAsync &x) const;
+};
+
 enum class RGYParamInitVulkan {
     Disable,
     TargetVendor,
@@ -2616,10 +2632,12 @@ struct RGYParamControl {
     RGYDebugLogFile logMuxVidTs;
     int threadOutput;
     int threadAudio;
+    int threadAudioMax;      //音声処理に使用するスレッド数の上限 (0で自動)
     int threadInput;
     RGYParamThreads threadParams;
     int procSpeedLimit;      //処理速度制限 (0で制限なし)
     bool taskPerfMonitor;
+    tstring traceFile;            //パイプラインのトレース出力先 (Chrome trace形式)
     int64_t perfMonitorSelect;
     int64_t perfMonitorSelectMatplot;
     int     perfMonitorInterval;
@@ -2633,11 +2651,14 @@ struct RGYParamControl {
     bool enableOpenCL;
     RGYParamInitVulkan enableVulkan;
     int openclBuildThreads;
+    bool openclCache;           //OpenCLのプログラムのバイナリをキャッシュする
+    tstring openclCacheDir;     //OpenCLのプログラムのバイナリのキャッシュの保存先 (空ならデフォルト)
     RGYParamAvoidIdleClock avoidIdleClock;
     bool processMonitorDevUsage;
     bool processMonitorDevUsageReset;
 
     int outputBufSizeMB;         //出力バッファサイズ
+    RGYParamOutputAsync outputAsync; //出力の非同期書き込み
 
     RGYParamParallelEnc parallelEnc;
 
@@ -35,6 +35,10 @@
 #include <climits>
 #include <memory>
 #include <mutex>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <type_traits>
 #include "rgy_arch.h"
 #include "rgy_osdep.h"
 #include "rgy_util.h"
@@ -369,6 +373,411 @@ protected:
 };
 #pragma warning (pop)
 
+enum class RGYQueueBoundedMode {
+    SPSC, //単一スレッドからpush、単一スレッドからpop
+    MPMC, //複数スレッドからpush、複数スレッドからpop
+};
+
+#pragma warning (push)
+#pragma warning (disable: 4324) //アラインメント指定子のために構造体がパッドされました
+//ロックフリーなリングバッファ
+//キューが一杯の場合はpushが待機(あるいは失敗)する
+//待機はRGYのイベントではなく、rgy_atomic_wait (futex/WaitOnAddress)で行い、待機者がいるときのみ通知する
+//modeはテンプレート引数で指定し、SPSCの場合はシーケンス番号のCASを省略した実装となる
+//
+//init(bufSize, maxCapacity)でmaxCapacity > bufSizeとした場合、リングが一杯になるとpush側が2倍の大きさのリングを確保して後ろにつなぎ、
+//pop側は前のリングを読み切ってから次のリングに移る。リングの追加時のみロックをとり、それ以外はロックフリーで動作する
+//使い終わったリングはclear()/close()まで保持するので、他スレッドが参照中のリングが解放されることはない
+template<typename Type, RGYQueueBoundedMode mode = RGYQueueBoundedMode::MPMC>
+class RGYQueueBounded {
+    //要素ごとにはパディングしない (競合するhead/tailやカウンタのみキャッシュラインを分ける)
+    //SPSCではシーケンス番号を使わないので、データのみとする
+    struct cellMPMC {
+        std::atomic<size_t> seq; //MPMC用のシーケンス番号
+        Type data;
+    };
+    struct cellSPSC {
+        Type data;
+    };
+    typedef typename std::conditional<mode == RGYQueueBoundedMode::MPMC, cellMPMC, cellSPSC>::type cell;
+    //MPMCで、このリングにはもう追加しないことを示すheadのフラグ
+    static const size_t SEGMENT_CLOSED = (size_t)1 << (sizeof(size_t) * 8 - 1);
+    struct segment {
+        std::unique_ptr<cell[]> buf;
+        size_t mask;
+        alignas(64) std::atomic<size_t> head;    //次にpushする位置
+                    size_t tailCache;            //SPSCでpush側が最後に読んだtail
+        alignas(64) std::atomic<size_t> tail;    //次にpopする位置
+                    size_t headCache;            //SPSCでpop側が最後に読んだhead
+        alignas(64) std::atomic<segment *> next; //次のリング
+
+        segment(size_t bufSize) : buf(std::make_unique<cell[]>(bufSize)), mask(bufSize - 1), head(0), tailCache(0), tail(0), headCache(0), next(nullptr) {
+            if constexpr (mode == RGYQueueBoundedMode::MPMC) {
+                for (size_t i = 0; i < bufSize; i++) {
+                    buf[i].seq.store(i, std::memory_order_relaxed);
+                }
+            }
+        }
+    };
+public:
+    RGYQueueBounded() :
+        m_segments(), m_growMtx(), m_capacity(0), m_keepLength(0),
+        m_pushSeg(nullptr), m_pushCount(0), m_waitPop(0),
+        m_popSeg(nullptr), m_popCount(0), m_waitPush(0) {
+    }
+    ~RGYQueueBounded() {
+        close();
+    }
+    //キューを初期化する
+    //capacityは2の累乗に切り上げる
+    void init(size_t capacity) {
+        init(capacity, capacity);
+    }
+    //キューを初期化する
+    //bufSizeは最初に確保するリングのサイズ (2の累乗に切り上げる)
+    //maxCapacityはキューに格納できる最大のデータ数で、bufSizeより大きい場合はリングを追加して伸長する
+    void init(size_t bufSize, size_t maxCapacity) {
+        close();
+        size_t size = 2;
+        while (size < std::min(bufSize, maxCapacity)) size <<= 1;
+        m_segments.push_back(std::make_unique<segment>(size));
+        m_pushSeg = m_segments.back().get();
+        m_popSeg = m_segments.back().get();
+        m_capacity = (maxCapacity == bufSize) ? size : maxCapacity;
+        m_keepLength = 0;
+        m_pushCount = 0;
+        m_popCount = 0;
+    }
+    //キューのデータをクリアする際に、指定した関数で内部データを開放してから、データをクリアする
+    //push/popしているスレッドがない状態で呼ぶこと
+    template<typename Func>
+    void clear(Func deleter) {
+        const auto keepLength = m_keepLength.exchange(0);
+        Type data;
+        while (try_pop(&data)) {
+            deleter(&data);
+        }
+        m_keepLength = keepLength;
+        //読み切ったリングのうち、最後(最大)のもの以外は破棄する
+        if (m_segments.size() > 1) {
+            auto last = std::move(m_segments.back());
+            m_segments.clear();
+            m_segments.push_back(std::move(last));
+            m_pushSeg = m_segments.back().get();
+            m_popSeg = m_segments.back().get();
+        }
+    }
+    //キューのリソースを破棄する
+    void close() {
+        m_pushSeg = nullptr;
+        m_popSeg = nullptr;
+        m_segments.clear();
+        m_capacity = 0;
+        m_keepLength = 0;
+        m_pushCount = 0;
+        m_popCount = 0;
+    }
+    template<typename Func>
+    void close(Func deleter) {
+        if (m_popSeg) {
+            clear(deleter);
+        }
+        close();
+    }
+    //キューの最大サイズを取得する
+    size_t capacity() const {
+        return m_capacity.load(std::memory_order_relaxed);
+    }
+    //キューの最大サイズを設定する
+    //確保済みのリングより大きくした場合は、必要になった時点でリングを追加する
+    void set_capacity(size_t capacity) {
+        m_capacity.store(capacity, std::memory_order_relaxed);
+        wake_all(); //push側の待機を解除して再確認させる
+    }
+    //キューが一定の長さに達しないとpopできないように設定する
+    //MPMCの場合、判定に使うsizeは概算値となる
+    void set_keep_length(size_t keepLength) {
+        m_keepLength.store(keepLength, std::memory_order_relaxed);
+        wake_all(); //pop側の待機を解除して再確認させる
+    }
+    size_t get_keep_length() const {
+        return m_keepLength.load(std::memory_order_relaxed);
+    }
+    //キューのsizeを取得する (他スレッドが操作中の場合は概算値)
+    size_t size() const {
+        const uint32_t popCount = m_popCount.load(std::memory_order_acquire);
+        const uint32_t pushCount = m_pushCount.load(std::memory_order_acquire);
+        //pushの完了の計上より先にpopが計上されることがあるので、負になる場合は0とする
+        const uint32_t diff = pushCount - popCount;
+        return (diff > (uint32_t)INT32_MAX) ? 0 : (size_t)diff;
+    }
+    bool empty() const {
+        return size() == 0;
+    }
+    //キューに空きがあれば押し込む、一杯ならfalseを返す
+    //リングを追加した直後は、前のリングの残りの分だけmaxCapacityを超えることがある
+    template<typename T>
+    bool try_push(T&& in) {
+        if constexpr (mode == RGYQueueBoundedMode::SPSC) {
+            segment *seg = m_pushSeg.load(std::memory_order_relaxed);
+            if (!check_capacity(seg)) {
+                return false;
+            }
+            size_t head = seg->head.load(std::memory_order_relaxed);
+            if (head - seg->tailCache > seg->mask
+                && head - (seg->tailCache = seg->tail.load(std::memory_order_acquire)) > seg->mask) {
+                if (!(seg = grow(seg))) {
+                    return false;
+                }
+                head = seg->head.load(std::memory_order_relaxed);
+            }
+            seg->buf[head & seg->mask].data = std::forward<T>(in);
+            seg->head.store(head + 1, std::memory_order_release);
+        } else {
+            segment *seg = m_pushSeg.load(std::memory_order_acquire);
+            if (!check_capacity(seg)) {
+                return false;
+            }
+            size_t head = seg->head.load(std::memory_order_relaxed);
+            cell *target = nullptr;
+            for (;;) {
+                if (head & SEGMENT_CLOSED) {
+                    //次のリングに移る (closeする前にnextを設定しているので、nullptrにはならない)
+                    seg = seg->next.load(std::memory_order_acquire);
+                    head = seg->head.load(std::memory_order_relaxed);
+                    continue;
+                }
+                target = &seg->buf[head & seg->mask];
+                const size_t seq = target->seq.load(std::memory_order_acquire);
+                const intptr_t diff = (intptr_t)seq - (intptr_t)head;
+                if (diff == 0) {
+                    if (seg->head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    if (!(seg = grow(seg))) {
+                        return false; //一杯
+                    }
+                    head = seg->head.load(std::memory_order_relaxed);
+                } else {
+                    head = seg->head.load(std::memory_order_relaxed);
+                }
+            }
+            target->data = std::forward<T>(in);
+            target->seq.store(head + 1, std::memory_order_release);
+        }
+        m_pushCount.fetch_add(1, std::memory_order_seq_cst);
+        notify(m_pushCount, m_waitPop);
+        return true;
+    }
+    //キューが空でなければ先頭のデータを取り出す、空ならfalseを返す
+    //pnSizeには取り出す前のキューのsizeを返す
+    bool try_pop(Type *out, size_t *pnSize = nullptr) {
+        const size_t keepLength = m_keepLength.load(std::memory_order_relaxed);
+        if (keepLength > 0 || pnSize) {
+            const auto nSize = size();
+            if (pnSize) *pnSize = nSize;
+            if (nSize <= keepLength) {
+                return false;
+            }
+        }
+        if constexpr (mode == RGYQueueBoundedMode::SPSC) {
+            segment *seg = m_popSeg.load(std::memory_order_relaxed);
+            size_t tail = seg->tail.load(std::memory_order_relaxed);
+            while (tail == seg->headCache && tail == (seg->headCache = seg->head.load(std::memory_order_acquire))) {
+                //push側は次のリングをつないだ後は前のリングに追加しないので、
+                //nextの取得後にもう一度空であることを確認できれば次のリングに移ってよい
+                segment *next = seg->next.load(std::memory_order_acquire);
+                if (!next) {
+                    return false;
+                }
+                if (tail != (seg->headCache = seg->head.load(std::memory_order_acquire))) {
+                    break;
+                }
+                seg = next;
+                m_popSeg.store(seg, std::memory_order_relaxed);
+                tail = seg->tail.load(std::memory_order_relaxed);
+            }
+            *out = std::move(seg->buf[tail & seg->mask].data);
+            seg->tail.store(tail + 1, std::memory_order_release);
+        } else {
+            segment *seg = m_popSeg.load(std::memory_order_acquire);
+            size_t tail = seg->tail.load(std::memory_order_relaxed);
+            cell *target = nullptr;
+            for (;;) {
+                target = &seg->buf[tail & seg->mask];
+                const size_t seq = target->seq.load(std::memory_order_acquire);
+                const intptr_t diff = (intptr_t)seq - (intptr_t)(tail + 1);
+                if (diff == 0) {
+                    if (seg->tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    //closeされたリングを最後まで読み切っていれば、次のリングに移る
+                    const size_t head = seg->head.load(std::memory_order_acquire);
+                    if ((head & SEGMENT_CLOSED) == 0 || (head & ~SEGMENT_CLOSED) != tail) {
+                        return false; //空
+                    }
+                    segment *next = seg->next.load(std::memory_order_acquire);
+                    m_popSeg.compare_exchange_strong(seg, next, std::memory_order_acq_rel);
+                    seg = m_popSeg.load(std::memory_order_acquire);
+                    tail = seg->tail.load(std::memory_order_relaxed);
+                } else {
+                    tail = seg->tail.load(std::memory_order_relaxed);
+                }
+            }
+            *out = std::move(target->data);
+            target->seq.store(tail + seg->mask + 1, std::memory_order_release);
+        }
+        m_popCount.fetch_add(1, std::memory_order_seq_cst);
+        notify(m_popCount, m_waitPush);
+        return true;
+    }
+    //先頭からindex番目のデータへのポインタを返す (取り出しはしない)
+    //indexの位置にデータがなければnullptrを返す
+    // !! pop側のスレッドが1つの場合に、pop側のスレッドからのみ有効 !!
+    Type *get(size_t index) {
+        for (segment *seg = m_popSeg.load(std::memory_order_acquire); seg; seg = seg->next.load(std::memory_order_acquire)) {
+            const size_t tail = seg->tail.load(std::memory_order_relaxed);
+            const size_t count = (seg->head.load(std::memory_order_acquire) & ~SEGMENT_CLOSED) - tail;
+            if (index < count) {
+                cell *target = &seg->buf[(tail + index) & seg->mask];
+                if constexpr (mode == RGYQueueBoundedMode::MPMC) {
+                    if (target->seq.load(std::memory_order_acquire) != tail + index + 1) {
+                        return nullptr; //書き込み中
+                    }
+                }
+                return &target->data;
+            }
+            index -= count;
+        }
+        return nullptr;
+    }
+    //先頭からindex番目のデータのコピーを取得する
+    // !! pop側のスレッドが1つの場合に、pop側のスレッドからのみ有効 !!
+    bool copy(Type *out, size_t index) {
+        const Type *ptr = get(index);
+        if (!ptr) {
+            return false;
+        }
+        *out = *ptr;
+        return true;
+    }
+    //先頭のデータのコピーを取得する (取り出しはしない)
+    //sizeがkeep_length以下ならfalseを返す、pnSizeにはキューのsizeを返す
+    // !! pop側のスレッドが1つの場合に、pop側のスレッドからのみ有効 !!
+    bool front_copy(Type *out, size_t *pnSize = nullptr) {
+        const auto nSize = size();
+        if (pnSize) *pnSize = nSize;
+        if (nSize <= m_keepLength.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        return copy(out, 0);
+    }
+    //データをキューに押し込む
+    //キューが一杯の場合は、空きができるかmillisecが経過するまで待機する
+    template<typename T>
+    bool push(T&& in, uint32_t millisec = INFINITE) {
+        return wait_until(m_popCount, m_waitPush, millisec, [&]() { return try_push(std::forward<T>(in)); });
+    }
+    //キューの先頭のデータを取り出す
+    //キューが空の場合は、データが追加されるかmillisecが経過するまで待機する
+    bool pop(Type *out, uint32_t millisec = INFINITE) {
+        return wait_until(m_pushCount, m_waitPop, millisec, [&]() { return try_pop(out); });
+    }
+    //要素が追加される(あるいはset_keep_lengthが呼ばれる)か、millisecが経過するまで待機する
+    void wait_for_push(uint32_t millisec = 16) {
+        m_waitPop.store(1, std::memory_order_seq_cst);
+        rgy_atomic_wait(&m_pushCount, m_pushCount.load(std::memory_order_seq_cst), millisec);
+    }
+protected:
+    //maxCapacityがリングより小さい場合のみ、sizeがmaxCapacityに達していないかを確認する
+    //(それ以外の場合はリングが一杯かどうかで判定できるので、pop側と共有するカウンタを読まないようにする)
+    bool check_capacity(const segment *seg) const {
+        const size_t capacity = m_capacity.load(std::memory_order_relaxed);
+        return capacity > seg->mask || size() < capacity;
+    }
+    //segが一杯の場合に、maxCapacityの範囲内であれば次のリングを追加してそれを返す
+    //追加できない場合はnullptrを返す
+    segment *grow(segment *seg) {
+        if (seg->mask + 1 >= m_capacity.load(std::memory_order_relaxed)) {
+            return nullptr; //リングの大きさが最大サイズに達している
+        }
+        std::lock_guard<std::mutex> lock(m_growMtx);
+        segment *next = seg->next.load(std::memory_order_acquire);
+        if (!next) {
+            m_segments.push_back(std::make_unique<segment>((seg->mask + 1) * 2));
+            next = m_segments.back().get();
+            seg->next.store(next, std::memory_order_release);
+            if constexpr (mode == RGYQueueBoundedMode::MPMC) {
+                //以降、segへのpushは次のリングに回す
+                seg->head.fetch_or(SEGMENT_CLOSED, std::memory_order_acq_rel);
+            }
+            m_pushSeg.store(next, std::memory_order_release);
+        }
+        return next;
+    }
+    //sizeを変えずにpush/popの回数を進めて、待機中のスレッドを起こす
+    //(回数を進めることで、待機しようとしているスレッドもrgy_atomic_waitからすぐに戻る)
+    void wake_all() {
+        m_popCount.fetch_add(1, std::memory_order_seq_cst);
+        m_pushCount.fetch_add(1, std::memory_order_seq_cst);
+        notify(m_pushCount, m_waitPop);
+        notify(m_popCount, m_waitPush);
+    }
+    //待機者がいれば起こす
+    //フラグは起こす側が下ろすので、待機者が起きるまでの間に何度もシステムコールを発行することはない
+    void notify(std::atomic<uint32_t>& counter, std::atomic<int>& waiters) {
+        if (waiters.load(std::memory_order_seq_cst) && waiters.exchange(0, std::memory_order_seq_cst)) {
+            rgy_atomic_notify_all(&counter);
+        }
+    }
+    template<typename Func>
+    bool wait_until(std::atomic<uint32_t>& counter, std::atomic<int>& waiters, uint32_t millisec, Func tryFunc) {
+        const auto start = (millisec == INFINITE) ? std::chrono::steady_clock::time_point() : std::chrono::steady_clock::now();
+        //シングルコアでは、スピンしても相手側のスレッドが進まないのでスピンしない
+        static const int spinCount = (std::thread::hardware_concurrency() > 1) ? 64 : 0;
+        for (;;) {
+            //すぐに空きができる/データが来ることも多いので、少しだけスピンしてからカーネル側で待機する
+            for (int i = 0; i < spinCount; i++) {
+                if (tryFunc()) {
+                    return true;
+                }
+                rgy_yield();
+            }
+            //待機者のフラグを立ててから再確認することで、通知の取りこぼしを防ぐ
+            //(待機せずに戻る場合もフラグはそのままにしておく、次の通知が1回余分になるだけ)
+            waiters.store(1, std::memory_order_seq_cst);
+            const uint32_t count = counter.load(std::memory_order_seq_cst);
+            if (tryFunc()) {
+                return true;
+            }
+            uint32_t remain = INFINITE;
+            if (millisec != INFINITE) {
+                const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+                if (elapsed >= millisec) {
+                    return false;
+                }
+                remain = (uint32_t)(millisec - elapsed);
+            }
+            rgy_atomic_wait(&counter, count, remain);
+        }
+    }
+
+    std::vector<std::unique_ptr<segment>> m_segments; //確保したリング (追加時はm_growMtxをとる)
+    std::mutex m_growMtx;
+    std::atomic<size_t> m_capacity;   //キューに詰められる有効なデータの最大数
+    std::atomic<size_t> m_keepLength; //ある一定の長さを常にキュー内に保持するようにする
+    //待機中のスレッド数は、毎回それを確認する側(m_waitPopならpush側)のカウンタと同じキャッシュラインに置く
+    alignas(64) std::atomic<segment *> m_pushSeg;  //pushするリング
+                std::atomic<uint32_t> m_pushCount; //pushの回数 (sizeの計算とpop側の待機用)
+                std::atomic<int> m_waitPop;        //popで待機中のスレッドがいれば1
+    alignas(64) std::atomic<segment *> m_popSeg;   //popするリング
+                std::atomic<uint32_t> m_popCount;  //popの回数 (sizeの計算とpush側の待機用)
+                std::atomic<int> m_waitPush;       //pushで待機中のスレッドがいれば1
+};
+#pragma warning (pop)
+
 class RGYQueueBuffer {
 public:
     RGYQueueBuffer() :
@@ -0,0 +1,252 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2025 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <random>
+#include <fcntl.h>
+#if !(defined(_WIN32) || defined(_WIN64))
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif //#if !(defined(_WIN32) || defined(_WIN64))
+#include "rgy_seek_index.h"
+#include "rgy_filesystem.h"
+
+static const char RGY_SEEK_INDEX_MAGIC[8] = { 'R', 'G', 'Y', 'S', 'I', 'D', 'X', '\0' };
+
+// キーフレームの格納位置 (ヘッダとパスの後ろ、8byte境界)
+static uint64_t seekIndexKeyframeOffset(const RGYSeekIndex::Header& header) {
+    return ((uint64_t)header.headerSize + header.srcPathSize + 7) & (~(uint64_t)7);
+}
+
+RGYSeekIndex::RGYSeekIndex() :
+    m_indexFile(),
+    m_srcPath(),
+    m_header(),
+    m_recording(false),
+    m_newKeyframes(),
+    m_mapPtr(nullptr),
+    m_mapSize(0),
+#if defined(_WIN32) || defined(_WIN64)
+    m_mapHandle(nullptr),
+#endif //#if defined(_WIN32) || defined(_WIN64)
+    m_keyframes(nullptr),
+    m_keyframeCount(0) {
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+RGYSeekIndex::~RGYSeekIndex() {
+    close();
+}
+
+bool RGYSeekIndex::getSrcFileInfo(const tstring& srcFile, uint64_t *size, int64_t *time) {
+    std::error_code ec;
+    const auto path = std::filesystem::path(srcFile);
+    if (!std::filesystem::is_regular_file(path, ec) || ec) {
+        return false;
+    }
+    *size = (uint64_t)std::filesystem::file_size(path, ec);
+    if (ec) {
+        return false;
+    }
+    const auto lastWrite = std::filesystem::last_write_time(path, ec);
+    if (ec) {
+        return false;
+    }
+    *time = (int64_t)lastWrite.time_since_epoch().count();
+    return true;
+}
+
+RGY_ERR RGYSeekIndex::open(const tstring& indexFile, const tstring& srcFile, int streamIndex, int timebaseNum, int timebaseDen) {
+    close();
+    m_indexFile = indexFile;
+    memcpy(m_header.magic, RGY_SEEK_INDEX_MAGIC, sizeof(m_header.magic));
+    m_header.version = VERSION;
+    m_header.headerSize = (uint32_t)sizeof(Header);
+    m_header.streamIndex = streamIndex;
+    m_header.timebaseNum = timebaseNum;
+    m_header.timebaseDen = timebaseDen;
+    if (!getSrcFileInfo(srcFile, &m_header.srcFileSize, &m_header.srcFileTime)) {
+        // 通常のファイルでない (パイプなど) 場合は使用しない
+        return RGY_ERR_UNSUPPORTED;
+    }
+    m_srcPath = tchar_to_string(GetFullPathFrom(srcFile.c_str()), CP_UTF8);
+    m_header.srcPathSize = (uint32_t)m_srcPath.length();
+    m_recording = true;
+
+    if (!rgy_file_exists(indexFile)) {
+        return RGY_ERR_NOT_FOUND;
+    }
+    FILE *fp = nullptr;
+    if (_tfopen_s(&fp, indexFile.c_str(), _T("rb")) != 0 || fp == nullptr) {
+        return RGY_ERR_NOT_FOUND;
+    }
+    std::unique_ptr<FILE, fp_deleter> fpIndex(fp, fp_deleter());
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE hFile = (HANDLE)_get_osfhandle(_fileno(fp));
+    LARGE_INTEGER fileSize = { 0 };
+    if (hFile == INVALID_HANDLE_VALUE
+        || !GetFileSizeEx(hFile, &fileSize)
+        || fileSize.QuadPart < (int64_t)sizeof(Header)) {
+        return RGY_ERR_NOT_FOUND;
+    }
+    m_mapHandle = CreateFileMapping(hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (m_mapHandle == nullptr) {
+        return RGY_ERR_NOT_FOUND;
+    }
+    m_mapPtr = (const uint8_t *)MapViewOfFile(m_mapHandle, FILE_MAP_READ, 0, 0, 0);
+    if (m_mapPtr == nullptr) {
+        close();
+        return RGY_ERR_NOT_FOUND;
+    }
+    m_mapSize = (uint64_t)fileSize.QuadPart;
+#else
+    const int fd = fileno(fp);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < (off_t)sizeof(Header)) {
+        return RGY_ERR_NOT_FOUND;
+    }
+    void *ptr = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (ptr == MAP_FAILED) {
+        return RGY_ERR_NOT_FOUND;
+    }
+    m_mapPtr = (const uint8_t *)ptr;
+    m_mapSize = (uint64_t)st.st_size;
+#endif //#if defined(_WIN32) || defined(_WIN64)
+
+    // 入力ファイルと一致するか確認する
+    const Header *header = (const Header *)m_mapPtr;
+    const uint64_t keyframeOffset = seekIndexKeyframeOffset(*header);
+    if (memcmp(header->magic, RGY_SEEK_INDEX_MAGIC, sizeof(header->magic)) != 0
+        || header->version != VERSION
+        || header->headerSize != sizeof(Header)
+        || header->srcFileSize != m_header.srcFileSize
+        || header->srcFileTime != m_header.srcFileTime
+        || header->streamIndex != m_header.streamIndex
+        || header->timebaseNum != m_header.timebaseNum
+        || header->timebaseDen != m_header.timebaseDen
+        || header->srcPathSize != m_header.srcPathSize
+        || keyframeOffset > m_mapSize
+        || header->keyframeCount > (m_mapSize - keyframeOffset) / sizeof(Keyframe)
+        || memcmp(m_mapPtr + header->headerSize, m_srcPath.c_str(), header->srcPathSize) != 0) {
+        close();
+        m_recording = true;
+        return RGY_ERR_NOT_FOUND;
+    }
+    m_header = *header;
+    m_keyframes = (const Keyframe *)(m_mapPtr + keyframeOffset);
+    m_keyframeCount = (size_t)header->keyframeCount;
+    return RGY_ERR_NONE;
+}
+
+void RGYSeekIndex::close() {
+    if (m_mapPtr) {
+#if defined(_WIN32) || defined(_WIN64)
+        UnmapViewOfFile(m_mapPtr);
+#else
+        munmap((void *)m_mapPtr, (size_t)m_mapSize);
+#endif //#if defined(_WIN32) || defined(_WIN64)
+        m_mapPtr = nullptr;
+    }
+#if defined(_WIN32) || defined(_WIN64)
+    if (m_mapHandle) {
+        CloseHandle(m_mapHandle);
+        m_mapHandle = nullptr;
+    }
+#endif //#if defined(_WIN32) || defined(_WIN64)
+    m_mapSize = 0;
+    m_keyframes = nullptr;
+    m_keyframeCount = 0;
+    m_recording = false;
+    m_newKeyframes.clear();
+}
+
+const RGYSeekIndex::Keyframe *RGYSeekIndex::findKeyframe(int64_t pts) const {
+    const auto fin = m_keyframes + m_keyframeCount;
+    // av_seek_frame(flags=0)と同様に、pts以前で最後のキーフレームからデコードを開始する
+    const auto it = std::upper_bound(m_keyframes, fin, pts, [](const int64_t value, const Keyframe& key) { return value < key.pts; });
+    return (it != m_keyframes) ? it - 1 : nullptr;
+}
+
+void RGYSeekIndex::addKeyframe(int64_t pts, int64_t dts, int64_t pos) {
+    if (!recording()) {
+        return;
+    }
+    // seek用なので、ptsの昇順に並べておく (OpenGOP等で前後する場合は後から来たほうを採用しない)
+    if (m_newKeyframes.size() > 0 && m_newKeyframes.back().pts >= pts) {
+        return;
+    }
+    m_newKeyframes.push_back(Keyframe{ pts, dts, pos });
+}
+
+void RGYSeekIndex::setAnalysis(const Analysis& analysis) {
+    if (!recording()) {
+        return;
+    }
+    m_header.analysis = analysis;
+}
+
+RGY_ERR RGYSeekIndex::write() {
+    if (!recording()) {
+        return RGY_ERR_NONE;
+    }
+    m_recording = false;
+    m_header.keyframeCount = m_newKeyframes.size();
+    //同じ入力を複数のプロセスが同時に読み込んだ場合でも衝突しないよう、一時ファイル名は一意にする
+    std::random_device rd;
+    const auto tmpFile = m_indexFile + strsprintf(_T(".%08x%08x.tmp"), rd(), rd());
+    {
+        FILE *fp = nullptr;
+        if (_tfopen_s(&fp, tmpFile.c_str(), _T("wb")) != 0 || fp == nullptr) {
+            return RGY_ERR_FILE_OPEN;
+        }
+        std::unique_ptr<FILE, fp_deleter> fpIndex(fp, fp_deleter());
+        const uint64_t keyframeOffset = seekIndexKeyframeOffset(m_header);
+        const char padding[8] = { 0 };
+        fwrite(&m_header, 1, sizeof(m_header), fp);
+        fwrite(m_srcPath.c_str(), 1, m_srcPath.length(), fp);
+        fwrite(padding, 1, (size_t)(keyframeOffset - sizeof(m_header) - m_srcPath.length()), fp);
+        if (m_newKeyframes.size() > 0) {
+            fwrite(m_newKeyframes.data(), sizeof(m_newKeyframes[0]), m_newKeyframes.size(), fp);
+        }
+        if (ferror(fp)) {
+            fpIndex.reset();
+            rgy_file_remove(tmpFile.c_str());
+            return RGY_ERR_UNKNOWN;
+        }
+    }
+    m_newKeyframes.clear();
+    m_newKeyframes.shrink_to_fit();
+    if (!rgy_file_rename(tmpFile, m_indexFile, true)) {
+        rgy_file_remove(tmpFile.c_str());
+        return RGY_ERR_UNKNOWN;
+    }
+    return RGY_ERR_NONE;
+}
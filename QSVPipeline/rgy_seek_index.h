@@ -0,0 +1,118 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2025 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+
+#pragma once
+#ifndef __RGY_SEEK_INDEX_H__
+#define __RGY_SEEK_INDEX_H__
+
+#include <cstdint>
+#include <vector>
+#include "rgy_err.h"
+#include "rgy_tchar.h"
+#include "rgy_util.h"
+
+// 入力ファイルのキーフレーム位置と解析結果を保存するindexファイル
+// 入力ファイルのパス・サイズ・更新時刻が一致する場合のみ有効とし、読み込み時はmmapして参照する
+// 先頭から最後まで読み込んだ際に作成し、以降の起動やseek、並列エンコードの各chunkで使用する
+class RGYSeekIndex {
+public:
+    static const uint32_t VERSION = 1;
+
+    struct Keyframe {
+        int64_t pts; // キーフレームのpts (動画のtimebase)
+        int64_t dts; // キーフレームのdts (動画のtimebase)
+        int64_t pos; // ファイル上の位置 (不明なら-1)
+    };
+
+    // 入力ファイルの解析結果
+    struct Analysis {
+        int32_t fpsNum;       // 推定したフレームレート (0なら未設定)
+        int32_t fpsDen;
+        uint32_t ptsStatus;   // RGYPtsStatus
+        int32_t detectPulldown; // 解析時のpulldown検出の有無
+        double analyzeSec;    // 解析時の--input-analyze
+    };
+
+    struct Header {
+        char     magic[8];
+        uint32_t version;
+        uint32_t headerSize;
+        uint64_t srcFileSize;
+        int64_t  srcFileTime;
+        int32_t  streamIndex;
+        int32_t  timebaseNum;
+        int32_t  timebaseDen;
+        uint32_t srcPathSize;  // ヘッダの直後に格納する入力ファイルのパス(UTF-8)のバイト数
+        uint64_t keyframeCount;
+        Analysis analysis;
+    };
+
+    RGYSeekIndex();
+    ~RGYSeekIndex();
+
+    // 入力ファイルの情報を取得し、indexファイルが有効ならmmapして読み込む
+    // 読み込めなかった場合は、記録モード(addKeyframe/write)で使用できる状態になる
+    // RGY_ERR_NONE: 読み込み成功, RGY_ERR_NOT_FOUND: indexファイルがない/一致しない
+    RGY_ERR open(const tstring& indexFile, const tstring& srcFile, int streamIndex, int timebaseNum, int timebaseDen);
+    void close();
+
+    bool loaded() const { return m_mapPtr != nullptr; }
+    bool recording() const { return !loaded() && m_recording; }
+    const tstring& filename() const { return m_indexFile; }
+
+    // 読み込んだindexの内容
+    const Keyframe *keyframes() const { return m_keyframes; }
+    size_t keyframeCount() const { return m_keyframeCount; }
+    const Analysis& analysis() const { return m_header.analysis; }
+    // pts以下となる最後のキーフレームを返す (なければnullptr)
+    const Keyframe *findKeyframe(int64_t pts) const;
+
+    // 記録
+    void addKeyframe(int64_t pts, int64_t dts, int64_t pos);
+    void setAnalysis(const Analysis& analysis);
+    // 記録した内容をindexファイルに書き出す (一時ファイルに書き出してから置き換える)
+    RGY_ERR write();
+protected:
+    static bool getSrcFileInfo(const tstring& srcFile, uint64_t *size, int64_t *time);
+
+    tstring m_indexFile;
+    std::string m_srcPath;
+    Header m_header;
+    bool m_recording;
+    std::vector<Keyframe> m_newKeyframes;
+
+    const uint8_t *m_mapPtr;
+    uint64_t m_mapSize;
+#if defined(_WIN32) || defined(_WIN64)
+    HANDLE m_mapHandle;
+#endif //#if defined(_WIN32) || defined(_WIN64)
+    const Keyframe *m_keyframes;
+    size_t m_keyframeCount;
+};
+
+#endif //__RGY_SEEK_INDEX_H__
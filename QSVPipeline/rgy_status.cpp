@@ -55,6 +55,9 @@ EncodeStatus::EncodeStatus() :
     m_tmLastUpdate(std::chrono::system_clock::now()),
     m_peStatusShare(nullptr),
     m_childStatus(),
+    m_mtxChildStatus(),
+    m_chunkFinished(0),
+    m_chunkTotal(0),
     m_bStdErrWriteToConsole(false),
     m_bEncStarted(false) {
 }
@@ -110,6 +113,10 @@ void EncodeStatus::SetOutputData(RGY_FRAMETYPE picType, uint64_t outputBytes, ui
     m_sData.frameOutPQPSum += (0-((picType & RGY_FRAMETYPE_P)   >> 1)) & frameAvgQP;
     m_sData.frameOutBQPSum += (0-((picType & RGY_FRAMETYPE_B)   >> 2)) & frameAvgQP;
 }
+void EncodeStatus::SetOutputStall(double stallSec, int64_t stallCount) {
+    m_sData.outputStallSec   = stallSec;
+    m_sData.outputStallCount = stallCount;
+}
 #pragma warning(push)
 #pragma warning(disable: 4100)
 void EncodeStatus::UpdateDisplay(const TCHAR *mes, double progressPercent) {
@@ -243,12 +250,15 @@ RGY_ERR EncodeStatus::UpdateDisplay(double progressPercent) {
         m_sData.encodeFps = (m_sData.frameOut + m_sData.frameDrop) * 1000.0 / elapsedTime;
         m_sData.bitrateKbps = (double)m_sData.outFileSize * (m_sData.outputFPSRate / (double)m_sData.outputFPSScale) / ((1000 / 8) * (m_sData.frameOut + m_sData.frameDrop));
         std::vector<EncodeStatusData> childStsList;
-        for (size_t i = 0; i < m_childStatus.size(); i++) {
-            if (m_childStatus[i].second) {
-                EncodeStatusData data;
-                if (m_childStatus[i].second->get(data)) { // 進捗表示を取得できたら
-                    data.progressPercent *= m_childStatus[i].first;
-                    childStsList.push_back(data);
+        {
+            std::lock_guard<std::mutex> lock(m_mtxChildStatus);
+            for (size_t i = 0; i < m_childStatus.size(); i++) {
+                if (m_childStatus[i].second) {
+                    EncodeStatusData data;
+                    if (m_childStatus[i].second->get(data)) { // 進捗表示を取得できたら
+                        data.progressPercent *= m_childStatus[i].first;
+                        childStsList.push_back(data);
+                    }
                 }
             }
         }
@@ -290,6 +300,11 @@ RGY_ERR EncodeStatus::UpdateDisplay(double progressPercent) {
                     : std::accumulate(childStsList.begin(), childStsList.end(), 0u, [](uint32_t sum, const EncodeStatusData& child) { return sum + child.frameIn; });
                 totalProgressPercent = totalFrameIn * 100 / (double)m_sData.frameTotal;
             }
+            // 総フレーム数が不明な場合、子の進捗は推定でしかないので、完了したチャンクの割合を下限とする
+            // (チャンクを細かく分割している場合、残り時間はチャンクの完了ペースから見積もることになる)
+            if (m_sData.frameTotal <= 0 && m_chunkTotal > 0 && m_chunkFinished > 0) {
+                totalProgressPercent = (std::max)(totalProgressPercent, m_chunkFinished * 100.0 / m_chunkTotal);
+            }
             totalProgressPercent = (std::min)(totalProgressPercent, 100.0);
             uint32_t remaining_time = (uint32_t)(elapsedTime * (100.0 - totalProgressPercent) / totalProgressPercent + 0.5);
             const int hh = remaining_time / (60*60*1000);
@@ -462,6 +477,11 @@ void EncodeStatus::WriteResults() {
     WriteFrameTypeResult(_T("frame type I   "), m_sData.frameOutI, maxCount, m_sData.frameOutISize, maxFrameSize, (m_sData.frameOutI && m_sData.frameOutIQPSum) ? m_sData.frameOutIQPSum / (double)m_sData.frameOutI : -1);
     WriteFrameTypeResult(_T("frame type P   "), m_sData.frameOutP, maxCount, m_sData.frameOutPSize, maxFrameSize, (m_sData.frameOutP && m_sData.frameOutPQPSum) ? m_sData.frameOutPQPSum / (double)m_sData.frameOutP : -1);
     WriteFrameTypeResult(_T("frame type B   "), m_sData.frameOutB, maxCount, m_sData.frameOutBSize, maxFrameSize, (m_sData.frameOutB && m_sData.frameOutBQPSum) ? m_sData.frameOutBQPSum / (double)m_sData.frameOutB : -1);
+    if (m_sData.outputStallCount > 0) {
+        //出力ファイルの書き込みが律速になっているかの目安
+        _stprintf_s(mes, _countof(mes), _T("output stall    %.2fs (%lld times)"), m_sData.outputStallSec, (long long)m_sData.outputStallCount);
+        WriteResultLine(mes);
+    }
 }
 int64_t EncodeStatus::getStartTimeMicroSec() {
 #if defined(_WIN32) || defined(_WIN64)
@@ -484,9 +504,22 @@ EncodeStatusData EncodeStatus::GetEncodeData() {
 }
 
 void EncodeStatus::addChildStatus(const std::pair<double, RGYParallelEncodeStatusData*>& encStatus) {
+    std::lock_guard<std::mutex> lock(m_mtxChildStatus);
     m_childStatus.push_back(encStatus);
 }
 
+void EncodeStatus::setChildStatusWeight(const std::vector<double>& weights) {
+    std::lock_guard<std::mutex> lock(m_mtxChildStatus);
+    for (size_t i = 0; i < std::min(weights.size(), m_childStatus.size()); i++) {
+        m_childStatus[i].first = weights[i];
+    }
+}
+
+void EncodeStatus::setChunkProgress(int finished, int total) {
+    m_chunkTotal = total;
+    m_chunkFinished = finished;
+}
+
 void EncodeStatus::WriteResultLine(const TCHAR *mes) {
     if (m_pRGYLog != nullptr && m_pRGYLog->getLogLevel(RGY_LOGT_CORE_RESULT) > RGY_LOG_INFO) {
         return;
@@ -38,6 +38,8 @@
 #include <chrono>
 #include <memory>
 #include <vector>
+#include <mutex>
+#include <atomic>
 #include <cmath>
 #include <algorithm>
 #include "rgy_err.h"
@@ -89,6 +91,8 @@ typedef struct EncodeStatusData {
     double VEClockTotal;
     double GPUClockTotal;
     double progressPercent;
+    double outputStallSec;     //出力ファイルの書き込み待ちで出力が止まった時間(s)
+    int64_t outputStallCount;  //出力ファイルの書き込み待ちで出力が止まった回数
 } EncodeStatusData;
 
 class EncodeStatus {
@@ -103,6 +107,7 @@ public:
 
     void SetStart();
     void SetOutputData(RGY_FRAMETYPE picType, uint64_t outputBytes, uint32_t frameAvgQP);
+    void SetOutputStall(double stallSec, int64_t stallCount);
     virtual void UpdateDisplay(const TCHAR *mes, double progressPercent = 0.0);
 
     virtual RGY_ERR UpdateDisplayByCurrentDuration(double currentDuration);
@@ -112,6 +117,8 @@ public:
     bool getEncStarted();
     virtual void SetPrivData(void *pPrivateData);
     void addChildStatus(const std::pair<double, RGYParallelEncodeStatusData*>& encStatus);  // 親側で子エンコーダの担当割合と進捗表示共有クラスへのポインタ (実体はRGYParallelEncProcess::m_sendData::encStatus)を追加
+    void setChildStatusWeight(const std::vector<double>& weights); // 親側で子エンコーダの担当割合を、addChildStatusした順に設定し直す
+    void setChunkProgress(int finished, int total); // 親側で完了したチャンク数と総チャンク数を設定 (進捗/残り時間の推定に使用)
     EncodeStatusData GetEncodeData();
     EncodeStatusData m_sData;
 protected:
@@ -127,6 +134,9 @@ protected:
     std::chrono::system_clock::time_point m_tmLastUpdate;     //最終更新時刻
     RGYParallelEncodeStatusData *m_peStatusShare; // 子エンコーダ側から親への進捗表示共有するためのクラスへのポインタ (実体はRGYParallelEncProcess::m_sendData::encStatus)
     std::vector<std::pair<double, RGYParallelEncodeStatusData*>> m_childStatus; // 親側で使用する、子エンコーダの担当割合と子エンコーダから進捗表示を取得するクラスへのポインタ (実体はRGYParallelEncProcess::m_sendData::encStatus)
+    std::mutex m_mtxChildStatus; // m_childStatusは並列エンコードのチャンク起動スレッドから追加される
+    std::atomic<int> m_chunkFinished; // 親側で使用する、完了したチャンク数
+    std::atomic<int> m_chunkTotal;    // 親側で使用する、総チャンク数
     bool m_bStdErrWriteToConsole;
     bool m_bEncStarted;
 };
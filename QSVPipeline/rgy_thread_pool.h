@@ -30,81 +30,391 @@
 #define __RGY_THREAD_POOL_H__
 
 #include <vector>
-#include <queue>
+#include <deque>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <functional>
 #include <future>
 #include <memory>
+#include <tuple>
+#include <exception>
+#include <stdexcept>
+#include <type_traits>
+#include <algorithm>
+#include "rgy_osdep.h"
+#include "rgy_thread_affinity.h"
 
-class RGYThreadPool {
+// std::functionはコピー可能な関数しか保持できないため、
+// packaged_taskなどmove-onlyな関数もそのまま保持できるようにしたもの
+class RGYThreadPoolTask {
+private:
+    struct Base {
+        virtual ~Base() {};
+        virtual void run() = 0;
+    };
+    template<typename F>
+    struct Impl : public Base {
+        F f;
+        Impl(F&& f_) : f(std::move(f_)) {};
+        virtual void run() override { f(); }
+    };
+    std::unique_ptr<Base> m_impl;
 public:
-    RGYThreadPool(int num_threads = 0) {
-        if (num_threads == 0) num_threads = std::thread::hardware_concurrency();
+    RGYThreadPoolTask() : m_impl() {};
+    template<typename F, typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, RGYThreadPoolTask>::value>::type>
+    RGYThreadPoolTask(F&& f) : m_impl(std::make_unique<Impl<typename std::decay<F>::type>>(std::forward<F>(f))) {};
+    RGYThreadPoolTask(RGYThreadPoolTask&&) = default;
+    RGYThreadPoolTask& operator=(RGYThreadPoolTask&&) = default;
+    RGYThreadPoolTask(const RGYThreadPoolTask&) = delete;
+    RGYThreadPoolTask& operator=(const RGYThreadPoolTask&) = delete;
+    explicit operator bool() const { return (bool)m_impl; }
+    void operator()() { m_impl->run(); }
+};
+
+// futureを使わずに、投入したタスク群の完了を待つためのもの
+// タスク内で発生した例外は、最初の1つをwait()で再送出する
+// 最後のタスクの完了(m_remainの減算と通知)はm_mtxをとって行い、待機側も戻る前に必ずm_mtxをとるので、
+// 待機側が戻ってgroupが破棄された後に、ワーカーがgroupに触れることはない
+class RGYThreadPoolTaskGroup {
+private:
+    std::atomic<int> m_remain;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::exception_ptr m_exception;
+
+    friend class RGYThreadPool;
+    void add(int n) { m_remain.fetch_add(n, std::memory_order_relaxed); }
+    void done(std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        if (e && !m_exception) m_exception = e;
+        if (m_remain.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            m_cv.notify_all();
+        }
+    }
+    void wait_blocking() {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        m_cv.wait(lock, [this]() { return finished(); });
+    }
+    void rethrow() {
+        std::exception_ptr e;
+        {
+            std::lock_guard<std::mutex> lock(m_mtx);
+            std::swap(e, m_exception);
+        }
+        if (e) std::rethrow_exception(e);
+    }
+public:
+    RGYThreadPoolTaskGroup() : m_remain(0), m_mtx(), m_cv(), m_exception() {};
+    ~RGYThreadPoolTaskGroup() { wait_blocking(); }
+    RGYThreadPoolTaskGroup(const RGYThreadPoolTaskGroup&) = delete;
+    RGYThreadPoolTaskGroup& operator=(const RGYThreadPoolTaskGroup&) = delete;
+    // 完了したかの確認用 (これだけを見てgroupを破棄しないこと、完了待ちはRGYThreadPool::wait()で行う)
+    bool finished() const { return m_remain.load(std::memory_order_acquire) == 0; }
+};
+
+// ワーカーごとにタスクキューを持ち、空いたワーカーはほかのワーカーのキューからタスクを奪って処理する
+// 自分のキューからは後ろから(LIFO)、ほかのワーカーのキューからは前から(FIFO)取り出す
+class RGYThreadPool {
+private:
+    struct alignas(64) WorkerQueue {
+        std::mutex mtx;
+        std::deque<RGYThreadPoolTask> tasks;
+    };
+    struct WorkerLocal {
+        RGYThreadPool *pool;
+        int idx;
+    };
+    static WorkerLocal& workerLocal() {
+        static thread_local WorkerLocal local = { nullptr, -1 };
+        return local;
+    }
+
+    std::vector<std::thread> m_workers;
+    std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+    std::atomic<int64_t> m_pending; // キューに積まれているタスク数
+    std::atomic<int> m_sleeping;    // 待機中のワーカー数
+    std::atomic<uint32_t> m_next;   // 外部からの投入先(ラウンドロビン)
+    std::mutex m_sleepMtx;
+    std::condition_variable m_sleepCv;
+    std::atomic<bool> m_stop;
+
+    int currentWorker() const {
+        const auto& local = workerLocal();
+        return (local.pool == this) ? local.idx : -1;
+    }
+
+    void push(RGYThreadPoolTask&& task) {
+        int idx = currentWorker();
+        if (idx < 0) {
+            idx = (int)(m_next.fetch_add(1, std::memory_order_relaxed) % (uint32_t)m_queues.size());
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_queues[idx]->mtx);
+            if (m_stop) {
+                throw std::runtime_error("スレッドプールは停止しています");
+            }
+            m_queues[idx]->tasks.push_back(std::move(task));
+        }
+        m_pending.fetch_add(1, std::memory_order_seq_cst);
+        wake(1);
+    }
+
+    void wake(int n) {
+        if (m_sleeping.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lock(m_sleepMtx);
+            if (n == 1) {
+                m_sleepCv.notify_one();
+            } else {
+                m_sleepCv.notify_all();
+            }
+        }
+    }
+
+    bool tryPop(int self, RGYThreadPoolTask& task) {
+        if (m_pending.load(std::memory_order_acquire) <= 0) {
+            return false;
+        }
+        const int nqueue = (int)m_queues.size();
+        if (self >= 0) {
+            auto& q = *m_queues[self];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                m_pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        const int start = (self >= 0) ? self + 1 : (int)(m_next.load(std::memory_order_relaxed) % (uint32_t)nqueue);
+        for (int i = 0; i < nqueue; i++) {
+            const int idx = (start + i) % nqueue;
+            if (idx == self) continue;
+            auto& q = *m_queues[idx];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                m_pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerFunc(int idx, RGYParamThread threadParam, bool pinWorker) {
+        workerLocal() = { this, idx };
+        threadParam.apply(GetCurrentThread());
+        if (pinWorker && threadParam.affinity.mode != RGYThreadAffinityMode::ALL) {
+            const uint64_t mask = threadParam.affinity.getMask();
+            int ncores = 0;
+            for (uint64_t m = mask; m; m &= m - 1) ncores++;
+            if (ncores > 0) {
+#if defined(_WIN32) || defined(_WIN64)
+                SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)selectMaskFromLowerBit(mask, idx % ncores));
+#else //#if defined(_WIN32) || defined(_WIN64)
+                SetThreadAffinityMask(GetCurrentThread(), selectMaskFromLowerBit(mask, idx % ncores));
+#endif //#if defined(_WIN32) || defined(_WIN64)
+            }
+        }
+        RGYThreadPoolTask task;
+        for (;;) {
+            if (tryPop(idx, task)) {
+                task();
+                task = RGYThreadPoolTask();
+                continue;
+            }
+            m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+            {
+                std::unique_lock<std::mutex> lock(m_sleepMtx);
+                m_sleepCv.wait(lock, [this] {
+                    return m_stop.load() || m_pending.load(std::memory_order_seq_cst) > 0;
+                });
+            }
+            m_sleeping.fetch_sub(1, std::memory_order_relaxed);
+            if (m_stop && m_pending.load() <= 0) {
+                return;
+            }
+        }
+    }
+
+    template<typename F>
+    RGYThreadPoolTask wrapGroupTask(F&& f, RGYThreadPoolTaskGroup *group) {
+        if (!group) {
+            return RGYThreadPoolTask(std::forward<F>(f));
+        }
+        return RGYThreadPoolTask([func = typename std::decay<F>::type(std::forward<F>(f)), group]() mutable {
+            std::exception_ptr e;
+            try {
+                func();
+            } catch (...) {
+                e = std::current_exception();
+            }
+            group->done(e);
+        });
+    }
+
+    void init(int num_threads, const RGYParamThread& threadParam, bool pinWorkers) {
+        if (num_threads <= 0) num_threads = std::thread::hardware_concurrency();
         num_threads = std::max(num_threads, 1);
         for (int i = 0; i < num_threads; i++) {
-            workers.emplace_back([this] {
-                while (true) {
-                    std::function<void()> task;
-                    {
-                        std::unique_lock<std::mutex> lock(queue_mutex);
-                        condition.wait(lock, [this] {
-                            return stop || !tasks.empty();
-                        });
-                        
-                        if (stop && tasks.empty()) {
-                            return;
-                        }
-                        
-                        task = std::move(tasks.front());
-                        tasks.pop();
-                    }
-                    task();
+            m_queues.push_back(std::make_unique<WorkerQueue>());
+        }
+        for (int i = 0; i < num_threads; i++) {
+            m_workers.emplace_back(&RGYThreadPool::workerFunc, this, i, threadParam, pinWorkers);
+        }
+    }
+public:
+    RGYThreadPool(int num_threads = 0) : RGYThreadPool(num_threads, RGYParamThread(), false) {};
+
+    // pinWorkers=trueの場合、threadParam.affinityのマスクから各ワーカーに1コアずつ割り当てる
+    RGYThreadPool(int num_threads, const RGYParamThread& threadParam, bool pinWorkers) :
+        m_workers(), m_queues(), m_pending(0), m_sleeping(0), m_next(0),
+        m_sleepMtx(), m_sleepCv(), m_stop(false) {
+        init(num_threads, threadParam, pinWorkers);
+    }
+
+    RGYThreadPool(const RGYThreadPool&) = delete;
+    RGYThreadPool& operator=(const RGYThreadPool&) = delete;
+
+    ~RGYThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m_sleepMtx);
+            m_stop = true;
+        }
+        m_sleepCv.notify_all();
+        for (std::thread &worker : m_workers) {
+            worker.join();
+        }
+    }
+
+    int size() const { return (int)m_workers.size(); }
+
+    // プロセス内で共有するスレッドプールを取得する
+    // 同じスレッド数・スレッド設定のプールがすでにあればそれを返し、なければ新たに作成する
+    // プールは最後の参照が解放された時点で破棄される
+    static std::shared_ptr<RGYThreadPool> shared(int num_threads, const RGYParamThread& threadParam) {
+        struct SharedPool {
+            int num_threads;
+            RGYParamThread threadParam;
+            std::weak_ptr<RGYThreadPool> pool;
+        };
+        static std::mutex mtx;
+        static std::vector<SharedPool> pools;
+        std::lock_guard<std::mutex> lock(mtx);
+        pools.erase(std::remove_if(pools.begin(), pools.end(), [](const SharedPool& p) { return p.pool.expired(); }), pools.end());
+        for (const auto& p : pools) {
+            if (p.num_threads == num_threads && p.threadParam == threadParam) {
+                if (auto pool = p.pool.lock()) {
+                    return pool;
                 }
-            });
+            }
         }
+        auto pool = std::make_shared<RGYThreadPool>(num_threads, threadParam, false);
+        pools.push_back({ num_threads, threadParam, pool });
+        return pool;
     }
 
     template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args) 
+    auto enqueue(F&& f, Args&&... args)
         -> std::future<typename std::invoke_result<F, Args...>::type> {
         using return_type = typename std::invoke_result<F, Args...>::type;
 
-        auto task = std::make_shared<std::packaged_task<return_type()>>(
-            std::bind(std::forward<F>(f), std::forward<Args>(args)...)
-        );
+        std::packaged_task<return_type()> task(
+            [func = typename std::decay<F>::type(std::forward<F>(f)), targs = std::make_tuple(std::forward<Args>(args)...)]() mutable -> return_type {
+                return std::apply(func, std::move(targs));
+            });
+        std::future<return_type> res = task.get_future();
+        push(RGYThreadPoolTask(std::move(task)));
+        return res;
+    }
 
-        std::future<return_type> res = task->get_future();
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            if (stop) {
+    // futureを作らずにタスクを投入する
+    // groupを指定した場合は、wait(group)で完了を待つことができる
+    template<class F>
+    void submit(F&& f, RGYThreadPoolTaskGroup *group = nullptr) {
+        if (group) group->add(1);
+        push(wrapGroupTask(std::forward<F>(f), group));
+    }
+
+    // まとめてタスクを投入する (各ワーカーのキューへのロックは1回ずつ)
+    template<class F>
+    void submit_batch(std::vector<F>& funcs, RGYThreadPoolTaskGroup *group = nullptr) {
+        if (funcs.empty()) return;
+        if (group) group->add((int)funcs.size());
+        const int nqueue = (int)m_queues.size();
+        const int self = currentWorker();
+        const int start = (self >= 0) ? self : (int)(m_next.fetch_add(1, std::memory_order_relaxed) % (uint32_t)nqueue);
+        const int per_queue = ((int)funcs.size() + nqueue - 1) / nqueue;
+        size_t ifunc = 0;
+        for (int i = 0; i < nqueue && ifunc < funcs.size(); i++) {
+            auto& q = *m_queues[(start + i) % nqueue];
+            std::lock_guard<std::mutex> lock(q.mtx);
+            if (m_stop) {
                 throw std::runtime_error("スレッドプールは停止しています");
             }
-            tasks.emplace([task]() { (*task)(); });
+            for (int j = 0; j < per_queue && ifunc < funcs.size(); j++, ifunc++) {
+                q.tasks.push_back(wrapGroupTask(std::move(funcs[ifunc]), group));
+            }
         }
-        condition.notify_one();
-        return res;
+        m_pending.fetch_add((int64_t)funcs.size(), std::memory_order_seq_cst);
+        wake((int)funcs.size());
+        funcs.clear();
     }
 
-    ~RGYThreadPool() {
-        {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            stop = true;
-        }
-        condition.notify_all();
-        for (std::thread &worker : workers) {
-            worker.join();
+    // groupのタスクがすべて終了するまで待つ
+    // 待機中もプールのタスクを処理するので、ワーカー内から呼んでもデッドロックしない
+    void wait(RGYThreadPoolTaskGroup& group) {
+        const int self = currentWorker();
+        RGYThreadPoolTask task;
+        while (!group.finished()) {
+            if (tryPop(self, task)) {
+                task();
+                task = RGYThreadPoolTask();
+            } else {
+                group.wait_blocking();
+            }
         }
+        group.rethrow(); // m_mtxをとるので、最後のタスクのdone()が抜けるまで待ってから戻る
     }
 
-private:
-    std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
-    
-    std::mutex queue_mutex;
-    std::condition_variable condition;
-    bool stop = false;
+    // [begin, end)をgrainごとに分割し、func(start, end)を並列に実行する
+    // 分割した範囲は空いているスレッドから順に取得していくので、処理時間の偏りがあっても負荷が分散される
+    // 呼び出し元のスレッドも処理に参加する
+    template<class F>
+    void parallel_for(int begin, int end, int grain, F&& func) {
+        if (end <= begin) return;
+        const int nthreads = size() + 1;
+        if (grain <= 0) {
+            grain = std::max(1, (end - begin + nthreads * 4 - 1) / (nthreads * 4));
+        }
+        const int nchunks = (end - begin + grain - 1) / grain;
+        if (nchunks <= 1) {
+            func(begin, end);
+            return;
+        }
+        std::atomic<int> next(0);
+        auto loop = [&]() {
+            for (int ichunk; (ichunk = next.fetch_add(1, std::memory_order_relaxed)) < nchunks; ) {
+                const int start = begin + ichunk * grain;
+                func(start, std::min(start + grain, end));
+            }
+        };
+        RGYThreadPoolTaskGroup group;
+        const int nhelpers = std::min(nchunks, nthreads) - 1;
+        std::vector<std::function<void()>> helpers(nhelpers, loop);
+        submit_batch(helpers, &group);
+        std::exception_ptr e;
+        try {
+            loop();
+        } catch (...) {
+            e = std::current_exception();
+            next = nchunks;
+        }
+        wait(group);
+        if (e) std::rethrow_exception(e);
+    }
 };
 
 #endif //__RGY_THREAD_POOL_H__
@@ -0,0 +1,170 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2025 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#include <array>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <memory>
+#include <string>
+#include "rgy_trace.h"
+#include "rgy_util.h"
+
+// スレッドごとの記録用バッファ
+// 書き込みは所有スレッドのみが行い、countをreleaseで更新することで、出力時はcountまでを読めばよい
+// チャンク単位で確保するので、確保はCHUNK_SIZEイベントごとに1回のみ
+struct RGYTraceThreadBuffer {
+    static const size_t CHUNK_SIZE = 4096;
+    static const size_t MAX_CHUNKS = 512; // スレッドあたり最大2M イベントまで (超えた分は捨てる)
+
+    std::array<std::unique_ptr<RGYTrace::Event[]>, MAX_CHUNKS> chunks;
+    std::atomic<size_t> count;
+    std::atomic<size_t> dropped;
+    std::atomic<const char *> name;
+    int tid;
+
+    RGYTraceThreadBuffer(int tid_) : chunks(), count(0), dropped(0), name(nullptr), tid(tid_) {};
+};
+
+std::atomic<bool> RGYTrace::s_enabled(false);
+
+static std::mutex g_traceMtx;
+static std::vector<std::unique_ptr<RGYTraceThreadBuffer>> g_traceBuffers;
+static std::deque<std::string> g_traceNames;
+static std::unique_ptr<FILE, fp_deleter> g_traceFile;
+static int64_t g_traceStart = 0;
+static thread_local RGYTraceThreadBuffer *g_traceThreadBuffer = nullptr;
+
+static RGYTraceThreadBuffer *getTraceThreadBuffer() {
+    if (g_traceThreadBuffer == nullptr) {
+        std::lock_guard<std::mutex> lock(g_traceMtx);
+        g_traceBuffers.push_back(std::make_unique<RGYTraceThreadBuffer>((int)g_traceBuffers.size() + 1));
+        g_traceThreadBuffer = g_traceBuffers.back().get();
+    }
+    return g_traceThreadBuffer;
+}
+
+RGY_ERR RGYTrace::start(const tstring& filename) {
+    std::lock_guard<std::mutex> lock(g_traceMtx);
+    FILE *fp = nullptr;
+    if (_tfopen_s(&fp, filename.c_str(), _T("w")) != 0 || fp == nullptr) {
+        return RGY_ERR_FILE_OPEN;
+    }
+    g_traceFile.reset(fp);
+    g_traceStart = now();
+    s_enabled = true;
+    return RGY_ERR_NONE;
+}
+
+const char *RGYTrace::intern(const tstring& name) {
+    std::lock_guard<std::mutex> lock(g_traceMtx);
+    g_traceNames.push_back(tchar_to_string(name));
+    return g_traceNames.back().c_str();
+}
+
+void RGYTrace::setThreadName(const char *name) {
+    if (enabled()) {
+        getTraceThreadBuffer()->name = name;
+    }
+}
+
+void RGYTrace::addEvent(const Event& event) {
+    auto buf = getTraceThreadBuffer();
+    const size_t idx = buf->count.load(std::memory_order_relaxed);
+    const size_t ichunk = idx / RGYTraceThreadBuffer::CHUNK_SIZE;
+    if (ichunk >= RGYTraceThreadBuffer::MAX_CHUNKS) {
+        buf->dropped++;
+        return;
+    }
+    if (!buf->chunks[ichunk]) {
+        buf->chunks[ichunk].reset(new Event[RGYTraceThreadBuffer::CHUNK_SIZE]);
+    }
+    buf->chunks[ichunk][idx % RGYTraceThreadBuffer::CHUNK_SIZE] = event;
+    buf->count.store(idx + 1, std::memory_order_release);
+}
+
+static void writeTraceJsonStr(FILE *fp, const char *str) {
+    fputc('"', fp);
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', fp);
+        }
+        fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+RGY_ERR RGYTrace::stop() {
+    if (!enabled()) {
+        return RGY_ERR_NONE;
+    }
+    s_enabled = false;
+    std::lock_guard<std::mutex> lock(g_traceMtx);
+    FILE *fp = g_traceFile.get();
+    if (fp == nullptr) {
+        return RGY_ERR_NULL_PTR;
+    }
+    fprintf(fp, "{\"traceEvents\":[\n");
+    size_t dropped = 0;
+    bool first = true;
+    for (const auto& buf : g_traceBuffers) {
+        const size_t count = buf->count.load(std::memory_order_acquire);
+        dropped += buf->dropped;
+        if (!first) fprintf(fp, ",\n");
+        first = false;
+        fprintf(fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", buf->tid);
+        const char *threadName = buf->name.load();
+        if (threadName) {
+            writeTraceJsonStr(fp, threadName);
+        } else {
+            fprintf(fp, "\"thread %d\"", buf->tid);
+        }
+        fprintf(fp, "}}");
+        for (size_t i = 0; i < count; i++) {
+            const auto& ev = buf->chunks[i / RGYTraceThreadBuffer::CHUNK_SIZE][i % RGYTraceThreadBuffer::CHUNK_SIZE];
+            fprintf(fp, ",\n{\"name\":");
+            writeTraceJsonStr(fp, ev.name);
+            const double ts = (ev.ts - g_traceStart) * 1e-3;
+            if (ev.type == 'C') {
+                fprintf(fp, ",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{\"value\":%lld}}", buf->tid, ts, (long long)ev.value);
+            } else {
+                fprintf(fp, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", buf->tid, ts, ev.value * 1e-3);
+                if (ev.frame >= 0 || ev.queue >= 0) {
+                    fprintf(fp, ",\"args\":{");
+                    if (ev.frame >= 0) fprintf(fp, "\"frame\":%d%s", ev.frame, (ev.queue >= 0) ? "," : "");
+                    if (ev.queue >= 0) fprintf(fp, "\"queue\":%d", ev.queue);
+                    fprintf(fp, "}");
+                }
+                fprintf(fp, "}");
+            }
+        }
+    }
+    fprintf(fp, "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":%lld}}\n", (long long)dropped);
+    const bool error = ferror(fp) != 0;
+    g_traceFile.reset();
+    return (error) ? RGY_ERR_UNDEFINED_BEHAVIOR : RGY_ERR_NONE;
+}
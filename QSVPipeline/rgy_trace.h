@@ -0,0 +1,101 @@
+﻿// -----------------------------------------------------------------------------------------
+// QSVEnc/NVEnc by rigaya
+// -----------------------------------------------------------------------------------------
+// The MIT License
+//
+// Copyright (c) 2025 rigaya
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -------------------------------------------------------------------------------------------
+
+#pragma once
+#ifndef __RGY_TRACE_H__
+#define __RGY_TRACE_H__
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include "rgy_err.h"
+#include "rgy_tchar.h"
+
+// パイプラインの各処理の区間とキューの深さを記録し、Chrome trace形式(json)で出力する
+// (chrome://tracing や Perfetto UI で表示できる)
+// 記録はスレッドごとのバッファに追記するだけでロックは取らない
+// 名前はconst char*のまま保持するので、文字列リテラルかRGYTrace::intern()で得たものを渡すこと
+class RGYTrace {
+public:
+    struct Event {
+        int64_t ts;       // 開始時刻 (ns)
+        int64_t value;    // 区間の長さ(ns) / カウンタの値
+        const char *name;
+        int32_t frame;    // フレーム番号 (-1なら無し)
+        int32_t queue;    // 区間終了時のキューの深さ (-1なら無し)
+        char type;        // 'X': 区間, 'C': カウンタ
+    };
+
+    // 有効かどうか (無効時は各記録関数はこのチェックのみで戻る)
+    static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // 記録を開始する (出力はstop()で行う)
+    static RGY_ERR start(const tstring& filename);
+    // 記録を終了し、ファイルに出力する
+    static RGY_ERR stop();
+    // 記録時に渡す名前を永続化する (初期化時などに使用し、フレームごとには呼ばないこと)
+    static const char *intern(const tstring& name);
+    // 現在のスレッドの表示名を設定する
+    static void setThreadName(const char *name);
+    // イベントを追加する
+    static void addEvent(const Event& event);
+    static void counter(const char *name, int64_t value) {
+        if (enabled()) {
+            addEvent(Event{ now(), value, name, -1, -1, 'C' });
+        }
+    }
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+// スコープの開始から終了までを区間として記録する
+class RGYTraceScope {
+private:
+    const char *m_name;
+    int64_t m_start;
+    int m_frame;
+    int m_queue;
+public:
+    RGYTraceScope(const char *name, int frame = -1) : m_name(name), m_start(-1), m_frame(frame), m_queue(-1) {
+        if (RGYTrace::enabled()) {
+            m_start = RGYTrace::now();
+        }
+    }
+    ~RGYTraceScope() {
+        if (m_start >= 0) {
+            RGYTrace::addEvent(RGYTrace::Event{ m_start, RGYTrace::now() - m_start, m_name, m_frame, m_queue, 'X' });
+        }
+    }
+    // 区間終了時に記録するフレーム番号/キューの深さを設定する
+    void setFrame(int frame) { m_frame = frame; }
+    void setQueue(int queue) { m_queue = queue; }
+};
+
+#endif //__RGY_TRACE_H__
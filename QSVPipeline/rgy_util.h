@@ -43,6 +43,7 @@
 #include <list>
 #include <sstream>
 #include <atomic>
+#include <mutex>
 #include <functional>
 #include <type_traits>
 #include "rgy_osdep.h"
@@ -1456,17 +1457,20 @@ public:
     vector<vector<int>> m_nCombinationList;
 };
 
+//取得したshared_ptrは別スレッドで解放されることがあるので、m_refCountsの操作はm_mtxで保護する
 template<typename T>
 class RGYListRef {
 private:
     std::vector<std::unique_ptr<T>> m_objs;
     std::unordered_map<T *, std::atomic<int>> m_refCounts;
+    std::mutex m_mtx;
 public:
-    RGYListRef() : m_objs(), m_refCounts() {};
+    RGYListRef() : m_objs(), m_refCounts(), m_mtx() {};
     ~RGYListRef() {
         clear();
     }
     void clear(std::function<void(T*)> deleteFunc = nullptr) {
+        std::lock_guard<std::mutex> lock(m_mtx);
         m_refCounts.clear();
         if (deleteFunc) {
             for (auto &obj : m_objs) {
@@ -1476,20 +1480,22 @@ public:
         m_objs.clear();
     }
     std::shared_ptr<T> get(T *ptr) {
+        std::lock_guard<std::mutex> lock(m_mtx);
         if (ptr == nullptr || m_refCounts.count(ptr) == 0) {
             return std::shared_ptr<T>();
         }
         m_refCounts[ptr]++;
         return std::shared_ptr<T>(ptr, [this](T *ptr) {
-            m_refCounts[ptr]--;
+            release(ptr);
         });
     }
     std::shared_ptr<T> get(std::function<int(T*)> initFunc = nullptr) {
+        std::lock_guard<std::mutex> lock(m_mtx);
         for (auto &count : m_refCounts) {
             if (count.second == 0) {
                 m_refCounts[count.first]++;
                 return std::shared_ptr<T>(count.first, [this](T *ptr) {
-                    m_refCounts[ptr]--;
+                    release(ptr);
                 });
             }
         }
@@ -1502,9 +1508,14 @@ public:
         m_refCounts[ptr] = 1;
         m_objs.push_back(std::move(obj));
         return std::shared_ptr<T>(ptr, [this](T *ptr) {
-            m_refCounts[ptr]--;
+            release(ptr);
         });
     }
+private:
+    void release(T *ptr) {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_refCounts[ptr]--;
+    }
 };
 
 unsigned short float2half(float value);